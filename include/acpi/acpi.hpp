@@ -142,6 +142,44 @@ struct Info {
     };
     // One NmiSourceDesc per NMI source.
     Vector<NmiSourceDesc> nmiSourceDesc;
+
+    // PCI Express
+    // -----------
+    // The MCFG describes the Enhanced Configuration Access Mechanism (ECAM) of
+    // each PCI segment, e.g. where the configuration space of its functions is
+    // memory-mapped. Systems without PCI Express, e.g. Qemu's i440fx machine,
+    // have no MCFG, in which case the configuration space is only accessible
+    // through I/O ports.
+    // Details about the ECAM of a range of buses of a PCI segment.
+    struct EcamDesc {
+        // The physical address of the configuration space of bus 0 of the
+        // segment, even if startBus is not 0. The configuration space of
+        // function <bus>:<dev>.<func> starts at:
+        //  address + (bus << 20 | dev << 15 | func << 12)
+        PhyAddr address;
+        // The PCI segment group number.
+        u16 segment = 0;
+        // The first and last bus numbers decoded by this ECAM, inclusive.
+        u8 startBus = 0;
+        u8 endBus = 0;
+    };
+    // One EcamDesc per entry in the MCFG. Empty if there is no MCFG.
+    Vector<EcamDesc> ecamDesc;
+
+    // HPET
+    // ----
+    // The HPET table gives the address of the High Precision Event Timer. Some
+    // systems have no HPET.
+    struct HpetDesc {
+        // The physical address of the registers of the HPET.
+        PhyAddr address;
+        // The minimum number of ticks of the main counter between two
+        // interrupts in periodic mode.
+        u16 minimumTick = 0;
+    };
+    // True if an HPET table was found, in which case hpetDesc is valid.
+    bool hasHpet = false;
+    HpetDesc hpetDesc;
 };
 
 // Parse the ACPI tables found in BIOS memory.
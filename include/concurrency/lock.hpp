@@ -71,4 +71,33 @@ private:
     Atomic<u8> m_flag;
 };
 
+// Sequence lock, for data that is read often and rarely written. Readers do
+// not write to the lock, hence do not bounce its cache line between cpus, and
+// never block the writer: they retry if a write happened while they were
+// reading. Writers must be serialized by other means, e.g. a SpinLock. Readers
+// must not follow pointers read in the critical section before readRetry()
+// returned false.
+class SeqLock {
+public:
+    // Start a read-side critical section. Waits for any write in progress.
+    // @return: The sequence number to pass to readRetry().
+    u64 readBegin() const;
+
+    // End a read-side critical section.
+    // @param seq: The value returned by readBegin().
+    // @return: true if a write happened during the section, in which case the
+    // data read must be discarded and the section retried.
+    bool readRetry(u64 const seq) const;
+
+    // Start a write-side critical section.
+    void writeBegin();
+
+    // End a write-side critical section.
+    void writeEnd();
+
+private:
+    // Odd while a write is in progress, incremented at the start and end of
+    // each write.
+    u64 volatile m_seq = 0;
+};
 }
@@ -3,6 +3,7 @@
 
 #pragma once
 #include <util/util.hpp>
+#include <util/addr.hpp>
 #include <selftests/selftests.hpp>
 
 namespace Cpu {
@@ -54,6 +55,18 @@ void lidt(TableDesc const& desc);
 // @return: The current value loaded in IDTR.
 TableDesc sidt();
 
+// Forward declaration, see below.
+class SegmentSel;
+
+// Load the task register using the LTR instruction.
+// @param sel: The segment selector of the TSS descriptor to load. The TSS
+// descriptor must not be busy.
+void ltr(SegmentSel const sel);
+
+// Read the current value of the task register using the STR instruction.
+// @return: The segment selector currently loaded in the task register.
+SegmentSel str();
+
 
 // #############################################################################
 // Types and functions related to segment registers.
@@ -149,6 +162,17 @@ u64 cr3();
 // @param value: The value to be written in the cr3 register.
 void writeCr3(u64 const value);
 
+// Read the current value of CR4.
+u64 cr4();
+
+// Write the CR4 register.
+// @param value: The value to be written in the cr4 register.
+void writeCr4(u64 const value);
+
+// Invalidate the TLB entry of a virtual page, even if the entry is global.
+// @param addr: A virtual address within the page to invalidate.
+void invlpg(VirAddr const addr);
+
 
 // #############################################################################
 // I/O instructions.
@@ -167,11 +191,33 @@ void outb(Port const port, u8 const value);
 // @param value: The word to write to the port.
 void outw(Port const port, u16 const value);
 
+// Output a dword in an I/O port.
+// @param port: The port to output into.
+// @param value: The dword to write to the port.
+void outl(Port const port, u32 const value);
+
+// Output a sequence of bytes in an I/O port, one byte after the other, using
+// a single rep outsb.
+// @param port: The port to output into.
+// @param data: The bytes to write to the port.
+// @param len: The number of bytes to write.
+void outsb(Port const port, u8 const * const data, u64 const len);
+
 // Read a byte from an I/O port.
 // @param port: The port to read from.
 // @return: The byte read from the port.
 u8 inb(Port const port);
 
+// Read a word from an I/O port.
+// @param port: The port to read from.
+// @return: The word read from the port.
+u16 inw(Port const port);
+
+// Read a dword from an I/O port.
+// @param port: The port to read from.
+// @return: The dword read from the port.
+u32 inl(Port const port);
+
 
 // #############################################################################
 // CPUID
@@ -186,11 +232,13 @@ struct CpuidResult {
     u32 edx;
 };
 
-// Execute the CPUID instruction with the given param.
+// Execute the CPUID instruction with the given params.
 // @param eax: The value to set the EAX register to before executing the CPUID
 // instruction.
+// @param ecx: The value to set the ECX register to before executing the CPUID
+// instruction, e.g. the sub-leaf.
 // @return: A CpuidResult containing the output of CPUID.
-CpuidResult cpuid(u32 const eax);
+CpuidResult cpuid(u32 const eax, u32 const ecx = 0x0);
 
 
 // #############################################################################
@@ -200,6 +248,14 @@ CpuidResult cpuid(u32 const eax);
 // MSR values. Use an enum so that we avoid making mistakes using raw u32s.
 enum class Msr : u32 {
     IA32_APIC_BASE = 0x1b,
+    IA32_PMC0 = 0xc1,
+    IA32_PERFEVTSEL0 = 0x186,
+    IA32_PAT = 0x277,
+    IA32_PERF_GLOBAL_STATUS = 0x38e,
+    IA32_PERF_GLOBAL_CTRL = 0x38f,
+    IA32_PERF_GLOBAL_OVF_CTRL = 0x390,
+    IA32_TSC_DEADLINE = 0x6e0,
+    IA32_GS_BASE = 0xc0000101,
 };
 
 // Read a MSR.
@@ -15,7 +15,9 @@ namespace DataStruct {
 class EmbeddedFreeList {
 public:
     // Create an empty EmbeddedFreeList.
-    EmbeddedFreeList();
+    // @param zeroAllocs: If true, the memory returned by alloc() and
+    // allocAligned() is zeroed. Otherwise its content is undefined.
+    EmbeddedFreeList(bool const zeroAllocs = true);
 
     // Insert a region of free memory in the EmbeddedFreeList. This is mostly
     // used to iteratively construct the free list. Note: since Nodes are
@@ -32,6 +34,16 @@ public:
     // failed then return an Error.
     Res<VirAddr> alloc(u64 const size);
 
+    // Allocate memory from the free-list with a start address aligned on a
+    // given alignment. This is used to allocate physically contiguous and
+    // aligned frames, e.g. for large pages.
+    // @param size: The size of the allocation in bytes.
+    // @param alignment: The alignment of the allocation's start address, in
+    // bytes. Must be a power of two.
+    // @return: The virtual address of the allocated memory. If the allocation
+    // failed then return an Error.
+    Res<VirAddr> allocAligned(u64 const size, u64 const alignment);
+
     // Free memory that was allocated from this free-list, adds this memory back
     // to the free-list. The address passed as argument *must* have come from a
     // call to alloc().
@@ -98,6 +110,9 @@ private:
     // empty.
     Node* m_head;
 
+    // If true, allocated memory is zeroed.
+    bool m_zeroAllocs;
+
     // Make the EmbeddedFreeList tests as friend to be able to test the internal
     // state of the free-list.
     friend SelfTests::TestResult embeddedFreeListNodeTest();
@@ -106,6 +121,7 @@ private:
     friend SelfTests::TestResult embeddedFreeListInsertTest();
     friend SelfTests::TestResult embeddedFreeListAllocFreeTest();
     friend SelfTests::TestResult embeddedFreeListAllocMinSizeTest();
+    friend SelfTests::TestResult embeddedFreeListAllocAlignedTest();
 };
 
 }
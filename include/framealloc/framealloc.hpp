@@ -42,7 +42,8 @@ void Test(SelfTests::TestRunner& runner);
 void directMapInitialized();
 
 // Allocate a physical frame using the global allocator. This function panics if
-// no frame can be allocated.
+// no frame can be allocated. The content of the frame is undefined, callers
+// needing a zeroed frame must zero it themselves.
 // @return: The Frame describing the allocated frame. If the allocation failed
 // return an error instead.
 Res<Frame> alloc();
@@ -51,6 +52,21 @@ Res<Frame> alloc();
 // @param Frame: A Frame describing the physical frame to be freed.
 void free(Frame const& frame);
 
+// Allocate physically contiguous frames using the global allocator, e.g. to
+// back a large page. As with alloc(), the content of the frames is undefined.
+// @param numFrames: The number of frames to allocate.
+// @param alignment: The alignment of the physical address of the first frame,
+// in bytes. Must be a power of two and a multiple of PAGE_SIZE.
+// @return: The Frame describing the first allocated frame. If the allocation
+// failed return an error instead.
+Res<Frame> allocContiguous(u64 const numFrames, u64 const alignment);
+
+// Free physically contiguous frames allocated with allocContiguous(). Freeing
+// the frames one by one using free() is also allowed.
+// @param frame: The first frame of the contiguous frames.
+// @param numFrames: The number of frames to free.
+void freeContiguous(Frame const& frame, u64 const numFrames);
+
 }
 
 // Shortcut to avoid long typenames.
@@ -0,0 +1,70 @@
+// Per-cpu state of the interrupt subsystem, accessed from interrupt handlers.
+#pragma once
+#include <interrupts/stats.hpp>
+#include <interrupts/softirq.hpp>
+
+namespace Interrupts {
+
+class Lapic;
+
+// The state of the interrupt subsystem of a cpu. The GS base of each cpu points
+// to its CpuLocal, so that interrupt handlers can access it without
+// Smp::id(), which executes CPUID and is therefore expensive.
+struct CpuLocal {
+    // Pointer to this struct, must be the first field. Reading GS:0 is the
+    // cheapest way to get the address pointed by the GS base.
+    CpuLocal* self;
+    // The id of the cpu owning this struct.
+    Smp::Id id;
+    // The LAPIC of the cpu owning this struct, set by the first call to lapic()
+    // on that cpu. nullptr until then.
+    Lapic* lapic;
+    // The interrupt statistics of each vector.
+    Stats::VectorStats stats[256];
+    // Bitmap of the softirqs pending on this cpu. Only modified by this cpu.
+    u64 volatile pendingSoftirqs;
+    // Set while this cpu is running softirqs, avoids nesting.
+    bool volatile isRunningSoftirqs;
+    // The TSC value at which the softirqs currently running on this cpu
+    // exhaust their budget.
+    u64 softirqDeadline;
+    // The queue of tasklets scheduled on this cpu. Only modified by this cpu
+    // with interrupts disabled.
+    Softirq::Tasklet* taskletHead;
+    Softirq::Tasklet* taskletTail;
+};
+
+// Point the GS base of the BSP to a statically allocated CpuLocal. Must be
+// called before loading the IDT. InitCpuLocal() later replaces it with the
+// BSP's own state.
+void InitBootCpuLocal();
+
+// Check if the GS base of the cpus points to a CpuLocal, which is the case
+// once InitBootCpuLocal() has been called.
+// @return: true if cpuLocal() can be used.
+bool isCpuLocalInitialized();
+
+// Get the CpuLocal of the current cpu. Must only be called once
+// isCpuLocalInitialized() returns true.
+// @return: The CpuLocal pointed by the GS base.
+static inline CpuLocal& cpuLocal() {
+    CpuLocal* local;
+    asm volatile("mov %%gs:0, %0" : "=r"(local));
+    return *local;
+}
+
+// Get the CpuLocal of a cpu.
+// @param cpu: The cpu.
+// @return: The CpuLocal of `cpu`.
+CpuLocal& cpuLocal(Smp::Id const cpu);
+
+// Add a value to a counter of the current cpu. Nested interrupts on the same
+// cpu can update the same counter, a single add instruction cannot be torn by
+// them while not paying for a lock prefix.
+// @param counter: The counter to update.
+// @param value: The value to add.
+template<typename T>
+static inline void localAdd(T& counter, T const value) {
+    asm volatile("add %1, %0" : "+m"(counter) : "r"(value));
+}
+}
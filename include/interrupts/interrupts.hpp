@@ -5,6 +5,8 @@
 #include <selftests/selftests.hpp>
 #include <util/subrange.hpp>
 #include <acpi/acpi.hpp>
+#include <memory/segmentation.hpp>
+#include <util/result.hpp>
 
 namespace Interrupts {
 
@@ -24,10 +26,14 @@ public:
     // @param targetOffset: Virtual address of the interrupt handler.
     // @param dpl: Privilege level of the descriptor.
     // @param type: The type of this descriptor.
+    // @param ist: The Interrupt Stack Table index of the stack to switch to
+    // when raising the interrupt.
     Descriptor(Cpu::SegmentSel const targetSel,
                u64 const targetOffset,
                Cpu::PrivLevel const dpl,
-               Type const type);
+               Type const type,
+               Memory::Segmentation::IstIndex const ist =
+                   Memory::Segmentation::IstIndex::None);
 
     // Construct a default descriptor, marked as non-present.
     Descriptor();
@@ -35,7 +41,7 @@ public:
 private:
     // The four raw DWORDs making up the descriptor, as expected by the
     // hardware.
-    u32 const m_raw[4];
+    u32 m_raw[4];
 };
 static_assert(sizeof(Descriptor) == 16);
 
@@ -46,6 +52,16 @@ void Init();
 // Automatically called by Init() for the BSP.
 void InitCurrCpu();
 
+// Allocate the per-cpu state of the interrupt subsystem, e.g. statistics and
+// pending deferred work, for all cpus and enable it on the BSP. Requires the
+// heap allocator.
+void InitCpuLocal();
+
+// Enable the per-cpu state of the interrupt subsystem on the current cpu by
+// pointing its GS base to it. Automatically called by InitCpuLocal() for the
+// BSP, APs must call it before running any other code.
+void InitCurrCpuLocal();
+
 // Only 256 possible interrupt vectors per x86's architecture.
 class Vector : public SubRange<Vector, 0, 255> {
 public:
@@ -59,6 +75,30 @@ public:
     bool isUserDefined() const;
 };
 
+// Priority class of a vector as used by the LAPIC, that is the upper 4 bits of
+// the vector. Pending interrupts of a higher class are delivered first and
+// interrupts are only delivered if their class is above the task priority.
+// Classes 0 and 1 only contain exception vectors and cannot be allocated.
+class PriorityClass : public SubRange<PriorityClass, 2, 15> {};
+
+// Allocate a free vector in the given priority class. The vector is reserved
+// until it is freed with freeVector(), e.g. to be used by a driver or MSIs.
+// @param priorityClass: The priority class of the vector.
+// @return: The allocated vector or an error if all the vectors of the class
+// are already allocated.
+Res<Vector> allocateVector(PriorityClass const priorityClass);
+
+// Allocate a free vector in the priority class with the most free vectors. This
+// spreads the vectors allocated without priority requirements evenly across
+// the classes.
+// @return: The allocated vector or an error if all vectors are allocated.
+Res<Vector> allocateVector();
+
+// Free a vector allocated with allocateVector(). Any handler registered for the
+// vector must have been deregistered.
+// @param vector: The vector to free.
+void freeVector(Vector const vector);
+
 // Hardware interrupt number.
 class Irq : public SubRange<Irq, 0, 15> {
 public:
@@ -120,6 +160,31 @@ void registerHandler(Vector const vector, InterruptHandler const& handler);
 // @param vector: The vector for which to remove the handler.
 void deregisterHandler(Vector const vector);
 
+// Get the interrupt handler currently registered for a vector.
+// @param vector: The vector for which to get the handler.
+// @return: The handler registered for `vector`, nullptr if no handler is
+// registered.
+InterruptHandler registeredHandler(Vector const vector);
+
+// Fast interrupt handlers only take the vector as argument. They are called
+// from the fast interrupt entry path which does not build an interrupt Frame.
+using FastInterruptHandler = void (*)(Vector const);
+
+// Register a fast interrupt handler for a user-defined vector. Interrupts of
+// this vector then use a lighter entry path which only saves the caller-saved
+// registers, sends the EOI inline and calls `handler` directly. This is meant
+// for latency-critical vectors, e.g. IPIs and timer ticks, whose handlers do
+// not need the interrupt Frame. Registering a regular handler with
+// registerHandler() or calling deregisterHandler() switches the vector back to
+// the regular entry path. The vector should not be raised while its entry path
+// is being switched. The spurious vector cannot use the fast path since its
+// interrupts must not be acknowledged.
+// @param vector: The user-defined vector for which to register the handler.
+// @param handler: The function to be called everytime an interrupt with vector
+// `vector` is raised.
+void registerFastHandler(Vector const vector,
+                         FastInterruptHandler const handler);
+
 // Map an IRQ to a particular vector. This function takes care of configuring
 // the I/O APIC so that a vector `vector` is raised when the given IRQ is
 // asserted.
@@ -137,7 +202,52 @@ void unmapIrq(Irq const irq);
 // @param irq: The IRQ to mask.
 void maskIrq(Irq const irq);
 
+// A set of cpus, bit i is set if cpu i is part of the set. Only the first 64
+// cpus can be part of a CpuMask.
+using CpuMask = u64;
+
+// Set the cpus allowed to handle an IRQ. If the mask contains a single cpu the
+// IRQ is delivered to that cpu. Otherwise the IRQ is delivered to the cpu
+// running at the lowest priority among the cpus in the mask using logical
+// destinations, or to the first cpu of the mask if some of its cpus cannot be
+// addressed logically. By default, IRQs are delivered to cpu 0. Takes effect
+// immediately if the IRQ is mapped.
+// @param irq: The IRQ.
+// @param affinity: The set of cpus allowed to handle the IRQ. Must not be
+// empty.
+void setIrqAffinity(Irq const irq, CpuMask const affinity);
+
+// Get the cpus allowed to handle an IRQ.
+// @param irq: The IRQ.
+// @return: The mask set by the last call to setIrqAffinity() for this IRQ.
+CpuMask irqAffinity(Irq const irq);
+
+// Run a pass of the IRQ balancer. The load of each mapped IRQ is the number of
+// cycles spent in its handler since the previous pass, computed from the
+// interrupt statistics. The IRQs with more than one online cpu in their
+// affinity are then pinned, heaviest first, to the least loaded online cpu of
+// their affinity. This runs periodically once InitIrqBalancer() has been
+// called, it can also be called directly. Balancing of an IRQ stops upon the
+// next call to setIrqAffinity().
+// @return: The number of IRQs that were moved to another cpu.
+u64 balanceIrqs();
+
+// Enable the periodic IRQ balancer. From then on, balanceIrqs() runs
+// periodically from a high-resolution timer as long as at least one IRQ has
+// more than one cpu in its affinity. The timer is armed on the cpu calling the
+// setIrqAffinity() that gives an IRQ such an affinity, see HrTimer for the
+// restrictions on the LAPIC timer of that cpu. Must be called after
+// Timer::HrTimer::Init().
+void InitIrqBalancer();
+
+// Get the number of passes run by the periodic IRQ balancer.
+// @return: The number of passes since boot.
+u64 irqBalancerPasses();
+
 // Run the interrupt tests.
 void Test(SelfTests::TestRunner& runner);
 
+// Run the IRQ affinity tests. Those tests need the APs to be online.
+void IrqAffinityTest(SelfTests::TestRunner& runner);
+
 }
@@ -65,6 +65,12 @@ public:
     // Notify the local APIC of End Of Interrupt.
     void endOfInterrupt();
 
+    // Get the address of the End Of Interrupt register in the direct map. An
+    // EOI is signaled by writing 0 to this address. Used by the fast interrupt
+    // entry path which sends the EOI from assembly.
+    // @return: The virtual address of the EOI register.
+    VirAddr endOfInterruptRegister() const;
+
     // Get the value from a read to a remote APIC. Only valid after issuing a
     // remote read request using the Interrupt Command Register and if the
     // readRemoteStatus of the ICR is set to DataAvailable.
@@ -299,6 +305,10 @@ public:
             // The timer is automatically re-armed after firing an interrupt at
             // expiration time.
             Periodic = 1,
+            // The timer fires a single interrupt once the TSC reaches the value
+            // written in the IA32_TSC_DEADLINE MSR. Only available if CPUID
+            // advertises it.
+            TscDeadline = 2,
         };
 
         // The vector that is sent for this interrupt source when the message
@@ -436,7 +446,7 @@ private:
         ErrorStatus                             = 0xec,
         InterruptCommandHigh                    = 0xff000000,
         InterruptCommandLow                     = 0xccfff,
-        TimerLocalVectorTableEntry              = 0x300ff,
+        TimerLocalVectorTableEntry              = 0x700ff,
         ThermalLocalVectorTableEntry            = 0x107ff,
         PerformanceCounterLocalVectorTableEntry = 0x107ff,
         LocalInterrupt0VectorTableEntry         = 0x187ff,
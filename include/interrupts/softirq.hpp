@@ -0,0 +1,90 @@
+// Deferred interrupt work: softirqs and tasklets.
+// Interrupt handlers should do the minimum amount of work and defer the rest to
+// a softirq or a tasklet. Softirqs and tasklets raised on a cpu run on the same
+// cpu, upon exiting the interrupt handler, with interrupts enabled. The time
+// spent running deferred work on each interrupt exit is bounded by a budget so
+// that it cannot starve the interrupted context. Work left over once the budget
+// is exhausted runs on the next interrupt exit or when the cpu becomes idle.
+#pragma once
+#include <util/subrange.hpp>
+#include <concurrency/atomic.hpp>
+#include <selftests/selftests.hpp>
+
+namespace Interrupts::Softirq {
+
+// Identifies a softirq. Softirqs are statically assigned, see below.
+class Id : public SubRange<Id, 0, 63> {};
+
+// Softirq used to run the tasklets.
+static const Id TaskletSoftirq = Id(0);
+
+// Softirq used by various tests. Since tests are ran serially this softirq
+// should always be available to use.
+static const Id TestSoftirq = Id(1);
+
+// Softirq draining the per-cpu log buffers, see Log::InitAsync().
+static const Id LogFlushSoftirq = Id(2);
+
+// Softirq handlers take no argument. A handler may run concurrently on
+// multiple cpus but never nests on the same cpu.
+using Handler = void (*)();
+
+// Maximum number of cycles spent running deferred work on a single interrupt
+// exit, in TSC cycles. A softirq that already started is never interrupted,
+// the budget is checked between softirqs and between tasklets.
+static constexpr u64 BUDGET_CYCLES = 2000000;
+
+// Maximum number of times the pending softirqs are re-scanned on a single
+// interrupt exit, softirqs raised while running deferred work are picked up by
+// the next scan.
+static constexpr u64 MAX_RESTARTS = 10;
+
+// Register the handler of a softirq.
+// @param id: The softirq.
+// @param handler: The function called when the softirq runs. nullptr
+// deregisters the current handler.
+void registerHandler(Id const id, Handler const handler);
+
+// Mark a softirq as pending on the current cpu. The softirq runs on the next
+// interrupt exit on this cpu. Safe to call from any context.
+// @param id: The softirq to raise.
+void raise(Id const id);
+
+// Run the softirqs pending on the current cpu, within the budget. This is
+// called automatically on interrupt exit, it is also meant to be called by
+// idle loops so that left-over work eventually completes. Does nothing if the
+// current cpu is already running softirqs or interrupts are disabled.
+void runPending();
+
+// Check if the softirqs currently running on this cpu exhausted their budget.
+// Softirq handlers processing their work incrementally should stop and raise
+// themselves again once this returns true.
+// @return: true if the budget is exhausted, false otherwise.
+bool isBudgetExhausted();
+
+// A unit of deferred work. Unlike softirqs, tasklets can be created
+// dynamically. A tasklet runs on the cpu it was scheduled on and is scheduled
+// at most once at any time: scheduling an already scheduled tasklet is a no-op.
+// A tasklet may re-schedule itself.
+struct Tasklet {
+    // Function called when the tasklet runs.
+    void (*func)(u64 const data);
+    // Argument passed to func.
+    u64 data;
+
+    // Internal state, do not modify.
+    // Next tasklet in the queue of the cpu.
+    Tasklet* next = nullptr;
+    // Is this tasklet currently scheduled? Set atomically since tasklets can
+    // be scheduled from any cpu.
+    Atomic<u64> isScheduled;
+};
+
+// Schedule a tasklet on the current cpu. The tasklet must remain valid until
+// it runs. Safe to call from any context.
+// @param tasklet: The tasklet to schedule.
+void schedule(Tasklet& tasklet);
+
+// Run the softirq tests.
+void Test(SelfTests::TestRunner& runner);
+}
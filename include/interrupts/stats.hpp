@@ -0,0 +1,56 @@
+// Per-cpu, per-vector interrupt statistics.
+#pragma once
+#include <interrupts/interrupts.hpp>
+#include <smp/smp.hpp>
+#include <selftests/selftests.hpp>
+
+namespace Interrupts::Stats {
+
+// Number of buckets in the handler duration histograms. Bucket 0 counts the
+// durations below 2^FIRST_BUCKET_SHIFT cycles, bucket i > 0 counts durations in
+// [2^(FIRST_BUCKET_SHIFT + i - 1); 2^(FIRST_BUCKET_SHIFT + i)) cycles. The last
+// bucket also counts all the longer durations.
+static constexpr u64 NUM_BUCKETS = 16;
+static constexpr u64 FIRST_BUCKET_SHIFT = 8;
+
+// The statistics of a single vector on a single cpu.
+struct VectorStats {
+    // Number of interrupts handled.
+    u64 count;
+    // Sum of the durations of the handlers, in TSC cycles.
+    u64 totalCycles;
+    // Histogram of the durations of the handlers, see NUM_BUCKETS.
+    u32 histogram[NUM_BUCKETS];
+};
+
+// Account for an interrupt on the current cpu. Called by the interrupt entry
+// paths, this is cheap enough to always be enabled.
+// @param vector: The vector of the interrupt.
+// @param cycles: The duration of the handler, in TSC cycles.
+void record(Vector const vector, u64 const cycles);
+
+// Get the statistics of a vector on a cpu.
+// @param cpu: The cpu.
+// @param vector: The vector.
+// @return: A snapshot of the statistics.
+VectorStats vectorStats(Smp::Id const cpu, Vector const vector);
+
+// Find the histogram bucket containing a percentile of the durations.
+// @param stats: The statistics to compute the percentile of.
+// @param percent: The percentile, between 0 and 100.
+// @return: The index of the bucket. Must only be called if stats.count != 0.
+u64 percentileBucket(VectorStats const& stats, u64 const percent);
+
+// Get the upper bound of a histogram bucket.
+// @param bucket: The index of the bucket.
+// @return: The upper bound in cycles, exclusive. The last bucket is unbounded,
+// its lower bound is returned instead.
+u64 bucketBound(u64 const bucket);
+
+// Log the statistics of all vectors that have been raised at least once, for
+// all cpus. Similar to Linux's /proc/interrupts.
+void dump();
+
+// Run the interrupt statistics tests.
+void Test(SelfTests::TestRunner& runner);
+}
@@ -1,4 +1,5 @@
-// File containing all the interrupt vectors used in the kernel.
+// File containing all the interrupt vectors statically assigned in the kernel.
+// Other vectors are dynamically allocated using Interrupts::allocateVector().
 #pragma once
 #include <interrupts/interrupts.hpp>
 
@@ -17,4 +18,8 @@ static const Vector TestVector = Vector(34);
 // Vector used to notify a cpu that a new remote call has been enqueued in its
 // remote call queue.
 static const Vector RemoteCallVector = Vector(35);
+
+// Vector of the spurious interrupts raised by the LAPIC. This is the reset
+// value of the Spurious Interrupt Vector Register.
+static const Vector SpuriousVector = Vector(0xff);
 }
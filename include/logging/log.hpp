@@ -7,13 +7,53 @@
 //  - WARN: Warning messages.
 //  - CRIT: Critical messages.
 // Each level has its own helper function, e.g. Log::info(), Log::warn(), ...
+// Messages are first written synchronously to the output device. Once
+// Log::InitAsync() has been called, each cpu appends its messages to its own
+// ring buffer instead, without taking any lock nor waiting on the output
+// device. The buffers are drained in the background by a softirq, messages of
+// different cpus are then printed in the order of their timestamps.
 
 #pragma once
 #include <logging/logger.hpp>
 #include <concurrency/lock.hpp>
+#include <selftests/selftests.hpp>
 
 namespace Log {
 
+// Switch to asynchronous logging: each cpu appends its messages to its own ring
+// buffer, which is drained by the LogFlushSoftirq. Must be called after
+// Smp::PerCpu::Init() and Timer::Tsc::Init(), the messages are timestamped with
+// the monotonic clock.
+void InitAsync();
+
+// Drive the serial console from its THR-empty interrupt instead of polling it,
+// see SerialOutputDev. Does nothing when logging to VGA. Must be called after
+// Interrupts::InitIoApics().
+void InitSerialInterrupt();
+
+// Drain the log buffers of all cpus to the output device. Waits for a flush
+// running on another cpu to complete. Must not be called from an interrupt
+// handler.
+void flush();
+
+// Redirect all messages to another output device, meant for the tests. The log
+// buffers and the current device are drained first.
+// @param dev: The device to redirect the messages to, nullptr to restore the
+// actual output device.
+void redirectOutput(Logging::Logger::OutputDev* const dev);
+
+// Switch back to synchronous logging and drain the log buffers and the output
+// device, for PANIC. Gives up on draining the buffers if another cpu does not
+// complete its flush in a timely manner.
+void flushForPanic();
+
+// Run the logging tests.
+void Test(SelfTests::TestRunner& runner);
+
+// Run the tests of the asynchronous logging and of the interrupt-driven serial
+// console. Those tests need the APs to be online.
+void AsyncTest(SelfTests::TestRunner& runner);
+
 // Print a formatted string into the log. This is mostly used as a helper
 // function for the helper functions below.
 // @param color: The color to use for this string.
@@ -29,6 +69,17 @@ void fmtWithPrefixAndColor(Logging::Logger::Color const color,
     // to loggerInstance().
     extern Logging::Logger& loggerInstance();
     extern Concurrency::Lock& loggerLock();
+    extern Logging::Logger* beginBufferedMessage();
+    extern void endBufferedMessage();
+
+    Logging::Logger* const bufferLogger(beginBufferedMessage());
+    if (!!bufferLogger) {
+        bufferLogger->setColor(color);
+        bufferLogger->printNoNewLine(prefix);
+        bufferLogger->printf(fmt, args...);
+        endBufferedMessage();
+        return;
+    }
 
     Concurrency::LockGuard lg(loggerLock());
     Logging::Logger& logger(loggerInstance());
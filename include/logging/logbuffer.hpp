@@ -0,0 +1,108 @@
+// Ring buffer of log messages.
+#pragma once
+#include <logging/logger.hpp>
+#include <concurrency/atomic.hpp>
+
+namespace Logging {
+
+// Ring buffer of log messages, written by a single producer and drained by a
+// single consumer, possibly running on another cpu. A message is formatted into
+// the buffer through the OutputDev interface: it is started with begin(),
+// formatted by a Logger writing into this buffer and published with commit().
+// Appending a message never waits on the actual output device. The producer
+// and the consumer only synchronize through the head and tail of the ring,
+// hence a message can be appended while the buffer is being drained.
+class LogBuffer final : public Logger::OutputDev {
+public:
+    // The size of the ring in bytes.
+    static constexpr u64 Size = 16384;
+    // The max length of a message, including the new line. Longer messages
+    // are truncated.
+    static constexpr u64 MaxMessageLen = 256;
+
+    // Create an empty buffer.
+    LogBuffer();
+
+    // A LogBuffer is several KiB and is used in place, it cannot be copied.
+    LogBuffer(LogBuffer const& other) = delete;
+    LogBuffer& operator=(LogBuffer const& other) = delete;
+
+    // Start a new message. A message started but not committed is discarded.
+    // @param timestamp: The timestamp of the message, used to order messages
+    // across buffers.
+    void begin(u64 const timestamp);
+
+    // Append a char to the message started by begin().
+    // @param c: The character to be appended.
+    virtual void printChar(char const c);
+
+    // Append a new line to the message started by begin().
+    virtual void newLine();
+
+    // Not supported, this is a no-op.
+    virtual void clear();
+
+    // Set the color of the message started by begin().
+    // @param color: The color.
+    virtual void setColor(Logger::Color const color);
+
+    // Publish the message started by begin() to the consumer.
+    // @return: true if the message was published, false if the ring does not
+    // have enough space for it. In the latter case the message is kept and
+    // commit() can be retried once the ring has been drained.
+    bool commit();
+
+    // Discard the message started by begin() and count it as dropped.
+    void drop();
+
+    // Get the timestamp of the oldest message in the ring. Must only be called
+    // by the consumer.
+    // @return: The timestamp given to begin() for this message, or ~0ULL if the
+    // ring is empty.
+    u64 oldestTimestamp() const;
+
+    // Remove the oldest message from the ring and write it to an output device.
+    // Must only be called by the consumer, on a non-empty ring.
+    // @param dev: The device to write the message to.
+    void pop(Logger::OutputDev& dev);
+
+    // Get the number of messages dropped since the creation of this buffer.
+    // @return: The number of calls to drop().
+    u64 numDropped() const;
+
+private:
+    // Header preceding each message in the ring.
+    struct MessageHeader {
+        u64 timestamp;
+        u16 length;
+        u8 color;
+    } __attribute__((packed));
+
+    // Copy data into the ring, wrapping around its end.
+    // @param pos: The position in the ring, modulo Size.
+    // @param src: The data to copy.
+    // @param len: The number of bytes to copy.
+    void copyIn(u64 const pos, void const * const src, u64 const len);
+
+    // Copy data out of the ring, wrapping around its end.
+    // @param pos: The position in the ring, modulo Size.
+    // @param dest: The destination of the copy.
+    // @param len: The number of bytes to copy.
+    void copyOut(u64 const pos, void * const dest, u64 const len) const;
+
+    // The message being formatted, not yet visible to the consumer.
+    char m_message[MaxMessageLen];
+    u64 m_messageLen;
+    u64 m_messageTimestamp;
+    Logger::Color m_messageColor;
+
+    // The ring. m_head and m_tail are the number of bytes written and read
+    // since the creation of the buffer, m_head is only written by the producer
+    // and m_tail only by the consumer.
+    u8 m_ring[Size];
+    Atomic<u64> m_head;
+    Atomic<u64> m_tail;
+
+    u64 volatile m_numDropped;
+};
+}
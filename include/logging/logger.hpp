@@ -44,6 +44,10 @@ public:
         // ignore such calls.
         // @param color: The color.
         virtual void setColor(Color const color) = 0;
+
+        // Wait for all the chars printed so far to be written out, for devices
+        // buffering their output. The default implementation is a no-op.
+        virtual void flush() {}
     };
 
     // Create a new Logger instance using the given OutputDev as backend.
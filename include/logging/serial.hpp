@@ -2,11 +2,19 @@
 #pragma once
 #include <logging/logger.hpp>
 #include <cpu/cpu.hpp>
+#include <concurrency/lock.hpp>
 
 namespace Logging {
 
-// Implementation of logging through the serial console.
-class SerialOutputDev : public Logger::OutputDev {
+// Implementation of logging through the serial console. The FIFO of the UART
+// is used if present, 16 bytes on a 16550A or 64 bytes on a 16750. Until
+// enableTxInterrupt() is called, chars are written to the FIFO by polling the
+// line status once per FIFO-full. Afterwards, chars are appended to a TX ring
+// which is drained by the THR-empty interrupt, refilling the entire FIFO at
+// once, and writers only wait on the UART when the ring is full.
+// The OutputDev functions must be serialized by the caller, as done by the
+// Log::* functions.
+class SerialOutputDev final : public Logger::OutputDev {
 public:
     // A COM port address. COM1 and COM2 are guaranteed to be at the specified
     // address. Other ports are less reliable. See
@@ -25,6 +33,9 @@ public:
     // The baud rate used by the implementation.
     static u32 const BaudRate = 115200;
 
+    // The size of the TX ring in bytes.
+    static constexpr u64 TxRingSize = 8192;
+
     // Create a serial output device using the given port.
     // @param port: The port to be used.
     SerialOutputDev(ComPort const port);
@@ -44,6 +55,36 @@ public:
     // @param color: The color.
     virtual void setColor(Logger::Color const color);
 
+    // Wait for all the chars printed so far to be handed over to the UART.
+    virtual void flush();
+
+    // Switch to interrupt-driven transmission. The caller is responsible for
+    // routing the IRQ of the port to a handler calling handleInterrupt().
+    void enableTxInterrupt();
+
+    // Handle an interrupt from the UART, refilling the FIFO from the TX ring
+    // if the transmitter is empty. Can be called on any cpu.
+    void handleInterrupt();
+
+    // Get the size of the TX FIFO of the UART.
+    // @return: The size of the FIFO in bytes, 1 if the UART has no FIFO.
+    u8 fifoSize() const;
+
+    // Check if all the chars printed so far have been handed over to the UART.
+    // @return: true if the TX ring is empty.
+    bool isTxRingEmpty() const;
+
+    // Enable or disable the loopback mode of the UART, in which the chars sent
+    // are received back by the UART instead of going out on the line. Meant for
+    // the tests, must be called after enableTxInterrupt().
+    // @param enable: Whether to enable the loopback mode.
+    void setLoopback(bool const enable);
+
+    // Read a char received by the UART, if any.
+    // @param c[out]: The char read.
+    // @return: true if a char was read, false if none was available.
+    bool receiveChar(char& c);
+
 private:
     // The COM port to be used by this device.
     ComPort const m_port;
@@ -52,7 +93,12 @@ private:
     enum class Register : u8 {
         Data = 0,
         InterruptEnable = 1,
+        // FifoControl is write-only and InterruptIdentification read-only,
+        // they share the same port.
+        FifoControl = 2,
+        InterruptIdentification = 2,
         LineControl = 3,
+        ModemControl = 4,
         LineStatus = 5,
         Scratch = 7,
 
@@ -84,8 +130,41 @@ private:
     // @param value: The value to set the DLAB bit to.
     void setDlab(bool const value);
 
-    // Check if the controller is ready to send data.
+    // Check if the controller is ready to send data, that is if the holding
+    // register, or the FIFO if enabled, is empty.
     // @return: true if the controller can send data, false otherwise.
     bool canSendData();
+
+    // Write a char to the UART directly, waiting for the FIFO to be empty only
+    // once every m_fifoSize chars.
+    // @param c: The character to write.
+    void writePolled(char const c);
+
+    // Move up to a FIFO-full of chars from the TX ring to the UART. Must be
+    // called with m_txLock held and while the FIFO is empty.
+    void refillFifo();
+
+    // Refill the FIFO if the transmitter is empty. If `wait` is true, wait for
+    // the transmitter to be empty first.
+    // @param wait: Whether or not to wait for the FIFO to be empty.
+    void kickTx(bool const wait);
+
+    // The size of the FIFO in bytes, 1 if there is no FIFO.
+    u8 m_fifoSize;
+    // The number of chars that can be written in the FIFO by writePolled()
+    // before having to poll the line status.
+    u8 m_fifoFree;
+
+    // If true, chars are appended to the TX ring.
+    bool volatile m_useTxRing;
+    // The TX ring. m_txHead and m_txTail are the number of chars written and
+    // read since the creation of the device, m_txHead is only written by the
+    // caller of the OutputDev functions and m_txTail only with m_txLock held.
+    u8 m_txRing[TxRingSize];
+    Atomic<u64> m_txHead;
+    Atomic<u64> m_txTail;
+    // Serializes the refills of the FIFO, which can happen from the interrupt
+    // handler on one cpu and from a writer on another.
+    Concurrency::SpinLock m_txLock;
 };
 }
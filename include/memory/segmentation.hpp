@@ -4,6 +4,7 @@
 #include <cpu/cpu.hpp>
 #include <util/subrange.hpp>
 #include <selftests/selftests.hpp>
+#include <memory/stack.hpp>
 
 namespace Memory::Segmentation {
 
@@ -118,6 +119,56 @@ static_assert(sizeof(Descriptor) == 8);
 static_assert(sizeof(Descriptor32) == 8);
 static_assert(sizeof(Descriptor64) == 8);
 
+// 64-bit Task State Segment. In 64-bit mode the TSS is only used to hold the
+// stack pointers loaded by the cpu when changing privilege level or when
+// raising an interrupt configured to use the Interrupt Stack Table (IST).
+struct Tss {
+    u32 reserved0;
+    // Stack pointers loaded when changing privilege level to ring 0, 1 or 2.
+    u64 rsp[3];
+    u64 reserved1;
+    // The Interrupt Stack Table. ist[i] is loaded in RSP when raising an
+    // interrupt with IST index i + 1 in its IDT descriptor.
+    u64 ist[7];
+    u64 reserved2;
+    u16 reserved3;
+    // Offset of the I/O permission bitmap from the base of the TSS. Setting it
+    // to the size of the TSS disables the bitmap.
+    u16 ioMapBase;
+} __attribute__((packed));
+static_assert(sizeof(Tss) == 104);
+
+// Index of the stacks in the Interrupt Stack Table. Interrupts using an IST
+// stack always run on a known-good stack, no matter the state of the stack of
+// the interrupted context.
+enum class IstIndex : u8 {
+    // Do not switch stack when raising the interrupt.
+    None = 0,
+    DoubleFault = 1,
+    Nmi = 2,
+    MachineCheck = 3,
+};
+
+// The number of IST stacks allocated for each cpu.
+static constexpr u64 NUM_IST_STACKS = 3;
+
+// Index of the TSS descriptor in the per-cpu GDTs. A TSS descriptor occupies
+// two GDT entries.
+static constexpr u16 TSS_SELECTOR_INDEX = 3;
+
+// The segmentation state of a cpu. Each cpu needs its own GDT since the GDT
+// contains the descriptor of the cpu's TSS.
+struct PerCpuTables {
+    // The GDT of the cpu, a copy of the kernel-wide GDT followed by the TSS
+    // descriptor.
+    u64 gdt[TSS_SELECTOR_INDEX + 2];
+    // The TSS of the cpu.
+    Tss tss;
+    // The stacks pointed by the IST of the tss. istStacks[i] is used by the
+    // interrupts with IST index i + 1.
+    Ptr<Stack> istStacks[NUM_IST_STACKS];
+};
+
 // Initialize segmentation. Create a GDT and load it in GDTR.
 void Init();
 
@@ -130,4 +181,16 @@ void Test(SelfTests::TestRunner& runner);
 // Automatically called by Init() for the BSP.
 void InitCurrCpu();
 
+// Configure the current cpu to use its own GDT and TSS, and allocate the stacks
+// of its Interrupt Stack Table. The segment selectors of the kernel-wide GDT
+// are still valid after this call. Requires the per-cpu data and the virtual
+// address allocator, must be called after InitCurrCpu(). Until this is called,
+// the interrupts using the Interrupt Stack Table cannot be delivered.
+void InitCurrCpuTss();
+
+// Get the top of the IST stack of the current cpu for the given index.
+// @param index: The index of the IST stack, must not be IstIndex::None.
+// @return: The highest address of the stack.
+VirAddr istStackTop(IstIndex const index);
+
 }
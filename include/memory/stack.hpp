@@ -3,21 +3,33 @@
 #include <util/addr.hpp>
 #include <util/result.hpp>
 #include <util/ptr.hpp>
+#include <selftests/selftests.hpp>
 
 namespace Memory {
 
+// The default size of allocated stacks in number of pages, 16KiB.
+static constexpr u64 DEFAULT_STACK_PAGES = 4;
+
+// Value written in every 8-byte word of a newly allocated stack. Words still
+// containing this value have never been used by the stack.
+static constexpr u64 STACK_CANARY = 0x57ac57ac57ac57ac;
+
 // Describes a stack that has been allocated in kernel virtual memory. This
 // class uses RAII in the sense that the destructor automatically de-allocate
 // the virtual memory used by this stack.
+// Each stack is preceded by un-mapped guard page(s), hence a stack overflow
+// triggers a page fault instead of silently corrupting the memory below it.
 // A Stack instance has ownership of the memory it covers. As such the type is
 // non-copyable and non-copy-assignable to avoid having multiple Stack instances
 // referring to the same memory.
 class Stack {
 public:
-    // Allocate a new stack in memory.
+    // Allocate a new stack in memory. The stack is entirely mapped and filled
+    // with STACK_CANARY.
+    // @param numPages: The size of the stack in number of pages.
     // @return: A pointer to the Stack instance associated with the allocated
     // stack or an error, if any.
-    static Res<Ptr<Stack>> New();
+    static Res<Ptr<Stack>> New(u64 const numPages = DEFAULT_STACK_PAGES);
 
     // De-allocate the associated memory upon destruction.
     ~Stack();
@@ -36,6 +48,17 @@ public:
     VirAddr lowAddress() const;
     VirAddr highAddress() const;
 
+    // Get the size of this stack in bytes.
+    u64 size() const;
+
+    // Compute the high-water mark of this stack, that is the maximum number of
+    // bytes that have ever been used on this stack. This is computed by
+    // scanning the stack, from its low address, for the first word that does
+    // not contain the STACK_CANARY, hence the cost is linear in the number of
+    // unused bytes.
+    // @return: The number of bytes used, rounded up to 8 bytes.
+    u64 highWaterMark() const;
+
 private:
     // Create a Stack instance.
     // @param low: Low address of the stack.
@@ -66,4 +89,7 @@ void switchToStack(VirAddr const newStackTop, void (*jmpTarget)());
 void switchToStack(VirAddr const newStackTop,
                    void (*jmpTarget)(u64),
                    u64 const arg);
+
+// Run the tests for stack allocation.
+void Test(SelfTests::TestRunner& runner);
 }
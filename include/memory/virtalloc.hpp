@@ -0,0 +1,88 @@
+// Kernel virtual address space allocator.
+#pragma once
+#include <util/addr.hpp>
+#include <util/result.hpp>
+#include <paging/paging.hpp>
+#include <selftests/selftests.hpp>
+
+namespace VirtAlloc {
+
+// The virtual address range managed by the allocator. This range sits right
+// below the kernel image, in the last PML4 entry which is shared by all address
+// spaces.
+static constexpr u64 REGION_START_VADDR = 0xffffff8000000000;
+static constexpr u64 REGION_END_VADDR = 0xffffffff80000000;
+
+// Number of un-mapped guard pages placed right below each range returned by
+// reserve() or alloc(). Accessing a guard page triggers a page fault.
+static constexpr u64 GUARD_PAGES = 1;
+
+// Initialize the allocator. Must be called after the heap allocator has been
+// initialized.
+void Init();
+
+// Reserve a range of kernel virtual addresses. No memory is mapped to the
+// range, the caller is free to map it as it wishes, e.g. to access MMIO
+// registers. Any mapping left when the range is freed is un-mapped, the
+// physical memory itself is not freed.
+// @param nPages: The size of the range in number of pages.
+// @return: The start address of the range or an error if the range could not
+// be allocated.
+Res<VirAddr> reserve(u64 const nPages);
+
+// Allocate a range of kernel virtual addresses backed by physical memory.
+// Physical frames are allocated and mapped lazily, when a page is accessed for
+// the first time. Newly mapped pages are zeroed. The physical memory is freed
+// when the range is freed.
+// @param nPages: The size of the range in number of pages.
+// @param attrs: The attributes used to map the pages of the range.
+// @param allowLargePages: If false, the range is never promoted to large pages
+// by collapseLargePages(). This is required for stacks: a region is read-only
+// while being promoted and a fault while pushing an interrupt frame onto it
+// would escalate to a double fault.
+// @return: The start address of the range or an error if the range could not
+// be allocated.
+Res<VirAddr> alloc(u64 const nPages,
+                   Paging::PageAttr const attrs,
+                   bool const allowLargePages = true);
+
+// Free a range of virtual addresses returned by reserve() or alloc(). Freeing
+// is lazy: the range is un-mapped and made available for future allocations
+// once enough pages have been freed, with a single TLB shootdown for all the
+// ranges freed since the last one.
+// @param addr: The start address of the range.
+void free(VirAddr const addr);
+
+// Immediately un-map all the ranges pending a lazy free and make them available
+// for future allocations.
+void flushPendingFrees();
+
+// Statistics of the large page promotion done by collapseLargePages().
+struct LargePageStats {
+    // Number of regions successfully promoted to a large page.
+    u64 promotions;
+    // Number of promotion attempts that failed, e.g. because no contiguous
+    // physical memory was available.
+    u64 failures;
+};
+
+// Promote to large pages the regions of the ranges returned by alloc() that are
+// fully populated with 4KiB pages, unless the range was allocated with
+// allowLargePages = false. A region is LARGE_PAGE_SIZE-aligned and
+// LARGE_PAGE_SIZE long. For each such region, a contiguous large frame is
+// allocated, the content of the 4KiB pages is copied into it and the region is
+// re-mapped with a single large page, freeing the 4KiB frames. This reduces the
+// TLB pressure of long-lived allocations.
+// This runs automatically, from a tasklet scheduled by the page fault handler
+// once a fault completes a region. It can also be called directly, from a
+// context where interrupts are enabled.
+// @return: The number of regions promoted by this call.
+u64 collapseLargePages();
+
+// Get the statistics of the large page promotion.
+// @return: The number of promotions and failures since boot.
+LargePageStats largePageStats();
+
+// Run the tests for the virtual address allocator.
+void Test(SelfTests::TestRunner& runner);
+}
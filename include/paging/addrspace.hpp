@@ -4,6 +4,8 @@
 #include <util/addr.hpp>
 #include <util/ptr.hpp>
 #include <util/result.hpp>
+#include <util/err.hpp>
+#include <paging/paging.hpp>
 
 namespace Paging {
 
@@ -30,6 +32,38 @@ public:
     // @return: The physical address of the PML4.
     PhyAddr pml4Address() const;
 
+    // Map a region of virtual memory to physical memory in this address space.
+    // This address space does not need to be the current one, the page tables
+    // are modified through the direct map.
+    // @param vaddrStart: The start virtual address of the region to be mapped.
+    // @param paddrStart: The start physical address at which the region should
+    // be mapped.
+    // @param pageAttr: Control the attribute of the mapping. All mapped pages
+    // will end up using those attributes.
+    // @param nPages: The size of the region in number of pages.
+    // @return: Returns an error if the mapping failed.
+    Err map(VirAddr const vaddrStart,
+            PhyAddr const paddrStart,
+            PageAttr const pageAttr,
+            u64 const nPages);
+
+    // Unmap virtual pages from this address space. This address space does not
+    // need to be the current one. Attempting to unmap a page that is not
+    // currently mapped is a no-op.
+    // @param addrStart: The address to start unmapping from.
+    // @param nPages: The number of pages to unmap.
+    void unmap(VirAddr const addrStart, u64 const nPages);
+
+    // Change the attributes of mapped virtual pages in this address space. This
+    // address space does not need to be the current one. Pages that are not
+    // mapped are skipped.
+    // @param addrStart: The address of the first page to modify.
+    // @param pageAttr: The new attributes of the pages.
+    // @param nPages: The number of pages to modify.
+    void protect(VirAddr const addrStart,
+                 PageAttr const pageAttr,
+                 u64 const nPages);
+
     // Switch from the current address space to another one.
     // @param to: The address space to switch to.
     static void switchAddrSpace(Ptr<AddrSpace> const& to);
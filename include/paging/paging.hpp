@@ -3,6 +3,7 @@
 #pragma once
 #include <util/util.hpp>
 #include <util/err.hpp>
+#include <util/result.hpp>
 #include <bootstruct.hpp>
 #include <selftests/selftests.hpp>
 #include <util/addr.hpp>
@@ -13,9 +14,13 @@ namespace Paging {
 // ==============
 // The direct map maps the entire physical memory as R/W starting at address
 // DIRECT_MAP_START_VADDR, hence to access physical address X we use virtual
-// address X + DIRECT_MAP_START_VADDR.
+// address X + DIRECT_MAP_START_VADDR. As all kernel mappings, the direct map
+// uses global pages.
 static constexpr u64 DIRECT_MAP_START_VADDR = 0xffff800000000000;
 
+// Size of a large page, mapped by a single level 2 (Page Directory) entry.
+static constexpr u64 LARGE_PAGE_SIZE = 512 * PAGE_SIZE;
+
 // Initialize paging.
 // This function creates the direct map.
 void Init(BootStruct const& bootStruct);
@@ -24,9 +29,28 @@ void Init(BootStruct const& bootStruct);
 // Automatically called by Init() for the BSP.
 void InitCurrCpu();
 
+// Flush the entire TLB of the current cpu, including the entries of global
+// pages. Kernel mappings are global, use this when changing kernel mappings
+// outside of map(), unmap() and protect(), which already take care of
+// flushing.
+void flushGlobalTlb();
+
 // Run paging tests.
 void Test(SelfTests::TestRunner& runner);
 
+// Per-cpu cache of physical frames used to allocate new page tables. Frames in
+// the cache are always zeroed, hence a page table can be taken from the cache
+// and linked into the page-table hierarchy as is. Each cpu holds one instance
+// of this cache in its PerCpu::Data.
+struct PageTableFrameCache {
+    // Max number of frames held in the cache.
+    static constexpr u64 Capacity = 16;
+    // Number of frames currently held in the cache.
+    u64 size = 0;
+    // The cached frames, only the first `size` entries are valid.
+    PhyAddr frames[Capacity];
+};
+
 // Attributes of pages when mapping virtual addresses to physical addresses.
 // Can use a combination of attributes using the operator|.
 enum class PageAttr : u64 {
@@ -36,13 +60,32 @@ enum class PageAttr : u64 {
     Writable = 2,
     // The page can be accessed from ring 3.
     User = 4,
-    // Memory type of the page.
+    // Raw memory type bits of the page, the combination of those three bits is
+    // an index into the Page Attribute Table (PAT) which gives the memory type
+    // of the page. Prefer using the memory types below instead of those bits.
     WriteThrough = 8,
     CacheDisable = 16,
+    Pat = 128,
     // Indicate if this page is global.
     Global = 32,
     // Disable executing instructions from this page.
     NoExec = 64,
+
+    // Memory types, as configured in the PAT by InitCurrCpu(). At most one
+    // memory type should be used in a combination of attributes. The default
+    // memory type is WriteBack. The WriteThrough bit above, on its own, selects
+    // the write-through memory type (PAT entry 1).
+    // Write-back, cacheable.
+    WriteBack = 0,
+    // Uncached-minus, can be overridden by the MTRRs. Same value as the
+    // CacheDisable bit, PAT entry 2.
+    UncacheableMinus = CacheDisable,
+    // Strong uncacheable, for memory-mapped registers. PAT entry 3.
+    Uncacheable = WriteThrough | CacheDisable,
+    // Write-combining, for frame buffers and device buffers. PAT entry 4.
+    WriteCombining = Pat,
+    // Write-protected. PAT entry 5.
+    WriteProtected = Pat | WriteThrough,
 };
 
 // operator| for PageAttr. Use to create combination of attributes.
@@ -78,4 +121,114 @@ Err map(VirAddr const vaddrStart,
 // @param addrStart: The address to start unmapping from.
 // @param nPages: The number of pages to unmap.
 void unmap(VirAddr const addrStart, u64 const nPages);
+
+// Unmap virtual pages from the current address space without invalidating the
+// TLB of any cpu. Meant to batch multiple unmaps: the caller is responsible for
+// calling tlbShootdown() before re-using the virtual pages or the physical
+// frames they were mapped to. Pages that are not mapped are silently skipped,
+// e.g. the untouched pages of a lazy allocation.
+// @param addrStart: The address to start unmapping from.
+// @param nPages: The number of pages to unmap.
+void unmapNoFlush(VirAddr const addrStart, u64 const nPages);
+
+// Change the attributes of mapped virtual pages in the current address space,
+// e.g. to make a range read-only or non-executable. Pages that are not mapped
+// are skipped. Large pages in the range are modified as a whole, hence the
+// range must cover them entirely.
+// @param addrStart: The address of the first page to modify.
+// @param pageAttr: The new attributes of the pages.
+// @param nPages: The number of pages to modify.
+void protect(VirAddr const addrStart,
+             PageAttr const pageAttr,
+             u64 const nPages);
+
+// Description of the mapping of a virtual address, as returned by translate().
+struct Mapping {
+    // The physical address the virtual address is mapped to.
+    PhyAddr paddr;
+    // The size of the page containing the virtual address in bytes, i.e.
+    // PAGE_SIZE or LARGE_PAGE_SIZE for large pages.
+    u64 pageSize;
+    // The attributes of the page containing the virtual address.
+    PageAttr attrs;
+};
+
+// Translate a virtual address to the physical address it is mapped to in the
+// current address space.
+// @param vaddr: The virtual address to translate.
+// @return: The Mapping of vaddr, or an error if vaddr is not mapped.
+Res<Mapping> translate(VirAddr const vaddr);
+
+// Flush the TLB, including the entries of global pages, on all online cpus.
+// Returns once all cpus completed the flush. Other cpus are interrupted through
+// remote calls, hence this must be called with interrupts enabled otherwise two
+// cpus calling this function at the same time would deadlock.
+void tlbShootdown();
+
+// Replace the 4KiB pages mapping a LARGE_PAGE_SIZE-aligned region of the
+// current address space by a single large page. The content of the pages is
+// copied into the large page and the level 1 table that was mapping them is
+// freed. The physical frames of the 4KiB pages are not freed, this is the
+// responsibility of the caller.
+// While the copy is in progress, the pages are made read-only: a write to the
+// region from another cpu causes a page fault which must be resolved by simply
+// retrying the access. The caller must ensure that the region is not
+// re-mapped or un-mapped during the operation. Must be called with interrupts
+// enabled as it uses tlbShootdown().
+// @param vaddr: The start address of the region. Must be LARGE_PAGE_SIZE
+// aligned.
+// @param largeFrame: The physical address of the large page, e.g. allocated
+// with FrameAlloc::allocContiguous(). Must be LARGE_PAGE_SIZE aligned.
+// @param attrs: The attributes of the large page.
+// @return: An error if the region is not entirely mapped by 4KiB pages, in
+// which case nothing is modified.
+Err collapseLargePage(VirAddr const vaddr,
+                      PhyAddr const largeFrame,
+                      PageAttr const attrs);
+
+// Map a region of virtual memory to physical memory in the address space using
+// the given PML4. The page tables are accessed through the direct map, hence
+// the address space does not need to be the current one. Prefer using
+// AddrSpace::map() over this function.
+// @param pml4Addr: The physical address of the PML4 of the address space.
+// @param vaddrStart: The start virtual address of the region to be mapped.
+// @param paddrStart: The start physical address at which the region should be
+// mapped.
+// @param pageAttr: Control the attribute of the mapping. All mapped pages will
+// end up using those attributes.
+// @param nPages: The size of the region in number of pages.
+// @return: Returns an error if the mapping failed.
+Err map(PhyAddr const pml4Addr,
+        VirAddr const vaddrStart,
+        PhyAddr const paddrStart,
+        PageAttr const pageAttr,
+        u64 const nPages);
+
+// Unmap virtual pages from the address space using the given PML4. Attempting
+// to unmap a page that is not currently mapped is a no-op. Prefer using
+// AddrSpace::unmap() over this function.
+// @param pml4Addr: The physical address of the PML4 of the address space.
+// @param addrStart: The address to start unmapping from.
+// @param nPages: The number of pages to unmap.
+void unmap(PhyAddr const pml4Addr, VirAddr const addrStart, u64 const nPages);
+
+// Change the attributes of mapped virtual pages in the address space using the
+// given PML4. Pages that are not mapped are skipped. Large pages in the range
+// are modified as a whole, hence the range must cover them entirely. Prefer
+// using AddrSpace::protect() over this function.
+// @param pml4Addr: The physical address of the PML4 of the address space.
+// @param addrStart: The address of the first page to modify.
+// @param pageAttr: The new attributes of the pages.
+// @param nPages: The number of pages to modify.
+void protect(PhyAddr const pml4Addr,
+             VirAddr const addrStart,
+             PageAttr const pageAttr,
+             u64 const nPages);
+
+// Free the page tables of the user half of the address space using the given
+// PML4, as well as the PML4 itself. The pages mapped in the address space are
+// not freed. The address space must not be in use by any cpu. Called by the
+// destructor of AddrSpace.
+// @param pml4Addr: The physical address of the PML4 of the address space.
+void freePageTables(PhyAddr const pml4Addr);
 }
@@ -0,0 +1,214 @@
+// PCI bus enumeration, configuration space access and MSI/MSI-X.
+// The configuration space is accessed through the Enhanced Configuration
+// Access Mechanism (ECAM) described by the ACPI MCFG table when present,
+// otherwise through the legacy I/O port mechanism which can only reach the
+// first 256 bytes of the configuration space of segment 0.
+#pragma once
+#include <util/result.hpp>
+#include <util/err.hpp>
+#include <datastruct/vector.hpp>
+#include <interrupts/interrupts.hpp>
+#include <smp/smp.hpp>
+#include <selftests/selftests.hpp>
+
+namespace Pci {
+
+// The address of a function on the PCI bus.
+struct Address {
+    // The PCI segment group of the function.
+    u16 segment;
+    u8 bus;
+    // The device number, between 0 and 31.
+    u8 device;
+    // The function number, between 0 and 7.
+    u8 function;
+
+    bool operator==(Address const& other) const = default;
+};
+
+// Offsets of the registers common to all configuration space headers.
+static constexpr u16 VENDOR_ID = 0x00;
+static constexpr u16 DEVICE_ID = 0x02;
+static constexpr u16 COMMAND = 0x04;
+static constexpr u16 STATUS = 0x06;
+static constexpr u16 PROG_IF = 0x09;
+static constexpr u16 SUBCLASS = 0x0a;
+static constexpr u16 CLASS_CODE = 0x0b;
+static constexpr u16 HEADER_TYPE = 0x0e;
+static constexpr u16 BAR0 = 0x10;
+static constexpr u16 CAPABILITIES_POINTER = 0x34;
+// Offset of the secondary bus number in the header of PCI-to-PCI bridges.
+static constexpr u16 SECONDARY_BUS = 0x19;
+
+// Bits of the COMMAND register.
+static constexpr u16 COMMAND_IO_SPACE = 1 << 0;
+static constexpr u16 COMMAND_MEMORY_SPACE = 1 << 1;
+static constexpr u16 COMMAND_BUS_MASTER = 1 << 2;
+static constexpr u16 COMMAND_INTX_DISABLE = 1 << 10;
+
+// Bits of the STATUS register.
+static constexpr u16 STATUS_CAPABILITIES_LIST = 1 << 4;
+
+// Read a register in the configuration space of a function.
+// @param addr: The address of the function.
+// @param offset: The offset of the register, must be aligned on the size of
+// the register.
+// @return: The value of the register.
+u8 read8(Address const& addr, u16 const offset);
+u16 read16(Address const& addr, u16 const offset);
+u32 read32(Address const& addr, u16 const offset);
+
+// Write a register in the configuration space of a function.
+// @param addr: The address of the function.
+// @param offset: The offset of the register, must be aligned on the size of
+// the register.
+// @param value: The value to write.
+void write8(Address const& addr, u16 const offset, u8 const value);
+void write16(Address const& addr, u16 const offset, u16 const value);
+void write32(Address const& addr, u16 const offset, u32 const value);
+
+// Check if the configuration space of a function is accessed through ECAM.
+// @param addr: The address of the function.
+// @return: true if ECAM is used, false if the legacy I/O ports are used.
+bool usesEcam(Address const& addr);
+
+// A function found while enumerating the PCI buses.
+struct Device {
+    Address addr;
+    u16 vendorId;
+    u16 deviceId;
+    u8 classCode;
+    u8 subclass;
+    u8 progIf;
+    // The layout of the configuration space header, without the multi-function
+    // bit: 0 for regular functions, 1 for PCI-to-PCI bridges.
+    u8 headerType;
+};
+
+// Enumerate the PCI buses. Must be called after Acpi::Init().
+void Init();
+
+// Get the functions found by Init().
+// @return: The functions in the system, in the order they were enumerated.
+Vector<Device> const& devices();
+
+// A Base Address Register.
+struct Bar {
+    enum class Type {
+        // The BAR decodes an address range in the physical address space.
+        Memory,
+        // The BAR decodes a range of I/O ports.
+        Io,
+    };
+    Type type;
+    // The physical address or the first I/O port of the range.
+    u64 base;
+    // The size of the range in bytes, always a power of two.
+    u64 size;
+    // Reads from the range have no side effect.
+    bool isPrefetchable;
+    // The BAR uses two consecutive registers.
+    bool is64Bit;
+};
+
+// Read and size a Base Address Register of a function. Decoding is disabled
+// on the function while the BAR is being sized.
+// @param dev: The function.
+// @param index: The index of the BAR, between 0 and 5. The second register of
+// a 64-bit BAR is not a BAR on its own.
+// @return: The BAR, or an error if the BAR does not exist or is not
+// implemented.
+Res<Bar> readBar(Device const& dev, u8 const index);
+
+// Map the address range of a memory BAR in the direct map, uncacheable.
+// @param dev: The function.
+// @param index: The index of the BAR.
+// @return: The virtual address of the start of the range, or an error if the
+// BAR does not exist or is not a memory BAR.
+Res<VirAddr> mapBar(Device const& dev, u8 const index);
+
+// Capability IDs.
+static constexpr u8 CAPABILITY_MSI = 0x05;
+static constexpr u8 CAPABILITY_MSIX = 0x11;
+
+// Find a capability in the capability list of a function.
+// @param dev: The function.
+// @param id: The ID of the capability.
+// @return: The offset of the capability in the configuration space, or an
+// error if the function does not implement it.
+Res<u8> findCapability(Device const& dev, u8 const id);
+
+// Message Signaled Interrupts
+// ---------------------------
+// MSIs are memory writes of the device which are delivered to a LAPIC without
+// going through the I/O APIC. All MSIs configured here use Fixed delivery and
+// Physical destination mode.
+
+// Compute the address of an MSI targeting a cpu.
+// @param cpu: The destination cpu.
+// @return: The message address.
+u64 msiAddress(Smp::Id const cpu);
+
+// Compute the data of an MSI raising a vector.
+// @param vector: The vector raised on the destination cpu.
+// @return: The message data.
+u16 msiData(Interrupts::Vector const vector);
+
+// Configure and enable MSI on a function, using a single message. INTx is
+// disabled.
+// @param dev: The function.
+// @param cpu: The cpu receiving the interrupts.
+// @param vector: The vector raised on `cpu`.
+// @return: An error if the function does not support MSI.
+Err enableMsi(Device const& dev,
+              Smp::Id const cpu,
+              Interrupts::Vector const vector);
+
+// Disable MSI on a function.
+// @param dev: The function.
+void disableMsi(Device const& dev);
+
+// The MSI-X table of a function, as returned by enableMsix().
+struct MsixTable {
+    Device dev;
+    // The offset of the MSI-X capability in the configuration space.
+    u8 capOffset;
+    // The virtual address of the table.
+    VirAddr table;
+    // Number of entries in the table.
+    u16 size;
+};
+
+// Enable MSI-X on a function. All entries of the table are masked, each entry
+// is then meant to be configured with setMsixEntry(), typically one entry per
+// queue of the device. INTx is disabled.
+// @param dev: The function.
+// @return: The MSI-X table of the function or an error if the function does
+// not support MSI-X.
+Res<MsixTable> enableMsix(Device const& dev);
+
+// Configure and unmask an entry of an MSI-X table.
+// @param table: The table.
+// @param index: The index of the entry.
+// @param cpu: The cpu receiving the interrupts of this entry.
+// @param vector: The vector raised on `cpu`.
+void setMsixEntry(MsixTable const& table,
+                  u16 const index,
+                  Smp::Id const cpu,
+                  Interrupts::Vector const vector);
+
+// (Un-)Mask an entry of an MSI-X table.
+// @param table: The table.
+// @param index: The index of the entry.
+// @param isMasked: If true, mask the entry, otherwise unmask it.
+void setMsixEntryMask(MsixTable const& table,
+                      u16 const index,
+                      bool const isMasked);
+
+// Disable MSI-X on a function.
+// @param table: The table returned by enableMsix().
+void disableMsix(MsixTable const& table);
+
+// Run the PCI tests. Those tests need the APs to be online.
+void Test(SelfTests::TestRunner& runner);
+}
@@ -0,0 +1,94 @@
+// Sampling profiler.
+// Each profiled cpu periodically records the RIP of the code it interrupted
+// into a per-cpu buffer. The sampling interrupt comes from an architectural
+// performance-monitoring counter overflowing every N core cycles, delivered as
+// an NMI through the performance-counter LVT of the LAPIC, so that code running
+// with interrupts disabled is also sampled. When the cpu does not expose an
+// architectural PMU, which is typically the case under emulation, the periodic
+// LAPIC timer is used instead.
+// Building the kernel with `make PROFILE_PERIOD=<cycles>` profiles all cpus
+// exposing a perf counter from boot, the profile is logged on shutdown.
+#pragma once
+#include <util/result.hpp>
+#include <smp/smp.hpp>
+#include <selftests/selftests.hpp>
+
+namespace Profiler {
+
+// The source of the sampling interrupts on a cpu.
+enum class Source {
+    // IA32_PMC0 counting unhalted core cycles, overflow raises an NMI. The
+    // period is in core cycles.
+    PerfCounter,
+    // The LAPIC timer in periodic mode. The period is in LAPIC timer ticks.
+    LapicTimer,
+};
+
+// Maximum number of samples recorded per cpu. Samples taken once the buffer of
+// a cpu is full are dropped.
+static constexpr u64 BUFFER_SIZE = 8192;
+
+// Allocate the per-cpu sample buffers and install the sampling interrupt
+// handlers. Must be called after Smp::PerCpu::Init().
+void Init();
+
+// Start profiling the current cpu if the kernel was built with PROFILE_PERIOD.
+// Called by Init() for the BSP and by each AP once online.
+void InitCurrCpu();
+
+// Check if the kernel was built with PROFILE_PERIOD, in which case all cpus
+// are profiled from boot until shutdown.
+// @return: true if profiling from boot, false otherwise.
+bool isBootProfiling();
+
+// Check if the current cpu exposes an architectural PMU that can be used for
+// sampling.
+// @return: true if the perf counter source is available, false otherwise.
+bool hasPerfCounter();
+
+// Start profiling on the current cpu. The samples recorded so far on this cpu
+// are kept. While the LAPIC timer is the source, the LAPIC timer of this cpu
+// cannot be used for anything else, including LapicTimer::delay().
+// @param period: The number of cycles, or LAPIC timer ticks if the perf counter
+// is not available, between two samples. Must be non-zero and below 2^31.
+// @return: The source used for the sampling interrupts.
+Source startCurrCpu(u64 const period);
+
+// Stop profiling on the current cpu. No-op if profiling is not running.
+void stopCurrCpu();
+
+// Start profiling on all online cpus, see startCurrCpu().
+// @param period: The period between two samples on each cpu.
+void start(u64 const period);
+
+// Stop profiling on all online cpus.
+void stop();
+
+// Get the number of samples recorded on a cpu.
+// @param cpu: The cpu.
+// @return: The number of samples in the buffer of `cpu`.
+u64 numSamples(Smp::Id const cpu);
+
+// Get the number of samples that were dropped on a cpu because its buffer was
+// full.
+// @param cpu: The cpu.
+// @return: The number of dropped samples.
+u64 numDropped(Smp::Id const cpu);
+
+// Get the number of samples recorded on all cpus with a given RIP.
+// @param rip: The RIP to count.
+// @return: The number of samples of `rip` in all buffers.
+u64 numSamplesAt(u64 const rip);
+
+// Discard all the samples recorded so far. Profiling must be stopped on all
+// cpus.
+void reset();
+
+// Log the histogram of the samples recorded on all cpus, most sampled RIPs
+// first. No-op if no sample was recorded.
+// @param maxEntries: The maximum number of RIPs to log.
+void dump(u64 const maxEntries = 20);
+
+// Run the profiler tests. Those tests need the APs to be online.
+void Test(SelfTests::TestRunner& runner);
+}
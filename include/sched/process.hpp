@@ -18,13 +18,23 @@ public:
     // Create a process that executes a function or lambda.
     // @param func: The function to be executed. This must be a function taking
     // no argument. If this function ever returns, a PANIC is raised.
+    // @param kernelStackPages: The size of the process' kernel stack in number
+    // of pages.
     // @return: A pointer to the Proc instance or an error, if any.
-    static Res<Ptr<Proc>> New(void (*func)(void));
+    static Res<Ptr<Proc>> New(
+        void (*func)(void),
+        u64 const kernelStackPages = Memory::DEFAULT_STACK_PAGES);
 
     // Get the unique identifier associated with this process. This ID is
     // auto-generated in the constructor.
     Id id() const;
 
+    // Get the high-water mark of the kernel stack of this process, that is the
+    // maximum number of bytes that have ever been used on this stack. Useful to
+    // tune the size of kernel stacks.
+    // @return: The number of bytes used on the kernel stack.
+    u64 kernelStackHighWaterMark() const;
+
     // The state of a process.
     enum class State {
         // The process is currently running on a cpu.
@@ -77,8 +87,10 @@ public:
 protected:
     // Create a default process. This merely allocate an AddrSpace and Stack for
     // the process and allocate a Proc.
+    // @param kernelStackPages: The size of the process' kernel stack in number
+    // of pages.
     // @return: A pointer to the Proc instance or an error, if any.
-    static Res<Ptr<Proc>> New();
+    static Res<Ptr<Proc>> New(u64 const kernelStackPages);
 
     // Create a process. The process starts in the blocked state.
     // @param addrSpace: The address space of the process.
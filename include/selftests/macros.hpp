@@ -3,7 +3,7 @@
 
 #include <logging/log.hpp>
 #include <util/panic.hpp>
-#include <timers/lapictimer.hpp>
+#include <timers/tsc.hpp>
 #include <interrupts/interrupts.hpp>
 
 // Check that the current machine has multiple cores. If not, print a warning
@@ -40,20 +40,38 @@
         }                                                       \
     } while (0)
 
-// Wait for a condition to be true. This function uses the LapicTimer to delay
-// execution on the current core. If the condition is still not true after the
-// timeout logs the failure and return TestResult::Failure.
+namespace SelfTests {
+// Busy-wait for a condition to be true or a timeout to expire. This spins on
+// the monotonic clock and therefore can be used with interrupts disabled and
+// while the LAPIC timer is in use. Unlike TEST_WAIT_FOR, a timeout is not a
+// failure, e.g. to check that something does not happen.
+// @param cond: Callable returning true once the condition holds.
+// @param ms: The max amount of time to wait on the condition in
+// milliseconds.
+// @return: true if the condition holds, false on timeout.
+template<typename Cond>
+bool waitFor(Cond const& cond, u64 const ms) {
+    u64 const deadline(Timer::Tsc::monotonicNanos()
+        + Timer::Duration::MilliSecs(ms).microSecs() * 1000);
+    while (!cond()) {
+        if (Timer::Tsc::monotonicNanos() >= deadline) {
+            return cond();
+        }
+        asm("pause");
+    }
+    return true;
+}
+}
+
+// Wait for a condition to be true, see SelfTests::waitFor(). If the condition
+// is still not true after the timeout logs the failure and return
+// TestResult::Failure.
 // @param cond: The condition to wait on.
 // @param ms: The max amount of time to wait on the condition in
 // milliseconds.
 #define TEST_WAIT_FOR(cond, ms)                                               \
     do {                                                                      \
-        u64 __remainingIte(Timer::Duration::MilliSecs(ms).microSecs()/10000); \
-        while (!(cond) && !!__remainingIte) {                                 \
-            Timer::LapicTimer::delay(Timer::Duration::MilliSecs(10));         \
-            __remainingIte--;                                                 \
-        }                                                                     \
-        if (!__remainingIte) {                                                \
+        if (!SelfTests::waitFor([&]() { return !!(cond); }, ms)) {            \
             char const * const condStr(#cond);                                \
             Log::crit("    Timeout waiting for: {}", condStr);                \
             return SelfTests::TestResult::Failure;                            \
@@ -61,7 +79,8 @@
     } while (0)
 
 // RAII class to temporarily register an interrupt handler for a vector and
-// automatically deregister it upon leaving the scope/destruction.
+// automatically restore the previously registered handler upon leaving the
+// scope/destruction.
 class TemporaryInterruptHandlerGuard {
 public:
     // Create a TemporaryInterruptHandlerGuard. Register the handler `handler`
@@ -69,14 +88,22 @@ public:
     // @param vector: The vector for which to register a handler.
     // @param handler: The handler to register for `vector`.
     TemporaryInterruptHandlerGuard(Interrupts::Vector const vector,
-        Interrupts::InterruptHandler const& handler) : m_vector(vector) {
+        Interrupts::InterruptHandler const& handler) :
+        m_vector(vector),
+        m_prevHandler(Interrupts::registeredHandler(vector)) {
         Interrupts::registerHandler(m_vector, handler);
     }
 
-    // Deregister the handler upon destruction.
+    // Restore the previous handler upon destruction. If there was no handler
+    // registered before, the handler is deregistered.
     ~TemporaryInterruptHandlerGuard() {
-        Interrupts::deregisterHandler(m_vector);
+        if (!!m_prevHandler) {
+            Interrupts::registerHandler(m_vector, m_prevHandler);
+        } else {
+            Interrupts::deregisterHandler(m_vector);
+        }
     }
 private:
     Interrupts::Vector const m_vector;
+    Interrupts::InterruptHandler const m_prevHandler;
 };
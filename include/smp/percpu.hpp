@@ -7,6 +7,8 @@
 #include <concurrency/lock.hpp>
 #include <util/ptr.hpp>
 #include <memory/stack.hpp>
+#include <memory/segmentation.hpp>
+#include <paging/paging.hpp>
 
 namespace Smp::PerCpu {
 
@@ -25,6 +27,13 @@ struct Data {
     // Used to avoid nested processing of the remoteCallQueue, see
     // handleRemoteCallInterrupt() in smp/remotecall.cpp.
     bool isProcessingRemoteCallQueue = false;
+    // Set once this cpu is up and running and can process interrupts, such as
+    // remote calls.
+    bool isOnline = false;
+    // Pre-zeroed frames used by this cpu when allocating page tables.
+    Paging::PageTableFrameCache pageTableFrameCache;
+    // The GDT, TSS and IST stacks of this cpu.
+    Ptr<Memory::Segmentation::PerCpuTables> segmentation;
 };
 // This struct must be packed as it can be accessed directly from assembly.
 
@@ -32,6 +41,12 @@ struct Data {
 // system. Requires the heap allocator.
 void Init();
 
+// Check if Init() has been called. This is meant for subsystems that are
+// initialized before the per-cpu data but that want to make use of it once
+// available, e.g. paging.
+// @return: true if the per-cpu data is available, false otherwise.
+bool isInitialized();
+
 // Get a reference to the per-cpu data of the current cpu.
 // @return: A non-const reference to this cpu's Data instance.
 Data& data();
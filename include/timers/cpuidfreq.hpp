@@ -0,0 +1,26 @@
+// Timer frequencies reported by CPUID.
+// Recent cpus report the frequency of the TSC and of the core crystal clock,
+// which drives the LAPIC timer, in leaves 0x15 and 0x16. Some hypervisors
+// report the frequencies of the TSC and of the LAPIC timer in leaf 0x40000010,
+// which is the only source trusted when running under a hypervisor.
+// When available those frequencies make the calibration of the timers, and the
+// delay it adds to the boot, unnecessary.
+#pragma once
+#include <timers/timers.hpp>
+#include <selftests/selftests.hpp>
+
+namespace Timer::CpuidFreq {
+
+// Get the frequency of the TSC as reported by CPUID.
+// @return: The frequency in Hz, or 0 if CPUID does not report it.
+u64 tscFrequency();
+
+// Get the frequency of the LAPIC timer, with a divisor of 1, as reported by
+// CPUID.
+// @return: The frequency in Hz, or 0 if CPUID does not report it.
+u64 lapicTimerFrequency();
+
+// Run the tests comparing the frequencies reported by CPUID with the measured
+// frequencies.
+void Test(SelfTests::TestRunner& runner);
+}
@@ -0,0 +1,45 @@
+// High Precision Event Timer (HPET).
+// The HPET is a memory-mapped counter running at a constant frequency of at
+// least 10MHz, described by the ACPI HPET table. Only its main counter is used:
+// to calibrate the other timers in well under a millisecond and as the source
+// of the monotonic clock when the TSC is not invariant. The comparators are
+// left untouched.
+#pragma once
+#include <timers/timers.hpp>
+#include <selftests/selftests.hpp>
+
+namespace Timer::Hpet {
+
+// Map the registers of the HPET and start its main counter. Must be called
+// after Acpi::Init(). Does nothing if ACPI does not report an HPET.
+void Init();
+
+// Check if the HPET can be used.
+// @return: true if Init() found and enabled an HPET, false otherwise.
+bool isAvailable();
+
+// Check if the main counter is 64 bits wide. A 32-bit counter wraps around
+// after a few minutes and is therefore only usable for short measurements.
+// @return: true if the main counter is 64-bit, false otherwise.
+bool is64Bit();
+
+// Get the frequency of the main counter, as reported by the HPET.
+// @return: The frequency in Hz.
+Freq frequency();
+
+// Read the main counter. Must only be called if isAvailable().
+// @return: The current value of the main counter.
+u64 counter();
+
+// Measure the frequency of another counter against the main counter. Each end
+// of the measurement interval is bracketed by two reads of the measured counter
+// so that the latency of the MMIO reads does not skew the result.
+// @param readCounter: Function reading the measured counter, which must be
+// increasing and must not wrap around during the measurement.
+// @param nanos: The duration of the measurement in nanoseconds.
+// @return: The frequency of the measured counter in Hz.
+Freq measureFrequency(u64 (*readCounter)(), u64 const nanos);
+
+// Run the HPET tests.
+void Test(SelfTests::TestRunner& runner);
+}
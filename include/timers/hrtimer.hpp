@@ -0,0 +1,84 @@
+// High-resolution timers.
+// An HrTimer runs a callback once the monotonic clock reaches a deadline, with
+// nanosecond resolution. Each cpu keeps its pending timers in a min-heap
+// ordered by deadline and arms its LAPIC timer for the earliest one, in
+// TSC-deadline mode if available, otherwise in one-shot mode. Expired timers
+// are run from the LAPIC timer interrupt.
+// While a cpu has pending timers its LAPIC timer must not be used for anything
+// else, e.g. LapicTimer::delay() or the profiler.
+#pragma once
+#include <smp/smp.hpp>
+#include <selftests/selftests.hpp>
+
+namespace Timer {
+
+class HrTimer {
+public:
+    // Callback of a timer, called in interrupt context on the cpu the timer was
+    // started on. The callback may restart or destroy its timer.
+    // @param timer: The timer that expired.
+    using Callback = void (*)(HrTimer& timer);
+
+    // Initialize the per-cpu timer queues. Must be called after
+    // Smp::PerCpu::Init() and Tsc::Init().
+    static void Init();
+
+    // Create a timer. The timer is not started.
+    // @param callback: The function called when the timer expires.
+    // @param arg: Opaque argument for the callback, see arg().
+    HrTimer(Callback const callback, void* const arg = nullptr);
+
+    // Timers are linked in the per-cpu queues, they cannot be copied.
+    HrTimer(HrTimer const& other) = delete;
+    HrTimer& operator=(HrTimer const& other) = delete;
+
+    // Destroy a timer, cancelling it if it is pending.
+    ~HrTimer();
+
+    // Start the timer on the current cpu. If the timer was already pending it
+    // is re-armed with the new deadline, possibly moving it to the current
+    // cpu. A timer must not be started or cancelled concurrently from multiple
+    // cpus.
+    // @param deadline: The value of Tsc::monotonicNanos() at which the timer
+    // expires. A deadline in the past expires immediately.
+    void start(u64 const deadline);
+
+    // Start the timer on the current cpu to expire after the given duration.
+    // @param nanos: The number of nanoseconds until the timer expires.
+    void startAfter(u64 const nanos);
+
+    // Cancel the timer. If the callback of the timer is running on another cpu
+    // this waits for it to complete.
+    // @return: true if the timer was pending, false otherwise.
+    bool cancel();
+
+    // Check if the timer is pending, i.e. started and not yet expired.
+    // @return: true if pending, false otherwise.
+    bool isPending() const;
+
+    // Get the deadline of the timer.
+    // @return: The deadline given to the last call to start().
+    u64 deadline() const;
+
+    // Get the argument given at construction.
+    // @return: The opaque argument of the callback.
+    void* arg() const;
+
+private:
+    // Value of m_heapIndex when the timer is not in a queue.
+    static constexpr u64 NotQueued = ~0ULL;
+
+    Callback const m_callback;
+    void* const m_arg;
+    u64 m_deadline;
+    // The cpu in whose queue the timer was last inserted.
+    Smp::Id m_cpu;
+    // The index of the timer in the heap of m_cpu, NotQueued if not pending.
+    u64 volatile m_heapIndex;
+
+    friend struct HrTimerQueue;
+};
+
+// Run the high-resolution timer tests. Those tests need the APs to be online.
+void HrTimerTest(SelfTests::TestRunner& runner);
+}
@@ -1,9 +1,16 @@
 // Functions to interact with and configure the LAPIC timer.
 #pragma once
 #include <timers/timers.hpp>
+#include <interrupts/interrupts.hpp>
 
 namespace Timer::LapicTimer {
 
+// Compute the frequency of the LAPIC timer if it has not been computed yet. The
+// frequency may be measured against the PIT, whose interrupts must be able to
+// fire: this must not be called with interrupts disabled or while holding a
+// spinlock.
+void InitFrequency();
+
 // Initialize the LAPIC timer. The timer is configured to use the given
 // frequency and uses vector Interrupts::VectorMap::LapicTimerVector. The timer
 // is _not_ started by calling this function.
@@ -23,4 +30,46 @@ void stop();
 // used if the timer is already running!
 // @param duration: The amount of time to delay the thread/core for.
 void delay(Duration const duration);
+
+// Measure the frequency of the LAPIC timer of the current cpu against the HPET
+// if available, otherwise against the PIT. The frequency used by this namespace
+// comes from CPUID when reported, in which case it is never measured. This
+// clobbers the configuration of the LAPIC timer.
+// @return: The measured frequency, with a divisor of 1.
+Freq measureFrequency();
+
+// Arm the LAPIC timer of the current cpu to fire a single interrupt after the
+// given duration. The duration is rounded to the resolution of the LAPIC timer
+// and clamped to the longest duration the timer can count, the caller is
+// expected to re-arm the timer if it fired too early. InitFrequency() must
+// have been called.
+// @param vector: The vector raised when the timer expires.
+// @param nanos: The duration in nanoseconds.
+void armOneShot(Interrupts::Vector const vector, u64 const nanos);
+
+// TSC-deadline mode
+// -----------------
+// In TSC-deadline mode the timer fires a single interrupt once the TSC reaches
+// an absolute deadline. Programming the next event is then a single MSR write
+// with cycle precision, without any dependency on the calibrated frequency of
+// the LAPIC timer. The mode is per-cpu and is left by calling start() or
+// delay() on the cpu.
+
+// Check if the current cpu supports the TSC-deadline mode.
+// @return: true if CPUID advertises the TSC-deadline mode, false otherwise.
+bool hasTscDeadline();
+
+// Switch the LAPIC timer of the current cpu to TSC-deadline mode. No deadline
+// is armed after this call. Must only be called if hasTscDeadline().
+// @param vector: The vector raised when a deadline is reached.
+void initTscDeadline(Interrupts::Vector const vector);
+
+// Arm the timer of the current cpu to fire at the given TSC value. Replaces
+// the previous deadline, if any. A deadline in the past fires immediately. The
+// timer must be in TSC-deadline mode, see initTscDeadline().
+// @param tscDeadline: The value of the TSC at which the interrupt fires.
+void setTscDeadline(u64 const tscDeadline);
+
+// Disarm the deadline of the current cpu, if any.
+void cancelTscDeadline();
 }
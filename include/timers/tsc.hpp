@@ -0,0 +1,70 @@
+// Time-Stamp Counter (TSC) clocksource.
+// The TSC is calibrated once at boot, either from the frequencies reported by
+// CPUID or by measuring it against the HPET or the PIT. The monotonic clock is
+// then derived from the TSC with a multiply and a shift, its parameters are
+// protected by a SeqLock so that reading the clock never takes a lock nor
+// writes to shared memory. If the TSC is not invariant the monotonic clock is
+// derived from the HPET instead, when available.
+#pragma once
+#include <timers/timers.hpp>
+#include <selftests/selftests.hpp>
+
+namespace Timer::Tsc {
+
+// Calibrate the TSC and start the monotonic clock at 0. Must be called after
+// the I/O APICs and the HPET have been initialized, the HPET or the PIT is used
+// for the calibration if CPUID does not report the frequency of the TSC.
+void Init();
+
+// Measure the frequency of the TSC against the HPET if available, otherwise
+// against the PIT. Init() only measures the frequency if CPUID does not report
+// it. Must be called after the I/O APICs and the HPET have been initialized.
+// @return: The measured frequency.
+Freq measureFrequency();
+
+// Check if the TSC is invariant, that is it ticks at a constant rate in all
+// ACPI P-, C- and T-states.
+// @return: true if CPUID reports an invariant TSC, false otherwise.
+bool isInvariant();
+
+// Get the frequency of the TSC computed by Init().
+// @return: The frequency in Hz.
+Freq frequency();
+
+// Check that the TSCs of all online cpus are synchronized, that is a value read
+// on a cpu is never smaller than a value read earlier on another cpu. Logs a
+// warning if a cpu is not synchronized with the current cpu.
+// @return: true if all online cpus are synchronized with the current cpu.
+bool checkSynchronization();
+
+// Get the current value of the monotonic clock. This is callable from any cpu
+// and any context, including interrupt handlers.
+// @return: The number of nanoseconds elapsed since Init().
+u64 monotonicNanos();
+
+// Busy-wait for the given duration, counting TSC cycles. Unlike
+// LapicTimer::delay() this does not touch the LAPIC timer and can therefore be
+// called from any context, including interrupt handlers and while the LAPIC
+// timer is in use. The interrupt flag is untouched during the delay.
+// @param duration: The amount of time to busy-wait for.
+void delay(Duration const duration);
+
+// Busy-wait until the monotonic clock reaches a deadline. Like delay(), this
+// can be called from any context.
+// @param deadline: The value of monotonicNanos() to wait for. A deadline in the
+// past returns immediately.
+void spinUntil(u64 const deadline);
+
+// Convert a number of TSC cycles to nanoseconds.
+// @param cycles: The number of cycles.
+// @return: The duration of `cycles` in nanoseconds.
+u64 cyclesToNanos(u64 const cycles);
+
+// Convert a number of nanoseconds to TSC cycles.
+// @param nanos: The number of nanoseconds.
+// @return: The number of cycles in `nanos`.
+u64 nanosToCycles(u64 const nanos);
+
+// Run the TSC tests. Those tests need the APs to be online.
+void Test(SelfTests::TestRunner& runner);
+}
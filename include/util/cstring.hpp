@@ -3,6 +3,7 @@
 #pragma once
 
 #include <util/ints.hpp>
+#include <selftests/selftests.hpp>
 
 namespace Util {
 
@@ -18,16 +19,51 @@ u64 strlen(char const * const str);
 // false otherwise.
 bool streq(char const * const str1, char const * const str2);
 
+// The memory functions below use REP MOVSB/STOSB when the cpu advertises fast
+// string operations (ERMS/FSRM) and 8-byte wide string operations otherwise.
+
+// FIXME: Do we really need to use void here?
+// Set all the bytes of a memory buffer to the same value.
+// @param ptr: Memory buffer to set.
+// @param value: The value to write in each byte of the buffer.
+// @param size: Size of the buffer in bytes.
+void memset(void * const ptr, u8 const value, u64 const size);
+
 // FIXME: Do we really need to use void here?
 // Zero a memory buffer.
 // @param ptr: Memory buffer to zero.
 // @param size: Size of the buffer in bytes.
 void memzero(void * const ptr, u64 const size);
 
+// Zero a memory buffer using non-temporal stores, e.g. without polluting the
+// caches. This is meant for bulk zeroing of memory that is not accessed soon
+// after, e.g. pages put in a cache for later use.
+// @param ptr: Memory buffer to zero, must be 8-byte aligned.
+// @param size: Size of the buffer in bytes, must be a multiple of 64.
+void memzeroNonTemporal(void * const ptr, u64 const size);
+
 // FIXME: Do we really need to use void here?
-// Copy a memory buffer into another
+// Copy a memory buffer into another. The buffers must not overlap, use
+// memmove() for overlapping buffers.
 // @param dest: The destination buffer.
 // @param src: The source buffer.
 // @param size: The number of bytes to copy.
 void memcpy(void * const dst, void const * const src, u64 const size);
+
+// Copy a memory buffer into another. The buffers may overlap.
+// @param dest: The destination buffer.
+// @param src: The source buffer.
+// @param size: The number of bytes to copy.
+void memmove(void * const dst, void const * const src, u64 const size);
+
+// Compare two memory buffers.
+// @param ptr1: The first buffer.
+// @param ptr2: The second buffer.
+// @param size: The number of bytes to compare.
+// @return: 0 if both buffers have the same content, otherwise the difference
+// between the first differing bytes of ptr1 and ptr2, interpreted as u8.
+i32 memcmp(void const * const ptr1, void const * const ptr2, u64 const size);
+
+// Run the tests and benchmarks of the memory functions.
+void Test(SelfTests::TestRunner& runner);
 }
@@ -13,6 +13,22 @@ enum class Error {
     // The ACPI parsing function was not able to file the RSDP.
     NoRsdpFound,
 
+    // No more virtual memory available in the kernel virtual address range
+    // managed by VirtAlloc.
+    OutOfVirtualMemory,
+
+    // The virtual address is not mapped to any physical memory.
+    AddrNotMapped,
+
+    // No free interrupt vector is available in the requested priority class.
+    OutOfInterruptVectors,
+
+    // The PCI Base Address Register does not exist or is not implemented.
+    InvalidPciBar,
+
+    // The PCI function does not implement the requested capability.
+    PciCapabilityNotFound,
+
     // To be used for testing only.
     Test,
 };
@@ -26,6 +42,11 @@ inline char const * errorToString(Error const value) {
         CASE(OutOfPhysicalMemory)
         CASE(MaxHeapSizeReached)
         CASE(NoRsdpFound)
+        CASE(OutOfVirtualMemory)
+        CASE(AddrNotMapped)
+        CASE(OutOfInterruptVectors)
+        CASE(InvalidPciBar)
+        CASE(PciCapabilityNotFound)
         CASE(Test)
         // -Wall and -Werror make sure that all values of Error must appear
         // here.
@@ -11,6 +11,8 @@ using i8  = int8_t;
 using i16 = int16_t;
 using i32 = int32_t;
 using i64 = int64_t;
+// Only meant for intermediate results of 64-bit multiplications.
+using u128 = unsigned __int128;
 
 // Compute the min of two value, using operator<().
 template<typename T>
@@ -32,6 +32,8 @@ void _panic(char const * const fileName,
             char const * const funcName,
             char const * const fmt,
             T const&... args) {
+    // Print the messages logged so far before the panic message.
+    Log::flushForPanic();
     Log::crit("==================== PANIC ====================");
     Log::crit("Location: {}:{}", fileName, lineNumber);
     Log::crit("Function: {}", funcName);
@@ -41,6 +43,9 @@ void _panic(char const * const fileName,
                                "[CRIT] Reason  : ",
                                fmt,
                                args...);
+    // Make sure the panic message reached the output device, its interrupts
+    // will not be served anymore.
+    Log::flushForPanic();
 
     // Halt the CPU forever.
     while (true) {
@@ -230,6 +230,44 @@ static void parseMadt(Madt const * const madt) {
     madt->forEachEntry(parseMadtEntry);
 }
 
+// Parse a MCFG.
+// @param mcfg: Pointer to the MCFG to parse.
+static void parseMcfg(Mcfg const * const mcfg) {
+    for (u64 i(0); i < mcfg->numEntries(); ++i) {
+        Mcfg::Entry const& entry(mcfg->entries[i]);
+        Log::info("    ECAM @{x}: segment = {} buses = {} - {}",
+                  entry.baseAddress, entry.segment, entry.startBus,
+                  entry.endBus);
+        Info::EcamDesc const desc({
+            .address = entry.baseAddress,
+            .segment = entry.segment,
+            .startBus = entry.startBus,
+            .endBus = entry.endBus,
+        });
+        AcpiInfo.ecamDesc.pushBack(desc);
+    }
+}
+
+// Parse a HPET table. Only the first HPET is used.
+// @param hpet: Pointer to the HPET table to parse.
+static void parseHpet(Hpet const * const hpet) {
+    Log::info("    HPET #{} @{x}: minimum tick = {}", hpet->hpetNumber,
+              hpet->address, hpet->minimumTick);
+    // The address space ID must be 0, e.g. system memory.
+    if (!!hpet->addressSpaceId) {
+        Log::warn("    HPET registers are not memory mapped, ignoring");
+        return;
+    }
+    if (AcpiInfo.hasHpet) {
+        return;
+    }
+    AcpiInfo.hasHpet = true;
+    AcpiInfo.hpetDesc = {
+        .address = hpet->address,
+        .minimumTick = hpet->minimumTick,
+    };
+}
+
 // Has Init() been called already? Used to assert that cpus are not trying to
 // use the namespace before its initialization.
 static bool IsInitialized = false;
@@ -283,6 +321,10 @@ void Init() {
         Log::info("  {} table @{}", sig, sdt);
         if (compareSignatures(sdtSig, "APIC", 4)) {
             parseMadt(reinterpret_cast<Madt const*>(sdt));
+        } else if (compareSignatures(sdtSig, "MCFG", 4)) {
+            parseMcfg(reinterpret_cast<Mcfg const*>(sdt));
+        } else if (compareSignatures(sdtSig, "HPET", 4)) {
+            parseHpet(reinterpret_cast<Hpet const*>(sdt));
         } else {
             Log::info("    Ignored by this kernel");
         }
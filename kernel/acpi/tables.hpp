@@ -132,6 +132,53 @@ struct Madt {
     }
 } __attribute__ ((packed));
 
+// PCI Express memory mapped configuration space base address Description Table
+// (MCFG). Lists the ECAM regions of the PCI segments.
+struct Mcfg {
+    RsdtHeader header;
+    u64 reserved;
+
+    // Describes the ECAM region of a range of buses of a PCI segment.
+    struct Entry {
+        // Physical address of the configuration space of bus 0.
+        u64 baseAddress;
+        // The PCI segment group number.
+        u16 segment;
+        // The first and last bus numbers decoded by this region, inclusive.
+        u8 startBus;
+        u8 endBus;
+        u32 reserved;
+    } __attribute__ ((packed));
+    // The entries, the size of the array is given by numEntries().
+    Entry entries[0];
+
+    // Compute the number of entries in this MCFG.
+    // @return: The number of entries.
+    u64 numEntries() const {
+        return (header.length - sizeof(*this)) / sizeof(Entry);
+    }
+} __attribute__ ((packed));
+
+// High Precision Event Timer Description Table (HPET). Gives the address of
+// the registers of the HPET.
+struct Hpet {
+    RsdtHeader header;
+    // Copy of the lower 32 bits of the General Capabilities and ID register.
+    u32 eventTimerBlockId;
+    // The address of the registers, as a Generic Address Structure.
+    u8 addressSpaceId;
+    u8 registerBitWidth;
+    u8 registerBitOffset;
+    u8 reserved;
+    u64 address;
+    // The sequence number of this HPET.
+    u8 hpetNumber;
+    // The minimum number of ticks of the main counter between two interrupts
+    // in periodic mode.
+    u16 minimumTick;
+    u8 pageProtection;
+} __attribute__ ((packed));
+
 // Root System Description Table (RSDT). This is essentially a header followed
 // by an array of pointers to various System Descriptor Tables (SDT). The size
 // of the array is determined by the total length of the RSDT as:
@@ -54,4 +54,38 @@ void SpinLock::doUnlock() {
     // serializing the instruction stream.
     m_flag.compareAndExchange(1, 0);
 }
+
+// Prevent the compiler from moving memory accesses across this point. On x86
+// loads are not reordered with other loads and stores are not reordered with
+// other stores, hence this is enough for the SeqLock.
+static inline void compilerBarrier() {
+    asm volatile("" : : : "memory");
+}
+
+u64 SeqLock::readBegin() const {
+    u64 seq(m_seq);
+    while (seq & 1) {
+        asm("pause");
+        seq = m_seq;
+    }
+    compilerBarrier();
+    return seq;
+}
+
+bool SeqLock::readRetry(u64 const seq) const {
+    compilerBarrier();
+    return m_seq != seq;
+}
+
+void SeqLock::writeBegin() {
+    ASSERT(!(m_seq & 1));
+    m_seq = m_seq + 1;
+    compilerBarrier();
+}
+
+void SeqLock::writeEnd() {
+    compilerBarrier();
+    ASSERT(m_seq & 1);
+    m_seq = m_seq + 1;
+}
 }
@@ -188,6 +188,49 @@ SelfTests::TestResult spinLockMutualExclusionTest() {
     return SelfTests::TestResult::Success;
 }
 
+// Check that readers of a SeqLock never observe a partial write.
+SelfTests::TestResult seqLockTest() {
+    TEST_REQUIRES_MULTICORE();
+    u64 const numWrites(1000000);
+    Smp::Id const writer(Smp::id() == 0 ? 1 : 0);
+
+    SeqLock lock;
+    u64 volatile val1(0);
+    u64 volatile val2(0);
+    bool volatile done(false);
+    Ptr<Smp::RemoteCall::CallResult<void>> res(Smp::RemoteCall::invokeOn(
+        writer, [&]() {
+            for (u64 i(1); i <= numWrites; ++i) {
+                lock.writeBegin();
+                val1 = i;
+                val2 = ~i;
+                lock.writeEnd();
+            }
+            done = true;
+    }));
+
+    u64 numReads(0);
+    u64 last(0);
+    while (!done) {
+        u64 seq;
+        u64 read1;
+        u64 read2;
+        do {
+            seq = lock.readBegin();
+            read1 = val1;
+            read2 = val2;
+        } while (lock.readRetry(seq));
+        TEST_ASSERT(read2 == ~read1 || (!read1 && !read2));
+        // The writes are observed in order.
+        TEST_ASSERT(last <= read1);
+        last = read1;
+        numReads++;
+    }
+    res->wait();
+    TEST_ASSERT(!!numReads);
+    return SelfTests::TestResult::Success;
+}
+
 // Run concurrency related tests.
 void Test(SelfTests::TestRunner& runner) {
     RUN_TEST(runner, atomicBasicOperatorsTest);
@@ -195,6 +238,7 @@ void Test(SelfTests::TestRunner& runner) {
     RUN_TEST(runner, spinLockBasicTest);
     RUN_TEST(runner, lockGuardTest);
     RUN_TEST(runner, spinLockMutualExclusionTest);
+    RUN_TEST(runner, seqLockTest);
 }
 
 }
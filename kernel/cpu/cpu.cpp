@@ -66,6 +66,27 @@ TableDesc sidt() {
     return TableDesc(base, limit);
 }
 
+// Load the task register using the LTR instruction. Implemented in assembly.
+// @param sel: The segment selector of the TSS descriptor to load.
+extern "C" void _ltr(u16 const sel);
+
+// Load the task register using the LTR instruction.
+// @param sel: The segment selector of the TSS descriptor to load. The TSS
+// descriptor must not be busy.
+void ltr(SegmentSel const sel) {
+    _ltr(sel.raw());
+}
+
+// Read the current value of the task register using the STR instruction.
+// Implemented in assembly.
+extern "C" u16 _str();
+
+// Read the current value of the task register using the STR instruction.
+// @return: The segment selector currently loaded in the task register.
+SegmentSel str() {
+    return SegmentSel(_str());
+}
+
 
 // Create a segment selector value.
 // @param selectorIndex: The index of the segment to point to in the
@@ -127,6 +148,19 @@ extern "C" void _setFs(u16 const sel);
 extern "C" void _setGs(u16 const sel);
 extern "C" void _setSs(u16 const sel);
 
+// Set the value of GS while preserving the GS base. Loading GS resets the GS
+// base which points to per-cpu data accessed from interrupt handlers, hence
+// interrupts are disabled until the base is restored.
+// @param sel: The new value for GS.
+static void setGsPreserveBase(SegmentSel const sel) {
+    bool const savedIf(interruptsEnabled());
+    disableInterrupts();
+    u64 const gsBase(rdmsr(Msr::IA32_GS_BASE));
+    _setGs(sel.raw());
+    wrmsr(Msr::IA32_GS_BASE, gsBase);
+    setInterruptFlag(savedIf);
+}
+
 // Set the value of a segment register.
 // @param reg: Select which register to write.
 // @param sel: The value to write in the segment register.
@@ -136,7 +170,7 @@ void writeSegmentReg(SegmentReg const reg, SegmentSel const sel) {
         case SegmentReg::Ds: _setDs(sel.raw()); break;
         case SegmentReg::Es: _setEs(sel.raw()); break;
         case SegmentReg::Fs: _setFs(sel.raw()); break;
-        case SegmentReg::Gs: _setGs(sel.raw()); break;
+        case SegmentReg::Gs: setGsPreserveBase(sel); break;
         case SegmentReg::Ss: _setSs(sel.raw()); break;
     }
 }
@@ -205,6 +239,32 @@ void writeCr3(u64 const value) {
     _writeCr3(value);
 }
 
+// Implementation of cr4() in assembly.
+extern "C" u64 _readCr4();
+
+// Read the current value of CR4.
+u64 cr4() {
+    return _readCr4();
+}
+
+// Implementation of writeCr4() in assembly.
+extern "C" void _writeCr4(u64);
+
+// Write the CR4 register.
+// @param value: The value to be written in the cr4 register.
+void writeCr4(u64 const value) {
+    _writeCr4(value);
+}
+
+// Implementation of invlpg() in assembly.
+extern "C" void _invlpg(u64 const addr);
+
+// Invalidate the TLB entry of a virtual page, even if the entry is global.
+// @param addr: A virtual address within the page to invalidate.
+void invlpg(VirAddr const addr) {
+    _invlpg(addr.raw());
+}
+
 
 // Implementation of outw() in assembly.
 // @param port: The port to output into.
@@ -230,11 +290,38 @@ void outb(Port const port, u8 const value) {
     _outb(port, value);
 }
 
+// Implementation of outsb() in assembly.
+// @param port: The port to output into.
+// @param data: The bytes to write to the port.
+// @param len: The number of bytes to write.
+extern "C" void _outsb(u32 const port, u8 const * const data, u64 const len);
+
+// Output a sequence of bytes in an I/O port, one byte after the other, using
+// a single rep outsb.
+// @param port: The port to output into.
+// @param data: The bytes to write to the port.
+// @param len: The number of bytes to write.
+void outsb(Port const port, u8 const * const data, u64 const len) {
+    _outsb(port, data, len);
+}
+
 // Implementation of inb() in assembly.
 // @param port: The port to read from.
 // @return: The byte read from the port.
 extern "C" u8 _inb(u32 const port);
 
+// Implementation of outl() in assembly.
+// @param port: The port to output into.
+// @param value: The dword to write to the port.
+extern "C" void _outl(u32 const port, u32 const value);
+
+// Output a dword in an I/O port.
+// @param port: The port to output into.
+// @param value: The dword to write to the port.
+void outl(Port const port, u32 const value) {
+    _outl(port, value);
+}
+
 // Read a byte from an I/O port.
 // @param port: The port to read from.
 // @return: The byte read from the port.
@@ -242,6 +329,30 @@ u8 inb(Port const port) {
     return _inb(port);
 }
 
+// Implementation of inw() in assembly.
+// @param port: The port to read from.
+// @return: The word read from the port.
+extern "C" u16 _inw(u32 const port);
+
+// Read a word from an I/O port.
+// @param port: The port to read from.
+// @return: The word read from the port.
+u16 inw(Port const port) {
+    return _inw(port);
+}
+
+// Implementation of inl() in assembly.
+// @param port: The port to read from.
+// @return: The dword read from the port.
+extern "C" u32 _inl(u32 const port);
+
+// Read a dword from an I/O port.
+// @param port: The port to read from.
+// @return: The dword read from the port.
+u32 inl(Port const port) {
+    return _inl(port);
+}
+
 // Execute the CPUID instruction with the given parameters. Implemented in
 // assembly.
 // @param inEax: The value to set the EAX register to before executing CPUID.
@@ -257,16 +368,15 @@ extern "C" void _cpuid(u32 const inEax,
                        u32* const outEcx,
                        u32* const outEdx);
 
-// Execute the CPUID instruction with the given param.
+// Execute the CPUID instruction with the given params.
 // @param eax: The value to set the EAX register to before executing the CPUID
 // instruction.
+// @param ecx: The value to set the ECX register to before executing the CPUID
+// instruction, e.g. the sub-leaf.
 // @return: A CpuidResult containing the output of CPUID.
-CpuidResult cpuid(u32 const eax) {
+CpuidResult cpuid(u32 const eax, u32 const ecx) {
     CpuidResult res;
-    // For now we don't support passing an arg to CPUID through ECX as this is
-    // rarely needed. _cpuid does support however, so if we ever need this this
-    // is only a matter of updating Cpu::cpuid()'s prototype to include ecx.
-    _cpuid(eax, 0x0, &res.eax, &res.ebx, &res.ecx, &res.edx);
+    _cpuid(eax, ecx, &res.eax, &res.ebx, &res.ecx, &res.edx);
     return res;
 }
 
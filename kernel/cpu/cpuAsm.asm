@@ -75,6 +75,33 @@ _sidt:
     leave
     ret
 
+; Load the task register using the LTR instruction. Implemented in assembly.
+; @param sel: The segment selector of the TSS descriptor to load.
+; extern "C" void _ltr(u16 const sel);
+GLOBAL  _ltr:function
+_ltr:
+    push    rbp
+    mov     rbp, rsp
+
+    ltr     di
+
+    leave
+    ret
+
+; Read the current value of the task register using the STR instruction.
+; Implemented in assembly.
+; extern "C" u16 _str();
+GLOBAL  _str:function
+_str:
+    push    rbp
+    mov     rbp, rsp
+
+    xor     rax, rax
+    str     ax
+
+    leave
+    ret
+
 ; Set the segment reg Xs to the value sel. Implemented in assembly.
 ; @param sel: The new value for Xs.
 ; extern "C" void _setCs(u16 const sel);
@@ -170,6 +197,24 @@ _writeCr3:
     mov     cr3, rdi
     ret
 
+GLOBAL  _readCr4:function
+_readCr4:
+    mov     rax, cr4
+    ret
+
+GLOBAL  _writeCr4:function
+_writeCr4:
+    mov     cr4, rdi
+    ret
+
+; Invalidate the TLB entry of a virtual page.
+; @param addr: A virtual address within the page to invalidate.
+; extern "C" void _invlpg(u64 const addr);
+GLOBAL  _invlpg:function
+_invlpg:
+    invlpg  [rdi]
+    ret
+
 ; Implementation of outb() in assembly.
 ; @param port: The port to output into.
 ; @param value: The byte to write to the port.
@@ -192,6 +237,29 @@ _outw:
     out     dx, ax
     ret
 
+; Implementation of outl() in assembly.
+; @param port: The port to output into.
+; @param value: The dword to write to the port.
+; extern "C" void _outl(u16 const port, u32 const value);
+GLOBAL  _outl:function
+_outl:
+    mov     dx, di
+    mov     eax, esi
+    out     dx, eax
+    ret
+
+; Implementation of outsb() in assembly.
+; @param port: The port to output into.
+; @param data: The bytes to write to the port.
+; @param len: The number of bytes to write.
+; extern "C" void _outsb(u16 const port, u8 const * const data, u64 const len);
+GLOBAL  _outsb:function
+_outsb:
+    mov     rcx, rdx
+    mov     dx, di
+    rep outsb
+    ret
+
 ;  Implementation of inb() in assembly.
 ;  @param port: The port to read from.
 ;  @return: The byte read from the port.
@@ -203,6 +271,27 @@ _inb:
     movzx   eax, al
     ret
 
+;  Implementation of inw() in assembly.
+;  @param port: The port to read from.
+;  @return: The word read from the port.
+; extern "C" u16 _inw(u16 const port);
+GLOBAL  _inw:function
+_inw:
+    mov     dx, di
+    in      ax, dx
+    movzx   eax, ax
+    ret
+
+;  Implementation of inl() in assembly.
+;  @param port: The port to read from.
+;  @return: The dword read from the port.
+; extern "C" u32 _inl(u16 const port);
+GLOBAL  _inl:function
+_inl:
+    mov     dx, di
+    in      eax, dx
+    ret
+
 ; Execute the CPUID instruction with the given parameters. Implemented in
 ; assembly.
 ; @param inEax: The value to set the EAX register to before executing CPUID.
@@ -5,7 +5,10 @@
 namespace DataStruct {
 
 // Create an empty EmbeddedFreeList.
-EmbeddedFreeList::EmbeddedFreeList() : m_head(nullptr) {}
+// @param zeroAllocs: If true, the memory returned by alloc() and allocAligned()
+// is zeroed. Otherwise its content is undefined.
+EmbeddedFreeList::EmbeddedFreeList(bool const zeroAllocs) :
+    m_head(nullptr), m_zeroAllocs(zeroAllocs) {}
 
 // Insert a region of free memory in the EmbeddedFreeList. This is mostly used
 // to iteratively construct the free list. Note: since Nodes are embedded, this
@@ -107,7 +110,9 @@ Res<VirAddr> EmbeddedFreeList::alloc(u64 const size) {
                 node->next = curr->next;
                 *prevNext = node;
             }
-            Util::memzero(res.ptr<void>(), allocSize);
+            if (m_zeroAllocs) {
+                Util::memzero(res.ptr<void>(), allocSize);
+            }
             return res;
         }
 
@@ -117,6 +122,59 @@ Res<VirAddr> EmbeddedFreeList::alloc(u64 const size) {
     return Error::OutOfPhysicalMemory;
 }
 
+// Allocate memory from the free-list with a start address aligned on a given
+// alignment.
+// @param size: The size of the allocation in bytes.
+// @param alignment: The alignment of the allocation's start address, in bytes.
+// Must be a power of two.
+// @return: The virtual address of the allocated memory. If the allocation
+// failed then return an Error.
+Res<VirAddr> EmbeddedFreeList::allocAligned(u64 const size,
+                                            u64 const alignment) {
+    ASSERT(!!alignment && !(alignment & (alignment - 1)));
+    u64 const allocSize(max(MinAllocSize, size));
+    Node** prevNext(&m_head);
+    Node* curr(m_head);
+    while (!!curr) {
+        // The allocation may start in the middle of the node, in which case the
+        // bytes before it (the padding) remain in the node. The padding must
+        // therefore be big enough to hold the Node. Same goes for the bytes
+        // left after the allocation, which need a new Node.
+        u64 const base(curr->base().raw());
+        u64 start((base + alignment - 1) & ~(alignment - 1));
+        while (start != base && start - base < MinAllocSize) {
+            start += alignment;
+        }
+        u64 const padding(start - base);
+        bool const fits(padding + allocSize <= curr->size);
+        u64 const sizeAfterAlloc(fits ? curr->size - padding - allocSize : 0);
+        if (!fits || (!!sizeAfterAlloc && sizeAfterAlloc < MinAllocSize)) {
+            prevNext = &curr->next;
+            curr = curr->next;
+            continue;
+        }
+        Node* next(curr->next);
+        if (!!sizeAfterAlloc) {
+            Node* const after(
+                Node::fromVirAddr(start + allocSize, sizeAfterAlloc));
+            after->next = next;
+            next = after;
+        }
+        if (!!padding) {
+            curr->size = padding;
+            curr->next = next;
+        } else {
+            *prevNext = next;
+        }
+        VirAddr const res(start);
+        if (m_zeroAllocs) {
+            Util::memzero(res.ptr<void>(), allocSize);
+        }
+        return res;
+    }
+    return Error::OutOfPhysicalMemory;
+}
+
 // Free memory that was allocated from this free-list, adds this memory back to
 // the free-list. The address passed as argument *must* have come from a call to
 // alloc().
@@ -255,6 +255,45 @@ SelfTests::TestResult embeddedFreeListAllocMinSizeTest() {
     return SelfTests::TestResult::Success;
 }
 
+SelfTests::TestResult embeddedFreeListAllocAlignedTest() {
+    alignas(256) u8 buf[512];
+    EmbeddedFreeList freeList;
+    VirAddr const bufAddr(buf);
+
+    // The free region is [16; 416) relative to the start of the buffer.
+    freeList.insert(bufAddr + 16, 400);
+
+    // Aligned allocations are carved out of the middle of the free region,
+    // leaving the padding before them in the free-list.
+    Res<VirAddr> const alloc1(freeList.allocAligned(64, 128));
+    TEST_ASSERT(!!alloc1);
+    TEST_ASSERT(*alloc1 == bufAddr + 128);
+    Res<VirAddr> const alloc2(freeList.allocAligned(64, 256));
+    TEST_ASSERT(!!alloc2);
+    TEST_ASSERT(*alloc2 == bufAddr + 256);
+
+    // The free-list should now contain [16; 128), [192; 256) and [320; 416).
+    EmbeddedFreeList::Node const * node(freeList.m_head);
+    TEST_ASSERT(!!node && node->base() == bufAddr + 16 && node->size == 112);
+    node = node->next;
+    TEST_ASSERT(!!node && node->base() == bufAddr + 192 && node->size == 64);
+    node = node->next;
+    TEST_ASSERT(!!node && node->base() == bufAddr + 320 && node->size == 96);
+    TEST_ASSERT(!node->next);
+
+    // No free region can hold an allocation aligned on 512 bytes.
+    TEST_ASSERT(!freeList.allocAligned(16, 512));
+
+    // Freeing the allocations merges the free-list back into a single node.
+    freeList.free(*alloc1, 64);
+    freeList.free(*alloc2, 64);
+    TEST_ASSERT(!!freeList.m_head);
+    TEST_ASSERT(freeList.m_head->base() == bufAddr + 16);
+    TEST_ASSERT(freeList.m_head->size == 400);
+    TEST_ASSERT(!freeList.m_head->next);
+    return SelfTests::TestResult::Success;
+}
+
 SelfTests::TestResult mapDefaultConstructionTest();
 SelfTests::TestResult mapInsertionLookupAndDestructorTestNoRehash();
 SelfTests::TestResult mapRehashTest();
@@ -279,6 +318,7 @@ void Test(SelfTests::TestRunner& runner) {
     RUN_TEST(runner, embeddedFreeListInsertTest);
     RUN_TEST(runner, embeddedFreeListAllocFreeTest);
     RUN_TEST(runner, embeddedFreeListAllocMinSizeTest);
+    RUN_TEST(runner, embeddedFreeListAllocAlignedTest);
 
     // Vector<T> tests.
     RUN_TEST(runner, vectorDefaultConstructionTest);
@@ -44,6 +44,21 @@ void EarlyAllocator::free(Frame const& frame) {
     PANIC("Attempted to free physical frame {}: not implemented", frame.addr());
 }
 
+// Allocate physically contiguous frames. This operation is not implemented by
+// this allocator and always returns an error.
+Res<Frame> EarlyAllocator::allocContiguous(u64 const, u64 const) {
+    // The EarlyAllocator is only used for a short period of time during boot,
+    // none of the allocations made during that time need contiguous frames.
+    return Error::OutOfPhysicalMemory;
+}
+
+// Free physically contiguous frames. This operation is not implemented by this
+// allocator and as such panics.
+void EarlyAllocator::freeContiguous(Frame const& frame, u64 const numFrames) {
+    PANIC("Attempted to free {} physical frames at {}: not implemented",
+          numFrames, frame.addr());
+}
+
 // Initialize an EmbeddedFreeListAllocator's free-list with this allocator's
 // free list. This is used as a "handover" situation when switching from the
 // EarlyAllocator to the EmbeddedFreeListAllocator once paging and the direct
@@ -74,7 +89,8 @@ void EarlyAllocator::initEmbeddedFreeListAllocator(
 
 // Create an empty EmbeddedFreeListAllocator. An EmbeddedFreeListAllocator is
 // meant to be constructed iteratively.
-EmbeddedFreeListAllocator::EmbeddedFreeListAllocator() : m_allowInsert(true) {}
+EmbeddedFreeListAllocator::EmbeddedFreeListAllocator() :
+    m_freeList(false), m_allowInsert(true) {}
 
 // Add a region of free frames to the allocator. Note: this will write the into
 // the frame starting at addr. This function can only be called before calling
@@ -107,4 +123,33 @@ void EmbeddedFreeListAllocator::free(Frame const& frame) {
     m_freeList.free(frame.addr().toVir(), PAGE_SIZE);
 }
 
+// Allocate physically contiguous frames.
+// @param numFrames: The number of frames to allocate.
+// @param alignment: The alignment of the physical address of the first frame,
+// in bytes. Must be a power of two and a multiple of PAGE_SIZE.
+// @return: The Frame object describing the first allocated frame. If the frames
+// cannot be allocated this function returns an error.
+Res<Frame> EmbeddedFreeListAllocator::allocContiguous(u64 const numFrames,
+                                                      u64 const alignment) {
+    ASSERT(!!numFrames);
+    ASSERT(!(alignment % PAGE_SIZE));
+    // The direct map starts on an address aligned on any reasonable alignment,
+    // hence aligning the virtual address aligns the physical address as well.
+    Res<VirAddr> const allocResult(
+        m_freeList.allocAligned(numFrames * PAGE_SIZE, alignment));
+    if (!allocResult) {
+        return allocResult.error();
+    } else {
+        return allocResult.value().raw() - Paging::DIRECT_MAP_START_VADDR;
+    }
+}
+
+// Free physically contiguous frames.
+// @param frame: The first frame of the contiguous frames.
+// @param numFrames: The number of frames to free.
+void EmbeddedFreeListAllocator::freeContiguous(Frame const& frame,
+                                               u64 const numFrames) {
+    m_freeList.free(frame.addr().toVir(), numFrames * PAGE_SIZE);
+}
+
 }
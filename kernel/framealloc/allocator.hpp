@@ -15,6 +15,20 @@ public:
     // Free a physical frame.
     // @param frame: The Frame describing the physical frame to be freed.
     virtual void free(Frame const& frame) = 0;
+
+    // Allocate physically contiguous frames.
+    // @param numFrames: The number of frames to allocate.
+    // @param alignment: The alignment of the physical address of the first
+    // frame, in bytes. Must be a power of two and a multiple of PAGE_SIZE.
+    // @return: The Frame object describing the first allocated frame. If the
+    // frames cannot be allocated this function returns an error.
+    virtual Res<Frame> allocContiguous(u64 const numFrames,
+                                       u64 const alignment) = 0;
+
+    // Free physically contiguous frames.
+    // @param frame: The first frame of the contiguous frames.
+    // @param numFrames: The number of frames to free.
+    virtual void freeContiguous(Frame const& frame, u64 const numFrames) = 0;
 };
 
 // Forward declaration needed by EarlyAllocator.
@@ -48,6 +62,15 @@ public:
     // allocator (see comment above class definition) and as such panics.
     virtual void free(Frame const& frame);
 
+    // Allocate physically contiguous frames. This operation is not implemented
+    // by this allocator and always returns an error.
+    virtual Res<Frame> allocContiguous(u64 const numFrames,
+                                       u64 const alignment);
+
+    // Free physically contiguous frames. This operation is not implemented by
+    // this allocator and as such panics.
+    virtual void freeContiguous(Frame const& frame, u64 const numFrames);
+
     // Initialize an EmbeddedFreeListAllocator's free-list with this allocator's
     // free list. This is used as a "handover" situation when switching from the
     // EarlyAllocator to the EmbeddedFreeListAllocator once paging and the
@@ -90,6 +113,20 @@ public:
     // allocator (see comment above class definition) and as such panics.
     virtual void free(Frame const& frame);
 
+    // Allocate physically contiguous frames.
+    // @param numFrames: The number of frames to allocate.
+    // @param alignment: The alignment of the physical address of the first
+    // frame, in bytes. Must be a power of two and a multiple of PAGE_SIZE.
+    // @return: The Frame object describing the first allocated frame. If the
+    // frames cannot be allocated this function returns an error.
+    virtual Res<Frame> allocContiguous(u64 const numFrames,
+                                       u64 const alignment);
+
+    // Free physically contiguous frames.
+    // @param frame: The first frame of the contiguous frames.
+    // @param numFrames: The number of frames to free.
+    virtual void freeContiguous(Frame const& frame, u64 const numFrames);
+
 private:
     // Free-list of physical page frames.
     DataStruct::EmbeddedFreeList m_freeList;
@@ -57,7 +57,8 @@ void directMapInitialized() {
 }
 
 // Allocate a physical frame using the global allocator. This function panics if
-// no frame can be allocated.
+// no frame can be allocated. The content of the frame is undefined, callers
+// needing a zeroed frame must zero it themselves.
 // @return: The Frame describing the allocated frame. If the allocation failed
 // return an error instead.
 Res<Frame> alloc() {
@@ -72,4 +73,23 @@ void free(Frame const& frame) {
     GLOBAL_ALLOCATOR->free(frame);
 }
 
+// Allocate physically contiguous frames using the global allocator.
+// @param numFrames: The number of frames to allocate.
+// @param alignment: The alignment of the physical address of the first frame,
+// in bytes. Must be a power of two and a multiple of PAGE_SIZE.
+// @return: The Frame describing the first allocated frame. If the allocation
+// failed return an error instead.
+Res<Frame> allocContiguous(u64 const numFrames, u64 const alignment) {
+    ASSERT(IsInitialized);
+    return GLOBAL_ALLOCATOR->allocContiguous(numFrames, alignment);
+}
+
+// Free physically contiguous frames allocated with allocContiguous().
+// @param frame: The first frame of the contiguous frames.
+// @param numFrames: The number of frames to free.
+void freeContiguous(Frame const& frame, u64 const numFrames) {
+    ASSERT(IsInitialized);
+    GLOBAL_ALLOCATOR->freeContiguous(frame, numFrames);
+}
+
 }
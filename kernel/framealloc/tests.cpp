@@ -116,9 +116,37 @@ SelfTests::TestResult embeddedFreeListAllocatorTest() {
     return SelfTests::TestResult::Success;
 }
 
+// Test allocating contiguous frames with the global allocator.
+SelfTests::TestResult contiguousAllocTest() {
+    // Allocate enough frames for a large page, aligned on the large page size.
+    u64 const numFrames(512);
+    u64 const alignment(numFrames * PAGE_SIZE);
+    Res<Frame> const allocRes(allocContiguous(numFrames, alignment));
+    TEST_ASSERT(!!allocRes);
+    PhyAddr const start(allocRes->addr());
+    TEST_ASSERT(!(start.raw() % alignment));
+    // The frames must be usable through the direct map.
+    u64 * const ptr(start.toVir().ptr<u64>());
+    for (u64 i(0); i < numFrames * PAGE_SIZE / sizeof(u64); ++i) {
+        ptr[i] = i;
+    }
+    for (u64 i(0); i < numFrames * PAGE_SIZE / sizeof(u64); ++i) {
+        TEST_ASSERT(ptr[i] == i);
+    }
+    freeContiguous(*allocRes, numFrames);
+
+    // Once freed, the same frames can be allocated again.
+    Res<Frame> const realloc(allocContiguous(numFrames, alignment));
+    TEST_ASSERT(!!realloc);
+    TEST_ASSERT(realloc->addr() == start);
+    freeContiguous(*realloc, numFrames);
+    return SelfTests::TestResult::Success;
+}
+
 // Run the frame allocation tests.
 void Test(SelfTests::TestRunner& runner) {
     RUN_TEST(runner, earlyAllocatorTest);
     RUN_TEST(runner, embeddedFreeListAllocatorTest);
+    RUN_TEST(runner, contiguousAllocTest);
 }
 }
@@ -0,0 +1,82 @@
+// Per-cpu state of the interrupt subsystem, accessed from interrupt handlers.
+#include <interrupts/cpulocal.hpp>
+#include <datastruct/vector.hpp>
+#include <util/ptr.hpp>
+#include <util/panic.hpp>
+#include <util/cstring.hpp>
+#include <cpu/cpu.hpp>
+
+namespace Interrupts {
+
+// The CpuLocal of the BSP until InitCpuLocal() allocates the state of all cpus.
+// Interrupts can be raised as soon as the IDT is loaded, long before the heap
+// allocator is available.
+static CpuLocal BootCpuLocal;
+
+// Has InitBootCpuLocal() been called already? From that point on, the GS base
+// of every cpu running kernel code points to a valid CpuLocal: APs point it to
+// their own state before anything else.
+static bool IsGsBaseValid = false;
+
+// Has InitCpuLocal() been called already?
+static bool IsInitialized = false;
+
+// The CpuLocal of each cpu, indexed by cpu id.
+static ::Vector<Ptr<CpuLocal>> AllCpuLocals;
+
+// Point the GS base of the BSP to a statically allocated CpuLocal. Must be
+// called before loading the IDT.
+void InitBootCpuLocal() {
+    BootCpuLocal.self = &BootCpuLocal;
+    BootCpuLocal.id = Smp::id();
+    Cpu::wrmsr(Cpu::Msr::IA32_GS_BASE, reinterpret_cast<u64>(&BootCpuLocal));
+    IsGsBaseValid = true;
+}
+
+// Allocate the per-cpu state of the interrupt subsystem for all cpus and point
+// the GS base of the BSP to its own state, carrying over the state accumulated
+// in the boot CpuLocal. Requires the heap allocator.
+void InitCpuLocal() {
+    ASSERT(IsGsBaseValid);
+    for (u64 i(0); i < Smp::ncpus(); ++i) {
+        Ptr<CpuLocal> const local(Ptr<CpuLocal>::New());
+        if (!local) {
+            PANIC("Cannot allocate the interrupt state of cpu {}", i);
+        }
+        Util::memzero(local.raw(), sizeof(CpuLocal));
+        local->self = local.raw();
+        local->id = Smp::Id(i);
+        AllCpuLocals.pushBack(local);
+    }
+    // Interrupt handlers must not modify the boot CpuLocal while it is copied.
+    bool const savedIf(Cpu::interruptsEnabled());
+    Cpu::disableInterrupts();
+    CpuLocal* const bspLocal(AllCpuLocals[Smp::id()].raw());
+    Util::memcpy(bspLocal, &BootCpuLocal, sizeof(CpuLocal));
+    bspLocal->self = bspLocal;
+    InitCurrCpuLocal();
+    IsInitialized = true;
+    Cpu::setInterruptFlag(savedIf);
+}
+
+// Point the GS base of the current cpu to its per-cpu interrupt state.
+void InitCurrCpuLocal() {
+    CpuLocal* const local(AllCpuLocals[Smp::id()].raw());
+    Cpu::wrmsr(Cpu::Msr::IA32_GS_BASE, reinterpret_cast<u64>(local));
+}
+
+// Check if the GS base of the cpus points to a CpuLocal, which is the case
+// once InitBootCpuLocal() has been called.
+// @return: true if cpuLocal() can be used.
+bool isCpuLocalInitialized() {
+    return IsGsBaseValid;
+}
+
+// Get the CpuLocal of a cpu.
+// @param cpu: The cpu.
+// @return: The CpuLocal of `cpu`.
+CpuLocal& cpuLocal(Smp::Id const cpu) {
+    ASSERT(IsInitialized);
+    return *AllCpuLocals[cpu];
+}
+}
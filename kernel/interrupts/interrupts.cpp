@@ -7,6 +7,13 @@
 #include <util/assert.hpp>
 #include "ioapic.hpp"
 #include <smp/smp.hpp>
+#include <interrupts/vectormap.hpp>
+#include <interrupts/stats.hpp>
+#include <interrupts/softirq.hpp>
+#include <interrupts/cpulocal.hpp>
+#include <concurrency/lock.hpp>
+#include <smp/percpu.hpp>
+#include <timers/hrtimer.hpp>
 
 namespace Interrupts {
 
@@ -18,86 +25,83 @@ Descriptor::Descriptor() : m_raw{0, 0, 0, 0} {}
 // @param targetOffset: Virtual address of the interrupt handler.
 // @param dpl: Privilege level of the descriptor.
 // @param type: The type of this descriptor.
+// @param ist: The Interrupt Stack Table index of the stack to switch to when
+// raising the interrupt.
 Descriptor::Descriptor(Cpu::SegmentSel const targetSel,
                        u64 const targetOffset,
                        Cpu::PrivLevel const dpl,
-                       Type const type) :
+                       Type const type,
+                       Memory::Segmentation::IstIndex const ist) :
     m_raw{
         (u32(targetSel.raw()) << 16) | u32(targetOffset & 0xffff),
-        u32(targetOffset & 0xffff0000)|(1<<15)|(u32(dpl)<<13)|(u32(type)<<8),
+        u32(targetOffset & 0xffff0000)|(1<<15)|(u32(dpl)<<13)|(u32(type)<<8)
+            | u32(ist),
         u32(targetOffset >> 32),
         0,
     } {}
 
-// Interrupt handlers for each vector are defined interruptsAsm.asm. Each
-// eventually call genericInterruptHandler defined further down this file.
-extern "C" void interruptHandler0();    extern "C" void interruptHandler1();
-extern "C" void interruptHandler2();    extern "C" void interruptHandler3();
-extern "C" void interruptHandler4();    extern "C" void interruptHandler5();
-extern "C" void interruptHandler6();    extern "C" void interruptHandler7();
-extern "C" void interruptHandler8();    extern "C" void interruptHandler10();
-extern "C" void interruptHandler11();   extern "C" void interruptHandler12();
-extern "C" void interruptHandler13();   extern "C" void interruptHandler14();
-extern "C" void interruptHandler16();   extern "C" void interruptHandler17();
-extern "C" void interruptHandler18();   extern "C" void interruptHandler19();
-extern "C" void interruptHandler21();   extern "C" void interruptHandler32();
-extern "C" void interruptHandler33();   extern "C" void interruptHandler34();
-extern "C" void interruptHandler35();
-
-// Create a Descriptor for the given vector. The descriptor points to the
-// interruptHandler<vector> function.
-// FIXME: Don't hardcode the code seg selector here.
-#define IDT_DESC(vector) \
-    Descriptor(Cpu::SegmentSel(1, Cpu::PrivLevel::Ring0), \
-               reinterpret_cast<u64>(interruptHandler ## vector), \
-               Cpu::PrivLevel::Ring0, \
-               Descriptor::Type::TrapGate)
-
-// The kernel-wide IDT.
-static const Descriptor IDT[] = {
-    IDT_DESC(0),
-    IDT_DESC(1),
-    IDT_DESC(2),
-    IDT_DESC(3),
-    IDT_DESC(4),
-    IDT_DESC(5),
-    IDT_DESC(6),
-    IDT_DESC(7),
-    IDT_DESC(8),
-    Descriptor(),
-    IDT_DESC(10),
-    IDT_DESC(11),
-    IDT_DESC(12),
-    IDT_DESC(13),
-    IDT_DESC(14),
-    Descriptor(),
-    IDT_DESC(16),
-    IDT_DESC(17),
-    IDT_DESC(18),
-    IDT_DESC(19),
-    Descriptor(),
-    IDT_DESC(21),
-    Descriptor(),
-    Descriptor(),
-    Descriptor(),
-    Descriptor(),
-    Descriptor(),
-    Descriptor(),
-    Descriptor(),
-    Descriptor(),
-    Descriptor(),
-    Descriptor(),
-    // Below are IDT entries for the user-defined vector starting at vector 32.
-    IDT_DESC(32),
-    IDT_DESC(33),
-    IDT_DESC(34),
-    IDT_DESC(35),
-    // FIXME: Use consts from vectorMap here. This might require making Vector
-    // and SubRange constexpr.
-};
+// The addresses of the interrupt handlers of each vector, defined in
+// interruptsAsm.asm. Each eventually call genericInterruptHandler defined
+// further down this file.
+extern "C" u64 const interruptHandlerTable[256];
+
+// The addresses of the fast interrupt handlers of each user-defined vector,
+// defined in interruptsAsm.asm. Each eventually call fastInterruptHandler
+// defined further down this file. Entries of non-user-defined vectors are 0.
+extern "C" u64 const fastInterruptHandlerTable[256];
+
+// Address of the LAPIC's EOI register, written by the fast interrupt entry path
+// from assembly. Needs C linkage. All cpus' LAPIC registers are at the same
+// address, hence a single global is enough. Set upon the first call to
+// registerFastHandler().
+extern "C" {
+    u32 volatile * FAST_INT_EOI_REGISTER = nullptr;
+}
+
+// The kernel-wide IDT, filled by Init().
+static Descriptor IDT[256];
 // The number of elements in the IDT.
 static u64 const IDT_SIZE = sizeof(IDT) / sizeof(*IDT);
 
+// Get the index in the Interrupt Stack Table of the stack used by a vector.
+// Exceptions that may be raised while the current stack is unusable, e.g. a
+// double fault caused by a stack overflow, run on their own IST stack. Those
+// vectors must not nest as a nested interrupt would re-use the same stack from
+// its top.
+// @param vector: The vector.
+// @return: The IST index of the vector, IstIndex::None if the vector does not
+// switch stack.
+static Memory::Segmentation::IstIndex istIndexForVector(Vector const vector) {
+    switch (vector.raw()) {
+        case 2: return Memory::Segmentation::IstIndex::Nmi;
+        case 8: return Memory::Segmentation::IstIndex::DoubleFault;
+        case 18: return Memory::Segmentation::IstIndex::MachineCheck;
+        default: return Memory::Segmentation::IstIndex::None;
+    }
+}
+
+// Point the IDT entry of a vector to an interrupt handler.
+// @param vector: The vector for which to set the IDT entry.
+// @param handlerAddr: The address of the entry point of the handler, as found
+// in interruptHandlerTable or fastInterruptHandlerTable.
+static void setIdtEntry(Vector const vector, u64 const handlerAddr) {
+    // FIXME: Don't hardcode the code seg selector here.
+    Cpu::SegmentSel const codeSel(1, Cpu::PrivLevel::Ring0);
+    Memory::Segmentation::IstIndex const ist(istIndexForVector(vector));
+    // Vectors running on an IST stack use interrupt gates so that no maskable
+    // interrupt can nest in their handler. The IRETQ of a nested interrupt
+    // would unblock NMIs, and the next NMI would restart at the top of the IST
+    // stack, overwriting the live frame.
+    Descriptor::Type const type(ist == Memory::Segmentation::IstIndex::None
+                                ? Descriptor::Type::TrapGate
+                                : Descriptor::Type::InterruptGate);
+    IDT[vector.raw()] = Descriptor(codeSel,
+                                   handlerAddr,
+                                   Cpu::PrivLevel::Ring0,
+                                   type,
+                                   ist);
+}
+
 // The default interrupt handler, raises a PANIC for the unhandled interrupt.
 // This handler is set for all arch interrupt vectors upon Init.
 void defaultHandler(Vector const vector, Frame const& frame) {
@@ -118,10 +122,143 @@ static void disablePic() {
 // Eventually, we may want to be able to have more.
 static InterruptHandler INT_HANDLERS[256] = {nullptr};
 
+// The mapping vector -> FastInterruptHandler for the vectors using the fast
+// entry path. A nullptr indicates that the vector uses the regular entry path.
+static FastInterruptHandler FAST_INT_HANDLERS[256] = {nullptr};
+
 // Has Init() been called already? Used to assert that cpus are not trying to
 // use the namespace before its initialization.
 static bool IsInitialized = false;
 
+// Bitmap of the allocated vectors, bit i of AllocatedVectors[j] indicates if
+// vector j * 64 + i is allocated.
+static u64 AllocatedVectors[256 / 64] = {0};
+// Protects AllocatedVectors.
+static Concurrency::SpinLock VectorAllocLock;
+
+// Check if a vector is allocated. Must be called with VectorAllocLock held.
+// @param vector: The vector to check.
+// @return: true if the vector is allocated, false otherwise.
+static bool isAllocated(u64 const vector) {
+    return AllocatedVectors[vector / 64] & (1ULL << (vector % 64));
+}
+
+// Mark a vector as allocated or free. Must be called with VectorAllocLock held.
+// @param vector: The vector to update.
+// @param allocated: The new state of the vector.
+static void setAllocated(u64 const vector, bool const allocated) {
+    if (allocated) {
+        AllocatedVectors[vector / 64] |= (1ULL << (vector % 64));
+    } else {
+        AllocatedVectors[vector / 64] &= ~(1ULL << (vector % 64));
+    }
+}
+
+// Initialize the vector allocator, marking the exception vectors and the
+// vectors statically assigned in VectorMap as allocated.
+static void initVectorAllocator() {
+    for (u64 v(0); v < 32; ++v) {
+        setAllocated(v, true);
+    }
+    setAllocated(VectorMap::PitVector.raw(), true);
+    setAllocated(VectorMap::LapicTimerVector.raw(), true);
+    setAllocated(VectorMap::TestVector.raw(), true);
+    setAllocated(VectorMap::RemoteCallVector.raw(), true);
+    setAllocated(VectorMap::SpuriousVector.raw(), true);
+}
+
+// Count the free vectors of a priority class. Must be called with
+// VectorAllocLock held.
+// @param priorityClass: The priority class.
+// @return: The number of free vectors in the class.
+static u64 numFreeVectors(PriorityClass const priorityClass) {
+    u64 const first(priorityClass.raw() << 4);
+    u64 res(0);
+    for (u64 v(first); v < first + 16; ++v) {
+        res += !isAllocated(v);
+    }
+    return res;
+}
+
+// Allocate the lowest free vector of a priority class. Must be called with
+// VectorAllocLock held.
+// @param priorityClass: The priority class of the vector.
+// @return: The allocated vector or an error if the class is full.
+static Res<Vector> doAllocateVector(PriorityClass const priorityClass) {
+    u64 const first(priorityClass.raw() << 4);
+    for (u64 v(first); v < first + 16; ++v) {
+        if (!isAllocated(v)) {
+            setAllocated(v, true);
+            return Vector(v);
+        }
+    }
+    return Error::OutOfInterruptVectors;
+}
+
+// The routing state of an IRQ.
+struct IrqRouting {
+    // Is the IRQ currently mapped to a vector?
+    bool isMapped;
+    // The vector the IRQ is mapped to. Only valid if isMapped is true.
+    Vector vector;
+    // The cpus allowed to handle the IRQ.
+    CpuMask affinity;
+    // Set if the balancer pinned the IRQ to a single cpu of its affinity.
+    bool isBalanced;
+    // The cpu the balancer pinned the IRQ to. Only valid if isBalanced is true.
+    Smp::Id balancedCpu;
+    // The total number of cycles spent in the handler of the IRQ's vector, on
+    // all cpus, as of the last balancing pass.
+    u64 lastTotalCycles;
+};
+
+// The routing state of each IRQ.
+static IrqRouting IRQ_ROUTING[Irq::Max + 1];
+
+// Protects IRQ_ROUTING and the redirection entries of the IRQs.
+static Concurrency::SpinLock IrqRoutingLock;
+
+// Period of the IRQ balancer, in nanoseconds.
+static constexpr u64 IRQ_BALANCER_PERIOD_NS = 100 * 1000 * 1000;
+
+// Serializes starting and cancelling IrqBalancerTimer, protects
+// IsIrqBalancerEnabled. Must be acquired before IrqRoutingLock.
+static Concurrency::SpinLock IrqBalancerLock;
+
+// Set by InitIrqBalancer().
+static bool IsIrqBalancerEnabled = false;
+
+// Set while IrqBalancerTimer is meant to be armed, that is while the balancer
+// is enabled and at least one IRQ has more than one cpu in its affinity.
+// Protected by IrqRoutingLock.
+static bool IsIrqBalancerRunning = false;
+
+// Number of passes run by the periodic IRQ balancer.
+static u64 volatile NumIrqBalancerPasses = 0;
+
+// Callback of IrqBalancerTimer. Runs a pass of the balancer and re-arms the
+// timer while IsIrqBalancerRunning is set.
+// @param timer: The timer.
+static void irqBalancerTimerCallback(Timer::HrTimer& timer);
+
+// Timer running the periodic IRQ balancer.
+static Timer::HrTimer IrqBalancerTimer(irqBalancerTimerCallback);
+
+// Initialize the routing state of all IRQs. IRQs are delivered to cpu 0 until
+// their affinity is changed.
+static void initIrqRouting() {
+    for (u64 i(0); i <= Irq::Max; ++i) {
+        IRQ_ROUTING[i] = {
+            .isMapped = false,
+            .vector = Vector(0),
+            .affinity = CpuMask(1),
+            .isBalanced = false,
+            .balancedCpu = Smp::Id(0),
+            .lastTotalCycles = 0,
+        };
+    }
+}
+
 // Initialize interrupts.
 void Init() {
     // Disable the legacy PIC, only use APIC.
@@ -134,6 +271,18 @@ void Init() {
         }
     }
 
+    // Fill the IDT, the entries of the reserved vectors are left non-present.
+    for (u64 i(0); i < IDT_SIZE; ++i) {
+        Vector const vector(i);
+        if (!vector.isReserved()) {
+            setIdtEntry(vector, interruptHandlerTable[i]);
+        }
+    }
+    initVectorAllocator();
+    initIrqRouting();
+
+    // Interrupt handlers access the CpuLocal through the GS base.
+    InitBootCpuLocal();
     InitCurrCpu();
     IsInitialized = true;
 }
@@ -177,12 +326,42 @@ Acpi::Gsi Irq::toGsi() const {
 // `vector` is raised.
 void registerHandler(Vector const vector, InterruptHandler const& handler) {
     ASSERT(IsInitialized);
-    if (vector >= IDT_SIZE) {
-        PANIC("IDT does not contain an entry for the target vector");
-    } else if (vector.isReserved()) {
+    if (vector.isReserved()) {
         PANIC("Cannot setup handler for a reserved vector");
     }
     INT_HANDLERS[vector.raw()] = handler;
+    if (!!FAST_INT_HANDLERS[vector.raw()]) {
+        // Switch back to the regular entry path.
+        setIdtEntry(vector, interruptHandlerTable[vector.raw()]);
+        FAST_INT_HANDLERS[vector.raw()] = nullptr;
+    }
+}
+
+// Register a fast interrupt handler for a user-defined vector. Interrupts of
+// this vector then use a lighter entry path which only saves the caller-saved
+// registers, sends the EOI inline and calls `handler` directly.
+// @param vector: The user-defined vector for which to register the handler.
+// @param handler: The function to be called everytime an interrupt with vector
+// `vector` is raised.
+void registerFastHandler(Vector const vector,
+                         FastInterruptHandler const handler) {
+    ASSERT(IsInitialized);
+    ASSERT(!!handler);
+    if (!vector.isUserDefined()) {
+        PANIC("Fast handlers are only supported for user-defined vectors");
+    }
+    // The fast entry path always sends an EOI, spurious interrupts must not be
+    // acknowledged.
+    ASSERT(vector != VectorMap::SpuriousVector);
+    if (!FAST_INT_EOI_REGISTER) {
+        FAST_INT_EOI_REGISTER =
+            lapic().endOfInterruptRegister().ptr<u32 volatile>();
+    }
+    // Set the handler before switching the entry path so that there is always
+    // a handler for the path in use.
+    FAST_INT_HANDLERS[vector.raw()] = handler;
+    setIdtEntry(vector, fastInterruptHandlerTable[vector.raw()]);
+    INT_HANDLERS[vector.raw()] = nullptr;
 }
 
 // Deregister the interrupt handler that was associated with the given vector.
@@ -192,6 +371,10 @@ void registerHandler(Vector const vector, InterruptHandler const& handler) {
 // @param vector: The vector for which to remove the handler.
 void deregisterHandler(Vector const vector) {
     ASSERT(IsInitialized);
+    if (!!FAST_INT_HANDLERS[vector.raw()]) {
+        setIdtEntry(vector, interruptHandlerTable[vector.raw()]);
+        FAST_INT_HANDLERS[vector.raw()] = nullptr;
+    }
     if (vector.isUserDefined()) {
         // For user-defined vector simply set the handler to nullptr. The
         // genericInterruptHandler knows to ignore such handlers.
@@ -203,27 +386,87 @@ void deregisterHandler(Vector const vector) {
     }
 }
 
-// Map an IRQ to a particular vector. This function takes care of configuring
-// the I/O APIC so that a vector `vector` is raised when the given IRQ is
-// asserted.
-// @param irq: The IRQ to map.
-// @param vector: The vector to map the IRQ to.
-void mapIrq(Irq const irq, Vector const vector) {
+// Get the interrupt handler currently registered for a vector.
+// @param vector: The vector for which to get the handler.
+// @return: The handler registered for `vector`, nullptr if no handler is
+// registered.
+InterruptHandler registeredHandler(Vector const vector) {
+    ASSERT(IsInitialized);
+    return INT_HANDLERS[vector.raw()];
+}
+
+// Allocate a free vector in the given priority class.
+// @param priorityClass: The priority class of the vector.
+// @return: The allocated vector or an error if all the vectors of the class
+// are already allocated.
+Res<Vector> allocateVector(PriorityClass const priorityClass) {
     ASSERT(IsInitialized);
+    Concurrency::LockGuard guard(VectorAllocLock);
+    return doAllocateVector(priorityClass);
+}
+
+// Allocate a free vector in the priority class with the most free vectors. In
+// case of a tie, the highest class is used.
+// @return: The allocated vector or an error if all vectors are allocated.
+Res<Vector> allocateVector() {
+    ASSERT(IsInitialized);
+    Concurrency::LockGuard guard(VectorAllocLock);
+    PriorityClass best(PriorityClass::Max);
+    u64 bestFree(0);
+    for (u64 c(PriorityClass::Max); c >= PriorityClass::Min; --c) {
+        u64 const numFree(numFreeVectors(PriorityClass(c)));
+        if (numFree > bestFree) {
+            best = PriorityClass(c);
+            bestFree = numFree;
+        }
+    }
+    if (!bestFree) {
+        return Error::OutOfInterruptVectors;
+    }
+    return doAllocateVector(best);
+}
+
+// Free a vector allocated with allocateVector().
+// @param vector: The vector to free.
+void freeVector(Vector const vector) {
+    ASSERT(IsInitialized);
+    ASSERT(vector.isUserDefined());
+    ASSERT(!INT_HANDLERS[vector.raw()]);
+    ASSERT(!FAST_INT_HANDLERS[vector.raw()]);
+    Concurrency::LockGuard guard(VectorAllocLock);
+    if (!isAllocated(vector.raw())) {
+        PANIC("Attempt to free vector {} which is not allocated", vector);
+    }
+    setAllocated(vector.raw(), false);
+}
+
+// Find the I/O APIC and its input pin an IRQ is connected to.
+// @param irq: The IRQ.
+// @param inputPin[out]: The input pin of the I/O APIC the IRQ is connected to.
+// @return: The I/O APIC the IRQ is connected to.
+static IoApic& ioApicForIrq(Irq const irq, IoApic::InputPin& inputPin) {
     Acpi::Gsi const gsi(irq.toGsi());
-    Log::debug("Mapping IRQ {} (GSI = {}) to Vector {}", irq, gsi, vector);
     Acpi::Info const& acpiInfo(Acpi::info());
-    Acpi::Info::IrqDesc const& irqDesc(acpiInfo.irqDesc[irq.raw()]);
     IoApic& ioApic(ioApicForGsi(gsi));
-    // Configure the redirection entry of the I/O APIC for the associated input
-    // pin.
     // FIXME: The IoApic::Id might not correspond to the index of this IoApic in
     // the IO_APICS array!
     Acpi::Gsi const gsiBase(acpiInfo.ioApicDesc[ioApic.id()].interruptBase);
     ASSERT(gsiBase < gsi);
+    inputPin = IoApic::InputPin(gsi.raw() - gsiBase.raw());
+    return ioApic;
+}
 
-    IoApic::InputPin const inputPin(gsi.raw() - gsiBase.raw());
-    IoApic::OutVector const outVector(vector.raw());
+// Write the redirection entry of a mapped IRQ according to its routing state.
+// Must be called with IrqRoutingLock held.
+// @param irq: The IRQ to program.
+static void programIrq(Irq const irq) {
+    IrqRouting const& routing(IRQ_ROUTING[irq.raw()]);
+    ASSERT(routing.isMapped);
+    Acpi::Info const& acpiInfo(Acpi::info());
+    Acpi::Info::IrqDesc const& irqDesc(acpiInfo.irqDesc[irq.raw()]);
+    IoApic::InputPin inputPin;
+    IoApic& ioApic(ioApicForIrq(irq, inputPin));
+    IoApic::OutVector const outVector(routing.vector.raw());
 
     // Convert the Acpi::Info::Polarity to IoApic::InputPinPolarity.
     IoApic::InputPinPolarity const polarity(
@@ -239,17 +482,46 @@ void mapIrq(Irq const irq, Vector const vector) {
             IoApic::TriggerMode::Edge :
             IoApic::TriggerMode::Level);
 
-    // FIXME: For now all interrupts are sent to CPU #0 in Fixed/Physical mode.
-    IoApic::Dest const destinationApic(0x0);
-
-    // Write the redirection entry.
+    // Pick the destination. Only the first 8 cpus have a logical destination,
+    // see lapic(), a mask with other cpus is delivered to its first cpu.
+    CpuMask const affinity(routing.affinity);
+    bool const isSingleCpu(!(affinity & (affinity - 1)));
+    IoApic::DeliveryMode deliveryMode(IoApic::DeliveryMode::Fixed);
+    IoApic::DestinationMode destMode(IoApic::DestinationMode::Physical);
+    IoApic::Dest dest;
+    if (routing.isBalanced) {
+        dest = routing.balancedCpu.raw();
+    } else if (!isSingleCpu && affinity < (1 << 8)) {
+        deliveryMode = IoApic::DeliveryMode::LowestPriority;
+        destMode = IoApic::DestinationMode::Logical;
+        dest = affinity;
+    } else {
+        dest = __builtin_ctzll(affinity);
+    }
     ioApic.redirectInterrupt(inputPin,
                              outVector,
-                             IoApic::DeliveryMode::Fixed,
-                             IoApic::DestinationMode::Physical,
+                             deliveryMode,
+                             destMode,
                              polarity,
                              triggerMode,
-                             destinationApic);
+                             dest);
+}
+
+// Map an IRQ to a particular vector. This function takes care of configuring
+// the I/O APIC so that a vector `vector` is raised when the given IRQ is
+// asserted. The IRQ is delivered according to its affinity.
+// @param irq: The IRQ to map.
+// @param vector: The vector to map the IRQ to.
+void mapIrq(Irq const irq, Vector const vector) {
+    ASSERT(IsInitialized);
+    Log::debug("Mapping IRQ {} (GSI = {}) to Vector {}", irq, irq.toGsi(),
+               vector);
+    Concurrency::LockGuard guard(IrqRoutingLock);
+    IrqRouting& routing(IRQ_ROUTING[irq.raw()]);
+    routing.isMapped = true;
+    routing.vector = vector;
+    routing.isBalanced = false;
+    programIrq(irq);
 }
 
 // Unmap an IRQ from whatever vector it was mapped to. This revert the
@@ -264,31 +536,213 @@ void unmapIrq(Irq const irq) {
 }
 
 // Mask a particular IRQ. This function configures the I/O APIC to ignore
-// subsequent interrupts for this IRQ.
+// subsequent interrupts for this IRQ. The IRQ is not mapped anymore, changing
+// its affinity or balancing does not unmask it.
 // @param irq: The IRQ to mask.
 void maskIrq(Irq const irq) {
     ASSERT(IsInitialized);
-    Acpi::Gsi const gsi(irq.toGsi());
-    Log::debug("Masking IRQ {} (GSI = {})", irq, gsi);
-    Acpi::Info const& acpiInfo(Acpi::info());
-    IoApic& ioApic(ioApicForGsi(gsi));
-    // Configure the redirection entry of the I/O APIC for the associated input
-    // pin.
-    // FIXME: The IoApic::Id might not correspond to the index of this IoApic in
-    // the IO_APICS array!
-    Acpi::Gsi const gsiBase(acpiInfo.ioApicDesc[ioApic.id()].interruptBase);
-    ASSERT(gsiBase < gsi);
-
-    IoApic::InputPin const inputPin(gsi.raw() - gsiBase.raw());
+    Log::debug("Masking IRQ {} (GSI = {})", irq, irq.toGsi());
+    Concurrency::LockGuard guard(IrqRoutingLock);
+    IRQ_ROUTING[irq.raw()].isMapped = false;
+    IoApic::InputPin inputPin;
+    IoApic& ioApic(ioApicForIrq(irq, inputPin));
     ioApic.setInterruptSourceMask(inputPin, true);
 }
 
-// Generic interrupt handler. _All_ interrupts are entering the C++ side of
-// the kernel through this function.
+// Check if at least one IRQ has more than one cpu in its affinity. Must be
+// called with IrqRoutingLock held.
+// @return: true if there is an IRQ for the balancer to balance, false
+// otherwise.
+static bool hasMultiCpuAffinity() {
+    for (u64 i(0); i <= Irq::Max; ++i) {
+        CpuMask const affinity(IRQ_ROUTING[i].affinity);
+        if (!!(affinity & (affinity - 1))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Start or stop the periodic IRQ balancer depending on the current affinities.
+// The timer is started on the current cpu. Must be called with IrqBalancerLock
+// held and without holding IrqRoutingLock, as cancelling the timer waits for
+// its callback.
+static void updateIrqBalancer() {
+    bool shouldRun;
+    {
+        Concurrency::LockGuard guard(IrqRoutingLock);
+        shouldRun = IsIrqBalancerEnabled && hasMultiCpuAffinity();
+        if (shouldRun == IsIrqBalancerRunning) {
+            return;
+        }
+        IsIrqBalancerRunning = shouldRun;
+    }
+    if (shouldRun) {
+        IrqBalancerTimer.startAfter(IRQ_BALANCER_PERIOD_NS);
+    } else {
+        IrqBalancerTimer.cancel();
+    }
+}
+
+// Set the cpus allowed to handle an IRQ.
+// @param irq: The IRQ.
+// @param affinity: The set of cpus allowed to handle the IRQ. Must not be
+// empty.
+void setIrqAffinity(Irq const irq, CpuMask const affinity) {
+    ASSERT(IsInitialized);
+    if (!affinity) {
+        PANIC("Cannot set an empty affinity for IRQ {}", irq);
+    }
+    Concurrency::LockGuard balancerGuard(IrqBalancerLock);
+    {
+        Concurrency::LockGuard guard(IrqRoutingLock);
+        IrqRouting& routing(IRQ_ROUTING[irq.raw()]);
+        routing.affinity = affinity;
+        routing.isBalanced = false;
+        if (routing.isMapped) {
+            programIrq(irq);
+        }
+    }
+    updateIrqBalancer();
+}
+
+// Get the cpus allowed to handle an IRQ.
+// @param irq: The IRQ.
+// @return: The mask set by the last call to setIrqAffinity() for this IRQ.
+CpuMask irqAffinity(Irq const irq) {
+    ASSERT(IsInitialized);
+    Concurrency::LockGuard guard(IrqRoutingLock);
+    return IRQ_ROUTING[irq.raw()].affinity;
+}
+
+// Get the online cpus of a CpuMask.
+// @param mask: The mask.
+// @return: The subset of `mask` containing the online cpus.
+static CpuMask onlineCpus(CpuMask const mask) {
+    CpuMask online(0);
+    u64 const numCpus(min<u64>(Smp::ncpus(), 64));
+    for (Smp::Id cpu(0); cpu < numCpus; ++cpu) {
+        if ((mask & (1ULL << cpu.raw())) && Smp::PerCpu::data(cpu).isOnline) {
+            online |= 1ULL << cpu.raw();
+        }
+    }
+    return online;
+}
+
+// Run a pass of the IRQ balancer. Must be called with IrqRoutingLock held.
+// @return: The number of IRQs that were moved to another cpu.
+static u64 doBalanceIrqs() {
+    // The load of each IRQ since the last pass and the load of each cpu. IRQs
+    // that cannot be balanced are accounted on the cpu they are delivered to.
+    u64 irqLoad[Irq::Max + 1] = {0};
+    u64 cpuLoad[64] = {0};
+    // The IRQs to balance, sorted by decreasing load below.
+    Irq toBalance[Irq::Max + 1];
+    u64 numToBalance(0);
+    for (Irq irq(0); irq <= Irq::Max; ++irq) {
+        IrqRouting& routing(IRQ_ROUTING[irq.raw()]);
+        if (!routing.isMapped) {
+            continue;
+        }
+        u64 totalCycles(0);
+        for (Smp::Id cpu(0); cpu < Smp::ncpus(); ++cpu) {
+            totalCycles += Stats::vectorStats(cpu, routing.vector).totalCycles;
+        }
+        irqLoad[irq.raw()] = totalCycles - routing.lastTotalCycles;
+        routing.lastTotalCycles = totalCycles;
+        CpuMask const online(onlineCpus(routing.affinity));
+        if (!!(online & (online - 1))) {
+            toBalance[numToBalance++] = irq;
+        } else {
+            // Account the load on the cpu the IRQ is delivered to.
+            u64 const cpu(routing.isBalanced ?
+                          routing.balancedCpu.raw() :
+                          __builtin_ctzll(routing.affinity));
+            cpuLoad[cpu] += irqLoad[irq.raw()];
+        }
+    }
+
+    // Insertion sort of the IRQs by decreasing load.
+    for (u64 i(1); i < numToBalance; ++i) {
+        Irq const irq(toBalance[i]);
+        u64 j(i);
+        for (; j > 0 && irqLoad[toBalance[j - 1].raw()] < irqLoad[irq.raw()];
+             --j) {
+            toBalance[j] = toBalance[j - 1];
+        }
+        toBalance[j] = irq;
+    }
+
+    // Greedily pin each IRQ on the least loaded cpu of its affinity.
+    u64 numMoved(0);
+    for (u64 i(0); i < numToBalance; ++i) {
+        Irq const irq(toBalance[i]);
+        IrqRouting& routing(IRQ_ROUTING[irq.raw()]);
+        CpuMask const online(onlineCpus(routing.affinity));
+        u64 best(__builtin_ctzll(online));
+        for (u64 cpu(best + 1); cpu < 64; ++cpu) {
+            if ((online & (1ULL << cpu)) && cpuLoad[cpu] < cpuLoad[best]) {
+                best = cpu;
+            }
+        }
+        cpuLoad[best] += irqLoad[irq.raw()];
+        if (routing.isBalanced && routing.balancedCpu == best) {
+            continue;
+        }
+        Log::debug("Balancing IRQ {} to cpu {}", irq, best);
+        routing.isBalanced = true;
+        routing.balancedCpu = Smp::Id(best);
+        programIrq(irq);
+        numMoved++;
+    }
+    return numMoved;
+}
+
+// Run a pass of the IRQ balancer.
+// @return: The number of IRQs that were moved to another cpu.
+u64 balanceIrqs() {
+    ASSERT(IsInitialized);
+    Concurrency::LockGuard guard(IrqRoutingLock);
+    return doBalanceIrqs();
+}
+
+// Callback of IrqBalancerTimer. Runs a pass of the balancer and re-arms the
+// timer while IsIrqBalancerRunning is set.
+// @param timer: The timer.
+static void irqBalancerTimerCallback(Timer::HrTimer& timer) {
+    // Checking IsIrqBalancerRunning and re-arming under the lock guarantees
+    // that the timer is not re-armed once updateIrqBalancer() cancelled it.
+    Concurrency::LockGuard guard(IrqRoutingLock);
+    if (!IsIrqBalancerRunning) {
+        return;
+    }
+    doBalanceIrqs();
+    NumIrqBalancerPasses = NumIrqBalancerPasses + 1;
+    timer.start(timer.deadline() + IRQ_BALANCER_PERIOD_NS);
+}
+
+// Enable the periodic IRQ balancer.
+void InitIrqBalancer() {
+    ASSERT(IsInitialized);
+    Concurrency::LockGuard balancerGuard(IrqBalancerLock);
+    IsIrqBalancerEnabled = true;
+    updateIrqBalancer();
+}
+
+// Get the number of passes run by the periodic IRQ balancer.
+// @return: The number of passes since boot.
+u64 irqBalancerPasses() {
+    return NumIrqBalancerPasses;
+}
+
+// Handle an interrupt coming from the regular entry path.
 // @param vector: The vector of the current interrupt.
-extern "C" void genericInterruptHandler(u8 const _vector,
-                                        Frame const * const frame) {
-    Vector const vector(_vector);
+// @param frame: The interrupt frame.
+static void handleInterrupt(Vector const vector, Frame const * const frame) {
+    if (vector == VectorMap::SpuriousVector) {
+        // Spurious interrupts must not be acknowledged.
+        return;
+    }
     if (vector.isUserDefined()) {
         // Since we are using Trap Gates to keep interrupts enabled in the
         // interrupt handlers, we are always ready to serve interrupts again,
@@ -317,4 +771,41 @@ extern "C" void genericInterruptHandler(u8 const _vector,
                   vector.raw());
     }
 }
+
+// Generic interrupt handler. _All_ interrupts using the regular entry path are
+// entering the C++ side of the kernel through this function.
+// @param vector: The vector of the current interrupt.
+// @param frame: The interrupt frame.
+extern "C" void genericInterruptHandler(u8 const _vector,
+                                        Frame const * const frame) {
+    Vector const vector(_vector);
+    u64 const start(Cpu::rdtsc());
+    handleInterrupt(vector, frame);
+    Stats::record(vector, Cpu::rdtsc() - start);
+    if (vector.isUserDefined()) {
+        // Exceptions can be raised while holding locks or with interrupts
+        // disabled, only run the deferred work on the exit of external
+        // interrupts.
+        Softirq::runPending();
+    }
+}
+
+// Entry point of the fast interrupt path in C++, called from
+// fastInterruptHandlerCommon after the EOI has been sent.
+// @param vector: The vector of the current interrupt.
+extern "C" void fastInterruptHandler(u8 const _vector) {
+    Vector const vector(_vector);
+    u64 const start(Cpu::rdtsc());
+    FastInterruptHandler const handler(FAST_INT_HANDLERS[vector.raw()]);
+    if (!!handler) {
+        handler(vector);
+    } else {
+        // The vector was switched back to the regular path while this
+        // interrupt was in flight and its handler has been deregistered.
+        Log::warn("Ignoring spurious interrupt #{} with no fast handler",
+                  vector.raw());
+    }
+    Stats::record(vector, Cpu::rdtsc() - start);
+    Softirq::runPending();
+}
 }
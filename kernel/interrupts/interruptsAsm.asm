@@ -45,31 +45,13 @@ BITS    64
     jmp     interruptHandlerCommon
 %endmacro
 
-; All interrupt handlers, one per vector.
-INT_HANDLER 0
-INT_HANDLER 1
-INT_HANDLER 2
-INT_HANDLER 3
-INT_HANDLER 4
-INT_HANDLER 5
-INT_HANDLER 6
-INT_HANDLER 7
-INT_HANDLER 8
-INT_HANDLER 10
-INT_HANDLER 11
-INT_HANDLER 12
-INT_HANDLER 13
-INT_HANDLER 14
-INT_HANDLER 16
-INT_HANDLER 17
-INT_HANDLER 18
-INT_HANDLER 19
-INT_HANDLER 21
-; User-defined vectors.
-INT_HANDLER 32
-INT_HANDLER 33
-INT_HANDLER 34
-INT_HANDLER 35
+; All interrupt handlers, one per vector. Handlers are generated for reserved
+; vectors as well, their IDT entries are simply marked as not present.
+%assign vector 0
+%rep 256
+INT_HANDLER %[vector]
+%assign vector vector + 1
+%endrep
 
 ; The common interrupt handler. All per-vector handlers are jumping to this
 ; routine after pushing the vector onto the stack.
@@ -137,3 +119,113 @@ interruptHandlerCommon:
     ; Return to the interrupted context.
     iretq
 
+;   Fast interrupt entry path:
+; ----------------------------
+; Latency-critical user-defined vectors, e.g. IPIs or timer ticks, can use a
+; lighter entry path, selected at runtime by rewriting their IDT entry to point
+; to their fastInterruptHandler<vector> stub instead. Handlers of those vectors
+; do not need an interrupt Frame, hence the fast path:
+;   * Only saves the caller-saved registers, the callee-saved registers are
+;   preserved by the C++ code anyway.
+;   * Sends the EOI to the LAPIC directly from assembly.
+;   * Calls fastInterruptHandler which dispatches to the handler of the vector.
+; User-defined vectors never push an error code, upon jumping to the fast
+; common handler the stack looks like this:
+;   |   Return SS   | +0x28
+;   |   Return RSP  | +0x20
+;   | Return RFLAGS | +0x18
+;   |   Return CS   | +0x10
+;   |   Return RIP  | +0x08
+;   |    Vector     | <- RSP
+
+; Define a fast interrupt handler for the given user-defined vector. The handler
+; is named "fastInterruptHandler<vector>", it pushes the vector number and jumps
+; to fastInterruptHandlerCommon.
+%macro FAST_INT_HANDLER 1
+%if (%1 < 32) || (255 < %1)
+    %error "Vector number is not between 32 and 255"
+%endif
+    GLOBAL  %tok(%strcat("fastInterruptHandler", %1)):function
+    %tok(%strcat("fastInterruptHandler", %1)):
+    push    %1
+    jmp     fastInterruptHandlerCommon
+%endmacro
+
+; All fast interrupt handlers, one per user-defined vector.
+%assign vector 32
+%rep 224
+FAST_INT_HANDLER %[vector]
+%assign vector vector + 1
+%endrep
+
+; The common fast interrupt handler. All fastInterruptHandler<vector> are
+; jumping to this routine after pushing the vector onto the stack.
+fastInterruptHandlerCommon:
+    ; Save the caller-saved registers onto the stack.
+    push    rax
+    push    rcx
+    push    rdx
+    push    rdi
+    push    rsi
+    push    r8
+    push    r9
+    push    r10
+    push    r11
+
+    ; Interrupts are enabled in the handlers (Trap Gates), hence ack the
+    ; interrupt right away, as done by genericInterruptHandler. This is a write
+    ; of 0 to the EOI register of the LAPIC.
+    EXTERN  FAST_INT_EOI_REGISTER
+    mov     rax, [FAST_INT_EOI_REGISTER]
+    mov     DWORD [rax], 0x0
+
+    ; Pass the vector number to fastInterruptHandler. The RSP was 16-bytes
+    ; aligned before the CPU pushed the interrupt frame, after the 5 quadwords
+    ; of the frame, the vector and the 9 registers it is 8 bytes off.
+    EXTERN  fastInterruptHandler
+    mov     rdi, [rsp + 9 * 0x8]
+    sub     rsp, 0x8
+    call    fastInterruptHandler
+    add     rsp, 0x8
+
+    ; Restore the registers of the interrupted context.
+    pop     r11
+    pop     r10
+    pop     r9
+    pop     r8
+    pop     rsi
+    pop     rdi
+    pop     rdx
+    pop     rcx
+    pop     rax
+
+    ; Pop the vector from the stack.
+    add     rsp, 0x8
+
+    ; Return to the interrupted context.
+    iretq
+
+SECTION .rodata
+
+; Table of the addresses of the interrupt handlers, indexed by vector. Used to
+; build the IDT.
+; extern "C" u64 const interruptHandlerTable[256];
+GLOBAL  interruptHandlerTable:data
+interruptHandlerTable:
+%assign vector 0
+%rep 256
+    dq  interruptHandler%[vector]
+%assign vector vector + 1
+%endrep
+
+; Table of the addresses of the fast interrupt handlers, indexed by vector.
+; Entries for the non-user-defined vectors are 0.
+; extern "C" u64 const fastInterruptHandlerTable[256];
+GLOBAL  fastInterruptHandlerTable:data
+fastInterruptHandlerTable:
+    times 32 dq 0
+%assign vector 32
+%rep 224
+    dq  fastInterruptHandler%[vector]
+%assign vector vector + 1
+%endrep
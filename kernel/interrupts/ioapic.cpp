@@ -11,12 +11,12 @@ namespace Interrupts {
 // Create an interface for an I/O APIC located at the given physical address.
 // @param base: The base physical addres of this I/O APIC.
 IoApic::IoApic(PhyAddr const base) : m_base(base) {
-    // Change the mapping in the page table to be uncachable and writethrough.
+    // Change the mapping in the page table to be strong uncacheable.
     ASSERT(base.isPageAligned());
     VirAddr const vaddr(base.toVir());
     Paging::PageAttr const attr(Paging::PageAttr::Writable
-                                | Paging::PageAttr::WriteThrough
-                                | Paging::PageAttr::CacheDisable);
+                                | Paging::PageAttr::Uncacheable
+                                | Paging::PageAttr::Global);
     Err const err(Paging::map(vaddr, base, attr, 1));
     if (err) {
         PANIC("Failed to map I/O APIC @{}: {}", base, err.error());
@@ -24,6 +24,7 @@ IoApic::IoApic(PhyAddr const base) : m_base(base) {
 
     m_ioRegSel = vaddr.ptr<Register volatile>();
     m_ioWin = (vaddr + 0x10).ptr<u32 volatile>();
+    syncRedirectionTable();
 
     // The default value of each entry should already be masked, but it does not
     // hurt to be too careful here.
@@ -233,35 +234,51 @@ IoApic::Register IoApic::redirectionTableEntryRegHigh(u8 const entryIndex) {
     return static_cast<Register>(static_cast<u8>(lowReg) + 1);
 }
 
-// Read an entry from the redirection table.
+// Read an entry from the redirection table. The entry is read from the shadow
+// copy, not from the I/O APIC.
 // @param entryIndex: The index of the entry to read.
 // @return: A RedirectionTableEntry describing the current entry's
 // configuration.
 IoApic::RedirectionTableEntry IoApic::readRedirectionTable(
     u8 const entryIndex) const {
-    ASSERT(entryIndex < numInterruptSources());
-    u64 const lowDword(readRegister(redirectionTableEntryRegLow(entryIndex)));
-    u64 const highDword(readRegister(redirectionTableEntryRegHigh(entryIndex)));
-    return (highDword << 32) | lowDword;
+    ASSERT(entryIndex < m_numRedirectionEntries);
+    return m_redirectionTable[entryIndex];
 }
 
-// Write an entry into the redirection table.
+// Write an entry into the redirection table. Only the DWORDs of the entry that
+// differ from the shadow copy are written.
 // @param entryIndex: The index of the entry to write.
 // @param value: The value the entry should be set to.
 void IoApic::writeRedirectionTable(u8 const entryIndex,
                                    RedirectionTableEntry const entry) {
-    ASSERT(entryIndex < numInterruptSources());
+    ASSERT(entryIndex < m_numRedirectionEntries);
     // Writing into a 64-bit register MUST to be done by first writing the low
     // DWORD followed by the high DWORD.
     // Also avoid overwritting reserved bits.
     u64 const entryRaw(entry.raw());
     Register const regLow(redirectionTableEntryRegLow(entryIndex));
     Register const regHigh(redirectionTableEntryRegHigh(entryIndex));
-    u64 const currRaw(u64(readRegister(regHigh)) << 32 | readRegister(regLow));
+    u64 const currRaw(m_redirectionTable[entryIndex]);
     u64 const newRaw((entryRaw & ~RedirectionTableEntryReservedBits)
                      | (currRaw & RedirectionTableEntryReservedBits));
-    writeRegister(regLow, newRaw & 0xffffffff);
-    writeRegister(regHigh, newRaw >> 32);
+    if ((newRaw & 0xffffffff) != (currRaw & 0xffffffff)) {
+        writeRegister(regLow, newRaw & 0xffffffff);
+    }
+    if ((newRaw >> 32) != (currRaw >> 32)) {
+        writeRegister(regHigh, newRaw >> 32);
+    }
+    m_redirectionTable[entryIndex] = newRaw;
+}
+
+// Re-read the entire redirection table from the I/O APIC into the shadow copy.
+void IoApic::syncRedirectionTable() {
+    m_numRedirectionEntries =
+        min<u64>(numInterruptSources(), InputPin::Max + 1);
+    for (u8 i(0); i < m_numRedirectionEntries; ++i) {
+        u64 const low(readRegister(redirectionTableEntryRegLow(i)));
+        u64 const high(readRegister(redirectionTableEntryRegHigh(i)));
+        m_redirectionTable[i] = (high << 32) | low;
+    }
 }
 
 // Has Init() been called already? Used to assert that cpus are not trying to
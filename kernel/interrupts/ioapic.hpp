@@ -163,6 +163,7 @@ public:
         ioApicWriteRedirectionTableEntryReservedBitTest();
     friend SelfTests::TestResult ioApicMaskInterruptSourceTest();
     friend SelfTests::TestResult ioApicRedirectInterruptTest();
+    friend SelfTests::TestResult ioApicShadowRedirectionTableTest();
 
 protected:
     // The base physical address of this I/O APIC.
@@ -253,18 +254,31 @@ protected:
     // Mask for the reserved bits in a Redirection Table entry.
     static u64 const RedirectionTableEntryReservedBits = 0x00fffffffffe5000ULL;
 
-    // Read an entry from the redirection table.
+    // Read an entry from the redirection table. The entry is read from the
+    // shadow copy, not from the I/O APIC.
     // @param entryIndex: The index of the entry to read.
     // @return: A RedirectionTableEntry describing the current entry's
     // configuration.
     RedirectionTableEntry readRedirectionTable(u8 const entryIndex) const;
 
-    // Write an entry into the redirection table.
+    // Write an entry into the redirection table. Only the DWORDs of the entry
+    // that differ from the shadow copy are written.
     // @param entryIndex: The index of the entry to write.
     // @param value: The value the entry should be set to.
     void writeRedirectionTable(u8 const entryIndex,
                                RedirectionTableEntry const entry);
 
+    // Re-read the entire redirection table from the I/O APIC into the shadow
+    // copy. Called upon construction.
+    void syncRedirectionTable();
+
+    // Shadow copy of the redirection table, including the reserved bits.
+    // Entries are read from the shadow copy, which avoids slow MMIO reads when
+    // updating an entry.
+    u64 m_redirectionTable[InputPin::Max + 1];
+    // Number of valid entries in m_redirectionTable.
+    u8 m_numRedirectionEntries;
+
     // The IOREGSEL register used to access the I/O APIC's registers.
     Register volatile * m_ioRegSel;
     // The IOWIN register used to read and write from the I/O APIC register
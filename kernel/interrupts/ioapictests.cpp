@@ -105,6 +105,10 @@ public:
         registers[static_cast<u8>(IoApic::Register::IOAPICID)] = 0x0;
         registers[static_cast<u8>(IoApic::Register::IOAPICVER)] = 0x00170011;
         registers[static_cast<u8>(IoApic::Register::IOAPICARB)] = 0x0;
+        // The IoApic constructor read the redirection table from the frame,
+        // not from the mocked registers.
+        syncRedirectionTable();
+        numReads = 0;
     }
 
     ~MockIoApic() {
@@ -122,10 +126,17 @@ public:
     // before that.
     Register lastTwoWrites[2];
 
+    // Number of calls to readRegister().
+    mutable u64 numReads;
+
+    // Number of calls to writeRegister().
+    u64 numWrites = 0;
+
     // Read an I/O APIC register.
     // @param src: The register to read.
     // @return: The current value of the register `src`.
     virtual u32 readRegister(Register const src) const {
+        numReads++;
         return registers[static_cast<u8>(src)];
     }
 
@@ -137,6 +148,7 @@ public:
     virtual void writeRegister(Register const dest, u32 const value) {
         lastTwoWrites[1] = lastTwoWrites[0];
         lastTwoWrites[0] = dest;
+        numWrites++;
         registers[static_cast<u8>(dest)] = value;
     }
 };
@@ -219,6 +231,7 @@ SelfTests::TestResult ioApicWriteRedirectionTableEntryReservedBitTest() {
     // Set the all the entry's bits to 1 (including the reserved bits).
     ioApic.registers[lowDwordReg] = u32(~0ULL);
     ioApic.registers[highDwordReg] = u32(~0ULL);
+    ioApic.syncRedirectionTable();
 
     // Write a random redirection table entry.
     IoApic::RedirectionTableEntry const entry(
@@ -294,6 +307,44 @@ SelfTests::TestResult ioApicRedirectInterruptTest() {
     return SelfTests::TestResult::Success;
 }
 
+// Check that the redirection table is read from the shadow copy and that only
+// the DWORDs that changed are written.
+SelfTests::TestResult ioApicShadowRedirectionTableTest() {
+    MockIoApic ioApic;
+    IoApic::InputPin const inputPin(3);
+    IoApic::Register const lowDwordReg(static_cast<IoApic::Register>(
+        static_cast<u8>(IoApic::Register::IOREDTBL_BASE) + inputPin.raw() * 2));
+
+    ioApic.redirectInterrupt(inputPin,
+                             IoApic::OutVector(17),
+                             IoApic::DeliveryMode::Fixed,
+                             IoApic::DestinationMode::Physical,
+                             IoApic::InputPinPolarity::ActiveHigh,
+                             IoApic::TriggerMode::Edge,
+                             0x2);
+    TEST_ASSERT(ioApic.numWrites == 2);
+
+    // Masking and unmasking only write the low DWORD and never read.
+    u64 const numReadsBefore(ioApic.numReads);
+    ioApic.setInterruptSourceMask(inputPin, true);
+    TEST_ASSERT(ioApic.numWrites == 3);
+    TEST_ASSERT(ioApic.lastTwoWrites[0] == lowDwordReg);
+    ioApic.setInterruptSourceMask(inputPin, true);
+    TEST_ASSERT(ioApic.numWrites == 3);
+    ioApic.setInterruptSourceMask(inputPin, false);
+    TEST_ASSERT(ioApic.numWrites == 4);
+    TEST_ASSERT(ioApic.lastTwoWrites[0] == lowDwordReg);
+    TEST_ASSERT(ioApic.numReads == numReadsBefore);
+
+    // Reads are served by the shadow copy.
+    ioApic.registers[static_cast<u8>(lowDwordReg)] = 0;
+    u8 const entryIndex(inputPin.raw());
+    TEST_ASSERT((ioApic.readRedirectionTable(entryIndex).raw() & 0xff) == 17);
+    ioApic.syncRedirectionTable();
+    TEST_ASSERT(!(ioApic.readRedirectionTable(entryIndex).raw() & 0xff));
+    return SelfTests::TestResult::Success;
+}
+
 void IoApic::Test(SelfTests::TestRunner& runner) {
     RUN_TEST(runner, ioApicRedirectionTableEntryTest);
     RUN_TEST(runner, ioApicReadRegisterTest);
@@ -301,5 +352,6 @@ void IoApic::Test(SelfTests::TestRunner& runner) {
     RUN_TEST(runner, ioApicWriteRedirectionTableEntryReservedBitTest);
     RUN_TEST(runner, ioApicMaskInterruptSourceTest);
     RUN_TEST(runner, ioApicRedirectInterruptTest);
+    RUN_TEST(runner, ioApicShadowRedirectionTableTest);
 }
 }
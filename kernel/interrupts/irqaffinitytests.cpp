@@ -0,0 +1,136 @@
+// Tests for the IRQ affinity and the IRQ balancer.
+#include <interrupts/interrupts.hpp>
+#include <timers/pit.hpp>
+#include <timers/tsc.hpp>
+#include <smp/smp.hpp>
+#include <selftests/macros.hpp>
+
+namespace Interrupts {
+
+// Number of PIT ticks received by each cpu during the current test.
+static u64 volatile TicksPerCpu[64];
+
+// Handler for the PIT interrupts, accounts the tick on the current cpu.
+// @param vector: Unused.
+// @param frame: Unused.
+static void pitTickHandler(Vector const, Frame const&) {
+    TicksPerCpu[Smp::id().raw()] = TicksPerCpu[Smp::id().raw()] + 1;
+}
+
+// Reset the PIT tick counters of all cpus.
+static void resetTicks() {
+    for (u64 i(0); i < 64; ++i) {
+        TicksPerCpu[i] = 0;
+    }
+}
+
+// Compute the total number of PIT ticks received by all cpus.
+// @return: The sum of TicksPerCpu.
+static u64 totalTicks() {
+    u64 total(0);
+    for (u64 i(0); i < 64; ++i) {
+        total += TicksPerCpu[i];
+    }
+    return total;
+}
+
+// Compute the set of cpus which received at least one PIT tick.
+// @return: The CpuMask of cpus with non-zero TicksPerCpu.
+static CpuMask cpusWithTicks() {
+    CpuMask mask(0);
+    for (u64 i(0); i < 64; ++i) {
+        if (!!TicksPerCpu[i]) {
+            mask |= 1ULL << i;
+        }
+    }
+    return mask;
+}
+
+// Check that the PIT IRQ is only delivered to the cpus of its affinity, for
+// both single-cpu and multi-cpu affinities.
+SelfTests::TestResult irqAffinityTest() {
+    if (Smp::ncpus() < 3) {
+        Log::warn("Not enough cpus to run this test, skipping");
+        return SelfTests::TestResult::Skip;
+    }
+    Res<Vector> const vector(allocateVector());
+    TEST_ASSERT(!!vector);
+    registerHandler(*vector, pitTickHandler);
+    Timer::Pit::setFrequency(Timer::Freq(100));
+
+    CpuMask const affinities[] = {
+        CpuMask(1 << 1),
+        CpuMask(1 << 2),
+        CpuMask((1 << 1) | (1 << 2)),
+    };
+    for (CpuMask const affinity : affinities) {
+        resetTicks();
+        setIrqAffinity(Timer::Pit::Irq, affinity);
+        TEST_ASSERT(irqAffinity(Timer::Pit::Irq) == affinity);
+        Timer::Pit::mapToVector(*vector);
+        TEST_WAIT_FOR(totalTicks() >= 10, 1000);
+        Timer::Pit::disable();
+        TEST_ASSERT(!(cpusWithTicks() & ~affinity));
+    }
+
+    setIrqAffinity(Timer::Pit::Irq, CpuMask(1));
+    deregisterHandler(*vector);
+    freeVector(*vector);
+    return SelfTests::TestResult::Success;
+}
+
+// Check that the periodic balancer pins an IRQ with a multi-cpu affinity to a
+// single cpu of its affinity and does not move it again while the load does not
+// change.
+SelfTests::TestResult irqBalancerTest() {
+    if (Smp::ncpus() < 3) {
+        Log::warn("Not enough cpus to run this test, skipping");
+        return SelfTests::TestResult::Skip;
+    }
+    Res<Vector> const vector(allocateVector());
+    TEST_ASSERT(!!vector);
+    registerHandler(*vector, pitTickHandler);
+    Timer::Pit::setFrequency(Timer::Freq(100));
+
+    CpuMask const affinity((1 << 1) | (1 << 2));
+    setIrqAffinity(Timer::Pit::Irq, affinity);
+    Timer::Pit::mapToVector(*vector);
+    resetTicks();
+    TEST_WAIT_FOR(totalTicks() >= 10, 1000);
+
+    // The PIT is the only IRQ with a multi-cpu affinity, the periodic balancer
+    // started by setIrqAffinity() pins it to the first cpu of its affinity
+    // since no other IRQ is running there.
+    u64 const passes(irqBalancerPasses());
+    TEST_WAIT_FOR(irqBalancerPasses() > passes, 1000);
+    TEST_ASSERT(irqAffinity(Timer::Pit::Irq) == affinity);
+    resetTicks();
+    TEST_WAIT_FOR(totalTicks() >= 10, 1000);
+    TEST_ASSERT(cpusWithTicks() == CpuMask(1 << 1));
+    TEST_ASSERT(balanceIrqs() == 0);
+
+    // Changing the affinity stops the balancing.
+    setIrqAffinity(Timer::Pit::Irq, CpuMask(1 << 2));
+    resetTicks();
+    TEST_WAIT_FOR(totalTicks() >= 10, 1000);
+    TEST_ASSERT(cpusWithTicks() == CpuMask(1 << 2));
+    TEST_ASSERT(balanceIrqs() == 0);
+
+    // No IRQ has a multi-cpu affinity anymore, the periodic balancer stopped.
+    u64 const stoppedPasses(irqBalancerPasses());
+    Timer::Tsc::delay(Timer::Duration::MilliSecs(300));
+    TEST_ASSERT(irqBalancerPasses() == stoppedPasses);
+
+    Timer::Pit::disable();
+    setIrqAffinity(Timer::Pit::Irq, CpuMask(1));
+    deregisterHandler(*vector);
+    freeVector(*vector);
+    return SelfTests::TestResult::Success;
+}
+
+// Run the IRQ affinity tests.
+void IrqAffinityTest(SelfTests::TestRunner& runner) {
+    RUN_TEST(runner, irqAffinityTest);
+    RUN_TEST(runner, irqBalancerTest);
+}
+}
@@ -1,6 +1,7 @@
 // Functions and types related to the local Advanced Programmable Interrupt
 // Controller (LAPIC).
 #include <interrupts/lapic.hpp>
+#include <interrupts/cpulocal.hpp>
 #include <util/assert.hpp>
 #include <util/panic.hpp>
 #include <paging/paging.hpp>
@@ -20,10 +21,10 @@ Lapic::Lapic(PhyAddr const base) : m_base(base) {
     }
 
     // Remap the virtual address in the Direct Map, associated with the base
-    // with CacheDisable and WriteThrough attributes.
+    // with the strong uncacheable memory type.
     Paging::PageAttr const attrs(Paging::PageAttr::Writable
-                                 | Paging::PageAttr::CacheDisable
-                                 | Paging::PageAttr::WriteThrough);
+                                 | Paging::PageAttr::Uncacheable
+                                 | Paging::PageAttr::Global);
     VirAddr const vaddr(base.toVir());
     if (Paging::map(vaddr, base, attrs, 1)) {
         PANIC("Could not map local APIC to virtual memory");
@@ -108,6 +109,14 @@ void Lapic::endOfInterrupt() {
     writeRegister(Register::EndOfInterrupt, 0, WriteMask::EndOfInterrupt);
 }
 
+// Get the address of the End Of Interrupt register in the direct map. An EOI is
+// signaled by writing 0 to this address. Used by the fast interrupt entry path
+// which sends the EOI from assembly.
+// @return: The virtual address of the EOI register.
+VirAddr Lapic::endOfInterruptRegister() const {
+    return m_base.toVir() + static_cast<u16>(Register::EndOfInterrupt);
+}
+
 // Get the value from a read to a remote APIC. Only valid after issuing a
 // remote read request using the Interrupt Command Register and if the
 // readRemoteStatus of the ICR is set to DataAvailable.
@@ -336,7 +345,7 @@ Lapic::Lvt Lapic::timerLvt() const {
         .remoteIRR = !!bits(raw, 14, 14),
         .triggerMode = static_cast<TriggerMode>(bits(raw, 15, 15)),
         .mask = !!bits(raw, 16, 16),
-        .timerMode = static_cast<Lvt::TimerMode>(bits(raw, 17, 17)),
+        .timerMode = static_cast<Lvt::TimerMode>(bits(raw, 18, 17)),
     });
     return lvt;
 }
@@ -519,6 +528,11 @@ void InitLapic() {
 // @return: Reference to the local APIC of this cpu.
 Lapic& lapic() {
     ASSERT(IsInitialized);
+    // Avoid Smp::id() which executes CPUID, this is called from the interrupt
+    // handlers.
+    if (isCpuLocalInitialized() && !!cpuLocal().lapic) {
+        return *cpuLocal().lapic;
+    }
     Smp::Id const id(Smp::id());
 	if (!LocalApics[id]) {
         Log::info("Initializing local APIC on cpu {}", id);
@@ -530,8 +544,19 @@ Lapic& lapic() {
         ASSERT(localApicBase.isPageAligned());
 
         LocalApics[id] = Ptr<Lapic>::New(localApicBase);
+        // Use the flat logical destination model, each of the first 8 cpus
+        // gets its own bit in the logical destination. This allows the I/O
+        // APIC to target a set of cpus, e.g. for LowestPriority delivery.
+        Lapic::Id const apicId(LocalApics[id]->apicId());
+        if (apicId < 8) {
+            LocalApics[id]->setDestinationFormat(Lapic::DestFmtModel::Flat);
+            LocalApics[id]->setLogicalDestination(1 << apicId);
+        }
         Log::info("Local APIC initialization on cpu {} done", id);
     }
+    if (isCpuLocalInitialized()) {
+        cpuLocal().lapic = LocalApics[id].raw();
+    }
     return *LocalApics[id];
 }
 }
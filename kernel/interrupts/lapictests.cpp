@@ -47,6 +47,7 @@ SelfTests::TestResult lapicConstantsTest() {
 
     CHECK(u8, Lvt::TimerMode::OneShot,      0);
     CHECK(u8, Lvt::TimerMode::Periodic,     1);
+    CHECK(u8, Lvt::TimerMode::TscDeadline,  2);
 
     CHECK(u8, TimerDivideConfiguration::DivideBy2  , 0b0000);
     CHECK(u8, TimerDivideConfiguration::DivideBy4  , 0b0001);
@@ -91,7 +92,7 @@ SelfTests::TestResult lapicConstantsTest() {
     CHECK(u32, WriteMask::ErrorStatus                            , 0xec);
     CHECK(u32, WriteMask::InterruptCommandHigh                   , 0xff000000);
     CHECK(u32, WriteMask::InterruptCommandLow                    , 0xccfff);
-    CHECK(u32, WriteMask::TimerLocalVectorTableEntry             , 0x300ff);
+    CHECK(u32, WriteMask::TimerLocalVectorTableEntry             , 0x700ff);
     CHECK(u32, WriteMask::ThermalLocalVectorTableEntry           , 0x107ff);
     CHECK(u32, WriteMask::PerformanceCounterLocalVectorTableEntry, 0x107ff);
     CHECK(u32, WriteMask::LocalInterrupt0VectorTableEntry        , 0x187ff);
@@ -245,6 +246,7 @@ SelfTests::TestResult lapicRawValuesTest() {
     Lapic::Lvt::TimerMode const timerMode[] = {
         Lapic::Lvt::TimerMode::OneShot,
         Lapic::Lvt::TimerMode::Periodic,
+        Lapic::Lvt::TimerMode::TscDeadline,
     };
 
     for (auto const msgType : messageTypeLvt) {
@@ -529,6 +531,7 @@ SelfTests::TestResult lapicReadTest() {
     Lapic::Lvt::TimerMode const timerMode[] = {
         Lapic::Lvt::TimerMode::OneShot,
         Lapic::Lvt::TimerMode::Periodic,
+        Lapic::Lvt::TimerMode::TscDeadline,
     };
 
     for (auto const delStat : deliveryStatus) {
@@ -777,6 +780,7 @@ SelfTests::TestResult lapicWriteTest() {
     Lapic::Lvt::TimerMode const timerMode[] = {
         Lapic::Lvt::TimerMode::OneShot,
         Lapic::Lvt::TimerMode::Periodic,
+        Lapic::Lvt::TimerMode::TscDeadline,
     };
 
     for (auto const delStat : deliveryStatus) {
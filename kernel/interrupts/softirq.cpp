@@ -0,0 +1,152 @@
+// Deferred interrupt work: softirqs and tasklets.
+#include <interrupts/softirq.hpp>
+#include <logging/log.hpp>
+#include <util/assert.hpp>
+#include <cpu/cpu.hpp>
+#include <interrupts/cpulocal.hpp>
+
+namespace Interrupts::Softirq {
+
+// Run the tasklets queued on the current cpu. Handler of the TaskletSoftirq.
+static void runTasklets();
+
+// The handler of each softirq. A nullptr indicates that the softirq has no
+// handler, raising it is then a no-op.
+static Handler Handlers[Id::Max + 1] = {runTasklets};
+
+// Register the handler of a softirq.
+// @param id: The softirq.
+// @param handler: The function called when the softirq runs. nullptr
+// deregisters the current handler.
+void registerHandler(Id const id, Handler const handler) {
+    ASSERT(id != TaskletSoftirq);
+    Handlers[id.raw()] = handler;
+}
+
+// Set bits in the pending softirqs of the current cpu. A single or instruction
+// cannot be torn by a nested interrupt on the same cpu.
+// @param bits: The bits to set.
+static void setPending(u64 const bits) {
+    asm volatile("or %1, %0" : "+m"(cpuLocal().pendingSoftirqs) : "r"(bits));
+}
+
+// Atomically read and clear the pending softirqs of the current cpu.
+// @return: The softirqs that were pending.
+static u64 takePending() {
+    u64 pending(0);
+    asm volatile("xchg %0, %1"
+                 : "+r"(pending), "+m"(cpuLocal().pendingSoftirqs));
+    return pending;
+}
+
+// Mark a softirq as pending on the current cpu.
+// @param id: The softirq to raise.
+void raise(Id const id) {
+    ASSERT(isCpuLocalInitialized());
+    setPending(1ULL << id.raw());
+}
+
+// Check if the softirqs currently running on this cpu exhausted their budget.
+// Softirq handlers processing their work incrementally should stop and raise
+// themselves again once this returns true.
+// @return: true if the budget is exhausted, false otherwise.
+bool isBudgetExhausted() {
+    return Cpu::rdtsc() >= cpuLocal().softirqDeadline;
+}
+
+// Run the softirqs pending on the current cpu, within the budget.
+void runPending() {
+    if (!isCpuLocalInitialized() || !Cpu::interruptsEnabled()) {
+        return;
+    }
+    CpuLocal& local(cpuLocal());
+    if (local.isRunningSoftirqs || !local.pendingSoftirqs) {
+        return;
+    }
+    local.isRunningSoftirqs = true;
+    local.softirqDeadline = Cpu::rdtsc() + BUDGET_CYCLES;
+    bool budgetExhausted(false);
+    for (u64 i(0); i < MAX_RESTARTS && !budgetExhausted; ++i) {
+        u64 pending(takePending());
+        if (!pending) {
+            break;
+        }
+        while (!!pending && !budgetExhausted) {
+            u64 const id(__builtin_ctzll(pending));
+            pending &= ~(1ULL << id);
+            Handler const handler(Handlers[id]);
+            if (!!handler) {
+                handler();
+            } else {
+                Log::warn("Ignoring softirq {} with no handler", id);
+            }
+            budgetExhausted = isBudgetExhausted();
+        }
+        // Softirqs that did not get to run within the budget are left pending
+        // for the next interrupt exit.
+        setPending(pending);
+    }
+    local.isRunningSoftirqs = false;
+}
+
+// Schedule a tasklet on the current cpu.
+// @param tasklet: The tasklet to schedule.
+void schedule(Tasklet& tasklet) {
+    ASSERT(isCpuLocalInitialized());
+    if (!tasklet.isScheduled.compareAndExchange(0, 1)) {
+        // Already scheduled.
+        return;
+    }
+    // The queue is also modified by interrupt handlers on this cpu.
+    bool const savedIf(Cpu::interruptsEnabled());
+    Cpu::disableInterrupts();
+    CpuLocal& local(cpuLocal());
+    tasklet.next = nullptr;
+    if (!!local.taskletTail) {
+        local.taskletTail->next = &tasklet;
+    } else {
+        local.taskletHead = &tasklet;
+    }
+    local.taskletTail = &tasklet;
+    raise(TaskletSoftirq);
+    Cpu::setInterruptFlag(savedIf);
+}
+
+// Run the tasklets queued on the current cpu. Handler of the TaskletSoftirq.
+static void runTasklets() {
+    CpuLocal& local(cpuLocal());
+    // Detach the current queue, tasklets scheduled while running it are added
+    // to a new queue and run on the next TaskletSoftirq.
+    Cpu::disableInterrupts();
+    Tasklet* head(local.taskletHead);
+    local.taskletHead = nullptr;
+    local.taskletTail = nullptr;
+    Cpu::enableInterrupts();
+
+    while (!!head) {
+        Tasklet* const tasklet(head);
+        head = tasklet->next;
+        tasklet->next = nullptr;
+        // Clear the scheduled flag first so that the tasklet can re-schedule
+        // itself.
+        tasklet->isScheduled = 0;
+        tasklet->func(tasklet->data);
+        if (!!head && isBudgetExhausted()) {
+            // Put the remaining tasklets back in front of the queue.
+            Tasklet* remainingTail(head);
+            while (!!remainingTail->next) {
+                remainingTail = remainingTail->next;
+            }
+            Cpu::disableInterrupts();
+            remainingTail->next = local.taskletHead;
+            if (!local.taskletTail) {
+                local.taskletTail = remainingTail;
+            }
+            local.taskletHead = head;
+            raise(TaskletSoftirq);
+            Cpu::enableInterrupts();
+            return;
+        }
+    }
+}
+}
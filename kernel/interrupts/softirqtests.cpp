@@ -0,0 +1,143 @@
+// Tests for the deferred interrupt work.
+#include <interrupts/softirq.hpp>
+#include <interrupts/ipi.hpp>
+#include <selftests/macros.hpp>
+#include <cpu/cpu.hpp>
+
+namespace Interrupts::Softirq {
+
+// Check that a softirq raised by an interrupt handler runs after the handler
+// returned, with interrupts enabled, and only once per raise.
+SelfTests::TestResult softirqRunOnInterruptExitTest() {
+    static volatile bool handlerDone;
+    static volatile bool ranAfterHandler;
+    static volatile bool ranWithInterruptsEnabled;
+    static volatile u64 softirqCount;
+    auto const handler([](Vector const, Frame const&) {
+        raise(TestSoftirq);
+        // Raising twice before the softirq runs only runs it once.
+        raise(TestSoftirq);
+        handlerDone = true;
+    });
+    auto const softirqHandler([]() {
+        ranAfterHandler = handlerDone;
+        ranWithInterruptsEnabled = Cpu::interruptsEnabled();
+        softirqCount = softirqCount + 1;
+    });
+    Res<Vector> const vector(allocateVector());
+    TEST_ASSERT(!!vector);
+    handlerDone = false;
+    ranAfterHandler = false;
+    ranWithInterruptsEnabled = false;
+    softirqCount = 0;
+    registerHandler(TestSoftirq, softirqHandler);
+    {
+        TemporaryInterruptHandlerGuard guard(*vector, handler);
+        Ipi::sendIpi(Smp::id(), *vector);
+        TEST_WAIT_FOR(softirqCount == 1, 1000);
+    }
+    registerHandler(TestSoftirq, nullptr);
+    freeVector(*vector);
+    TEST_ASSERT(ranAfterHandler);
+    TEST_ASSERT(ranWithInterruptsEnabled);
+    TEST_ASSERT(softirqCount == 1);
+    return SelfTests::TestResult::Success;
+}
+
+// Check that tasklets run once per scheduling and can re-schedule themselves.
+SelfTests::TestResult taskletTest() {
+    static volatile u64 runCount;
+    static Tasklet tasklet;
+    static Tasklet reschedulingTasklet;
+    static volatile u64 reschedulingRunCount;
+    u64 const numReschedules(8);
+    tasklet.func = [](u64 const data) {
+        runCount = runCount + data;
+    };
+    tasklet.data = 1;
+    reschedulingTasklet.func = [](u64 const data) {
+        reschedulingRunCount = reschedulingRunCount + 1;
+        if (reschedulingRunCount < data) {
+            schedule(reschedulingTasklet);
+        }
+    };
+    reschedulingTasklet.data = numReschedules;
+    auto const handler([](Vector const, Frame const&) {
+        schedule(tasklet);
+        // Already scheduled, no-op.
+        schedule(tasklet);
+        schedule(reschedulingTasklet);
+    });
+    Res<Vector> const vector(allocateVector());
+    TEST_ASSERT(!!vector);
+    runCount = 0;
+    reschedulingRunCount = 0;
+    {
+        TemporaryInterruptHandlerGuard guard(*vector, handler);
+        Ipi::sendIpi(Smp::id(), *vector);
+        TEST_WAIT_FOR(runCount == 1, 1000);
+        // Re-scheduled tasklets run on the subsequent scans of the pending
+        // softirqs, possibly on later interrupt exits.
+        for (u64 i(0); i < numReschedules; ++i) {
+            runPending();
+        }
+        TEST_WAIT_FOR(reschedulingRunCount == numReschedules, 1000);
+    }
+    freeVector(*vector);
+    TEST_ASSERT(runCount == 1);
+    TEST_ASSERT(!tasklet.isScheduled);
+    TEST_ASSERT(!reschedulingTasklet.isScheduled);
+    return SelfTests::TestResult::Success;
+}
+
+// Check that the deferred work running on an interrupt exit stops once the
+// budget is exhausted and that the left-over work runs later on.
+SelfTests::TestResult softirqBudgetTest() {
+    static Tasklet slowTasklet;
+    static Tasklet fastTasklet;
+    static volatile bool slowDone;
+    static volatile bool fastDone;
+    static volatile bool fastRanOverBudget;
+    slowTasklet.func = [](u64 const) {
+        u64 const start(Cpu::rdtsc());
+        while (Cpu::rdtsc() - start < BUDGET_CYCLES) {
+            asm("pause");
+        }
+        slowDone = true;
+    };
+    // Any interrupt exit may run the left-over work, hence instead of checking
+    // that the fast tasklet is still pending after the slow one, check that it
+    // ran with a fresh budget, i.e. not in the same run as the slow tasklet.
+    fastTasklet.func = [](u64 const) {
+        fastRanOverBudget = isBudgetExhausted();
+        fastDone = true;
+    };
+    auto const handler([](Vector const, Frame const&) {
+        schedule(slowTasklet);
+        schedule(fastTasklet);
+    });
+    Res<Vector> const vector(allocateVector());
+    TEST_ASSERT(!!vector);
+    slowDone = false;
+    fastDone = false;
+    fastRanOverBudget = false;
+    {
+        TemporaryInterruptHandlerGuard guard(*vector, handler);
+        Ipi::sendIpi(Smp::id(), *vector);
+        TEST_WAIT_FOR(slowDone, 1000);
+    }
+    freeVector(*vector);
+    // Run the left-over work now if no interrupt exit did it already.
+    runPending();
+    TEST_WAIT_FOR(fastDone, 1000);
+    TEST_ASSERT(!fastRanOverBudget);
+    return SelfTests::TestResult::Success;
+}
+
+// Run the softirq tests.
+void Test(SelfTests::TestRunner& runner) {
+    RUN_TEST(runner, softirqRunOnInterruptExitTest);
+    RUN_TEST(runner, taskletTest);
+    RUN_TEST(runner, softirqBudgetTest);
+}
+}
@@ -0,0 +1,99 @@
+// Per-cpu, per-vector interrupt statistics.
+#include <interrupts/stats.hpp>
+#include <logging/log.hpp>
+#include <util/assert.hpp>
+#include <interrupts/cpulocal.hpp>
+
+namespace Interrupts::Stats {
+
+// Get the histogram bucket of a duration.
+// @param cycles: The duration in cycles.
+// @return: The index of the bucket.
+static u64 bucketOf(u64 const cycles) {
+    u64 const log2(63 - __builtin_clzll(cycles | 1));
+    if (log2 < FIRST_BUCKET_SHIFT) {
+        return 0;
+    }
+    return min(log2 - FIRST_BUCKET_SHIFT + 1, NUM_BUCKETS - 1);
+}
+
+// Account for an interrupt on the current cpu.
+// @param vector: The vector of the interrupt.
+// @param cycles: The duration of the handler, in TSC cycles.
+void record(Vector const vector, u64 const cycles) {
+    if (!isCpuLocalInitialized()) {
+        return;
+    }
+    VectorStats& stats(cpuLocal().stats[vector.raw()]);
+    localAdd(stats.count, u64(1));
+    localAdd(stats.totalCycles, cycles);
+    localAdd(stats.histogram[bucketOf(cycles)], u32(1));
+}
+
+// Get the statistics of a vector on a cpu.
+// @param cpu: The cpu.
+// @param vector: The vector.
+// @return: A snapshot of the statistics.
+VectorStats vectorStats(Smp::Id const cpu, Vector const vector) {
+    return cpuLocal(cpu).stats[vector.raw()];
+}
+
+// Find the histogram bucket containing a percentile of the durations.
+// @param stats: The statistics to compute the percentile of.
+// @param percent: The percentile, between 0 and 100.
+// @return: The index of the bucket.
+u64 percentileBucket(VectorStats const& stats, u64 const percent) {
+    ASSERT(!!stats.count);
+    ASSERT(percent <= 100);
+    u64 cumulated(0);
+    for (u64 i(0); i < NUM_BUCKETS; ++i) {
+        cumulated += stats.histogram[i];
+        if (cumulated * 100 >= percent * stats.count) {
+            return i;
+        }
+    }
+    // The histogram and the count are updated separately, a snapshot taken
+    // while an interrupt is being accounted can be slightly inconsistent.
+    return NUM_BUCKETS - 1;
+}
+
+// Get the upper bound of a histogram bucket.
+// @param bucket: The index of the bucket.
+// @return: The upper bound in cycles, exclusive. The last bucket is unbounded,
+// its lower bound is returned instead.
+u64 bucketBound(u64 const bucket) {
+    ASSERT(bucket < NUM_BUCKETS);
+    if (bucket == NUM_BUCKETS - 1) {
+        return 1ULL << (FIRST_BUCKET_SHIFT + bucket - 1);
+    }
+    return 1ULL << (FIRST_BUCKET_SHIFT + bucket);
+}
+
+// Log the statistics of all vectors that have been raised at least once, for
+// all cpus.
+void dump() {
+    Log::info("Interrupt statistics:");
+    for (u64 v(0); v < 256; ++v) {
+        Vector const vector(v);
+        u64 total(0);
+        for (Smp::Id cpu(0); cpu < Smp::ncpus(); ++cpu) {
+            total += cpuLocal(cpu).stats[v].count;
+        }
+        if (!total) {
+            continue;
+        }
+        Log::info("  Vector {}: {} interrupts", v, total);
+        for (Smp::Id cpu(0); cpu < Smp::ncpus(); ++cpu) {
+            VectorStats const stats(vectorStats(cpu, vector));
+            if (!stats.count) {
+                continue;
+            }
+            u64 const p50(bucketBound(percentileBucket(stats, 50)));
+            u64 const p99(bucketBound(percentileBucket(stats, 99)));
+            Log::info("    cpu {}: {} interrupts, avg = {} cycles, "
+                      "p50 < {} cycles, p99 < {} cycles", cpu, stats.count,
+                      stats.totalCycles / stats.count, p50, p99);
+        }
+    }
+}
+}
@@ -0,0 +1,86 @@
+// Tests for the interrupt statistics.
+#include <interrupts/stats.hpp>
+#include <interrupts/ipi.hpp>
+#include <selftests/macros.hpp>
+
+namespace Interrupts::Stats {
+
+// Sum the buckets of the histogram of a VectorStats.
+// @param stats: The statistics.
+// @return: The sum of all the buckets.
+static u64 histogramSum(VectorStats const& stats) {
+    u64 sum(0);
+    for (u64 i(0); i < NUM_BUCKETS; ++i) {
+        sum += stats.histogram[i];
+    }
+    return sum;
+}
+
+// Check that interrupts are accounted on the cpu and vector that handled them,
+// on both the regular and fast entry paths.
+SelfTests::TestResult statsCountTest() {
+    static volatile u64 counter;
+    auto const handler([](Vector const, Frame const&) {
+        counter = counter + 1;
+    });
+    auto const fastHandler([](Vector const) {
+        counter = counter + 1;
+    });
+    Res<Vector> const vector(allocateVector());
+    TEST_ASSERT(!!vector);
+    Smp::Id const selfId(Smp::id());
+    VectorStats const before(vectorStats(selfId, *vector));
+
+    u64 const numInterrupts(16);
+    counter = 0;
+    registerHandler(*vector, handler);
+    for (u64 i(0); i < numInterrupts; ++i) {
+        Ipi::sendIpi(selfId, *vector);
+        TEST_WAIT_FOR(counter == i + 1, 1000);
+    }
+    registerFastHandler(*vector, fastHandler);
+    for (u64 i(numInterrupts); i < 2 * numInterrupts; ++i) {
+        Ipi::sendIpi(selfId, *vector);
+        TEST_WAIT_FOR(counter == i + 1, 1000);
+    }
+    deregisterHandler(*vector);
+    freeVector(*vector);
+
+    VectorStats const after(vectorStats(selfId, *vector));
+    TEST_ASSERT(after.count == before.count + 2 * numInterrupts);
+    TEST_ASSERT(histogramSum(after) == after.count);
+    TEST_ASSERT(after.totalCycles > before.totalCycles);
+    // Other cpus did not see any of those interrupts.
+    for (Smp::Id cpu(0); cpu < Smp::ncpus(); ++cpu) {
+        if (cpu != selfId) {
+            TEST_ASSERT(!vectorStats(cpu, *vector).count);
+        }
+    }
+    dump();
+    return SelfTests::TestResult::Success;
+}
+
+// Check the computation of percentiles from the histograms.
+SelfTests::TestResult statsPercentileTest() {
+    VectorStats stats = {};
+    stats.histogram[0] = 50;
+    stats.histogram[3] = 49;
+    stats.histogram[NUM_BUCKETS - 1] = 1;
+    stats.count = 100;
+    TEST_ASSERT(percentileBucket(stats, 0) == 0);
+    TEST_ASSERT(percentileBucket(stats, 50) == 0);
+    TEST_ASSERT(percentileBucket(stats, 51) == 3);
+    TEST_ASSERT(percentileBucket(stats, 99) == 3);
+    TEST_ASSERT(percentileBucket(stats, 100) == NUM_BUCKETS - 1);
+    TEST_ASSERT(bucketBound(0) == (1ULL << FIRST_BUCKET_SHIFT));
+    TEST_ASSERT(bucketBound(3) == (1ULL << (FIRST_BUCKET_SHIFT + 3)));
+    TEST_ASSERT(bucketBound(NUM_BUCKETS - 1) == bucketBound(NUM_BUCKETS - 2));
+    return SelfTests::TestResult::Success;
+}
+
+// Run the interrupt statistics tests.
+void Test(SelfTests::TestRunner& runner) {
+    RUN_TEST(runner, statsCountTest);
+    RUN_TEST(runner, statsPercentileTest);
+}
+}
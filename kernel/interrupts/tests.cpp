@@ -2,6 +2,12 @@
 #include <interrupts/interrupts.hpp>
 #include <interrupts/lapic.hpp>
 #include <selftests/macros.hpp>
+#include <logging/log.hpp>
+#include <interrupts/ipi.hpp>
+#include <interrupts/vectormap.hpp>
+#include <interrupts/stats.hpp>
+#include <interrupts/softirq.hpp>
+#include <smp/smp.hpp>
 #include "ioapic.hpp"
 
 namespace Interrupts {
@@ -194,14 +200,175 @@ SelfTests::TestResult interruptHandlerFrameTest() {
     return SelfTests::TestResult::Success;
 }
 
+// Check that allocateVector() returns distinct vectors of the requested
+// priority class, never returns statically assigned vectors and fails once the
+// class is full.
+SelfTests::TestResult vectorAllocationTest() {
+    for (u64 c(PriorityClass::Min); c <= PriorityClass::Max; ++c) {
+        PriorityClass const priorityClass(c);
+        Vector allocated[16];
+        u64 numAllocated(0);
+        while (true) {
+            Res<Vector> const res(allocateVector(priorityClass));
+            if (!res) {
+                TEST_ASSERT(res.error() == Error::OutOfInterruptVectors);
+                break;
+            }
+            TEST_ASSERT(numAllocated < 16);
+            TEST_ASSERT(res->raw() >> 4 == c);
+            TEST_ASSERT(*res != VectorMap::TestVector);
+            TEST_ASSERT(*res != VectorMap::RemoteCallVector);
+            TEST_ASSERT(*res != VectorMap::SpuriousVector);
+            for (u64 i(0); i < numAllocated; ++i) {
+                TEST_ASSERT(allocated[i] != *res);
+            }
+            allocated[numAllocated++] = *res;
+        }
+        for (u64 i(0); i < numAllocated; ++i) {
+            freeVector(allocated[i]);
+        }
+        // Vectors are re-usable once freed.
+        Res<Vector> const realloc(allocateVector(priorityClass));
+        TEST_ASSERT(!!realloc);
+        freeVector(*realloc);
+    }
+
+    // Allocations without priority class are spread across classes.
+    Res<Vector> const vec1(allocateVector());
+    Res<Vector> const vec2(allocateVector());
+    TEST_ASSERT(!!vec1 && !!vec2);
+    TEST_ASSERT(vec1->raw() >> 4 != vec2->raw() >> 4);
+    freeVector(*vec1);
+    freeVector(*vec2);
+    return SelfTests::TestResult::Success;
+}
+
+// Check that interrupts can be delivered on dynamically allocated vectors of
+// all priority classes.
+SelfTests::TestResult allocatedVectorInterruptTest() {
+    static volatile u64 gotVector;
+    auto const handler([](Vector const vector, Frame const&) {
+        gotVector = vector.raw();
+    });
+    for (u64 c(PriorityClass::Min); c <= PriorityClass::Max; ++c) {
+        Res<Vector> const vector(allocateVector(PriorityClass(c)));
+        TEST_ASSERT(!!vector);
+        {
+            TemporaryInterruptHandlerGuard guard(*vector, handler);
+            gotVector = 0;
+            Ipi::sendIpi(Smp::id(), *vector);
+            TEST_WAIT_FOR(gotVector == vector->raw(), 1000);
+        }
+        freeVector(*vector);
+    }
+    return SelfTests::TestResult::Success;
+}
+
+// Check that fast handlers are called on their vector and that registering a
+// regular handler switches the vector back to the regular entry path.
+SelfTests::TestResult fastInterruptHandlerTest() {
+    static volatile u64 gotFastVector;
+    static volatile u64 gotVector;
+    auto const fastHandler([](Vector const vector) {
+        gotFastVector = vector.raw();
+    });
+    auto const handler([](Vector const vector, Frame const&) {
+        gotVector = vector.raw();
+    });
+    Res<Vector> const vector(allocateVector());
+    TEST_ASSERT(!!vector);
+    gotFastVector = 0;
+    gotVector = 0;
+    registerFastHandler(*vector, fastHandler);
+    TEST_ASSERT(!registeredHandler(*vector));
+    Ipi::sendIpi(Smp::id(), *vector);
+    TEST_WAIT_FOR(gotFastVector == vector->raw(), 1000);
+    TEST_ASSERT(!gotVector);
+
+    gotFastVector = 0;
+    registerHandler(*vector, handler);
+    Ipi::sendIpi(Smp::id(), *vector);
+    TEST_WAIT_FOR(gotVector == vector->raw(), 1000);
+    TEST_ASSERT(!gotFastVector);
+
+    deregisterHandler(*vector);
+    freeVector(*vector);
+    return SelfTests::TestResult::Success;
+}
+
+// Measure the round-trip latency of a self-IPI, from sending the IPI to
+// returning to the interrupted context, over a number of iterations.
+// @param vector: The vector to raise, a handler incrementing `counter` must be
+// registered for it.
+// @param counter: The counter incremented by the handler.
+// @param minCycles: Output param set to the lowest latency measured.
+// @return: The average latency in cycles.
+static u64 measureSelfIpiLatency(Vector const vector,
+                                 u64 volatile const& counter,
+                                 u64& minCycles) {
+    u64 const iterations(1000);
+    u64 totalCycles(0);
+    minCycles = ~0ULL;
+    Smp::Id const selfId(Smp::id());
+    for (u64 i(0); i < iterations; ++i) {
+        u64 const before(counter);
+        u64 const start(Cpu::rdtsc());
+        Ipi::sendIpi(selfId, vector);
+        while (counter == before) {
+            asm("pause");
+        }
+        u64 const cycles(Cpu::rdtsc() - start);
+        totalCycles += cycles;
+        minCycles = min(minCycles, cycles);
+    }
+    return totalCycles / iterations;
+}
+
+// Compare the interrupt round-trip latency of the regular and fast entry paths
+// using self-IPIs. This never fails, the results are only logged.
+SelfTests::TestResult interruptLatencyBenchmark() {
+    static volatile u64 counter;
+    auto const fastHandler([](Vector const) {
+        counter = counter + 1;
+    });
+    auto const handler([](Vector const, Frame const&) {
+        counter = counter + 1;
+    });
+    Res<Vector> const vector(allocateVector());
+    TEST_ASSERT(!!vector);
+    counter = 0;
+
+    u64 regularMin;
+    registerHandler(*vector, handler);
+    u64 const regularAvg(measureSelfIpiLatency(*vector, counter, regularMin));
+
+    u64 fastMin;
+    registerFastHandler(*vector, fastHandler);
+    u64 const fastAvg(measureSelfIpiLatency(*vector, counter, fastMin));
+
+    deregisterHandler(*vector);
+    freeVector(*vector);
+    Log::info("  Regular path: avg = {} cycles, min = {} cycles", regularAvg,
+              regularMin);
+    Log::info("  Fast path:    avg = {} cycles, min = {} cycles", fastAvg,
+              fastMin);
+    return SelfTests::TestResult::Success;
+}
+
 // Run the interrupt tests.
 void Test(SelfTests::TestRunner& runner) {
     RUN_TEST(runner, interruptTest);
     RUN_TEST(runner, interruptRegistersSavedTest);
     RUN_TEST(runner, interruptHandlerRegistrationTest);
     RUN_TEST(runner, interruptHandlerFrameTest);
+    RUN_TEST(runner, vectorAllocationTest);
+    RUN_TEST(runner, allocatedVectorInterruptTest);
+    RUN_TEST(runner, fastInterruptHandlerTest);
+    RUN_TEST(runner, interruptLatencyBenchmark);
 
     Lapic::Test(runner);
+    Stats::Test(runner);
+    Softirq::Test(runner);
     IoApic::Test(runner);
 }
 
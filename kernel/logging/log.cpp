@@ -3,25 +3,105 @@
 #include <logging/log.hpp>
 #include <logging/vga.hpp>
 #include <logging/serial.hpp>
+#include <logging/logbuffer.hpp>
+#include <interrupts/softirq.hpp>
+#include <interrupts/interrupts.hpp>
+#include <interrupts/cpulocal.hpp>
+#include <timers/tsc.hpp>
+#include <smp/percpu.hpp>
+#include <datastruct/vector.hpp>
+#include <util/ptr.hpp>
+#include <cpu/cpu.hpp>
+#include <util/assert.hpp>
+#include <util/panic.hpp>
 
 namespace Log {
 
 // Lock for all Log::* function to avoid having cpus garbling the output.
 static Concurrency::SpinLock logLock;
 
-// Return the global Logger singleton instance.
-Logging::Logger& loggerInstance() {
-    // This is where the global Logger instance is created.
+// Return the output device used by the global Logger instance.
 #ifdef OUTPUT_VGA
+static Logging::VgaOutputDev& outputDev() {
     // FIXME: Eventually we will need to be able to set those from the Makefile,
     // for now leave it hardcoded.
     static Logging::VgaOutputDev outDev;
+    return outDev;
+}
 #else
+static Logging::SerialOutputDev& outputDev() {
     // Default to the serial console.
     static Logging::SerialOutputDev outDev(
         Logging::SerialOutputDev::ComPort::COM1);
+    return outDev;
+}
+
+// The IRQ of COM1.
+static const Interrupts::Irq SerialIrq = Interrupts::Irq(4);
+
+// The vector the IRQ of the serial console is routed to, set by
+// InitSerialInterrupt().
+static Interrupts::Vector SerialVector(0);
+static bool IsSerialInterruptEnabled = false;
 #endif
-    static Logging::Logger globalLogger(outDev);
+
+// OutputDev forwarding all calls to the output device, or to the device set by
+// redirectOutput().
+class RedirectableOutputDev final : public Logging::Logger::OutputDev {
+public:
+    RedirectableOutputDev() : m_target(nullptr) {}
+
+    // Set the device to forward the calls to.
+    // @param target: The device, nullptr to forward to outputDev().
+    void setTarget(Logging::Logger::OutputDev* const target) {
+        m_target = target;
+    }
+
+    virtual void printChar(char const c) {
+        target().printChar(c);
+    }
+
+    virtual void newLine() {
+        target().newLine();
+    }
+
+    virtual void clear() {
+        target().clear();
+    }
+
+    virtual void setColor(Logging::Logger::Color const color) {
+        target().setColor(color);
+    }
+
+    virtual void flush() {
+        target().flush();
+    }
+
+private:
+    // Get the device to forward the calls to.
+    // @return: The target set by setTarget(), or outputDev() if none.
+    Logging::Logger::OutputDev& target() {
+        if (!!m_target) {
+            return *m_target;
+        } else {
+            return outputDev();
+        }
+    }
+
+    Logging::Logger::OutputDev* m_target;
+};
+
+// Get the device all messages are written to.
+// @return: The RedirectableOutputDev singleton.
+static RedirectableOutputDev& redirectableDev() {
+    static RedirectableOutputDev dev;
+    return dev;
+}
+
+// Return the global Logger singleton instance.
+Logging::Logger& loggerInstance() {
+    // This is where the global Logger instance is created.
+    static Logging::Logger globalLogger(redirectableDev());
     return globalLogger;
 }
 
@@ -29,4 +109,285 @@ Concurrency::Lock& loggerLock() {
     return logLock;
 }
 
+// The asynchronous logging state of a cpu.
+struct CpuLog {
+    Logging::LogBuffer buffer;
+    // Logger formatting messages into the buffer.
+    Logging::Logger logger;
+    // True while the cpu is formatting a message into the buffer, a message
+    // logged in the meantime, e.g. from an exception handler, is written
+    // synchronously.
+    bool inMessage;
+    // The interrupt flag before beginBufferedMessage().
+    bool savedIrqFlag;
+    // The value of buffer.numDropped() last reported by the flusher.
+    u64 numDroppedReported;
+
+    CpuLog() : logger(buffer), inMessage(false), savedIrqFlag(false),
+        numDroppedReported(0) {}
+};
+
+// The state of each cpu, indexed by Smp::Id.
+static Vector<Ptr<CpuLog>> CpuLogs;
+
+// If true, messages are appended to the per-cpu buffers.
+static bool volatile IsAsync = false;
+
+// Set while a cpu is draining the buffers, there is at most one consumer.
+static Atomic<u8> IsFlushing;
+
+// Get the Logger of the current cpu and start a new message in its buffer.
+// Interrupts are disabled until endBufferedMessage().
+// @return: The Logger to format the message with, or nullptr if the message
+// must be written synchronously.
+Logging::Logger* beginBufferedMessage() {
+    if (!IsAsync) {
+        return nullptr;
+    }
+    bool const savedIrqFlag(Cpu::interruptsEnabled());
+    Cpu::disableInterrupts();
+    // Every cpu points its GS base to its CpuLocal before running any code,
+    // this avoids Smp::id() which executes CPUID.
+    Smp::Id const cpu(Interrupts::cpuLocal().id);
+    CpuLog& log(*CpuLogs[cpu.raw()]);
+    // APs log before being online, at which point they cannot raise softirqs.
+    if (log.inMessage || !Smp::PerCpu::data(cpu).isOnline) {
+        Cpu::setInterruptFlag(savedIrqFlag);
+        return nullptr;
+    }
+    log.inMessage = true;
+    log.savedIrqFlag = savedIrqFlag;
+    log.buffer.begin(Timer::Tsc::monotonicNanos());
+    return &log.logger;
+}
+
+// Maximum number of messages printed by a single run of the LogFlushSoftirq.
+// The softirq raises itself again while messages are left, so that a large
+// backlog, or a slow output device, does not starve the other deferred work of
+// the cpu.
+static constexpr u64 MaxMessagesPerSoftirq = 16;
+
+// Outcome of tryFlush().
+enum class FlushResult {
+    // The buffers of all cpus are empty.
+    Drained,
+    // Another cpu is draining the buffers.
+    Busy,
+    // The flush stopped before draining the buffers.
+    Partial,
+};
+
+// Check if the buffers of all cpus are empty.
+// @return: true if no buffer holds a message.
+static bool allBuffersEmpty() {
+    for (Ptr<CpuLog> const& log : CpuLogs) {
+        if (log->buffer.oldestTimestamp() != ~0ULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Drain the buffers of all cpus, unless another cpu is already draining them.
+// Messages are printed in the order of their timestamps.
+// @param inSoftirq: If true, stop after MaxMessagesPerSoftirq messages or once
+// the budget of the softirq is exhausted.
+// @return: The FlushResult.
+static FlushResult tryFlush(bool const inSoftirq) {
+    while (true) {
+        if (!IsFlushing.compareAndExchange(0, 1)) {
+            return FlushResult::Busy;
+        }
+        Logging::Logger& logger(loggerInstance());
+        u64 numPrinted(0);
+        bool isPartial(false);
+        while (true) {
+            if (inSoftirq && (numPrinted == MaxMessagesPerSoftirq
+                              || Interrupts::Softirq::isBudgetExhausted())) {
+                isPartial = true;
+                break;
+            }
+            // Release the lock between messages so that interrupts are not
+            // disabled for the entire drain.
+            Concurrency::LockGuard lg(logLock);
+            CpuLog* oldest(nullptr);
+            u64 oldestTimestamp(~0ULL);
+            for (u64 i(0); i < CpuLogs.size(); ++i) {
+                u64 const timestamp(CpuLogs[i]->buffer.oldestTimestamp());
+                if (timestamp < oldestTimestamp) {
+                    oldest = &*CpuLogs[i];
+                    oldestTimestamp = timestamp;
+                }
+            }
+            if (!oldest) {
+                break;
+            }
+            oldest->buffer.pop(redirectableDev());
+            numPrinted++;
+        }
+        for (u64 i(0); i < CpuLogs.size(); ++i) {
+            CpuLog& log(*CpuLogs[i]);
+            u64 const numDropped(log.buffer.numDropped());
+            if (numDropped != log.numDroppedReported) {
+                Concurrency::LockGuard lg(logLock);
+                logger.setColor(Logging::Logger::Color::Warn);
+                logger.printf("[WARN] {} log message(s) dropped on cpu {}",
+                              numDropped - log.numDroppedReported, i);
+                log.numDroppedReported = numDropped;
+            }
+        }
+        IsFlushing = 0;
+        // A message appended after its buffer was found empty could have been
+        // missed by this flush while another cpu failed to start its own.
+        if (allBuffersEmpty()) {
+            return FlushResult::Drained;
+        } else if (isPartial) {
+            return FlushResult::Partial;
+        }
+    }
+}
+
+// Make room for the pending message of a cpu whose buffer is full by printing
+// the oldest messages of that buffer only, then commit the message. The buffers
+// of the other cpus are left to the LogFlushSoftirq, the producer, possibly an
+// interrupt handler, only prints the few messages needed for its own.
+// @param log: The CpuLog of the current cpu.
+// @return: true if the message was committed, false if another flush is
+// running, possibly interrupted on this very cpu, or if the message does not
+// fit in an empty buffer.
+static bool makeRoomAndCommit(CpuLog& log) {
+    if (!IsFlushing.compareAndExchange(0, 1)) {
+        return false;
+    }
+    bool isCommitted(false);
+    while (!isCommitted && log.buffer.oldestTimestamp() != ~0ULL) {
+        {
+            Concurrency::LockGuard lg(logLock);
+            log.buffer.pop(redirectableDev());
+        }
+        isCommitted = log.buffer.commit();
+    }
+    IsFlushing = 0;
+    return isCommitted;
+}
+
+// Publish the message started by beginBufferedMessage() and restore the
+// interrupt flag.
+void endBufferedMessage() {
+    CpuLog& log(*CpuLogs[Interrupts::cpuLocal().id.raw()]);
+    if (!log.buffer.commit() && !makeRoomAndCommit(log)) {
+        log.buffer.drop();
+    }
+    log.inMessage = false;
+    Interrupts::Softirq::raise(Interrupts::Softirq::LogFlushSoftirq);
+    Cpu::setInterruptFlag(log.savedIrqFlag);
+}
+
+// Switch to asynchronous logging: each cpu appends its messages to its own ring
+// buffer, which is drained by the LogFlushSoftirq. Must be called after
+// Smp::PerCpu::Init() and Timer::Tsc::Init(), the messages are timestamped with
+// the monotonic clock.
+void InitAsync() {
+    ASSERT(!IsAsync);
+    for (u64 i(0); i < Smp::ncpus(); ++i) {
+        CpuLogs.pushBack(Ptr<CpuLog>::New());
+    }
+    Interrupts::Softirq::registerHandler(Interrupts::Softirq::LogFlushSoftirq,
+        []() {
+            if (tryFlush(true) == FlushResult::Partial) {
+                Interrupts::Softirq::raise(
+                    Interrupts::Softirq::LogFlushSoftirq);
+            }
+        });
+    IsAsync = true;
+    Log::info("Logging to per-cpu buffers ({} bytes per cpu)",
+              Logging::LogBuffer::Size);
+}
+
+// Drive the serial console from its THR-empty interrupt instead of polling it,
+// see SerialOutputDev. Does nothing when logging to VGA. Must be called after
+// Interrupts::InitIoApics().
+void InitSerialInterrupt() {
+#ifndef OUTPUT_VGA
+    Res<Interrupts::Vector> const vector(Interrupts::allocateVector());
+    if (!vector) {
+        PANIC("Could not allocate a vector for the serial console");
+    }
+    Interrupts::registerHandler(*vector,
+        [](Interrupts::Vector const, Interrupts::Frame const&) {
+            outputDev().handleInterrupt();
+        });
+    Interrupts::mapIrq(SerialIrq, *vector);
+    {
+        // Chars printed before this point were written to the UART directly.
+        Concurrency::LockGuard lg(logLock);
+        outputDev().enableTxInterrupt();
+    }
+    SerialVector = *vector;
+    IsSerialInterruptEnabled = true;
+    Log::info("Serial console using IRQ {} on vector {}, {}-byte FIFO",
+              SerialIrq.raw(), vector->raw(), outputDev().fifoSize());
+#endif
+}
+
+// Drain the log buffers of all cpus to the output device. Waits for a flush
+// running on another cpu to complete. Must not be called from an interrupt
+// handler.
+void flush() {
+    if (CpuLogs.empty()) {
+        return;
+    }
+    while (tryFlush(false) == FlushResult::Busy) {
+        asm("pause");
+    }
+}
+
+// Redirect all messages to another output device, meant for the tests. The log
+// buffers and the current device are drained first.
+// @param dev: The device to redirect the messages to, nullptr to restore the
+// actual output device.
+void redirectOutput(Logging::Logger::OutputDev* const dev) {
+    flush();
+    Concurrency::LockGuard lg(logLock);
+    // Don't leave chars in the device being replaced, e.g. in the TX ring of
+    // the serial console.
+    redirectableDev().flush();
+    redirectableDev().setTarget(dev);
+}
+
+// Get the interrupt-driven serial console, meant for the tests. Not declared in
+// log.hpp, the tests declare it extern.
+// @param vector[out]: The vector the IRQ of the console is routed to.
+// @return: The serial console, nullptr when logging to VGA or if
+// InitSerialInterrupt() was not called.
+Logging::SerialOutputDev* serialConsole(Interrupts::Vector& vector) {
+#ifdef OUTPUT_VGA
+    (void)vector;
+    return nullptr;
+#else
+    if (!IsSerialInterruptEnabled) {
+        return nullptr;
+    }
+    vector = SerialVector;
+    return &outputDev();
+#endif
+}
+
+// Switch back to synchronous logging and drain the log buffers and the output
+// device, for PANIC. Gives up on draining the buffers if another cpu does not
+// complete its flush in a timely manner.
+void flushForPanic() {
+    if (IsAsync) {
+        IsAsync = false;
+        u64 const timeout(100000000);
+        u64 const deadline(Timer::Tsc::monotonicNanos() + timeout);
+        while (tryFlush(false) == FlushResult::Busy
+               && Timer::Tsc::monotonicNanos() < deadline) {
+            asm("pause");
+        }
+    }
+    Concurrency::LockGuard lg(logLock);
+    redirectableDev().flush();
+}
+
 }
@@ -0,0 +1,162 @@
+// Ring buffer of log messages.
+#include <logging/logbuffer.hpp>
+#include <util/assert.hpp>
+
+namespace Logging {
+
+// Stored in the ring in place of a call to newLine(), so that the output device
+// sees the same calls as if the message had been written to it directly. This
+// cannot be confused with a printed char since strings are NUL-terminated.
+static constexpr char NEW_LINE = '\0';
+
+// Prevent the compiler from moving memory accesses across this point. On x86
+// loads are not reordered with other loads and stores are not reordered with
+// other stores, hence this is enough to order the accesses to the ring with
+// the accesses to its head and tail.
+static inline void compilerBarrier() {
+    asm volatile("" : : : "memory");
+}
+
+// Create an empty buffer.
+LogBuffer::LogBuffer() :
+    m_messageLen(0),
+    m_messageTimestamp(0),
+    m_messageColor(Logger::Color::Info),
+    m_numDropped(0) {}
+
+// Start a new message. A message started but not committed is discarded.
+// @param timestamp: The timestamp of the message, used to order messages across
+// buffers.
+void LogBuffer::begin(u64 const timestamp) {
+    m_messageLen = 0;
+    m_messageTimestamp = timestamp;
+    m_messageColor = Logger::Color::Info;
+}
+
+// Append a char to the message started by begin().
+// @param c: The character to be appended.
+void LogBuffer::printChar(char const c) {
+    // The last byte is reserved for the new line ending the message.
+    if (m_messageLen < MaxMessageLen - 1) {
+        m_message[m_messageLen++] = c;
+    }
+}
+
+// Append a new line to the message started by begin().
+void LogBuffer::newLine() {
+    if (m_messageLen < MaxMessageLen) {
+        m_message[m_messageLen++] = NEW_LINE;
+    } else {
+        // The message was truncated, make sure it still ends the line.
+        m_message[MaxMessageLen - 1] = NEW_LINE;
+    }
+}
+
+// Not supported, this is a no-op.
+void LogBuffer::clear() {}
+
+// Set the color of the message started by begin().
+// @param color: The color.
+void LogBuffer::setColor(Logger::Color const color) {
+    m_messageColor = color;
+}
+
+// Publish the message started by begin() to the consumer.
+// @return: true if the message was published, false if the ring does not have
+// enough space for it. In the latter case the message is kept and commit() can
+// be retried once the ring has been drained.
+bool LogBuffer::commit() {
+    u64 const head(m_head.read());
+    u64 const used(head - m_tail.read());
+    u64 const len(sizeof(MessageHeader) + m_messageLen);
+    if (Size - used < len) {
+        return false;
+    }
+    compilerBarrier();
+    MessageHeader const header({
+        .timestamp = m_messageTimestamp,
+        .length = static_cast<u16>(m_messageLen),
+        .color = static_cast<u8>(m_messageColor),
+    });
+    copyIn(head, &header, sizeof(header));
+    copyIn(head + sizeof(header), m_message, m_messageLen);
+    // Only publish the message once it has been entirely written.
+    compilerBarrier();
+    m_head = head + len;
+    m_messageLen = 0;
+    return true;
+}
+
+// Discard the message started by begin() and count it as dropped.
+void LogBuffer::drop() {
+    m_messageLen = 0;
+    m_numDropped = m_numDropped + 1;
+}
+
+// Get the timestamp of the oldest message in the ring. Must only be called by
+// the consumer.
+// @return: The timestamp given to begin() for this message, or ~0ULL if the
+// ring is empty.
+u64 LogBuffer::oldestTimestamp() const {
+    u64 const tail(m_tail.read());
+    if (tail == m_head.read()) {
+        return ~0ULL;
+    }
+    compilerBarrier();
+    MessageHeader header;
+    copyOut(tail, &header, sizeof(header));
+    return header.timestamp;
+}
+
+// Remove the oldest message from the ring and write it to an output device.
+// Must only be called by the consumer, on a non-empty ring.
+// @param dev: The device to write the message to.
+void LogBuffer::pop(Logger::OutputDev& dev) {
+    u64 const tail(m_tail.read());
+    ASSERT(tail != m_head.read());
+    compilerBarrier();
+    MessageHeader header;
+    copyOut(tail, &header, sizeof(header));
+    dev.setColor(static_cast<Logger::Color>(header.color));
+    u64 const start(tail + sizeof(header));
+    for (u64 i(0); i < header.length; ++i) {
+        char const c(m_ring[(start + i) % Size]);
+        if (c == NEW_LINE) {
+            dev.newLine();
+        } else {
+            dev.printChar(c);
+        }
+    }
+    // Only release the space once the message has been entirely read.
+    compilerBarrier();
+    m_tail = start + header.length;
+}
+
+// Get the number of messages dropped since the creation of this buffer.
+// @return: The number of calls to drop().
+u64 LogBuffer::numDropped() const {
+    return m_numDropped;
+}
+
+// Copy data into the ring, wrapping around its end.
+// @param pos: The position in the ring, modulo Size.
+// @param src: The data to copy.
+// @param len: The number of bytes to copy.
+void LogBuffer::copyIn(u64 const pos, void const * const src, u64 const len) {
+    u8 const * const bytes(reinterpret_cast<u8 const*>(src));
+    for (u64 i(0); i < len; ++i) {
+        m_ring[(pos + i) % Size] = bytes[i];
+    }
+}
+
+// Copy data out of the ring, wrapping around its end.
+// @param pos: The position in the ring, modulo Size.
+// @param dest: The destination of the copy.
+// @param len: The number of bytes to copy.
+void LogBuffer::copyOut(u64 const pos, void * const dest, u64 const len) const {
+    u8 * const bytes(reinterpret_cast<u8*>(dest));
+    for (u64 i(0); i < len; ++i) {
+        bytes[i] = m_ring[(pos + i) % Size];
+    }
+}
+}
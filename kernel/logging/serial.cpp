@@ -5,9 +5,45 @@ namespace Logging {
 
 static u32 const ClockFreq = 115200;
 
+// Bits of the FifoControl register.
+static u8 const FcrEnable = 1 << 0;
+static u8 const FcrClearRx = 1 << 1;
+static u8 const FcrClearTx = 1 << 2;
+// Only on 16750, ignored by other UARTs.
+static u8 const FcrEnable64Bytes = 1 << 5;
+
+// Bits of the InterruptIdentification register.
+static u8 const IirNoInterruptPending = 1 << 0;
+static u8 const IirFifo64Bytes = 1 << 5;
+static u8 const IirFifoEnabled = 0b11 << 6;
+
+// Bits of the InterruptEnable register.
+static u8 const IerThrEmpty = 1 << 1;
+
+// Bits of the ModemControl register. OUT2 gates the IRQ line of the UART on
+// PC-compatibles.
+static u8 const McrDtr = 1 << 0;
+static u8 const McrRts = 1 << 1;
+static u8 const McrOut2 = 1 << 3;
+static u8 const McrLoop = 1 << 4;
+
+// Bits of the LineStatus register.
+static u8 const LsrDataReady = 1 << 0;
+
+// Prevent the compiler from moving memory accesses across this point. This is
+// enough to order the accesses to the TX ring with the accesses to its head and
+// tail on x86.
+static inline void compilerBarrier() {
+    asm volatile("" : : : "memory");
+}
+
 // Create a serial output device using the given port.
 // @param port: The port to be used.
-SerialOutputDev::SerialOutputDev(ComPort const port) : m_port(port) {
+SerialOutputDev::SerialOutputDev(ComPort const port) :
+    m_port(port),
+    m_fifoSize(1),
+    m_fifoFree(0),
+    m_useTxRing(false) {
     // Initialize the serial port.
 
     // Set the divisor for the target baudrate. Make sure not to set it to zero.
@@ -23,6 +59,21 @@ SerialOutputDev::SerialOutputDev(ComPort const port) : m_port(port) {
 
     // Disable any interrupt.
     writeRegister(Register::InterruptEnable, 0x0);
+
+    // Enable and clear the FIFOs. The 64-byte FIFO of the 16750 can only be
+    // enabled while the DLAB is set.
+    setDlab(true);
+    writeRegister(Register::FifoControl,
+                  FcrEnable | FcrClearRx | FcrClearTx | FcrEnable64Bytes);
+    setDlab(false);
+    // The FIFO is only usable if the UART reports it as enabled, which is not
+    // the case on the 8250 and the original 16550.
+    u8 const iir(readRegister(Register::InterruptIdentification));
+    if ((iir & IirFifoEnabled) == IirFifoEnabled) {
+        m_fifoSize = (iir & IirFifo64Bytes) ? 64 : 16;
+    } else {
+        writeRegister(Register::FifoControl, 0x0);
+    }
 }
 
 // Print a char in the output device.
@@ -33,16 +84,30 @@ void SerialOutputDev::printChar(char const c) {
         printChar('\r');
     }
 
-    // Wait for the transmitter to be ready.
-    while (!canSendData());
-
-    // Write the char.
-    writeRegister(Register::Data, c);
+    if (!m_useTxRing) {
+        writePolled(c);
+        return;
+    }
+    // Wait for the ring to have room for the char, draining it synchronously
+    // if needed.
+    while (m_txHead.read() - m_txTail.read() == TxRingSize) {
+        kickTx(true);
+    }
+    u64 const head(m_txHead.read());
+    m_txRing[head % TxRingSize] = c;
+    // Only publish the char once it has been written in the ring.
+    compilerBarrier();
+    m_txHead = head + 1;
 }
 
 // Go to the next line.
 void SerialOutputDev::newLine() {
     printChar('\n');
+    // Start transmitting the line if the transmitter is idle, the rest of the
+    // ring is drained by the interrupt handler.
+    if (m_useTxRing) {
+        kickTx(false);
+    }
 }
 
 // Clear the output device.
@@ -71,6 +136,68 @@ void SerialOutputDev::setColor(Logger::Color const color) {
     }
 }
 
+// Wait for all the chars printed so far to be handed over to the UART.
+void SerialOutputDev::flush() {
+    // In polling mode chars are written to the UART directly.
+    if (!m_useTxRing) {
+        return;
+    }
+    while (m_txHead.read() != m_txTail.read()) {
+        kickTx(true);
+    }
+}
+
+// Switch to interrupt-driven transmission. The caller is responsible for
+// routing the IRQ of the port to a handler calling handleInterrupt().
+void SerialOutputDev::enableTxInterrupt() {
+    m_useTxRing = true;
+    writeRegister(Register::ModemControl, McrDtr | McrRts | McrOut2);
+    writeRegister(Register::InterruptEnable, IerThrEmpty);
+}
+
+// Handle an interrupt from the UART, refilling the FIFO from the TX ring if the
+// transmitter is empty. Can be called on any cpu.
+void SerialOutputDev::handleInterrupt() {
+    // Reading the IIR acknowledges the THR-empty interrupt.
+    if (readRegister(Register::InterruptIdentification)
+        & IirNoInterruptPending) {
+        return;
+    }
+    kickTx(false);
+}
+
+// Get the size of the TX FIFO of the UART.
+// @return: The size of the FIFO in bytes, 1 if the UART has no FIFO.
+u8 SerialOutputDev::fifoSize() const {
+    return m_fifoSize;
+}
+
+// Check if all the chars printed so far have been handed over to the UART.
+// @return: true if the TX ring is empty.
+bool SerialOutputDev::isTxRingEmpty() const {
+    return m_txHead.read() == m_txTail.read();
+}
+
+// Enable or disable the loopback mode of the UART, in which the chars sent are
+// received back by the UART instead of going out on the line. Meant for the
+// tests, must be called after enableTxInterrupt().
+// @param enable: Whether to enable the loopback mode.
+void SerialOutputDev::setLoopback(bool const enable) {
+    u8 const mcr(McrDtr | McrRts | McrOut2);
+    writeRegister(Register::ModemControl, enable ? (mcr | McrLoop) : mcr);
+}
+
+// Read a char received by the UART, if any.
+// @param c[out]: The char read.
+// @return: true if a char was read, false if none was available.
+bool SerialOutputDev::receiveChar(char& c) {
+    if (!(readRegister(Register::LineStatus) & LsrDataReady)) {
+        return false;
+    }
+    c = readRegister(Register::Data);
+    return true;
+}
+
 // Compute the port needed to read/write a register.
 // @param reg: The register to get the port for.
 // @return: The port to be used in the I/O instruction to access this register.
@@ -130,9 +257,58 @@ void SerialOutputDev::setDlab(bool const value) {
     writeRegister(Register::LineControl, newValue);
 }
 
-// Check if the controller is ready to send data.
+// Check if the controller is ready to send data, that is if the holding
+// register, or the FIFO if enabled, is empty.
 // @return: true if the controller can send data, false otherwise.
 bool SerialOutputDev::canSendData() {
     return !!(readRegister(Register::LineStatus) & 0x20);
 }
+
+// Write a char to the UART directly, waiting for the FIFO to be empty only once
+// every m_fifoSize chars.
+// @param c: The character to write.
+void SerialOutputDev::writePolled(char const c) {
+    if (!m_fifoFree) {
+        while (!canSendData()) {
+            asm("pause");
+        }
+        m_fifoFree = m_fifoSize;
+    }
+    writeRegister(Register::Data, c);
+    m_fifoFree--;
+}
+
+// Move up to a FIFO-full of chars from the TX ring to the UART. Must be called
+// with m_txLock held and while the FIFO is empty.
+void SerialOutputDev::refillFifo() {
+    u64 const tail(m_txTail.read());
+    u64 const len(min<u64>(m_fifoSize, m_txHead.read() - tail));
+    compilerBarrier();
+    // The chars might wrap around the end of the ring.
+    u64 const pos(tail % TxRingSize);
+    u64 const firstLen(min(len, TxRingSize - pos));
+    Cpu::Port const port(registerToPort(Register::Data));
+    Cpu::outsb(port, m_txRing + pos, firstLen);
+    if (firstLen < len) {
+        Cpu::outsb(port, m_txRing, len - firstLen);
+    }
+    // Only release the space once the chars have been written out.
+    compilerBarrier();
+    m_txTail = tail + len;
+}
+
+// Refill the FIFO if the transmitter is empty. If `wait` is true, wait for the
+// transmitter to be empty first.
+// @param wait: Whether or not to wait for the FIFO to be empty.
+void SerialOutputDev::kickTx(bool const wait) {
+    Concurrency::LockGuard lg(m_txLock);
+    bool isEmpty(canSendData());
+    while (wait && !isEmpty) {
+        asm("pause");
+        isEmpty = canSendData();
+    }
+    if (isEmpty) {
+        refillFifo();
+    }
+}
 }
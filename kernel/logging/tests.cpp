@@ -0,0 +1,557 @@
+// Tests for the logging.
+#include <logging/log.hpp>
+#include <logging/logbuffer.hpp>
+#include <logging/serial.hpp>
+#include <interrupts/stats.hpp>
+#include <interrupts/softirq.hpp>
+#include <smp/percpu.hpp>
+#include <smp/remotecall.hpp>
+#include <timers/tsc.hpp>
+#include <cpu/cpu.hpp>
+#include <util/cstring.hpp>
+#include <util/ptr.hpp>
+#include <selftests/macros.hpp>
+
+namespace Log {
+
+// OutputDev recording everything written to it in a string. New lines are
+// recorded as '\n' and colors as their value in brackets, e.g. "<2>".
+class RecordingOutputDev : public Logging::Logger::OutputDev {
+public:
+    RecordingOutputDev() : m_len(0) {
+        m_str[0] = '\0';
+    }
+
+    virtual void printChar(char const c) {
+        if (m_len < sizeof(m_str) - 1) {
+            m_str[m_len++] = c;
+            m_str[m_len] = '\0';
+        }
+    }
+
+    virtual void newLine() {
+        printChar('\n');
+    }
+
+    virtual void clear() {}
+
+    virtual void setColor(Logging::Logger::Color const color) {
+        printChar('<');
+        printChar('0' + static_cast<u8>(color));
+        printChar('>');
+    }
+
+    // Check the content recorded so far.
+    // @param expected: The expected content.
+    // @return: true if the recorded content equals `expected`.
+    bool equals(char const * const expected) const {
+        return Util::streq(m_str, expected);
+    }
+
+    // Get the content recorded so far.
+    // @return: The NUL-terminated content.
+    char const * str() const {
+        return m_str;
+    }
+
+private:
+    char m_str[512];
+    u64 m_len;
+};
+
+// Append a message to a LogBuffer.
+// @param buffer: The buffer.
+// @param timestamp: The timestamp of the message.
+// @param msg: The message, a new line is appended.
+// @return: The result of commit().
+static bool append(Logging::LogBuffer& buffer,
+                   u64 const timestamp,
+                   char const * const msg) {
+    buffer.begin(timestamp);
+    buffer.setColor(Logging::Logger::Color::Warn);
+    Logging::Logger(buffer).printf(msg);
+    return buffer.commit();
+}
+
+// Check that messages are popped from a LogBuffer in the order they were
+// committed, with their color and new line.
+SelfTests::TestResult logBufferOrderTest() {
+    Ptr<Logging::LogBuffer> const buffer(Ptr<Logging::LogBuffer>::New());
+    TEST_ASSERT(buffer->oldestTimestamp() == ~0ULL);
+    TEST_ASSERT(append(*buffer, 10, "first"));
+    TEST_ASSERT(append(*buffer, 20, "second"));
+    // A message started but not committed is not visible.
+    buffer->begin(30);
+    buffer->printChar('x');
+    TEST_ASSERT(buffer->oldestTimestamp() == 10);
+    RecordingOutputDev dev;
+    buffer->pop(dev);
+    TEST_ASSERT(dev.equals("<1>first\n"));
+    TEST_ASSERT(buffer->oldestTimestamp() == 20);
+    buffer->pop(dev);
+    TEST_ASSERT(dev.equals("<1>first\n<1>second\n"));
+    TEST_ASSERT(buffer->oldestTimestamp() == ~0ULL);
+    return SelfTests::TestResult::Success;
+}
+
+// Check that a full LogBuffer rejects messages until it is drained, including
+// when messages wrap around the end of the ring, and that long messages are
+// truncated.
+SelfTests::TestResult logBufferFullTest() {
+    Ptr<Logging::LogBuffer> const buffer(Ptr<Logging::LogBuffer>::New());
+    char longMsg[2 * Logging::LogBuffer::MaxMessageLen];
+    for (u64 i(0); i < sizeof(longMsg) - 1; ++i) {
+        longMsg[i] = 'a';
+    }
+    longMsg[sizeof(longMsg) - 1] = '\0';
+    u64 numCommitted(0);
+    while (append(*buffer, numCommitted, longMsg)) {
+        numCommitted++;
+    }
+    TEST_ASSERT(numCommitted > 0);
+    TEST_ASSERT(numCommitted <= Logging::LogBuffer::Size
+                / Logging::LogBuffer::MaxMessageLen);
+    // Draining a single message makes room for exactly one more message.
+    RecordingOutputDev dev;
+    buffer->pop(dev);
+    TEST_ASSERT(buffer->commit());
+    TEST_ASSERT(!append(*buffer, numCommitted + 1, longMsg));
+    buffer->drop();
+    TEST_ASSERT(buffer->numDropped() == 1);
+    // The messages are truncated to MaxMessageLen chars, including the new
+    // line.
+    char expected[Logging::LogBuffer::MaxMessageLen + 3];
+    expected[0] = '<';
+    expected[1] = '1';
+    expected[2] = '>';
+    for (u64 i(3); i < sizeof(expected) - 1; ++i) {
+        expected[i] = 'a';
+    }
+    expected[sizeof(expected) - 2] = '\n';
+    expected[sizeof(expected) - 1] = '\0';
+    TEST_ASSERT(dev.equals(expected));
+    // All messages, including those that wrapped around, are intact.
+    for (u64 i(1); i <= numCommitted; ++i) {
+        TEST_ASSERT(buffer->oldestTimestamp() == i);
+        RecordingOutputDev msgDev;
+        buffer->pop(msgDev);
+        TEST_ASSERT(msgDev.equals(expected));
+    }
+    TEST_ASSERT(buffer->oldestTimestamp() == ~0ULL);
+    return SelfTests::TestResult::Success;
+}
+
+// Run the logging tests.
+void Test(SelfTests::TestRunner& runner) {
+    RUN_TEST(runner, logBufferOrderTest);
+    RUN_TEST(runner, logBufferFullTest);
+}
+
+// Redirect the log to a device for the lifetime of this object, see
+// redirectOutput().
+class OutputRedirection {
+public:
+    // Redirect the log.
+    // @param dev: The device to redirect the log to.
+    OutputRedirection(Logging::Logger::OutputDev& dev) {
+        redirectOutput(&dev);
+    }
+
+    // Restore the actual output device.
+    ~OutputRedirection() {
+        redirectOutput(nullptr);
+    }
+};
+
+// OutputDev counting the lines written to it and the lines ending with a given
+// suffix. The device can also be made to block, simulating a slow device.
+class LineCountingOutputDev : public Logging::Logger::OutputDev {
+public:
+    // Create a device.
+    // @param suffix: The suffix of the lines to count, including the new line.
+    LineCountingOutputDev(char const * const suffix) : m_suffix(suffix),
+        m_lineLen(0), m_numLines(0), m_numMatches(0) {}
+
+    virtual void printChar(char const c) {
+        waitIfBlocking();
+        if (m_lineLen < sizeof(m_line) - 1) {
+            m_line[m_lineLen++] = c;
+        }
+    }
+
+    virtual void newLine() {
+        printChar('\n');
+        m_line[m_lineLen] = '\0';
+        u64 const suffixLen(Util::strlen(m_suffix));
+        if (m_lineLen >= suffixLen
+            && Util::streq(m_line + m_lineLen - suffixLen, m_suffix)) {
+            m_numMatches = m_numMatches + 1;
+        }
+        m_numLines = m_numLines + 1;
+        m_lineLen = 0;
+    }
+
+    virtual void clear() {}
+
+    virtual void setColor(Logging::Logger::Color const) {
+        waitIfBlocking();
+    }
+
+    // Make the next call to this device block until release() is called.
+    void blockNextCall() {
+        m_isBlocked = 0;
+        m_blockNextCall = 1;
+    }
+
+    // Check if a call is blocked in this device.
+    // @return: true if a call is waiting for release().
+    bool isBlocked() const {
+        return !!m_isBlocked.read();
+    }
+
+    // Unblock the call blocked by blockNextCall(), if any.
+    void release() {
+        m_blockNextCall = 0;
+    }
+
+    // Get the number of lines written so far.
+    // @return: The number of calls to newLine().
+    u64 numLines() const {
+        return m_numLines;
+    }
+
+    // Get the number of lines written so far that ended with the suffix.
+    // @return: The number of matching lines.
+    u64 numMatches() const {
+        return m_numMatches;
+    }
+
+private:
+    // Wait for release() if blockNextCall() was called.
+    void waitIfBlocking() {
+        if (!!m_blockNextCall.read()) {
+            m_isBlocked = 1;
+            while (!!m_blockNextCall.read()) {
+                asm("pause");
+            }
+        }
+    }
+
+    char const * const m_suffix;
+    char m_line[256];
+    u64 m_lineLen;
+    u64 volatile m_numLines;
+    u64 volatile m_numMatches;
+    Atomic<u64> m_blockNextCall;
+    Atomic<u64> m_isBlocked;
+};
+
+// Get an online cpu other than the current one.
+// @return: The id of the cpu, the current cpu if it is the only one online.
+static Smp::Id otherOnlineCpu() {
+    Smp::Id other(Smp::id());
+    for (Smp::Id cpu(0); cpu < Smp::ncpus(); ++cpu) {
+        if (cpu != Smp::id() && Smp::PerCpu::data(cpu).isOnline) {
+            other = cpu;
+        }
+    }
+    return other;
+}
+
+// Check that messages logged by two cpus in alternation are printed in the
+// order of their timestamps once the buffers of both cpus are flushed.
+SelfTests::TestResult logFlushMergeTest() {
+    TEST_REQUIRES_MULTICORE();
+    // Number of messages logged by each cpu.
+    static constexpr u64 NumMessages = 3;
+    // Incremented by each cpu once it logged its message, the current cpu logs
+    // on even values and the other cpu on odd values.
+    static Atomic<u64> turn;
+    turn = 0;
+    RecordingOutputDev dev;
+    bool allMessagesLogged(true);
+    {
+        OutputRedirection const redirection(dev);
+        // Interrupts are disabled on both cpus so that no LogFlushSoftirq
+        // drains the buffers before all the messages are logged.
+        bool const savedIrqFlag(Cpu::interruptsEnabled());
+        Cpu::disableInterrupts();
+        Ptr<Smp::RemoteCall::CallResult<void>> const call(
+            Smp::RemoteCall::invokeOn(otherOnlineCpu(), []() {
+                bool const remoteIrqFlag(Cpu::interruptsEnabled());
+                Cpu::disableInterrupts();
+                for (u64 i(0); i < NumMessages; ++i) {
+                    bool const isTurn(SelfTests::waitFor([&]() {
+                        return turn.read() == 2 * i + 1;
+                    }, 1000));
+                    if (!isTurn) {
+                        break;
+                    }
+                    Log::info("b{}", i);
+                    turn = 2 * i + 2;
+                }
+                Cpu::setInterruptFlag(remoteIrqFlag);
+            }));
+        for (u64 i(0); i < NumMessages && allMessagesLogged; ++i) {
+            Log::info("a{}", i);
+            turn = 2 * i + 1;
+            allMessagesLogged = SelfTests::waitFor([&]() {
+                return turn.read() == 2 * i + 2;
+            }, 1000);
+        }
+        Cpu::setInterruptFlag(savedIrqFlag);
+        call->wait();
+        Log::flush();
+    }
+    TEST_ASSERT(allMessagesLogged);
+    TEST_ASSERT(dev.equals("<0>[INFO] a0\n<0>[INFO] b0\n"
+                           "<0>[INFO] a1\n<0>[INFO] b1\n"
+                           "<0>[INFO] a2\n<0>[INFO] b2\n"));
+    return SelfTests::TestResult::Success;
+}
+
+// Format the end of the line reporting dropped messages of the current cpu, in
+// the same way the flush does.
+// @param dev: The device to format the line into.
+static void formatDropReportSuffix(RecordingOutputDev& dev) {
+    Logging::Logger(dev).printf(" log message(s) dropped on cpu {}",
+                                Smp::id().raw());
+}
+
+// Number of messages logged to overflow the buffer of a cpu. Each message is
+// about 50 bytes in the buffer.
+static constexpr u64 NumMessagesToOverflow = 2 * Logging::LogBuffer::Size / 50;
+
+// Check that a cpu whose buffer is full makes room by printing its own oldest
+// messages if no other cpu is flushing, in which case no message is lost.
+SelfTests::TestResult logFullBufferDrainTest() {
+    RecordingOutputDev suffixDev;
+    formatDropReportSuffix(suffixDev);
+    LineCountingOutputDev dev(suffixDev.str());
+    {
+        OutputRedirection const redirection(dev);
+        // Keep the LogFlushSoftirq from draining the buffer.
+        bool const savedIrqFlag(Cpu::interruptsEnabled());
+        Cpu::disableInterrupts();
+        for (u64 i(0); i < NumMessagesToOverflow; ++i) {
+            Log::info("Filling the log buffer: {}", i);
+        }
+        Cpu::setInterruptFlag(savedIrqFlag);
+        Log::flush();
+    }
+    TEST_ASSERT(dev.numLines() == NumMessagesToOverflow);
+    TEST_ASSERT(!dev.numMatches());
+    return SelfTests::TestResult::Success;
+}
+
+// Check that messages logged while the buffer of the cpu is full and another
+// cpu is flushing are dropped, and that the flush reports them.
+SelfTests::TestResult logDropTest() {
+    TEST_REQUIRES_MULTICORE();
+    RecordingOutputDev suffixDev;
+    formatDropReportSuffix(suffixDev);
+    LineCountingOutputDev dev(suffixDev.str());
+    bool flushBlocked;
+    {
+        OutputRedirection const redirection(dev);
+        // Keep the LogFlushSoftirq of this cpu from draining the buffer.
+        bool const savedIrqFlag(Cpu::interruptsEnabled());
+        Cpu::disableInterrupts();
+        // Have the other cpu flush a message and block in the output device,
+        // it then holds the flush until release().
+        dev.blockNextCall();
+        Log::info("Blocking the flush");
+        Smp::RemoteCall::invokeOn(otherOnlineCpu(), []() {
+            Interrupts::Softirq::raise(Interrupts::Softirq::LogFlushSoftirq);
+        });
+        flushBlocked = SelfTests::waitFor([&]() {
+            return dev.isBlocked();
+        }, 1000);
+        for (u64 i(0); i < NumMessagesToOverflow && flushBlocked; ++i) {
+            Log::info("Filling the log buffer: {}", i);
+        }
+        dev.release();
+        Cpu::setInterruptFlag(savedIrqFlag);
+        Log::flush();
+    }
+    TEST_ASSERT(flushBlocked);
+    TEST_ASSERT(dev.numMatches() == 1);
+    TEST_ASSERT(dev.numLines() < NumMessagesToOverflow);
+    return SelfTests::TestResult::Success;
+}
+
+// Defined in log.cpp.
+extern Logging::SerialOutputDev* serialConsole(Interrupts::Vector& vector);
+
+// Skip the test if the serial console is not interrupt-driven, e.g. when
+// logging to VGA. Otherwise set `console` and `vector` to the serial console
+// and the vector of its IRQ.
+#define TEST_REQUIRES_SERIAL_CONSOLE(console, vector)                         \
+    Interrupts::Vector vector(0);                                             \
+    Logging::SerialOutputDev* const console(serialConsole(vector));          \
+    do {                                                                      \
+        if (!console) {                                                       \
+            Log::warn("Skipping {}, no interrupt-driven serial console",      \
+                      __FUNCTION__);                                          \
+            return SelfTests::TestResult::Skip;                               \
+        }                                                                     \
+    } while (0)
+
+// Put the UART of the serial console in loopback mode for the lifetime of this
+// object, the chars sent are then received back instead of going out to the
+// host. The log must be redirected in the meantime, see OutputRedirection.
+class SerialLoopback {
+public:
+    // Enable the loopback mode and empty the RX FIFO.
+    // @param console: The serial console.
+    SerialLoopback(Logging::SerialOutputDev& console) : m_console(console) {
+        m_console.flush();
+        m_console.setLoopback(true);
+        char c;
+        while (m_console.receiveChar(c)) {}
+    }
+
+    // Drain the TX ring and disable the loopback mode.
+    ~SerialLoopback() {
+        m_console.flush();
+        m_console.setLoopback(false);
+    }
+
+private:
+    Logging::SerialOutputDev& m_console;
+};
+
+// Get the number of interrupts received on a vector by all cpus.
+// @param vector: The vector.
+// @return: The sum of the interrupt counts of all cpus.
+static u64 interruptCount(Interrupts::Vector const vector) {
+    u64 count(0);
+    for (Smp::Id cpu(0); cpu < Smp::ncpus(); ++cpu) {
+        count += Interrupts::Stats::vectorStats(cpu, vector).count;
+    }
+    return count;
+}
+
+// Check that a FIFO was detected on the UART, 16 bytes on a 16550A (e.g. QEMU)
+// or 64 bytes on a 16750.
+SelfTests::TestResult serialFifoSizeTest() {
+    TEST_REQUIRES_SERIAL_CONSOLE(console, vector);
+    TEST_ASSERT(console->fifoSize() == 16 || console->fifoSize() == 64);
+    return SelfTests::TestResult::Success;
+}
+
+// Check that the chars printed to the serial console reach the UART unchanged,
+// including when the FIFO is refilled by the interrupt handler.
+SelfTests::TestResult serialLoopbackTest() {
+    TEST_REQUIRES_SERIAL_CONSOLE(console, vector);
+    // A FIFO-full of chars, so that none is dropped by the RX FIFO.
+    char const * const expected("0123456789abcd\r\n");
+    RecordingOutputDev dev;
+    char received[17] = {};
+    u64 numReceived(0);
+    bool isDrained;
+    {
+        OutputRedirection const redirection(dev);
+        SerialLoopback const loopback(*console);
+        for (char const * c(expected); *c != '\r'; ++c) {
+            console->printChar(*c);
+        }
+        console->newLine();
+        isDrained = SelfTests::waitFor([&]() {
+            return console->isTxRingEmpty();
+        }, 1000);
+        while (numReceived < 16) {
+            char c;
+            if (!SelfTests::waitFor([&]() {
+                    return console->receiveChar(c);
+                }, 1000)) {
+                break;
+            }
+            received[numReceived++] = c;
+        }
+    }
+    TEST_ASSERT(isDrained);
+    TEST_ASSERT(numReceived == 16);
+    TEST_ASSERT(Util::streq(received, expected));
+    return SelfTests::TestResult::Success;
+}
+
+// Print `len` chars to the serial console and start their transmission.
+// @param console: The serial console.
+// @param len: The number of chars to print, in addition to the new line.
+static void printToSerialConsole(Logging::SerialOutputDev& console,
+                                 u64 const len) {
+    for (u64 i(0); i < len; ++i) {
+        console.printChar('a' + (i % 26));
+    }
+    console.newLine();
+}
+
+// Check that a burst of more chars than the TX ring can hold is drained by the
+// interrupt handler once the writer is done.
+SelfTests::TestResult serialTxRingDrainTest() {
+    TEST_REQUIRES_SERIAL_CONSOLE(console, vector);
+    RecordingOutputDev dev;
+    u64 numInterrupts;
+    bool isDrained;
+    {
+        OutputRedirection const redirection(dev);
+        SerialLoopback const loopback(*console);
+        u64 const startCount(interruptCount(vector));
+        u64 const len(Logging::SerialOutputDev::TxRingSize * 3 / 2);
+        printToSerialConsole(*console, len);
+        // Leave the rest of the ring to the interrupt handler.
+        isDrained = SelfTests::waitFor([&]() {
+            return console->isTxRingEmpty();
+        }, 1000);
+        numInterrupts = interruptCount(vector) - startCount;
+    }
+    TEST_ASSERT(isDrained);
+    // The ring was full when the writer returned, most of it must have been
+    // drained one FIFO-full per interrupt.
+    u64 const minInterrupts(
+        Logging::SerialOutputDev::TxRingSize / console->fifoSize() / 2);
+    TEST_ASSERT(numInterrupts >= minInterrupts);
+    return SelfTests::TestResult::Success;
+}
+
+// Compare the time spent by a writer printing a burst of chars to the time it
+// takes the UART to send them. With the TX ring, the writer should not wait on
+// the UART.
+SelfTests::TestResult serialThroughputTest() {
+    TEST_REQUIRES_SERIAL_CONSOLE(console, vector);
+    u64 const len(Logging::SerialOutputDev::TxRingSize / 2);
+    RecordingOutputDev dev;
+    u64 writerCycles;
+    u64 drainCycles;
+    bool isDrained;
+    {
+        OutputRedirection const redirection(dev);
+        SerialLoopback const loopback(*console);
+        u64 const start(Cpu::rdtsc());
+        printToSerialConsole(*console, len);
+        writerCycles = Cpu::rdtsc() - start;
+        isDrained = SelfTests::waitFor([&]() {
+            return console->isTxRingEmpty();
+        }, 1000);
+        drainCycles = Cpu::rdtsc() - start;
+    }
+    TEST_ASSERT(isDrained);
+    Log::info("    Writer: {} cycles/byte, UART: {} cycles/byte",
+              writerCycles / len, drainCycles / len);
+    TEST_ASSERT(writerCycles * 4 < drainCycles);
+    return SelfTests::TestResult::Success;
+}
+
+// Run the tests of the asynchronous logging and of the interrupt-driven serial
+// console. Those tests need the APs to be online.
+void AsyncTest(SelfTests::TestRunner& runner) {
+    RUN_TEST(runner, logFlushMergeTest);
+    RUN_TEST(runner, logFullBufferDrainTest);
+    RUN_TEST(runner, logDropTest);
+    RUN_TEST(runner, serialFifoSizeTest);
+    RUN_TEST(runner, serialLoopbackTest);
+    RUN_TEST(runner, serialTxRingDrainTest);
+    RUN_TEST(runner, serialThroughputTest);
+}
+}
@@ -14,11 +14,17 @@
 #include <util/err.hpp>
 #include <datastruct/datastruct.hpp>
 #include <memory/malloc.hpp>
+#include <memory/virtalloc.hpp>
+#include <util/cstring.hpp>
 #include <util/assert.hpp>
 #include <util/subrange.hpp>
 #include <acpi/acpi.hpp>
 #include <timers/timers.hpp>
 #include <timers/lapictimer.hpp>
+#include <timers/tsc.hpp>
+#include <timers/hpet.hpp>
+#include <timers/cpuidfreq.hpp>
+#include <timers/hrtimer.hpp>
 #include <interrupts/vectormap.hpp>
 #include <smp/smp.hpp>
 #include <memory/stack.hpp>
@@ -29,6 +35,8 @@
 #include <util/ptr.hpp>
 #include <sched/sched.hpp>
 #include <paging/addrspace.hpp>
+#include <pci/pci.hpp>
+#include <profiler/profiler.hpp>
 
 #include "interrupts/ioapic.hpp"
 
@@ -49,6 +57,7 @@ static void runSelfTests() {
     SelfTests::TestRunner runner;
 
     Cpu::Test(runner);
+    Log::Test(runner);
     Memory::Segmentation::Test(runner);
     Interrupts::Test(runner);
     Paging::Test(runner);
@@ -57,12 +66,24 @@ static void runSelfTests() {
     ErrType::Test(runner);
     DataStruct::Test(runner);
     HeapAlloc::Test(runner);
+    VirtAlloc::Test(runner);
+    Util::Test(runner);
+    Memory::Test(runner);
     Timer::Test(runner);
+    Timer::Hpet::Test(runner);
+    Timer::CpuidFreq::Test(runner);
     Smp::Test(runner);
 
     wakeAps();
+    Timer::Tsc::checkSynchronization();
 
+    Log::AsyncTest(runner);
     Interrupts::Ipi::Test(runner);
+    Interrupts::IrqAffinityTest(runner);
+    Pci::Test(runner);
+    Profiler::Test(runner);
+    Timer::Tsc::Test(runner);
+    Timer::HrTimerTest(runner);
     Smp::RemoteCall::Test(runner);
     Concurrency::Test(runner);
     SmartPtr::Test(runner);
@@ -112,22 +133,46 @@ static void initKernel(BootStruct const * const bootStruct) {
     // procedures may require dynamic allocations.
     HeapAlloc::Init();
     Paging::InitAddrSpace();
+    VirtAlloc::Init();
     // ACPI info must be parsed before initializing LAPIC and I/O APIC(s) as it
     // contains info about them.
     Acpi::Init();
     Interrupts::InitLapic();
     Interrupts::InitIoApics();
+    Interrupts::InitCpuLocal();
     Smp::PerCpu::Init();
+    // The per-cpu TSS and its IST stacks require the per-cpu data and stack
+    // allocation.
+    Memory::Segmentation::InitCurrCpuTss();
     Smp::RemoteCall::Init();
+    // The HPET is used to calibrate the TSC and the LAPIC timer, if present.
+    Timer::Hpet::Init();
+    // Calibrating the TSC may use the PIT, whose interrupts need the per-cpu
+    // data.
+    Timer::Tsc::Init();
+    // Log messages are timestamped with the monotonic clock.
+    Log::InitAsync();
+    Log::InitSerialInterrupt();
+    Timer::HrTimer::Init();
+    // The IRQ balancer runs from a high-resolution timer.
+    Interrupts::InitIrqBalancer();
+    // PCI enumeration needs the MCFG parsed by Acpi::Init().
+    Pci::Init();
+    // The sample buffers are per-cpu.
+    Profiler::Init();
 }
 
 // Target code after the BSP switches to the new higher-half stack. This
 // function does not return.
 static void stackSwitchTarget() {
     runSelfTests();
+    // Only logs a profile when built with PROFILE_PERIOD.
+    Profiler::stop();
+    Profiler::dump();
 
     // This may only work on QEMU.
     Log::info("Shutting down");
+    Log::flush();
     Cpu::outw(0x604, 0x2000);
 
     while (true) {
@@ -61,7 +61,8 @@ Res<void*> HeapAllocator::alloc(u64 const size) {
             // Map the new frame to the end of the current heap.
             PhyAddr const framePhyAddr(frameAllocRes->addr());
             VirAddr const mappedAddr(m_heapStart.raw() + m_heapSize);
-            Paging::PageAttr const attrs(Paging::PageAttr::Writable);
+            Paging::PageAttr const attrs(Paging::PageAttr::Writable
+                                         | Paging::PageAttr::Global);
             Err const err(Paging::map(mappedAddr, framePhyAddr, attrs, 1));
             if (!!err) {
                 Log::crit("Could not map new frame for heap allocator");
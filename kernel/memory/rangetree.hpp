@@ -0,0 +1,274 @@
+// Balanced tree of disjoint ranges, used by the virtual address allocator.
+#pragma once
+#include <util/ints.hpp>
+#include <util/assert.hpp>
+
+namespace VirtAlloc {
+
+// An AVL tree of disjoint ranges [start; start + size) keyed by their start.
+// Each node carries a value of type T. Each node also keeps track of the size
+// of the biggest range in its sub-tree, which allows finding the lowest range
+// of at least a given size in O(log n).
+// All operations are O(log n) where n is the number of ranges in the tree.
+template<typename T>
+class RangeTree {
+public:
+    // A node of the tree, describing a single range.
+    struct Node {
+        // Start of the range.
+        u64 start;
+        // Size of the range.
+        u64 size;
+        // The value associated with the range.
+        T value;
+        // Size of the biggest range in the sub-tree rooted at this node.
+        u64 maxSize;
+        // Height of the sub-tree rooted at this node.
+        u64 height;
+        Node* left;
+        Node* right;
+    };
+
+    // Create an empty tree.
+    RangeTree() : m_root(nullptr), m_size(0) {}
+
+    // De-allocate all the nodes of the tree.
+    ~RangeTree() {
+        destroy(m_root);
+    }
+
+    // Trees own their nodes and are therefore not copyable.
+    RangeTree(RangeTree const&) = delete;
+    RangeTree& operator=(RangeTree const&) = delete;
+
+    // Insert a range in the tree. The range must not overlap with any range
+    // already in the tree.
+    // @param start: The start of the range.
+    // @param size: The size of the range, must be non-zero.
+    // @param value: The value associated with the range.
+    void insert(u64 const start, u64 const size, T const& value) {
+        ASSERT(!!size);
+        Node* const node(new Node{start, size, value, size, 1, nullptr,
+                                  nullptr});
+        m_root = insert(m_root, node);
+        m_size++;
+    }
+
+    // Remove a range from the tree. The range must be in the tree.
+    // @param start: The start of the range to remove.
+    void erase(u64 const start) {
+        m_root = erase(m_root, start);
+        m_size--;
+    }
+
+    // Find the range with the highest start that is lower or equal to addr.
+    // @param addr: The address to look for.
+    // @return: A pointer to the node of the range or nullptr if no such range
+    // exists. The pointer is invalidated by any insert() or erase().
+    Node const* floor(u64 const addr) const {
+        Node const* res(nullptr);
+        Node const* curr(m_root);
+        while (!!curr) {
+            if (curr->start <= addr) {
+                res = curr;
+                curr = curr->right;
+            } else {
+                curr = curr->left;
+            }
+        }
+        return res;
+    }
+
+    // Find the range with the lowest start that is higher or equal to addr.
+    // @param addr: The address to look for.
+    // @return: A pointer to the node of the range or nullptr if no such range
+    // exists. The pointer is invalidated by any insert() or erase().
+    Node const* ceil(u64 const addr) const {
+        Node const* res(nullptr);
+        Node const* curr(m_root);
+        while (!!curr) {
+            if (curr->start >= addr) {
+                res = curr;
+                curr = curr->left;
+            } else {
+                curr = curr->right;
+            }
+        }
+        return res;
+    }
+
+    // Find the range containing an address.
+    // @param addr: The address to look for.
+    // @return: A pointer to the node of the range containing addr or nullptr if
+    // there is no such range. The pointer is invalidated by any insert() or
+    // erase().
+    Node const* find(u64 const addr) const {
+        Node const* const node(floor(addr));
+        if (!!node && addr - node->start < node->size) {
+            return node;
+        } else {
+            return nullptr;
+        }
+    }
+
+    // Find the range with the lowest start among the ranges of at least a given
+    // size.
+    // @param size: The minimum size of the range.
+    // @return: A pointer to the node of the range or nullptr if no range is big
+    // enough. The pointer is invalidated by any insert() or erase().
+    Node const* firstFit(u64 const size) const {
+        Node const* curr(m_root);
+        while (!!curr && curr->maxSize >= size) {
+            if (maxSize(curr->left) >= size) {
+                curr = curr->left;
+            } else if (curr->size >= size) {
+                return curr;
+            } else {
+                curr = curr->right;
+            }
+        }
+        return nullptr;
+    }
+
+    // Get the number of ranges in the tree.
+    // @return: The number of ranges.
+    u64 size() const {
+        return m_size;
+    }
+
+private:
+    // Helpers returning the height/maxSize of a potentially null sub-tree.
+    static u64 height(Node const* const node) {
+        return !!node ? node->height : 0;
+    }
+
+    static u64 maxSize(Node const* const node) {
+        return !!node ? node->maxSize : 0;
+    }
+
+    // Re-compute the height and maxSize of a node from its children.
+    // @param node: The node to update.
+    static void update(Node* const node) {
+        node->height = 1 + max(height(node->left), height(node->right));
+        node->maxSize = max(node->size,
+                            max(maxSize(node->left), maxSize(node->right)));
+    }
+
+    // Rotate a sub-tree to the right.
+    // @param node: The root of the sub-tree.
+    // @return: The new root of the sub-tree.
+    static Node* rotateRight(Node* const node) {
+        Node* const newRoot(node->left);
+        node->left = newRoot->right;
+        newRoot->right = node;
+        update(node);
+        update(newRoot);
+        return newRoot;
+    }
+
+    // Rotate a sub-tree to the left.
+    // @param node: The root of the sub-tree.
+    // @return: The new root of the sub-tree.
+    static Node* rotateLeft(Node* const node) {
+        Node* const newRoot(node->right);
+        node->right = newRoot->left;
+        newRoot->left = node;
+        update(node);
+        update(newRoot);
+        return newRoot;
+    }
+
+    // Re-balance a sub-tree after an insertion or deletion in one of its
+    // children.
+    // @param node: The root of the sub-tree.
+    // @return: The new root of the sub-tree.
+    static Node* balance(Node* const node) {
+        update(node);
+        u64 const leftHeight(height(node->left));
+        u64 const rightHeight(height(node->right));
+        if (leftHeight > rightHeight + 1) {
+            if (height(node->left->left) < height(node->left->right)) {
+                node->left = rotateLeft(node->left);
+            }
+            return rotateRight(node);
+        } else if (rightHeight > leftHeight + 1) {
+            if (height(node->right->right) < height(node->right->left)) {
+                node->right = rotateRight(node->right);
+            }
+            return rotateLeft(node);
+        }
+        return node;
+    }
+
+    // Insert a node in a sub-tree.
+    // @param root: The root of the sub-tree.
+    // @param node: The node to insert.
+    // @return: The new root of the sub-tree.
+    static Node* insert(Node* const root, Node* const node) {
+        if (!root) {
+            return node;
+        }
+        ASSERT(node->start != root->start);
+        if (node->start < root->start) {
+            root->left = insert(root->left, node);
+        } else {
+            root->right = insert(root->right, node);
+        }
+        return balance(root);
+    }
+
+    // Detach the node with the lowest start from a sub-tree.
+    // @param root: The root of the sub-tree.
+    // @param min: Output param set to the detached node.
+    // @return: The new root of the sub-tree.
+    static Node* detachMin(Node* const root, Node** const min) {
+        if (!root->left) {
+            *min = root;
+            return root->right;
+        }
+        root->left = detachMin(root->left, min);
+        return balance(root);
+    }
+
+    // Remove and de-allocate a node from a sub-tree.
+    // @param root: The root of the sub-tree.
+    // @param start: The start of the range to remove.
+    // @return: The new root of the sub-tree.
+    static Node* erase(Node* const root, u64 const start) {
+        ASSERT(!!root);
+        if (start < root->start) {
+            root->left = erase(root->left, start);
+        } else if (start > root->start) {
+            root->right = erase(root->right, start);
+        } else {
+            Node* const left(root->left);
+            Node* right(root->right);
+            delete root;
+            if (!right) {
+                return left;
+            }
+            Node* min;
+            right = detachMin(right, &min);
+            min->left = left;
+            min->right = right;
+            return balance(min);
+        }
+        return balance(root);
+    }
+
+    // De-allocate all nodes of a sub-tree.
+    // @param root: The root of the sub-tree.
+    static void destroy(Node* const root) {
+        if (!!root) {
+            destroy(root->left);
+            destroy(root->right);
+            delete root;
+        }
+    }
+
+    // The root of the tree.
+    Node* m_root;
+    // The number of ranges in the tree.
+    u64 m_size;
+};
+}
@@ -3,7 +3,9 @@
 
 #include <util/util.hpp>
 #include <util/panic.hpp>
+#include <util/cstring.hpp>
 #include <memory/segmentation.hpp>
+#include <smp/percpu.hpp>
 
 namespace Memory::Segmentation {
 // Constructor meant to be called by deriving classes.
@@ -73,6 +75,10 @@ static Descriptor GDT[] = {
     Descriptor64(Cpu::PrivLevel::Ring0, Descriptor::Type::DataReadWrite),
 };
 
+// The number of entries in the kernel-wide GDT.
+static constexpr u64 GDT_SIZE = sizeof(GDT) / sizeof(*GDT);
+static_assert(GDT_SIZE == TSS_SELECTOR_INDEX);
+
 // Has Init() been called already? Used to assert that cpus are not trying to
 // use the namespace before its initialization.
 static bool IsInitialized = false;
@@ -106,4 +112,72 @@ void InitCurrCpu() {
     Cpu::writeSegmentReg(Cpu::SegmentReg::Ss, dataSel);
 }
 
+// Create the raw TSS descriptor for a TSS. In 64-bit mode a TSS descriptor
+// occupies two GDT entries.
+// @param tss: The TSS the descriptor points to.
+// @param low: Output parameter set to the first entry of the descriptor.
+// @param high: Output parameter set to the second entry of the descriptor.
+static void tssDescriptor(Tss const& tss, u64& low, u64& high) {
+    u64 const base(reinterpret_cast<u64>(&tss));
+    u64 const limit(sizeof(Tss) - 1);
+    // Type of an available 64-bit TSS.
+    u64 const type(0x9);
+    low = (((base >> 24) & 0xff) << 56)
+          | (((limit >> 16) & 0xf) << 48)
+          | (1ULL << 47)
+          | (type << 40)
+          | ((base & 0xffffff) << 16)
+          | (limit & 0xffff);
+    high = base >> 32;
+}
+
+// Configure the current cpu to use its own GDT and TSS, and allocate the stacks
+// of its Interrupt Stack Table.
+void InitCurrCpuTss() {
+    ASSERT(IsInitialized);
+    // Any previous PerCpuTables is de-allocated by this assignment. This is
+    // fine as a cpu only calls this function once, or when being re-started in
+    // which case it is using the kernel-wide GDT and not the old TSS anymore.
+    Ptr<PerCpuTables> const tables(Ptr<PerCpuTables>::New());
+    if (!tables) {
+        PANIC("Cannot allocate the PerCpuTables of cpu {}", Smp::id());
+    }
+    Smp::PerCpu::data().segmentation = tables;
+
+    for (u64 i(0); i < GDT_SIZE; ++i) {
+        tables->gdt[i] = GDT[i].raw();
+    }
+    Util::memzero(&tables->tss, sizeof(tables->tss));
+    tables->tss.ioMapBase = sizeof(Tss);
+    for (u64 i(0); i < NUM_IST_STACKS; ++i) {
+        Res<Ptr<Stack>> const stackAllocRes(Stack::New());
+        if (!stackAllocRes) {
+            PANIC("Cannot allocate IST stack for cpu {}: {}", Smp::id(),
+                  stackAllocRes.error());
+        }
+        tables->istStacks[i] = *stackAllocRes;
+        tables->tss.ist[i] = tables->istStacks[i]->highAddress().raw();
+    }
+    tssDescriptor(tables->tss,
+                  tables->gdt[TSS_SELECTOR_INDEX],
+                  tables->gdt[TSS_SELECTOR_INDEX + 1]);
+
+    // The code and data descriptors are identical to the kernel-wide GDT,
+    // hence there is no need to reload the segment registers.
+    u64 const gdtBase(reinterpret_cast<u64>(tables->gdt));
+    u16 const gdtLimit(sizeof(tables->gdt) - 1);
+    Cpu::lgdt(Cpu::TableDesc(gdtBase, gdtLimit));
+    Cpu::ltr(Cpu::SegmentSel(TSS_SELECTOR_INDEX, Cpu::PrivLevel::Ring0));
+}
+
+// Get the top of the IST stack of the current cpu for the given index.
+// @param index: The index of the IST stack, must not be IstIndex::None.
+// @return: The highest address of the stack.
+VirAddr istStackTop(IstIndex const index) {
+    ASSERT(index != IstIndex::None);
+    Ptr<PerCpuTables> const& tables(Smp::PerCpu::data().segmentation);
+    ASSERT(!!tables);
+    return tables->tss.ist[static_cast<u8>(index) - 1];
+}
+
 }
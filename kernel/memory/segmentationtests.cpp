@@ -1,6 +1,8 @@
 // Tests for segmentation.
 #include <memory/segmentation.hpp>
 #include <selftests/macros.hpp>
+#include <interrupts/interrupts.hpp>
+#include <smp/percpu.hpp>
 
 namespace Memory::Segmentation {
 
@@ -110,8 +112,72 @@ SelfTests::TestResult segmentationDescriptorTest() {
     return SelfTests::TestResult::Success;
 }
 
+// Check that the current cpu uses its own GDT and TSS.
+SelfTests::TestResult tssTest() {
+    Ptr<PerCpuTables> const& tables(Smp::PerCpu::data().segmentation);
+    TEST_ASSERT(!!tables);
+    TEST_ASSERT(Cpu::sgdt().base() == reinterpret_cast<u64>(tables->gdt));
+    Cpu::SegmentSel const tssSel(TSS_SELECTOR_INDEX, Cpu::PrivLevel::Ring0);
+    TEST_ASSERT(Cpu::str() == tssSel);
+    // The TSS descriptor is marked busy once loaded.
+    u64 const type((tables->gdt[TSS_SELECTOR_INDEX] >> 40) & 0xf);
+    TEST_ASSERT(type == 0xb);
+    for (u64 i(0); i < NUM_IST_STACKS; ++i) {
+        TEST_ASSERT(!!tables->istStacks[i]);
+        VirAddr const top(tables->istStacks[i]->highAddress());
+        TEST_ASSERT(tables->tss.ist[i] == top.raw());
+    }
+    return SelfTests::TestResult::Success;
+}
+
+// Check that raising an interrupt configured with an IST index runs its handler
+// on the corresponding IST stack, with interrupts disabled.
+SelfTests::TestResult istStackTest() {
+    // Set by the handler to the value of RSP when running the handler and to
+    // the RSP of the interrupted context.
+    static u64 handlerRsp;
+    static u64 interruptedRsp;
+    // Set by the handler to the value of the interrupt flag in the handler.
+    static bool handlerIrqFlag;
+    handlerRsp = 0;
+    interruptedRsp = 0;
+    handlerIrqFlag = true;
+
+    auto const nmiHandler([](Interrupts::Vector const vector,
+                             Interrupts::Frame const& frame) {
+        ASSERT(vector == 2);
+        handlerRsp = Cpu::getRsp();
+        interruptedRsp = frame.rsp;
+        handlerIrqFlag = Cpu::interruptsEnabled();
+    });
+    u64 currRsp;
+    {
+        TemporaryInterruptHandlerGuard guard(Interrupts::Vector(2),
+                                             nmiHandler);
+        bool const savedIrqFlag(Cpu::interruptsEnabled());
+        Cpu::enableInterrupts();
+        currRsp = Cpu::getRsp();
+        asm("int $2");
+        Cpu::setInterruptFlag(savedIrqFlag);
+    }
+    // A maskable interrupt nesting in the handler would re-use the IST stack.
+    TEST_ASSERT(!handlerIrqFlag);
+
+    VirAddr const top(istStackTop(IstIndex::Nmi));
+    u64 const stackSize(DEFAULT_STACK_PAGES * PAGE_SIZE);
+    TEST_ASSERT(top.raw() - stackSize <= handlerRsp && handlerRsp < top.raw());
+    // The frame must still contain the RSP of the interrupted context, which is
+    // close to the RSP read before raising the interrupt.
+    u64 const diff(currRsp > interruptedRsp ? currRsp - interruptedRsp
+                                            : interruptedRsp - currRsp);
+    TEST_ASSERT(diff < 256);
+    return SelfTests::TestResult::Success;
+}
+
 // Run segmentation tests.
 void Test(SelfTests::TestRunner& runner) {
     RUN_TEST(runner, segmentationDescriptorTest);
+    RUN_TEST(runner, tssTest);
+    RUN_TEST(runner, istStackTest);
 }
 }
@@ -1,143 +1,54 @@
 #include <memory/stack.hpp>
-#include <framealloc/framealloc.hpp>
+#include <memory/virtalloc.hpp>
 #include <smp/smp.hpp>
 #include <util/assert.hpp>
 #include <logging/log.hpp>
 #include <util/panic.hpp>
-#include <datastruct/freelist.hpp>
 
 namespace Memory {
 
-// FIXME: We should only have one such const in the entire code base.
-static constexpr u64 PAGE_SIZE = 0x1000;
-
-// The default size of allocated stacks in number of pages.
-// 16KiB by default.
-static constexpr u64 DEFAULT_STACK_PAGES = 4;
-
-// Stack allocator. This allocates stacks from the very top of the virtual
-// address space.
-class Allocator {
-public:
-    // Allocate a new stack.
-    // @return: The virtual address of the allocated stack, or an error, if any.
-    Res<VirAddr> alloc() {
-        while (true) {
-            u64 const allocSize(DEFAULT_STACK_PAGES * PAGE_SIZE);
-            Res<VirAddr> const allocRes(m_freeList.alloc(allocSize));
-            if (allocRes) {
-                VirAddr const stack(allocRes.value());
-                ASSERT(stack.isPageAligned());
-                return stack;
-            } else {
-                // The allocation can only fail if there was no space available
-                // in the EmbeddedFreeList. Grow the arena.
-                Err const err(growArena(DEFAULT_STACK_PAGES * 4));
-                if (err) {
-                    return err.error();
-                }
-            }
-        }
-    }
-
-    // Free an allocated stack.
-    // @param stack: The stack to de-allocate.
-    void free(VirAddr const stack) {
-        ASSERT(stack.isPageAligned());
-        m_freeList.free(stack, DEFAULT_STACK_PAGES * PAGE_SIZE);
-    }
-
-private:
-    DataStruct::EmbeddedFreeList m_freeList;
-
-    // The current start of the virtual memory area used for stack allocation.
-    // Starting at -0x1000 is required because Stack::m_high is inclusive and we
-    // cannot represent address 0x10000000000000000.
-    VirAddr m_arenaStart = -0x1000;
-
-    // Grow the virtual memory arena used to allocate stacks.
-    // @param numPages: The number of pages to add to the arena.
-    // @return: Any error that occured while growing the arena.
-    Err growArena(u64 const numPages) {
-        Paging::PageAttr const attr(Paging::PageAttr::Writable);
-        for (u64 i(0); i < numPages; ++i) {
-            Res<Frame> const allocRes(FrameAlloc::alloc());
-            if (!allocRes) {
-                return allocRes.error();
-            }
-
-            Err const mapErr(Paging::map(m_arenaStart - PAGE_SIZE,
-                                         allocRes.value().addr(),
-                                         attr,
-                                         1));
-            if (mapErr) {
-                return mapErr.error();
-            }
-            m_arenaStart = m_arenaStart - PAGE_SIZE;
-        }
-        m_freeList.insert(m_arenaStart, numPages * PAGE_SIZE);
-        return Ok;
-    }
-};
-
-static Allocator StackAllocator;
-static Concurrency::SpinLock StackAllocatorLock;
-
-// Allocate a new stack in kernel virtual memory to be used by a CPU.
-// @return: The low address of the stack.
-static Res<VirAddr> allocate() {
-    Concurrency::LockGuard guard(StackAllocatorLock);
-    Res<VirAddr> const allocRes(StackAllocator.alloc());
-    if (!allocRes) {
-        return allocRes.error();
-    }
-
-    u64 const stackSize(DEFAULT_STACK_PAGES * PAGE_SIZE);
-    VirAddr const stackTop(allocRes.value() + stackSize);
-    VirAddr const stackBot(allocRes.value());
-    Log::debug("Allocated stack {}-{}", stackBot, stackTop);
-    return stackBot;
-}
-
-// De-allocate a stack in kernel virtual memory.
-// @param stack: The stack to de-allocate. This should be the low address of the
-// stack, ie the address that was returned by the allocate call.
-static void free(VirAddr const stack) {
-    Concurrency::LockGuard guard(StackAllocatorLock);
-    StackAllocator.free(stack);
-    u64 const stackSize(DEFAULT_STACK_PAGES * PAGE_SIZE);
-    VirAddr const stackTop(stack + stackSize);
-    VirAddr const stackBot(stack);
-    Log::debug("De-allocated stack {}-{}", stackBot, stackTop);
-}
-
-// Allocate a new stack in memory.
+// Allocate a new stack in memory. The stack is entirely mapped and filled with
+// STACK_CANARY.
+// @param numPages: The size of the stack in number of pages.
 // @return: A pointer to the Stack instance associated with the allocated
 // stack or an error, if any.
-Res<Ptr<Stack>> Stack::New() {
-    Res<VirAddr> const allocRes(allocate());
+Res<Ptr<Stack>> Stack::New(u64 const numPages) {
+    ASSERT(!!numPages);
+    // Stacks are allocated by the VirtAlloc which places guard page(s) right
+    // below each allocation. Stacks are never promoted to large pages, see
+    // VirtAlloc::alloc().
+    Paging::PageAttr const attrs(Paging::PageAttr::Writable
+                                 | Paging::PageAttr::Global);
+    Res<VirAddr> const allocRes(VirtAlloc::alloc(numPages, attrs, false));
     if (!allocRes) {
         return allocRes.error();
     }
 
-    // FIXME: For now, all stacks have the same hardcoded size.
-    u64 const stackSize(DEFAULT_STACK_PAGES * PAGE_SIZE);
     VirAddr const low(allocRes.value());
-    VirAddr const high(low + stackSize);
+    VirAddr const high(low + numPages * PAGE_SIZE);
+    // Writing the canary also maps all the pages of the stack. Stacks cannot be
+    // lazily mapped: a page fault while pushing an interrupt frame on the stack
+    // would escalate to a double fault.
+    u64* const words(low.ptr<u64>());
+    for (u64 i(0); i < numPages * PAGE_SIZE / sizeof(u64); ++i) {
+        words[i] = STACK_CANARY;
+    }
 
     // FIXME: We need to introduce a shortcut to perform those
     // if-alloc-ok-else-error schenanigans.
     Ptr<Stack> const stack(Ptr<Stack>::New(low, high));
     if (!stack) {
+        VirtAlloc::free(low);
         return Error::MaxHeapSizeReached;
-    } else {
-        return stack;
     }
+    Log::debug("Allocated stack {}-{}", low, high);
+    return stack;
 }
 
 // De-allocate the associated memory upon destruction.
 Stack::~Stack() {
-    free(m_low);
+    VirtAlloc::free(m_low);
+    Log::debug("De-allocated stack {}-{}", m_low, m_high);
 }
 
 // Get the low or high address of this stack.
@@ -149,6 +60,24 @@ VirAddr Stack::highAddress() const {
     return m_high;
 }
 
+// Get the size of this stack in bytes.
+u64 Stack::size() const {
+    return m_high - m_low;
+}
+
+// Compute the high-water mark of this stack, that is the maximum number of
+// bytes that have ever been used on this stack.
+// @return: The number of bytes used, rounded up to 8 bytes.
+u64 Stack::highWaterMark() const {
+    u64 const * const words(m_low.ptr<u64>());
+    u64 const numWords(size() / sizeof(u64));
+    u64 unused(0);
+    while (unused < numWords && words[unused] == STACK_CANARY) {
+        unused++;
+    }
+    return (numWords - unused) * sizeof(u64);
+}
+
 // Create a Stack instance.
 // @param low: Low address of the stack.
 // @param high: High address of the stack.
@@ -0,0 +1,67 @@
+// Tests for stack allocation.
+#include <memory/stack.hpp>
+#include <memory/virtalloc.hpp>
+#include <paging/paging.hpp>
+#include <selftests/macros.hpp>
+
+namespace Memory {
+
+// Check that stacks of different sizes are fully mapped and separated by
+// un-mapped guard pages.
+SelfTests::TestResult stackGuardPageTest() {
+    u64 const numStacks(4);
+    Ptr<Stack> stacks[numStacks];
+    for (u64 i(0); i < numStacks; ++i) {
+        u64 const numPages(i + 1);
+        Res<Ptr<Stack>> const allocRes(Stack::New(numPages));
+        TEST_ASSERT(!!allocRes);
+        stacks[i] = *allocRes;
+        TEST_ASSERT(stacks[i]->size() == numPages * PAGE_SIZE);
+        TEST_ASSERT(stacks[i]->lowAddress().isPageAligned());
+    }
+    for (Ptr<Stack> const& stack : stacks) {
+        VirAddr const low(stack->lowAddress());
+        for (u64 i(0); i < stack->size() / PAGE_SIZE; ++i) {
+            TEST_ASSERT(!!Paging::translate(low + i * PAGE_SIZE));
+        }
+        for (u64 i(1); i <= VirtAlloc::GUARD_PAGES; ++i) {
+            TEST_ASSERT(!Paging::translate(low - i * PAGE_SIZE));
+        }
+    }
+    return SelfTests::TestResult::Success;
+}
+
+// Check that the high-water mark reports the deepest use of a stack, even after
+// the stack pointer moved back up.
+SelfTests::TestResult stackHighWaterMarkTest() {
+    Ptr<Stack> const stack(Stack::New().value());
+    TEST_ASSERT(stack->size() == DEFAULT_STACK_PAGES * PAGE_SIZE);
+    TEST_ASSERT(!stack->highWaterMark());
+
+    // Simulate pushes on the stack.
+    u64* const top(stack->highAddress().ptr<u64>());
+    u64 const depth(100);
+    for (u64 i(1); i <= depth; ++i) {
+        *(top - i) = i;
+    }
+    TEST_ASSERT(stack->highWaterMark() == depth * sizeof(u64));
+
+    // Simulate pops, the "popped" values remain in memory, hence the
+    // high-water mark is unchanged. Writing less deep does not change it
+    // either.
+    *(top - 1) = STACK_CANARY;
+    *(top - depth / 2) = 0;
+    TEST_ASSERT(stack->highWaterMark() == depth * sizeof(u64));
+
+    // Using the entire stack.
+    *stack->lowAddress().ptr<u64>() = 0;
+    TEST_ASSERT(stack->highWaterMark() == stack->size());
+    return SelfTests::TestResult::Success;
+}
+
+// Run the tests for stack allocation.
+void Test(SelfTests::TestRunner& runner) {
+    RUN_TEST(runner, stackGuardPageTest);
+    RUN_TEST(runner, stackHighWaterMarkTest);
+}
+}
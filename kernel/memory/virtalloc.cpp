@@ -0,0 +1,521 @@
+// Kernel virtual address space allocator.
+#include <memory/virtalloc.hpp>
+#include <framealloc/framealloc.hpp>
+#include <interrupts/interrupts.hpp>
+#include <interrupts/softirq.hpp>
+#include <concurrency/lock.hpp>
+#include <datastruct/vector.hpp>
+#include <logging/log.hpp>
+#include <util/assert.hpp>
+#include <util/panic.hpp>
+#include <util/cstring.hpp>
+#include <cpu/cpu.hpp>
+#include "rangetree.hpp"
+
+namespace VirtAlloc {
+
+// Value associated with ranges that do not carry any information besides their
+// start and size, e.g. free ranges.
+struct NoValue {};
+
+// Value associated with each range of the allocation tree. Allocated ranges
+// start with their guard page(s), followed by the usable pages.
+struct Allocation {
+    // If true, the range was created by alloc(): its pages are mapped lazily
+    // upon page faults and the allocator owns the physical frames mapped to
+    // them. If false, the range was created by reserve().
+    bool isLazy;
+    // The attributes used to map the pages of a lazy allocation.
+    Paging::PageAttr attrs;
+    // If true, collapseLargePages() may promote the regions of a lazy
+    // allocation to large pages.
+    bool allowLargePages;
+};
+
+// Physically contiguous frames owned by a lazy allocation, e.g. a single 4KiB
+// frame or the frames of a large page.
+struct OwnedFrames {
+    // The first frame.
+    Frame frame;
+    // The number of frames.
+    u64 numFrames;
+};
+
+// A range pending a lazy free.
+struct PendingFree {
+    // Start and size of the range in bytes, including the guard page(s).
+    u64 start;
+    u64 size;
+    // Copy of the isLazy field of the range's Allocation.
+    bool isLazy;
+};
+
+// The free ranges of the region managed by the allocator.
+static RangeTree<NoValue>* FreeRanges = nullptr;
+
+// The allocated ranges, including their guard page(s). Ranges pending a lazy
+// free are not part of this tree.
+static RangeTree<Allocation>* Allocations = nullptr;
+
+// The ranges that have been freed but not yet un-mapped.
+static Vector<PendingFree>* PendingFrees = nullptr;
+
+// Total number of pages in PendingFrees, guard pages included.
+static u64 PendingPages = 0;
+
+// Once the number of pages pending a lazy free reaches this threshold, all the
+// pending ranges are un-mapped with a single TLB shootdown.
+static constexpr u64 PENDING_PAGES_THRESHOLD = 1024;
+
+// Lock protecting the trees, the pending frees and CollapsingRegion.
+static Concurrency::SpinLock Lock;
+
+// Serializes flushPendingFrees() and collapseLargePages() so that a region is
+// never un-mapped while being promoted to a large page. Both operations use TLB
+// shootdowns, hence this lock is always taken with interrupts enabled. Must be
+// acquired before Lock.
+static Concurrency::SpinLock UnmapLock;
+
+// The start address of the region currently being promoted to a large page, 0
+// if there is none.
+static u64 CollapsingRegion = 0;
+
+// Large page promotion statistics, protected by UnmapLock.
+static LargePageStats Stats = {};
+
+// Has Init() been called already?
+static bool IsInitialized = false;
+
+// Insert a range in the free tree, coalescing it with its adjacent free ranges.
+// Must be called with the Lock held.
+// @param start: The start address of the range.
+// @param size: The size of the range in bytes.
+static void insertFreeRange(u64 start, u64 size) {
+    RangeTree<NoValue>::Node const* const prev(FreeRanges->floor(start));
+    if (!!prev && prev->start + prev->size == start) {
+        start = prev->start;
+        size += prev->size;
+        FreeRanges->erase(start);
+    }
+    RangeTree<NoValue>::Node const* const next(FreeRanges->ceil(start));
+    if (!!next && next->start == start + size) {
+        size += next->size;
+        FreeRanges->erase(next->start);
+    }
+    FreeRanges->insert(start, size, NoValue{});
+}
+
+// Tasklet promoting to large pages the regions completed by handleLazyFault().
+static Interrupts::Softirq::Tasklet CollapseTasklet;
+
+// Function of CollapseTasklet.
+// @param data: Unused.
+static void collapseTaskletFunc(u64 const) {
+    if (UnmapLock.isLocked()) {
+        // UnmapLock is taken with interrupts enabled, the context interrupted
+        // on this cpu may be holding it. Try again on the next run.
+        Interrupts::Softirq::schedule(CollapseTasklet);
+        return;
+    }
+    collapseLargePages();
+}
+
+// Check if mapping a page completed its LARGE_PAGE_SIZE-aligned region, i.e. if
+// the region is within the usable pages of an allocation allowing large pages
+// and all of its pages are mapped. Must be called with the Lock held.
+// @param node: The allocation containing the page.
+// @param page: The page that was just mapped.
+// @return: true if the region can now be promoted to a large page.
+static bool completesRegion(RangeTree<Allocation>::Node const& node,
+                            VirAddr const page) {
+    u64 const largeSize(Paging::LARGE_PAGE_SIZE);
+    u64 const region(page.raw() & ~(largeSize - 1));
+    if (!node.value.allowLargePages
+        || region < node.start + GUARD_PAGES * PAGE_SIZE
+        || node.start + node.size < region + largeSize) {
+        return false;
+    }
+    // Pages are usually populated in increasing address order, starting from
+    // the end of the region rejects partially populated regions early.
+    for (u64 offset(largeSize); offset > 0; offset -= PAGE_SIZE) {
+        VirAddr const curr(region + offset - PAGE_SIZE);
+        if (curr != page && !Paging::translate(curr)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Try to map the page containing a faulting address if it belongs to a lazy
+// allocation.
+// @param faultAddr: The faulting address.
+// @param isProtectionViolation: true if the fault was caused by a protection
+// violation, false if it was caused by a non-present page.
+// @return: true if the fault has been handled, false if faultAddr is not part
+// of a lazy allocation, is within a guard page or if the fault is a protection
+// violation outside of a region being promoted to a large page.
+// Not static so that the tests can exercise the decisions of the page fault
+// handler without triggering a fatal fault.
+bool handleLazyFault(VirAddr const faultAddr,
+                     bool const isProtectionViolation) {
+    Concurrency::LockGuard guard(Lock);
+    if (!!CollapsingRegion && CollapsingRegion <= faultAddr.raw()
+        && faultAddr.raw() - CollapsingRegion < Paging::LARGE_PAGE_SIZE) {
+        // The region is temporarily read-only while being promoted to a large
+        // page. Retry the access, it succeeds once the large page is mapped.
+        return true;
+    } else if (isProtectionViolation) {
+        return false;
+    }
+    RangeTree<Allocation>::Node const* const node(
+        Allocations->find(faultAddr.raw()));
+    if (!node || !node->value.isLazy) {
+        return false;
+    } else if (faultAddr.raw() < node->start + GUARD_PAGES * PAGE_SIZE) {
+        // Guard page.
+        return false;
+    }
+    VirAddr const page(faultAddr.raw() & ~(PAGE_SIZE - 1));
+    if (!!Paging::translate(page)) {
+        // Another cpu faulted on the same page and mapped it first.
+        return true;
+    }
+    Res<Frame> const frame(FrameAlloc::alloc());
+    if (!frame) {
+        PANIC("Cannot allocate frame to back lazy allocation at {}", page);
+    }
+    Util::memzero(frame->addr().toVir().ptr<void>(), PAGE_SIZE);
+    Paging::PageAttr const attrs(node->value.attrs | Paging::PageAttr::Global);
+    if (!!Paging::map(page, frame->addr(), attrs, 1)) {
+        PANIC("Cannot map lazy allocation at {}", page);
+    }
+    if (completesRegion(*node, page)) {
+        // Promoting the region needs TLB shootdowns, defer it to a context
+        // where interrupts are enabled.
+        Interrupts::Softirq::schedule(CollapseTasklet);
+    }
+    return true;
+}
+
+// Page fault handler. Maps the pages of lazy allocations upon their first
+// access, any other page fault is fatal.
+// @param vector: The vector of the interrupt, always 14.
+// @param frame: The interrupt frame.
+static void pageFaultHandler(Interrupts::Vector const vector,
+                             Interrupts::Frame const& frame) {
+    ASSERT(vector == 14);
+    VirAddr const faultAddr(Cpu::cr2());
+    // Bit 0 of the error code is set for protection violations, e.g. writing
+    // into a read-only page.
+    bool const isProtectionViolation(frame.errorCode & 1);
+    if (handleLazyFault(faultAddr, isProtectionViolation)) {
+        return;
+    }
+    PANIC("Page fault on address {x}, rip = {x}, error code = {x}",
+          faultAddr.raw(), frame.rip, frame.errorCode);
+}
+
+// Initialize the allocator. Must be called after the heap allocator has been
+// initialized.
+void Init() {
+    ASSERT(!IsInitialized);
+    Log::info("Initializing virtual address allocator for {} - {}",
+              VirAddr(REGION_START_VADDR), VirAddr(REGION_END_VADDR));
+    FreeRanges = new RangeTree<NoValue>();
+    Allocations = new RangeTree<Allocation>();
+    PendingFrees = new Vector<PendingFree>();
+    FreeRanges->insert(REGION_START_VADDR,
+                       REGION_END_VADDR - REGION_START_VADDR,
+                       NoValue{});
+    Interrupts::registerHandler(Interrupts::Vector(14), pageFaultHandler);
+    CollapseTasklet.func = collapseTaskletFunc;
+    IsInitialized = true;
+}
+
+// Allocate a range of virtual addresses from the free tree.
+// @param nPages: The number of usable pages in the range.
+// @param allocation: The Allocation describing the range.
+// @return: The start address of the usable pages of the range.
+static Res<VirAddr> allocRange(u64 const nPages, Allocation const& allocation) {
+    ASSERT(IsInitialized);
+    ASSERT(nPages > 0);
+    u64 const maxPages((REGION_END_VADDR - REGION_START_VADDR) / PAGE_SIZE);
+    if (nPages > maxPages - GUARD_PAGES) {
+        return Error::OutOfVirtualMemory;
+    }
+    u64 const size((nPages + GUARD_PAGES) * PAGE_SIZE);
+    Concurrency::LockGuard guard(Lock);
+    RangeTree<NoValue>::Node const* const node(FreeRanges->firstFit(size));
+    if (!node) {
+        return Error::OutOfVirtualMemory;
+    }
+    u64 const start(node->start);
+    u64 const remSize(node->size - size);
+    FreeRanges->erase(start);
+    if (!!remSize) {
+        FreeRanges->insert(start + size, remSize, NoValue{});
+    }
+    Allocations->insert(start, size, allocation);
+    return VirAddr(start + GUARD_PAGES * PAGE_SIZE);
+}
+
+// Allocate a range of virtual addresses, purging the pending frees if the
+// region is full.
+// @param nPages: The number of usable pages in the range.
+// @param allocation: The Allocation describing the range.
+// @return: The start address of the usable pages of the range.
+static Res<VirAddr> allocRangeOrPurge(u64 const nPages,
+                                      Allocation const& allocation) {
+    Res<VirAddr> const res(allocRange(nPages, allocation));
+    if (!!res) {
+        return *res;
+    }
+    flushPendingFrees();
+    return allocRange(nPages, allocation);
+}
+
+// Reserve a range of kernel virtual addresses. No memory is mapped to the
+// range.
+// @param nPages: The size of the range in number of pages.
+// @return: The start address of the range or an error if the range could not
+// be allocated.
+Res<VirAddr> reserve(u64 const nPages) {
+    return allocRangeOrPurge(nPages, Allocation{
+        .isLazy = false,
+        .attrs = Paging::PageAttr::None,
+        .allowLargePages = false,
+    });
+}
+
+// Allocate a range of kernel virtual addresses backed by physical memory,
+// allocated and mapped lazily.
+// @param nPages: The size of the range in number of pages.
+// @param attrs: The attributes used to map the pages of the range.
+// @param allowLargePages: If false, the range is never promoted to large pages
+// by collapseLargePages().
+// @return: The start address of the range or an error if the range could not
+// be allocated.
+Res<VirAddr> alloc(u64 const nPages,
+                   Paging::PageAttr const attrs,
+                   bool const allowLargePages) {
+    return allocRangeOrPurge(nPages, Allocation{
+        .isLazy = true,
+        .attrs = attrs,
+        .allowLargePages = allowLargePages,
+    });
+}
+
+// Free a range of virtual addresses returned by reserve() or alloc().
+// @param addr: The start address of the range.
+void free(VirAddr const addr) {
+    ASSERT(IsInitialized);
+    bool shouldPurge;
+    {
+        Concurrency::LockGuard guard(Lock);
+        RangeTree<Allocation>::Node const* const node(
+            Allocations->find(addr.raw()));
+        if (!node || node->start + GUARD_PAGES * PAGE_SIZE != addr.raw()) {
+            PANIC("Address {} was not returned by VirtAlloc", addr);
+        }
+        PendingFrees->pushBack(PendingFree{
+            .start = node->start,
+            .size = node->size,
+            .isLazy = node->value.isLazy,
+        });
+        PendingPages += node->size / PAGE_SIZE;
+        Allocations->erase(node->start);
+        shouldPurge = PendingPages >= PENDING_PAGES_THRESHOLD;
+    }
+    if (shouldPurge) {
+        flushPendingFrees();
+    }
+}
+
+// Immediately un-map all the ranges pending a lazy free and make them available
+// for future allocations.
+void flushPendingFrees() {
+    ASSERT(IsInitialized);
+    Concurrency::LockGuard unmapGuard(UnmapLock, false);
+    Vector<PendingFree> pending;
+    {
+        Concurrency::LockGuard guard(Lock);
+        pending = *PendingFrees;
+        PendingFrees->clear();
+        PendingPages = 0;
+    }
+    if (pending.empty()) {
+        return;
+    }
+    // Un-map the ranges and collect the frames owned by the lazy allocations.
+    // The frames cannot be freed before all cpus flushed their TLB, since
+    // another cpu could still access them through a stale TLB entry.
+    Vector<OwnedFrames> frames;
+    for (PendingFree const& range : pending) {
+        VirAddr const usableStart(range.start + GUARD_PAGES * PAGE_SIZE);
+        u64 const nPages(range.size / PAGE_SIZE - GUARD_PAGES);
+        u64 i(0);
+        while (i < nPages && range.isLazy) {
+            VirAddr const page(usableStart.raw() + i * PAGE_SIZE);
+            Res<Paging::Mapping> const mapping(Paging::translate(page));
+            if (!mapping) {
+                i++;
+                continue;
+            }
+            // Large pages are always entirely contained in the range, page is
+            // therefore the first page of the large page.
+            u64 const numFrames(mapping->pageSize / PAGE_SIZE);
+            frames.pushBack(OwnedFrames{
+                .frame = Frame(mapping->paddr),
+                .numFrames = numFrames,
+            });
+            i += numFrames;
+        }
+        Paging::unmapNoFlush(usableStart, nPages);
+    }
+    Paging::tlbShootdown();
+    for (OwnedFrames const& owned : frames) {
+        FrameAlloc::freeContiguous(owned.frame, owned.numFrames);
+    }
+    Concurrency::LockGuard guard(Lock);
+    for (PendingFree const& range : pending) {
+        insertFreeRange(range.start, range.size);
+    }
+}
+
+// A region that can be promoted to a large page.
+struct LargePageCandidate {
+    // The start address of the region.
+    VirAddr addr;
+    // The attributes of the allocation containing the region.
+    Paging::PageAttr attrs;
+};
+
+// Check if all the pages of a region are mapped with 4KiB pages. Must be called
+// with the Lock held.
+// @param region: The start address of the region.
+// @param frames: If not nullptr, the physical frames of the pages are appended
+// to this vector.
+// @return: true if all pages are mapped with 4KiB pages, false otherwise, e.g.
+// if some pages are not mapped or if the region is already a large page.
+static bool isFullyMapped(VirAddr const region, Vector<PhyAddr>* const frames) {
+    for (u64 i(0); i < Paging::LARGE_PAGE_SIZE / PAGE_SIZE; ++i) {
+        Res<Paging::Mapping> const mapping(
+            Paging::translate(region + i * PAGE_SIZE));
+        if (!mapping || mapping->pageSize != PAGE_SIZE) {
+            return false;
+        } else if (!!frames) {
+            frames->pushBack(mapping->paddr);
+        }
+    }
+    return true;
+}
+
+// Check if a region is still entirely contained in a lazy allocation that
+// allows large pages. Must be called with the Lock held.
+// @param region: The start address of the region.
+// @return: true if the region can be promoted to a large page.
+static bool isInLazyAllocation(VirAddr const region) {
+    RangeTree<Allocation>::Node const* const node(
+        Allocations->find(region.raw()));
+    return !!node && node->value.isLazy && node->value.allowLargePages
+        && node->start + GUARD_PAGES * PAGE_SIZE <= region.raw()
+        && region.raw() + Paging::LARGE_PAGE_SIZE <= node->start + node->size;
+}
+
+// Find all the regions that can be promoted to a large page: regions within
+// lazy allocations allowing large pages that are fully mapped with 4KiB pages.
+// @return: The candidate regions.
+static Vector<LargePageCandidate> findLargePageCandidates() {
+    Vector<LargePageCandidate> candidates;
+    Concurrency::LockGuard guard(Lock);
+    u64 const largeSize(Paging::LARGE_PAGE_SIZE);
+    RangeTree<Allocation>::Node const* node(Allocations->ceil(0));
+    while (!!node) {
+        u64 const end(node->start + node->size);
+        if (node->value.isLazy && node->value.allowLargePages) {
+            u64 const usableStart(node->start + GUARD_PAGES * PAGE_SIZE);
+            u64 region((usableStart + largeSize - 1) & ~(largeSize - 1));
+            for (; region + largeSize <= end; region += largeSize) {
+                if (isFullyMapped(region, nullptr)) {
+                    candidates.pushBack(LargePageCandidate{
+                        .addr = region,
+                        .attrs = node->value.attrs,
+                    });
+                }
+            }
+        }
+        node = Allocations->ceil(end);
+    }
+    return candidates;
+}
+
+// Promote a region to a large page.
+// @param candidate: The region to promote.
+// @return: true if the region has been promoted, false otherwise.
+static bool collapseLargePage(LargePageCandidate const& candidate) {
+    u64 const numFrames(Paging::LARGE_PAGE_SIZE / PAGE_SIZE);
+    Res<Frame> const largeFrame(
+        FrameAlloc::allocContiguous(numFrames, Paging::LARGE_PAGE_SIZE));
+    if (!largeFrame) {
+        return false;
+    }
+    // The region may have been freed since it was found, re-check under the
+    // lock. From this point on the region cannot be un-mapped since we are
+    // holding the UnmapLock, and no page can be mapped in it since it is fully
+    // mapped.
+    Vector<PhyAddr> oldFrames;
+    {
+        Concurrency::LockGuard guard(Lock);
+        if (!isInLazyAllocation(candidate.addr)
+            || !isFullyMapped(candidate.addr, &oldFrames)) {
+            FrameAlloc::freeContiguous(*largeFrame, numFrames);
+            return false;
+        }
+        CollapsingRegion = candidate.addr.raw();
+    }
+    Paging::PageAttr const attrs(candidate.attrs | Paging::PageAttr::Global);
+    Err const err(
+        Paging::collapseLargePage(candidate.addr, largeFrame->addr(), attrs));
+    {
+        Concurrency::LockGuard guard(Lock);
+        CollapsingRegion = 0;
+    }
+    if (!!err) {
+        FrameAlloc::freeContiguous(*largeFrame, numFrames);
+        return false;
+    }
+    for (PhyAddr const& frame : oldFrames) {
+        FrameAlloc::free(Frame(frame));
+    }
+    return true;
+}
+
+// Promote to large pages the regions of the ranges returned by alloc() that are
+// fully populated with 4KiB pages.
+// @return: The number of regions promoted by this call.
+u64 collapseLargePages() {
+    ASSERT(IsInitialized);
+    Concurrency::LockGuard unmapGuard(UnmapLock, false);
+    Vector<LargePageCandidate> const candidates(findLargePageCandidates());
+    u64 numPromoted(0);
+    for (LargePageCandidate const& candidate : candidates) {
+        if (collapseLargePage(candidate)) {
+            numPromoted++;
+            Stats.promotions++;
+        } else {
+            Stats.failures++;
+        }
+    }
+    if (!!numPromoted) {
+        Log::debug("Promoted {} regions to large pages", numPromoted);
+    }
+    return numPromoted;
+}
+
+// Get the statistics of the large page promotion.
+// @return: The number of promotions and failures since boot.
+LargePageStats largePageStats() {
+    Concurrency::LockGuard unmapGuard(UnmapLock, false);
+    return Stats;
+}
+}
@@ -0,0 +1,273 @@
+// Tests for the virtual address allocator.
+#include <memory/virtalloc.hpp>
+#include <interrupts/softirq.hpp>
+#include <selftests/macros.hpp>
+#include "rangetree.hpp"
+
+namespace VirtAlloc {
+
+// Check that the RangeTree correctly implements floor, ceil, find and firstFit
+// while inserting and removing ranges.
+SelfTests::TestResult rangeTreeTest() {
+    RangeTree<u64> tree;
+    // Insert ranges [100*i; 100*i + i) for i in 1..64, in a non-sorted order to
+    // exercise the balancing.
+    u64 const numRanges(64);
+    for (u64 j(0); j < numRanges; ++j) {
+        u64 const i(1 + (j * 37) % numRanges);
+        tree.insert(100 * i, i, i);
+    }
+    TEST_ASSERT(tree.size() == numRanges);
+    for (u64 i(1); i <= numRanges; ++i) {
+        RangeTree<u64>::Node const* const inRange(tree.find(100 * i + i - 1));
+        TEST_ASSERT(!!inRange);
+        TEST_ASSERT(inRange->start == 100 * i);
+        TEST_ASSERT(inRange->value == i);
+        TEST_ASSERT(!tree.find(100 * i + i));
+        RangeTree<u64>::Node const* const floor(tree.floor(100 * i + 50));
+        TEST_ASSERT(!!floor && floor->start == 100 * i);
+        RangeTree<u64>::Node const* const ceil(tree.ceil(100 * i + 1));
+        if (i < numRanges) {
+            TEST_ASSERT(!!ceil && ceil->start == 100 * (i + 1));
+        } else {
+            TEST_ASSERT(!ceil);
+        }
+    }
+    TEST_ASSERT(!tree.floor(99));
+    // firstFit returns the lowest range of at least the requested size.
+    for (u64 i(1); i <= numRanges; ++i) {
+        RangeTree<u64>::Node const* const fit(tree.firstFit(i));
+        TEST_ASSERT(!!fit && fit->start == 100 * i);
+    }
+    TEST_ASSERT(!tree.firstFit(numRanges + 1));
+    // Remove the even ranges, firstFit should skip them.
+    for (u64 i(2); i <= numRanges; i += 2) {
+        tree.erase(100 * i);
+    }
+    TEST_ASSERT(tree.size() == numRanges / 2);
+    for (u64 i(1); i <= numRanges; ++i) {
+        RangeTree<u64>::Node const* const fit(tree.firstFit(i));
+        u64 const expected(i % 2 ? i : i + 1);
+        if (expected <= numRanges) {
+            TEST_ASSERT(!!fit && fit->start == 100 * expected);
+        } else {
+            TEST_ASSERT(!fit);
+        }
+        TEST_ASSERT(!!tree.find(100 * i) == !!(i % 2));
+    }
+    return SelfTests::TestResult::Success;
+}
+
+// Check that reserve() returns page-aligned, disjoint ranges within the region,
+// separated by the guard pages, and that freed ranges are re-used.
+SelfTests::TestResult reserveTest() {
+    u64 const numRanges(8);
+    VirAddr ranges[numRanges];
+    for (u64 i(0); i < numRanges; ++i) {
+        Res<VirAddr> const res(reserve(i + 1));
+        TEST_ASSERT(!!res);
+        ranges[i] = *res;
+        TEST_ASSERT(ranges[i].isPageAligned());
+        u64 const start(ranges[i].raw() - GUARD_PAGES * PAGE_SIZE);
+        u64 const end(ranges[i].raw() + (i + 1) * PAGE_SIZE);
+        TEST_ASSERT(REGION_START_VADDR <= start);
+        TEST_ASSERT(end <= REGION_END_VADDR);
+        // The guard pages and the range must not overlap any other range or its
+        // guard pages.
+        for (u64 j(0); j < i; ++j) {
+            u64 const otherStart(ranges[j].raw() - GUARD_PAGES * PAGE_SIZE);
+            u64 const otherEnd(ranges[j].raw() + (j + 1) * PAGE_SIZE);
+            TEST_ASSERT(end <= otherStart || otherEnd <= start);
+        }
+    }
+    // Free a range and flush, re-allocating the same size should return the
+    // same range since allocations are first-fit.
+    VirAddr const freed(ranges[3]);
+    free(freed);
+    flushPendingFrees();
+    Res<VirAddr> const realloc(reserve(4));
+    TEST_ASSERT(!!realloc);
+    TEST_ASSERT(*realloc == freed);
+    ranges[3] = *realloc;
+    for (u64 i(0); i < numRanges; ++i) {
+        free(ranges[i]);
+    }
+    flushPendingFrees();
+    return SelfTests::TestResult::Success;
+}
+
+// Check that the pages of an alloc() are lazily mapped to zeroed frames upon
+// their first access, and un-mapped once freed.
+SelfTests::TestResult lazyAllocTest() {
+    u64 const nPages(4);
+    Res<VirAddr> const res(alloc(nPages, Paging::PageAttr::Writable));
+    TEST_ASSERT(!!res);
+    VirAddr const start(*res);
+    for (u64 i(0); i < nPages; ++i) {
+        TEST_ASSERT(!Paging::translate(start + i * PAGE_SIZE));
+    }
+    // Reading a page maps it to a zeroed frame.
+    u64 const * const firstPage(start.ptr<u64>());
+    for (u64 i(0); i < PAGE_SIZE / sizeof(u64); ++i) {
+        TEST_ASSERT(firstPage[i] == 0);
+    }
+    TEST_ASSERT(!!Paging::translate(start));
+    TEST_ASSERT(!Paging::translate(start + PAGE_SIZE));
+    // Writing into the pages maps them as writable.
+    for (u64 i(0); i < nPages; ++i) {
+        u64* const ptr((start + i * PAGE_SIZE).ptr<u64>());
+        *ptr = 0xdeadbeef00 + i;
+    }
+    for (u64 i(0); i < nPages; ++i) {
+        u64 const * const ptr((start + i * PAGE_SIZE).ptr<u64>());
+        TEST_ASSERT(*ptr == 0xdeadbeef00 + i);
+        TEST_ASSERT(!!Paging::translate(start + i * PAGE_SIZE));
+    }
+    free(start);
+    flushPendingFrees();
+    for (u64 i(0); i < nPages; ++i) {
+        TEST_ASSERT(!Paging::translate(start + i * PAGE_SIZE));
+    }
+    return SelfTests::TestResult::Success;
+}
+
+// Defined in virtalloc.cpp, called by the page fault handler of the allocator.
+extern bool handleLazyFault(VirAddr const faultAddr,
+                            bool const isProtectionViolation);
+
+// Check that the page fault handler of the allocator does not map the guard
+// page below an allocation, making the fault fatal, while it maps the usable
+// pages.
+SelfTests::TestResult guardPageTest() {
+    Res<VirAddr> const res(alloc(1, Paging::PageAttr::Writable));
+    TEST_ASSERT(!!res);
+    VirAddr const guardPage(*res - GUARD_PAGES * PAGE_SIZE);
+
+    TEST_ASSERT(!handleLazyFault(guardPage, false));
+    TEST_ASSERT(!handleLazyFault(guardPage + PAGE_SIZE - 1, false));
+    TEST_ASSERT(!Paging::translate(guardPage));
+
+    TEST_ASSERT(handleLazyFault(*res, false));
+    TEST_ASSERT(!!Paging::translate(*res));
+    // Protection violations are fatal outside of a region being promoted to a
+    // large page.
+    TEST_ASSERT(!handleLazyFault(*res, true));
+
+    free(*res);
+    flushPendingFrees();
+    return SelfTests::TestResult::Success;
+}
+
+// Check that the page fault completing a region of a lazy allocation schedules
+// its promotion to a large page and that the content of the region is
+// preserved.
+SelfTests::TestResult largePagePromotionTest() {
+    // Allocate enough pages to be guaranteed to contain at least one
+    // LARGE_PAGE_SIZE-aligned region.
+    u64 const pagesPerLargePage(Paging::LARGE_PAGE_SIZE / PAGE_SIZE);
+    u64 const nPages(2 * pagesPerLargePage);
+    Res<VirAddr> const res(alloc(nPages, Paging::PageAttr::Writable));
+    TEST_ASSERT(!!res);
+    VirAddr const start(*res);
+    LargePageStats const statsBefore(largePageStats());
+    for (u64 i(0); i < nPages; ++i) {
+        *(start + i * PAGE_SIZE).ptr<u64>() = i;
+    }
+
+    // The promotion runs in a tasklet, run it now in case no interrupt was
+    // received since the last fault.
+    Interrupts::Softirq::runPending();
+    LargePageStats const statsAfter(largePageStats());
+    TEST_ASSERT(statsAfter.promotions > statsBefore.promotions);
+
+    // The content of the pages must have been preserved and the pages must
+    // still be writable.
+    for (u64 i(0); i < nPages; ++i) {
+        u64* const ptr((start + i * PAGE_SIZE).ptr<u64>());
+        TEST_ASSERT(*ptr == i);
+        *ptr = ~i;
+    }
+    for (u64 i(0); i < nPages; ++i) {
+        TEST_ASSERT(*(start + i * PAGE_SIZE).ptr<u64>() == ~i);
+    }
+
+    // The aligned region is now mapped to physically contiguous memory.
+    u64 const largeSize(Paging::LARGE_PAGE_SIZE);
+    VirAddr const region((start.raw() + largeSize - 1) & ~(largeSize - 1));
+    Res<Paging::Mapping> const regionMapping(Paging::translate(region));
+    TEST_ASSERT(!!regionMapping);
+    TEST_ASSERT(regionMapping->pageSize == largeSize);
+    PhyAddr const regionPaddr(regionMapping->paddr);
+    TEST_ASSERT(!(regionPaddr.raw() % largeSize));
+    for (u64 i(0); i < pagesPerLargePage; ++i) {
+        Res<Paging::Mapping> const mapping(
+            Paging::translate(region + i * PAGE_SIZE));
+        TEST_ASSERT(!!mapping);
+        TEST_ASSERT(mapping->paddr == regionPaddr + i * PAGE_SIZE);
+        TEST_ASSERT(mapping->pageSize == largeSize);
+    }
+
+    // Promoted regions are not promoted again.
+    TEST_ASSERT(!collapseLargePages());
+
+    free(start);
+    flushPendingFrees();
+    for (u64 i(0); i < nPages; ++i) {
+        TEST_ASSERT(!Paging::translate(start + i * PAGE_SIZE));
+    }
+    return SelfTests::TestResult::Success;
+}
+
+// Check that regions that are partly populated or part of a range allocated
+// with allowLargePages = false are not promoted to large pages.
+SelfTests::TestResult largePageExclusionTest() {
+    u64 const pagesPerLargePage(Paging::LARGE_PAGE_SIZE / PAGE_SIZE);
+    u64 const nPages(2 * pagesPerLargePage);
+    u64 const largeSize(Paging::LARGE_PAGE_SIZE);
+    Res<VirAddr> const excluded(alloc(nPages, Paging::PageAttr::Writable,
+                                      false));
+    TEST_ASSERT(!!excluded);
+    Res<VirAddr> const partial(alloc(nPages, Paging::PageAttr::Writable));
+    TEST_ASSERT(!!partial);
+    VirAddr const partialRegion(
+        (partial->raw() + largeSize - 1) & ~(largeSize - 1));
+    for (u64 i(0); i < nPages; ++i) {
+        *(*excluded + i * PAGE_SIZE).ptr<u64>() = i;
+        VirAddr const page(*partial + i * PAGE_SIZE);
+        // Leave the last page of the aligned region un-mapped.
+        if (page != partialRegion + largeSize - PAGE_SIZE) {
+            *page.ptr<u64>() = i;
+        }
+    }
+
+    collapseLargePages();
+    for (u64 i(0); i < nPages; ++i) {
+        Res<Paging::Mapping> const mapping(
+            Paging::translate(*excluded + i * PAGE_SIZE));
+        TEST_ASSERT(!!mapping);
+        TEST_ASSERT(mapping->pageSize == PAGE_SIZE);
+        TEST_ASSERT(*(*excluded + i * PAGE_SIZE).ptr<u64>() == i);
+    }
+    for (u64 i(0); i < pagesPerLargePage - 1; ++i) {
+        Res<Paging::Mapping> const mapping(
+            Paging::translate(partialRegion + i * PAGE_SIZE));
+        TEST_ASSERT(!!mapping);
+        TEST_ASSERT(mapping->pageSize == PAGE_SIZE);
+    }
+
+    free(*excluded);
+    free(*partial);
+    flushPendingFrees();
+    return SelfTests::TestResult::Success;
+}
+
+// Run the tests for the virtual address allocator.
+void Test(SelfTests::TestRunner& runner) {
+    RUN_TEST(runner, rangeTreeTest);
+    RUN_TEST(runner, reserveTest);
+    RUN_TEST(runner, lazyAllocTest);
+    RUN_TEST(runner, guardPageTest);
+    RUN_TEST(runner, largePagePromotionTest);
+    RUN_TEST(runner, largePageExclusionTest);
+}
+}
@@ -63,30 +63,10 @@ Res<Ptr<AddrSpace>> AddrSpace::New() {
     }
 }
 
-static void clearPageTable(u8 const level, PhyAddr const table) {
-    // FIXME: We may be better off doing this in paging.cpp with the
-    // PageTable<L> class.
-    ASSERT(level > 0);
-    ASSERT(table.isPageAligned());
-    if (level > 1) {
-        u64 const * entry(table.toVir().ptr<u64>());
-        u64 const maxIdx(level == 4 ? 256 : 512);
-        for (u64 i(0); i < maxIdx; ++i) {
-            bool const isPresent(entry[i] & 1);
-            if (isPresent) {
-                PhyAddr const nextTableAddr(entry[i] & ~(PAGE_SIZE - 1));
-                clearPageTable(level - 1, nextTableAddr);
-            }
-        }
-    }
-    Log::debug("Deallocating page-table level {} at {}", level, table);
-    FrameAlloc::free(Frame(table.raw()));
-}
-
 // De-allocate part of the page-table structure used by this AddrSpace that is
 // not shared with other AddrSpace (ie. the user mapping).
 AddrSpace::~AddrSpace() {
-    clearPageTable(4, m_pml4Address);
+    freePageTables(m_pml4Address);
 }
 
 // Get the address of the PML4 associated with this address space.
@@ -95,6 +75,44 @@ PhyAddr AddrSpace::pml4Address() const {
     return m_pml4Address;
 }
 
+// Map a region of virtual memory to physical memory in this address space. This
+// address space does not need to be the current one, the page tables are
+// modified through the direct map.
+// @param vaddrStart: The start virtual address of the region to be mapped.
+// @param paddrStart: The start physical address at which the region should be
+// mapped.
+// @param pageAttr: Control the attribute of the mapping. All mapped pages will
+// end up using those attributes.
+// @param nPages: The size of the region in number of pages.
+// @return: Returns an error if the mapping failed.
+Err AddrSpace::map(VirAddr const vaddrStart,
+                   PhyAddr const paddrStart,
+                   PageAttr const pageAttr,
+                   u64 const nPages) {
+    return Paging::map(m_pml4Address, vaddrStart, paddrStart, pageAttr, nPages);
+}
+
+// Unmap virtual pages from this address space. This address space does not
+// need to be the current one. Attempting to unmap a page that is not currently
+// mapped is a no-op.
+// @param addrStart: The address to start unmapping from.
+// @param nPages: The number of pages to unmap.
+void AddrSpace::unmap(VirAddr const addrStart, u64 const nPages) {
+    Paging::unmap(m_pml4Address, addrStart, nPages);
+}
+
+// Change the attributes of mapped virtual pages in this address space. This
+// address space does not need to be the current one. Pages that are not mapped
+// are skipped.
+// @param addrStart: The address of the first page to modify.
+// @param pageAttr: The new attributes of the pages.
+// @param nPages: The number of pages to modify.
+void AddrSpace::protect(VirAddr const addrStart,
+                        PageAttr const pageAttr,
+                        u64 const nPages) {
+    Paging::protect(m_pml4Address, addrStart, pageAttr, nPages);
+}
+
 // Switch from the current address space to another one.
 // @param to: The address space to switch to.
 void AddrSpace::switchAddrSpace(Ptr<AddrSpace> const& to) {
@@ -6,6 +6,10 @@
 #include <util/assert.hpp>
 #include <util/panic.hpp>
 #include <cpu/cpu.hpp>
+#include <smp/percpu.hpp>
+#include <smp/remotecall.hpp>
+#include <datastruct/vector.hpp>
+#include <util/cstring.hpp>
 
 namespace Paging {
 
@@ -85,10 +89,29 @@ static u64 getPhysicalMemorySize(BootStruct const& bootStruct) {
     PANIC("Cannot determine physical memory size: e820 memory map is empty");
 }
 
+// Start and end of the kernel image in virtual memory. Defined in the linker
+// script.
+extern "C" u8 KERNEL_START_VADDR;
+extern "C" u8 KERNEL_END_VADDR;
+
+// Physical address and size of the VGA text buffer.
+static constexpr u64 VgaBufferAddr = 0xb8000;
+static constexpr u64 VgaBufferSize = 0x8000;
+
+// The Page Global Enable bit in CR4.
+static constexpr u64 Cr4PgeBit = 1 << 7;
+
+// Get the physical address of the PML4 table currently loaded in CR3.
+static PhyAddr currPml4Address();
+
 // Has Init() been called already? Used to assert that cpus are not trying to
 // use the namespace before its initialization.
 static bool IsInitialized = false;
 
+// Compute the number of used entries of all page tables reachable from the
+// current PML4. Must be called once after the direct map has been initialized.
+static void initUsedEntriesCounts();
+
 // Initialize paging.
 // This function creates the direct map.
 void Init(BootStruct const& bootStruct) {
@@ -98,9 +121,71 @@ void Init(BootStruct const& bootStruct) {
     Log::info("Initializing direct map spanning {x} bytes", phyMemBytes);
     initializeDirectMap(DIRECT_MAP_START_VADDR, phyMemBytes);
     Log::debug("Direct map initialized");
+    initUsedEntriesCounts();
 
     InitCurrCpu();
     IsInitialized = true;
+
+    // The kernel image is mapped by the bootloader which does not know about
+    // global pages. Now that CR4.PGE is set, mark those mappings as global.
+    VirAddr const kernelStart(&KERNEL_START_VADDR);
+    VirAddr const kernelEnd(&KERNEL_END_VADDR);
+    u64 const kernelNumPages((kernelEnd - kernelStart + PAGE_SIZE - 1)
+                             / PAGE_SIZE);
+    Log::debug("Marking kernel image mappings as global");
+    protect(kernelStart,
+            PageAttr::Writable | PageAttr::Global,
+            kernelNumPages);
+
+    // The VGA text buffer is only ever written to, use write-combining for both
+    // the ID mapping set up by the bootloader and the direct map alias, since
+    // all mappings of the same physical memory should use the same type.
+    PhyAddr const vgaBufferStart(VgaBufferAddr);
+    u64 const vgaBufferNumPages(VgaBufferSize / PAGE_SIZE);
+    PageAttr const vgaAttrs(PageAttr::Writable | PageAttr::WriteCombining);
+    protect(VirAddr(vgaBufferStart.raw()),
+            vgaAttrs,
+            vgaBufferNumPages);
+    protect(vgaBufferStart.toVir(),
+            vgaAttrs | PageAttr::Global,
+            vgaBufferNumPages);
+}
+
+// Memory type encodings used in the IA32_PAT MSR.
+enum class MemType : u8 {
+    Uncacheable = 0x0,
+    WriteCombining = 0x1,
+    WriteThrough = 0x4,
+    WriteProtected = 0x5,
+    WriteBack = 0x6,
+    UncacheableMinus = 0x7,
+};
+
+// Value written into the IA32_PAT MSR. PAT entries 0 through 3 keep their
+// power-on default value, so that the PWT and PCD bits keep their usual meaning
+// in entries that do not set the PAT bit. Entries 4 and 5 are changed to
+// write-combining and write-protected respectively. This must match the
+// memory types in PageAttr.
+static constexpr u64 PatValue =
+    (static_cast<u64>(MemType::WriteBack) << (0 * 8))
+    | (static_cast<u64>(MemType::WriteThrough) << (1 * 8))
+    | (static_cast<u64>(MemType::UncacheableMinus) << (2 * 8))
+    | (static_cast<u64>(MemType::Uncacheable) << (3 * 8))
+    | (static_cast<u64>(MemType::WriteCombining) << (4 * 8))
+    | (static_cast<u64>(MemType::WriteProtected) << (5 * 8))
+    | (static_cast<u64>(MemType::UncacheableMinus) << (6 * 8))
+    | (static_cast<u64>(MemType::Uncacheable) << (7 * 8));
+
+// Program the Page Attribute Table of the current cpu. All cpus must use the
+// same PAT.
+static void initPat() {
+    bool const isPatSupported(Cpu::cpuid(0x1).edx & (1 << 16));
+    if (!isPatSupported) {
+        PANIC("The CPU does not support PAT. Required by this kernel");
+    }
+    Cpu::wrmsr(Cpu::Msr::IA32_PAT, PatValue);
+    // Make sure no TLB entry is using the old memory types.
+    flushGlobalTlb();
 }
 
 // Configure paging for the current cpu (set control regs, ...).
@@ -109,6 +194,10 @@ void InitCurrCpu() {
     // Enable the Write-Protect bit on CR0 to catch writes on read-only pages
     // originating from ring 0.
     Cpu::writeCr0(Cpu::cr0() | (1 << 16));
+    // Enable global pages. Kernel mappings are marked global so that their TLB
+    // entries survive address space switches.
+    Cpu::writeCr4(Cpu::cr4() | Cr4PgeBit);
+    initPat();
 }
 
 // operator| for PageAttr. Use to create combination of attributes.
@@ -142,6 +231,12 @@ bool operator&(PageAttr const& attr1, PageAttr const& attr2) {
 // Level 0 is therefore the page itself.
 
 // Type of an entry in a level L page table.
+// Bits 52 through 58 are ignored by the hardware, they are used by the kernel
+// to store metadata about the page table containing the entry, see
+// PageTable::usedEntries().
+// If pageSize is set in a level 2 entry, the entry directly maps a large page
+// instead of pointing to a level 1 table. In that case the global bit is
+// meaningful and the lowest bit of addr is the PAT bit of the large page.
 template<u8 L> requires (0 < L && L <= 4)
 struct PageTableEntry {
     u8 present : 1;
@@ -150,8 +245,13 @@ struct PageTableEntry {
     u8 writeThrough : 1;
     u8 cacheDisable : 1;
     u8 accessed : 1;
-    u16 : 6;
-    u64 addr : 51;
+    u8 : 1;
+    u8 pageSize : 1;
+    u8 global : 1;
+    u8 : 3;
+    u64 addr : 40;
+    u64 available : 7;
+    u8 : 4;
     u8 executeDisable : 1;
 } __attribute__((packed));
 
@@ -168,8 +268,10 @@ struct PageTableEntry<1> {
     u8 dirty : 1;
     u8 pat : 1;
     u8 global : 1;
-    u16 : 3;
-    u64 addr : 51;
+    u8 : 3;
+    u64 addr : 40;
+    u64 available : 7;
+    u8 : 4;
     u8 executeDisable : 1;
 } __attribute__((packed));
 
@@ -182,8 +284,63 @@ enum class UnmapResult {
     // now empty, e.g. it does not contain any more present entries, and can
     // be de-allocated and marked as non-present.
     DeallocateTable,
+    // The address was not mapped because a page table of the hierarchy is
+    // missing, nothing was unmapped.
+    NotMapped,
 };
 
+// Set the attribute bits of an entry mapping a page, i.e. a level 1 entry or
+// the entry of a large page. The present bit and the address of the page are
+// left untouched. For large pages, the PAT bit is the lowest bit of addr.
+// @param entry: The entry to modify.
+// @param attrs: The attributes to set on the entry.
+template<u8 L>
+static void setEntryAttrs(PageTableEntry<L>& entry, PageAttr const attrs) {
+    entry.writable = attrs & PageAttr::Writable;
+    entry.userAccessible = attrs & PageAttr::User;
+    entry.writeThrough = attrs & PageAttr::WriteThrough;
+    entry.cacheDisable = attrs & PageAttr::CacheDisable;
+    entry.global = attrs & PageAttr::Global;
+    entry.executeDisable = attrs & PageAttr::NoExec;
+    if constexpr (L == 1) {
+        entry.pat = attrs & PageAttr::Pat;
+    } else {
+        entry.addr = (entry.addr & ~u64(1)) | (attrs & PageAttr::Pat);
+    }
+}
+
+// Get the attributes of an entry mapping a page, i.e. a level 1 entry or the
+// entry of a large page. This is the reverse of setEntryAttrs().
+// @param entry: The entry.
+// @return: The attributes of the page mapped by the entry.
+template<u8 L>
+static PageAttr entryAttrs(PageTableEntry<L> const& entry) {
+    bool pat;
+    if constexpr (L == 1) {
+        pat = entry.pat;
+    } else {
+        pat = entry.addr & 1;
+    }
+    u64 const raw((entry.writable ? u64(PageAttr::Writable) : 0)
+                  | (entry.userAccessible ? u64(PageAttr::User) : 0)
+                  | (entry.writeThrough ? u64(PageAttr::WriteThrough) : 0)
+                  | (entry.cacheDisable ? u64(PageAttr::CacheDisable) : 0)
+                  | (pat ? u64(PageAttr::Pat) : 0)
+                  | (entry.global ? u64(PageAttr::Global) : 0)
+                  | (entry.executeDisable ? u64(PageAttr::NoExec) : 0));
+    return PageAttr(raw);
+}
+
+// Allocate a zeroed physical frame to be used as a page table.
+// @return: The physical address of the frame or an error if the allocation
+// failed.
+static Res<PhyAddr> allocPageTableFrame();
+
+// Free a physical frame that was used as a page table. The frame must not be
+// referenced by any page table anymore.
+// @param frame: The physical address of the frame.
+static void freePageTableFrame(PhyAddr const frame);
+
 // Type of a level L page table.
 template<u8 L> requires (0 < L && L <= 4)
 struct PageTable {
@@ -202,93 +359,280 @@ struct PageTable {
         u16 const idx((vaddr.raw() >> (12 + (L-1) * 9)) & 0x1ff);
         Entry& entry(entries[idx]);
         if constexpr (L == 1) {
+            if (!entry.present) {
+                setUsedEntries(usedEntries() + 1);
+            }
             entry.present = true;
-            entry.writable = attrs & PageAttr::Writable;
-            entry.userAccessible = attrs & PageAttr::User;
-            entry.writeThrough = attrs & PageAttr::WriteThrough;
-            entry.cacheDisable = attrs & PageAttr::CacheDisable;
-            entry.global = attrs & PageAttr::Global;
-            entry.executeDisable = attrs & PageAttr::NoExec;
             entry.addr = paddr.raw() >> 12;
+            setEntryAttrs(entry, attrs);
         } else {
+            if (entry.present && entry.pageSize) {
+                PANIC("Cannot map {}: already mapped by a large page", vaddr);
+            }
             if (!entry.present) {
-                Res<Frame> const allocRes(FrameAlloc::alloc());
+                Res<PhyAddr> const allocRes(allocPageTableFrame());
                 if (!allocRes) {
                     return allocRes.error();
                 }
                 Log::debug("Allocated page-table level {} at {}",
                            L - 1,
-                           allocRes->addr());
+                           *allocRes);
                 entry.present = true;
                 // For the upper levels, set the writable and user bit to true
                 // so that the PTE at the last level decides if a given page is
                 // writable/user accessible.
                 entry.writable = true;
                 entry.userAccessible = true;
-                entry.addr = allocRes->addr().raw() >> 12;
+                entry.addr = allocRes->raw() >> 12;
+                if constexpr (L < 4) {
+                    setUsedEntries(usedEntries() + 1);
+                }
             }
             VirAddr const nextLevelVaddr(PhyAddr(entry.addr << 12).toVir());
             PageTable<L-1>* nextLevel(nextLevelVaddr.ptr<PageTable<L-1>>());
-            nextLevel->map(vaddr, paddr, attrs);
+            return nextLevel->map(vaddr, paddr, attrs);
         }
         return Ok;
     }
 
     // Unmap a virtual page. If this is a level 1 page table then this marks the
     // entry associated with vaddr as non-present, otherwise it recurses on the
-    // next level page table mapping this address.
+    // next level page table mapping this address. If vaddr is mapped by a large
+    // page, the entire large page is unmapped.
     // @param vaddr: The virtual address to unmap.
+    // @param unmappedSize: Output param set to the size of the unmapped page in
+    // bytes, i.e. LARGE_PAGE_SIZE when unmapping a large page and PAGE_SIZE
+    // otherwise. When returning NotMapped, set to the size of the region
+    // covered by the missing page table instead.
     // @return: If the unmapping operation led to this table only holding
     // non-present entries this function returns DeallocateTable so that the
-    // caller may de-allocate this table. Otherwise always return Done.
-    UnmapResult unmap(VirAddr const vaddr) {
+    // caller may de-allocate this table. If a page table is missing for vaddr,
+    // returns NotMapped. Otherwise always return Done.
+    UnmapResult unmap(VirAddr const vaddr, u64& unmappedSize) {
         u16 const idx((vaddr.raw() >> (12 + (L-1) * 9)) & 0x1ff);
         Entry& entry(entries[idx]);
-        if constexpr (L == 1) {
-            entry.present = false;
-        } else {
-            if (entry.present) {
+        unmappedSize = PAGE_SIZE;
+        if (!entry.present) {
+            // If the entry is not present then the vaddr was not mapped in the
+            // first place, nothing to unmap.
+            if constexpr (L > 1) {
+                unmappedSize = EntrySize;
+                return UnmapResult::NotMapped;
+            }
+            return UnmapResult::Done;
+        }
+        if constexpr (L > 1) {
+            if (entry.pageSize) {
+                // The entry maps a large page, there is no next level table.
+                unmappedSize = EntrySize;
+            } else {
                 // There is a next level page table for this address, recurse.
                 PhyAddr const nextLevelPaddr(entry.addr << 12);
                 VirAddr const nextLevelVaddr(nextLevelPaddr.toVir());
-                PageTable<L-1>* nextLevel(nextLevelVaddr.ptr<PageTable<L-1>>());
-                UnmapResult const res(nextLevel->unmap(vaddr));
-                if (res == UnmapResult::DeallocateTable) {
-                    // The next level page-table is now empty, mark it as
-                    // non-present and de-allocate it.
-                    entry.present = false;
-                    Log::debug("Deallocating page-table level {} at {}",
-                               L - 1,
-                               nextLevelPaddr);
-                    FrameAlloc::free(Frame(nextLevelPaddr.raw()));
-                } else {
+                PageTable<L-1>* nextLevel(
+                    nextLevelVaddr.ptr<PageTable<L-1>>());
+                UnmapResult const res(nextLevel->unmap(vaddr, unmappedSize));
+                if (res != UnmapResult::DeallocateTable) {
                     // We are not marking any entry as non-present at this
                     // level, therefore this table cannot become empty.
-                    return UnmapResult::Done;
+                    return res;
                 }
-            } else {
-                // If the entry is not present then the vaddr was not mapped in
-                // the first place, nothing to unmap.
-                Log::warn("Unmapping non-mapped address {}", vaddr);
+                // The next level page-table is now empty, de-allocate it.
+                Log::debug("Deallocating page-table level {} at {}",
+                           L - 1,
+                           nextLevelPaddr);
+                freePageTableFrame(nextLevelPaddr);
             }
         }
-        // Arriving here means that we removed an entry from the current table,
-        // which might have become empty. If that is the case, notify our caller
-        // to deallocate us.
+        entry.present = false;
+        if constexpr (L == 4) {
+            // The number of used entries is not tracked for the PML4 as it
+            // cannot be de-allocated from here.
+            return UnmapResult::Done;
+        }
+        // We removed an entry from the current table, notify our caller to
+        // deallocate us if that was the last one.
+        u16 const newUsedEntries(usedEntries() - 1);
+        setUsedEntries(newUsedEntries);
+        if (!!newUsedEntries) {
+            return UnmapResult::Done;
+        } else {
+            return UnmapResult::DeallocateTable;
+        }
+    }
+
+    // Walk the page-table hierarchy down to the entry mapping a virtual
+    // address, that is either a level 1 entry or the entry of a large page, and
+    // invoke a function on this entry. This is the building block of all the
+    // operations inspecting or modifying existing mappings.
+    // @param vaddr: The virtual address to look up.
+    // @param func: Generic callable invoked as func(entry, pageSize) where
+    // entry is a reference to the PageTableEntry mapping vaddr and pageSize is
+    // the size in bytes of the page mapped by this entry.
+    // @return: true if vaddr is mapped, in which case func has been invoked,
+    // false otherwise.
+    template<typename Func>
+    bool walk(VirAddr const vaddr, Func const& func) {
+        u16 const idx((vaddr.raw() >> (12 + (L-1) * 9)) & 0x1ff);
+        Entry& entry(entries[idx]);
+        if (!entry.present) {
+            return false;
+        }
+        if constexpr (L == 1) {
+            func(entry, EntrySize);
+            return true;
+        } else {
+            if (entry.pageSize) {
+                func(entry, EntrySize);
+                return true;
+            }
+            VirAddr const nextLevelVaddr(PhyAddr(entry.addr << 12).toVir());
+            PageTable<L-1>* nextLevel(nextLevelVaddr.ptr<PageTable<L-1>>());
+            return nextLevel->walk(vaddr, func);
+        }
+    }
+
+    // Get the level 2 table through which a virtual address is mapped.
+    // @param vaddr: The virtual address.
+    // @return: A pointer to the level 2 table, nullptr if one of the upper
+    // level entries is not present.
+    PageTable<2>* level2Table(VirAddr const vaddr) requires (L > 2) {
+        u16 const idx((vaddr.raw() >> (12 + (L-1) * 9)) & 0x1ff);
+        Entry const& entry(entries[idx]);
+        if (!entry.present || entry.pageSize) {
+            return nullptr;
+        }
+        VirAddr const nextLevelVaddr(PhyAddr(entry.addr << 12).toVir());
+        PageTable<L-1>* nextLevel(nextLevelVaddr.ptr<PageTable<L-1>>());
+        if constexpr (L == 3) {
+            return nextLevel;
+        } else {
+            return nextLevel->level2Table(vaddr);
+        }
+    }
+
+    // Replace the level 1 table mapping a LARGE_PAGE_SIZE-aligned region by a
+    // single large page. See Paging::collapseLargePage().
+    // @param vaddr: The start address of the region.
+    // @param largeFrame: The physical address of the large page.
+    // @param attrs: The attributes of the large page.
+    // @return: An error if the region is not entirely mapped by 4KiB pages.
+    Err collapse(VirAddr const vaddr,
+                 PhyAddr const largeFrame,
+                 PageAttr const attrs) requires (L == 2) {
+        u16 const idx((vaddr.raw() >> 21) & 0x1ff);
+        Entry& entry(entries[idx]);
+        if (!entry.present || entry.pageSize) {
+            return Error::AddrNotMapped;
+        }
+        PhyAddr const tablePaddr(entry.addr << 12);
+        PageTable<1>* table(tablePaddr.toVir().ptr<PageTable<1>>());
+        if (table->usedEntries() != NumEntries) {
+            return Error::AddrNotMapped;
+        }
+        // Make the pages read-only while copying them, any write from another
+        // cpu would otherwise be lost. Writers fault until the large page is
+        // installed.
         for (u64 i(0); i < NumEntries; ++i) {
-            if (entries[i].present) {
-                // At least one entry is present, we cannot deallocate this
-                // table.
-                return UnmapResult::Done;
+            table->entries[i].writable = false;
+        }
+        tlbShootdown();
+        for (u64 i(0); i < NumEntries; ++i) {
+            PhyAddr const src(table->entries[i].addr << 12);
+            PhyAddr const dst(largeFrame + i * PAGE_SIZE);
+            Util::memcpy(dst.toVir().ptr<void>(),
+                         src.toVir().ptr<void const>(),
+                         PAGE_SIZE);
+        }
+        // Build the new entry on the side and write it in one go so that the
+        // MMU never sees a half-updated entry. The available bits hold the
+        // used entries count of this table and must be preserved.
+        Entry largeEntry(entry);
+        largeEntry.pageSize = true;
+        largeEntry.addr = largeFrame.raw() >> 12;
+        setEntryAttrs(largeEntry, attrs);
+        u64 raw;
+        Util::memcpy(&raw, &largeEntry, sizeof(raw));
+        *reinterpret_cast<u64 volatile*>(&entry) = raw;
+        // No cpu may still be using the level 1 table once it is freed.
+        tlbShootdown();
+        freePageTableFrame(tablePaddr);
+        return Ok;
+    }
+
+    // Free all the page tables below this one. The pages mapped by these tables
+    // are not freed. For a PML4 only the tables of the user half are freed,
+    // the kernel half is shared by all address spaces.
+    void freeTables() requires (L > 1) {
+        u64 const numEntries(L == 4 ? NumEntries / 2 : NumEntries);
+        for (u64 i(0); i < numEntries; ++i) {
+            Entry const& entry(entries[i]);
+            if (!entry.present || entry.pageSize) {
+                continue;
             }
+            PhyAddr const nextLevelPaddr(entry.addr << 12);
+            if constexpr (L > 2) {
+                nextLevelPaddr.toVir().ptr<PageTable<L-1>>()->freeTables();
+            }
+            Log::debug("Deallocating page-table level {} at {}",
+                       L - 1,
+                       nextLevelPaddr);
+            freePageTableFrame(nextLevelPaddr);
+        }
+    }
+
+    // Re-compute the number of used entries of this table and all the tables
+    // below it. This is only used on tables that were not created through
+    // map(), e.g. tables created by the bootloader or while initializing the
+    // direct map.
+    void initUsedEntries() {
+        u16 count(0);
+        for (u64 i(0); i < NumEntries; ++i) {
+            Entry const& entry(entries[i]);
+            if (!entry.present) {
+                continue;
+            }
+            count++;
+            if constexpr (L > 1) {
+                if (!entry.pageSize) {
+                    VirAddr const nextVaddr(PhyAddr(entry.addr << 12).toVir());
+                    nextVaddr.ptr<PageTable<L-1>>()->initUsedEntries();
+                }
+            }
+        }
+        if constexpr (L < 4) {
+            setUsedEntries(count);
         }
-        // All remaining entries are marked non-present, deallocate this table.
-        return UnmapResult::DeallocateTable;
     }
 
 private:
+    // Tables access the entries and used entries count of the next level.
+    template<u8 M> requires (0 < M && M <= 4)
+    friend struct PageTable;
+
     // Number of entries of this page table, always 512 in x86_64.
     static constexpr u64 NumEntries = 512;
+
+    // Size of the memory mapped by a single entry of this table.
+    static constexpr u64 EntrySize = PAGE_SIZE << ((L - 1) * 9);
+
+    // The number of present entries in this table is stored in the `available`
+    // bits of the first two entries. Keeping this count up-to-date on every
+    // map/unmap makes checking if a table became empty O(1) instead of
+    // scanning all the entries. The count is not maintained for the PML4.
+    // @return: The number of present entries in this table.
+    u16 usedEntries() const {
+        return entries[0].available | (entries[1].available << 7);
+    }
+
+    // Set the number of present entries in this table.
+    // @param count: The new number of present entries.
+    void setUsedEntries(u16 const count) {
+        ASSERT(count <= NumEntries);
+        entries[0].available = count & 0x7f;
+        entries[1].available = count >> 7;
+    }
+
     // The entries of this page table.
     Entry entries[NumEntries];
 } __attribute__((packed));
@@ -299,18 +643,150 @@ static_assert(sizeof(PageTable<3>) == PAGE_SIZE);
 static_assert(sizeof(PageTable<2>) == PAGE_SIZE);
 static_assert(sizeof(PageTable<1>) == PAGE_SIZE);
 
+// Get a (virtual) pointer to a PML4 table through the direct map.
+// @param pml4: The physical address of the PML4.
+static PageTable<4>* pml4Ptr(PhyAddr const pml4) {
+    return pml4.toVir().ptr<PageTable<4>>();
+}
+
+// Get the physical address of the PML4 table currently loaded in CR3.
+static PhyAddr currPml4Address() {
+    return PhyAddr(Cpu::cr3() & ~(PAGE_SIZE - 1));
+}
+
 // Get a (virtual) pointer to the PML4 table currently loaded in CR3.
 static PageTable<4>* currPml4() {
-    VirAddr const pml4VAddr(PhyAddr(Cpu::cr3() & ~(PAGE_SIZE - 1)).toVir());
-    return pml4VAddr.ptr<PageTable<4>>();
+    return pml4Ptr(currPml4Address());
+}
+
+// Compute the number of used entries of all page tables reachable from the
+// current PML4. Must be called once after the direct map has been initialized.
+static void initUsedEntriesCounts() {
+    currPml4()->initUsedEntries();
+}
+
+// Number of frames allocated at once when refilling a PageTableFrameCache.
+static constexpr u64 PageTableFrameCacheRefillSize = 8;
+
+// Allocate a physical frame from the frame allocator and zero it.
+// @return: The physical address of the frame or an error if the allocation
+// failed.
+static Res<PhyAddr> allocZeroedFrame() {
+    Res<Frame> const allocRes(FrameAlloc::alloc());
+    if (!allocRes) {
+        return allocRes.error();
+    }
+    PhyAddr const frame(allocRes->addr());
+    // The frame is usually put in a PageTableFrameCache and not accessed soon,
+    // do not pollute the caches with it.
+    Util::memzeroNonTemporal(frame.toVir().ptr<void>(), PAGE_SIZE);
+    return frame;
 }
 
-// Flush the TLB.
+// Allocate a zeroed physical frame to be used as a page table. The frame is
+// taken from the current cpu's PageTableFrameCache, which is refilled from the
+// frame allocator when empty. Before the per-cpu data is initialized, frames
+// are directly allocated from the frame allocator.
+// @return: The physical address of the frame or an error if the allocation
+// failed.
+static Res<PhyAddr> allocPageTableFrame() {
+    if (!Smp::PerCpu::isInitialized()) {
+        return allocZeroedFrame();
+    }
+    // The cache is per-cpu, disabling interrupts is enough to get exclusive
+    // access to it.
+    bool const savedInterruptFlag(Cpu::interruptsEnabled());
+    Cpu::disableInterrupts();
+    PageTableFrameCache& cache(Smp::PerCpu::data().pageTableFrameCache);
+    if (!cache.size) {
+        while (cache.size < PageTableFrameCacheRefillSize) {
+            Res<PhyAddr> const allocRes(allocZeroedFrame());
+            if (!allocRes) {
+                break;
+            }
+            cache.frames[cache.size++] = *allocRes;
+        }
+    }
+    if (!cache.size) {
+        Cpu::setInterruptFlag(savedInterruptFlag);
+        return Error::OutOfPhysicalMemory;
+    }
+    PhyAddr const frame(cache.frames[--cache.size]);
+    Cpu::setInterruptFlag(savedInterruptFlag);
+    return frame;
+}
+
+// Free a physical frame that was used as a page table. The frame is zeroed and
+// put back into the current cpu's PageTableFrameCache if there is room left,
+// otherwise it is freed to the frame allocator.
+// @param frame: The physical address of the frame.
+static void freePageTableFrame(PhyAddr const frame) {
+    if (!Smp::PerCpu::isInitialized()) {
+        FrameAlloc::free(Frame(frame));
+        return;
+    }
+    bool const savedInterruptFlag(Cpu::interruptsEnabled());
+    Cpu::disableInterrupts();
+    PageTableFrameCache& cache(Smp::PerCpu::data().pageTableFrameCache);
+    if (cache.size < PageTableFrameCache::Capacity) {
+        Util::memzeroNonTemporal(frame.toVir().ptr<void>(), PAGE_SIZE);
+        cache.frames[cache.size++] = frame;
+    } else {
+        FrameAlloc::free(Frame(frame));
+    }
+    Cpu::setInterruptFlag(savedInterruptFlag);
+}
+
+// Flush the TLB. This does not flush the entries of global pages.
 static void flushTlb() {
     // The magical `mov rax, cr3 ; mov cr3, rax`.
     Cpu::writeCr3(Cpu::cr3());
 }
 
+// Flush the entire TLB of the current cpu, including the entries of global
+// pages.
+void flushGlobalTlb() {
+    // Toggling CR4.PGE invalidates all TLB entries, global or not.
+    u64 const cr4(Cpu::cr4());
+    Cpu::writeCr4(cr4 & ~Cr4PgeBit);
+    Cpu::writeCr4(cr4);
+}
+
+// Check if a virtual address is in the kernel half of the address space.
+// @param vaddr: The address to test.
+// @return: true if the address is a kernel address, false otherwise.
+static bool isKernelAddr(VirAddr const vaddr) {
+    return !!(vaddr.raw() >> 63);
+}
+
+// Above this number of pages, flushing the entire TLB is cheaper than
+// invalidating the pages one by one.
+static constexpr u64 InvlpgMaxPages = 32;
+
+// Flush the TLB after modifying the mappings of a range of virtual pages in an
+// address space. Kernel addresses are shared by all address spaces and are
+// mapped as global pages, hence their entries are always invalidated.
+// Nothing needs to be flushed for user addresses if the address space is not
+// the current one.
+// @param pml4: The physical address of the PML4 of the modified address space.
+// @param addrStart: The first modified virtual page.
+// @param nPages: The number of modified pages.
+static void flushTlb(PhyAddr const pml4,
+                     VirAddr const addrStart,
+                     u64 const nPages) {
+    if (isKernelAddr(addrStart)) {
+        if (nPages <= InvlpgMaxPages) {
+            for (u64 i(0); i < nPages; ++i) {
+                Cpu::invlpg(addrStart + i * PAGE_SIZE);
+            }
+        } else {
+            flushGlobalTlb();
+        }
+    } else if (pml4 == currPml4Address()) {
+        flushTlb();
+    }
+}
+
 // Map a region of virtual memory to physical memory in the current address
 // space. The region's size must be a multiple of page size.
 // @param vaddrStart: The start virtual address of the region to be mapped. Must
@@ -325,12 +801,176 @@ Err map(VirAddr const vaddrStart,
         PhyAddr const paddrStart,
         PageAttr const pageAttr,
         u64 const nPages) {
+    return map(currPml4Address(), vaddrStart, paddrStart, pageAttr, nPages);
+}
+
+// Unmap virtual pages from virtual memory. Attempting to unmap a page that is
+// not currently mapped is a no-op.
+// @param addrStart: The address to start unmapping from.
+// @param nPages: The number of pages to unmap.
+void unmap(VirAddr const addrStart, u64 const nPages) {
+    unmap(currPml4Address(), addrStart, nPages);
+}
+
+// Unmap virtual pages from a page-table hierarchy without invalidating any TLB
+// entry.
+// @param pml4Addr: The physical address of the PML4 of the address space.
+// @param addrStart: The address to start unmapping from.
+// @param nPages: The number of pages to unmap.
+// @param warnIfNotMapped: If true, log a warning, once for the entire range,
+// if some of the pages were not mapped.
+static void doUnmap(PhyAddr const pml4Addr,
+                    VirAddr const addrStart,
+                    u64 const nPages,
+                    bool const warnIfNotMapped) {
     ASSERT(IsInitialized);
+    ASSERT(pml4Addr.isPageAligned());
+    ASSERT(addrStart.isPageAligned());
+    ASSERT(nPages > 0);
+    Log::debug("Unmapping {} ({} pages)", addrStart, nPages);
+    PageTable<4>* pml4(pml4Ptr(pml4Addr));
+    u64 const end(addrStart.raw() + nPages * PAGE_SIZE);
+    u64 vaddr(addrStart.raw());
+    u64 firstNotMapped(0);
+    while (vaddr < end) {
+        u64 unmappedSize;
+        UnmapResult const res(pml4->unmap(vaddr, unmappedSize));
+        // There is no way we would need to deallocate the PML4 as the code we
+        // are running is in the virtual address space!
+        ASSERT(res != UnmapResult::DeallocateTable);
+        if (res == UnmapResult::NotMapped) {
+            // Skip the entire region covered by the missing page table.
+            if (!firstNotMapped) {
+                firstNotMapped = vaddr;
+            }
+            u64 const skip(unmappedSize - (vaddr & (unmappedSize - 1)));
+            if (skip >= end - vaddr) {
+                break;
+            }
+            vaddr += skip;
+            continue;
+        }
+        // Large pages are unmapped as a whole, which is only allowed if the
+        // range covers the entire large page.
+        if (vaddr % unmappedSize || end - vaddr < unmappedSize) {
+            PANIC("Partially unmapped large page at {}", VirAddr(vaddr));
+        }
+        vaddr += unmappedSize;
+    }
+    if (!!firstNotMapped && warnIfNotMapped) {
+        Log::warn("Unmapping non-mapped address {}", VirAddr(firstNotMapped));
+    }
+}
+
+// Unmap virtual pages from the current address space without invalidating the
+// TLB of any cpu. Pages that are not mapped are silently skipped, e.g. the
+// untouched pages of a lazy allocation.
+// @param addrStart: The address to start unmapping from.
+// @param nPages: The number of pages to unmap.
+void unmapNoFlush(VirAddr const addrStart, u64 const nPages) {
+    doUnmap(currPml4Address(), addrStart, nPages, false);
+}
+
+// Translate a virtual address to the physical address it is mapped to in the
+// current address space.
+// @param vaddr: The virtual address to translate.
+// @return: The Mapping of vaddr, or an error if vaddr is not mapped.
+Res<Mapping> translate(VirAddr const vaddr) {
+    ASSERT(IsInitialized);
+    Mapping mapping;
+    bool const isMapped(currPml4()->walk(vaddr,
+        [&](auto const& entry, u64 const pageSize) {
+        // For large pages, the low bits of addr contain the PAT bit which must
+        // be masked out.
+        u64 const pageBase((entry.addr << 12) & ~(pageSize - 1));
+        mapping.paddr = pageBase | (vaddr.raw() & (pageSize - 1));
+        mapping.pageSize = pageSize;
+        mapping.attrs = entryAttrs(entry);
+    }));
+    if (!isMapped) {
+        return Error::AddrNotMapped;
+    }
+    return mapping;
+}
+
+// Change the attributes of mapped virtual pages in the current address space.
+// Pages that are not mapped are skipped.
+// @param addrStart: The address of the first page to modify.
+// @param pageAttr: The new attributes of the pages.
+// @param nPages: The number of pages to modify.
+void protect(VirAddr const addrStart,
+             PageAttr const pageAttr,
+             u64 const nPages) {
+    protect(currPml4Address(), addrStart, pageAttr, nPages);
+}
+
+// Replace the 4KiB pages mapping a LARGE_PAGE_SIZE-aligned region of the
+// current address space by a single large page.
+// @param vaddr: The start address of the region.
+// @param largeFrame: The physical address of the large page.
+// @param attrs: The attributes of the large page.
+// @return: An error if the region is not entirely mapped by 4KiB pages.
+Err collapseLargePage(VirAddr const vaddr,
+                      PhyAddr const largeFrame,
+                      PageAttr const attrs) {
+    ASSERT(IsInitialized);
+    ASSERT(!(vaddr.raw() % LARGE_PAGE_SIZE));
+    ASSERT(!(largeFrame.raw() % LARGE_PAGE_SIZE));
+    PageTable<2>* const table(currPml4()->level2Table(vaddr));
+    if (!table) {
+        return Error::AddrNotMapped;
+    }
+    return table->collapse(vaddr, largeFrame, attrs);
+}
+
+// Flush the TLB, including the entries of global pages, on all online cpus.
+// Returns once all cpus completed the flush.
+void tlbShootdown() {
+    flushGlobalTlb();
+    if (!Smp::PerCpu::isInitialized()) {
+        // No other cpu can be online before the per-cpu data exists.
+        return;
+    }
+    Smp::Id const self(Smp::id());
+    Vector<Ptr<Smp::RemoteCall::CallResult<void>>> calls;
+    for (Smp::Id id(0); id < Smp::ncpus(); ++id) {
+        if (id == self || !Smp::PerCpu::data(id).isOnline) {
+            continue;
+        }
+        calls.pushBack(Smp::RemoteCall::invokeOn(id, []() {
+            flushGlobalTlb();
+        }));
+    }
+    for (u64 i(0); i < calls.size(); ++i) {
+        calls[i]->wait();
+    }
+}
+
+// Map a region of virtual memory to physical memory in the address space using
+// the given PML4. The page tables are accessed through the direct map, hence
+// the address space does not need to be the current one. The region's size
+// must be a multiple of page size.
+// @param pml4Addr: The physical address of the PML4 of the address space.
+// @param vaddrStart: The start virtual address of the region to be mapped. Must
+// be page aligned.
+// @param paddrStart: The start physical address at which the region should be
+// mapped. Must be page aligned.
+// @param pageAttr: Control the attribute of the mapping. All mapped pages will
+// end up using those attributes.
+// @param nPages: The size of the region in number of pages.
+// @return: Returns an error if the mapping failed.
+Err map(PhyAddr const pml4Addr,
+        VirAddr const vaddrStart,
+        PhyAddr const paddrStart,
+        PageAttr const pageAttr,
+        u64 const nPages) {
+    ASSERT(IsInitialized);
+    ASSERT(pml4Addr.isPageAligned());
     ASSERT(vaddrStart.isPageAligned());
     ASSERT(paddrStart.isPageAligned());
     ASSERT(!!nPages);
     Log::debug("Mapping {} to {} ({} pages)", vaddrStart, paddrStart, nPages);
-    PageTable<4>* pml4(currPml4());
+    PageTable<4>* pml4(pml4Ptr(pml4Addr));
     Err returnedErr;
     for (u64 i(0); i < nPages; ++i) {
         VirAddr const vaddr(vaddrStart.raw() + i * PAGE_SIZE);
@@ -346,28 +986,70 @@ Err map(VirAddr const vaddrStart,
             break;
         }
     }
-    flushTlb();
+    flushTlb(pml4Addr, vaddrStart, nPages);
     return returnedErr;
 }
 
-// Unmap virtual pages from virtual memory. Attempting to unmap a page that is
-// not currently mapped is a no-op.
+// Unmap virtual pages from the address space using the given PML4. Attempting
+// to unmap a page that is not currently mapped is a no-op.
+// @param pml4Addr: The physical address of the PML4 of the address space.
 // @param addrStart: The address to start unmapping from.
 // @param nPages: The number of pages to unmap.
-void unmap(VirAddr const addrStart, u64 const nPages) {
+void unmap(PhyAddr const pml4Addr, VirAddr const addrStart, u64 const nPages) {
+    doUnmap(pml4Addr, addrStart, nPages, true);
+    flushTlb(pml4Addr, addrStart, nPages);
+}
+
+// Change the attributes of mapped virtual pages in the address space using the
+// given PML4. Pages that are not mapped are skipped.
+// @param pml4Addr: The physical address of the PML4 of the address space.
+// @param addrStart: The address of the first page to modify.
+// @param pageAttr: The new attributes of the pages.
+// @param nPages: The number of pages to modify.
+void protect(PhyAddr const pml4Addr,
+             VirAddr const addrStart,
+             PageAttr const pageAttr,
+             u64 const nPages) {
     ASSERT(IsInitialized);
+    ASSERT(pml4Addr.isPageAligned());
     ASSERT(addrStart.isPageAligned());
     ASSERT(nPages > 0);
-    Log::debug("Unmapping {} ({} pages)", addrStart, nPages);
-    PageTable<4>* pml4(currPml4());
-    for (u64 i(0); i < nPages; ++i) {
-        VirAddr const vaddr(addrStart.raw() + i * PAGE_SIZE);
-        UnmapResult const res(pml4->unmap(vaddr));
-        // There is no way we would need to deallocate the PML4 as the code we
-        // are running is in the virtual address space!
-        ASSERT(res != UnmapResult::DeallocateTable);
+    Log::debug("Protecting {} ({} pages)", addrStart, nPages);
+    PageTable<4>* pml4(pml4Ptr(pml4Addr));
+    u64 const end(addrStart.raw() + nPages * PAGE_SIZE);
+    u64 vaddr(addrStart.raw());
+    while (vaddr < end) {
+        u64 pageSize(PAGE_SIZE);
+        bool const isMapped(pml4->walk(vaddr,
+            [&](auto& entry, u64 const entryPageSize) {
+            // Large pages are modified as a whole, which is only allowed if the
+            // range covers the entire large page.
+            pageSize = entryPageSize;
+            if (vaddr % pageSize || end - vaddr < pageSize) {
+                PANIC("Partially protected large page at {}", VirAddr(vaddr));
+            }
+            setEntryAttrs(entry, pageAttr);
+        }));
+        if (!isMapped) {
+            Log::warn("Changing attributes of non-mapped address {}",
+                      VirAddr(vaddr));
+        }
+        vaddr += pageSize;
     }
-    flushTlb();
+    flushTlb(pml4Addr, addrStart, nPages);
+}
+
+// Free the page tables of the user half of the address space using the given
+// PML4, as well as the PML4 itself. The pages mapped in the address space are
+// not freed. The address space must not be in use by any cpu.
+// @param pml4Addr: The physical address of the PML4 of the address space.
+void freePageTables(PhyAddr const pml4Addr) {
+    ASSERT(IsInitialized);
+    ASSERT(pml4Addr.isPageAligned());
+    ASSERT(pml4Addr != currPml4Address());
+    pml4Ptr(pml4Addr)->freeTables();
+    Log::debug("Deallocating page-table level 4 at {}", pml4Addr);
+    freePageTableFrame(pml4Addr);
 }
 
 }
@@ -155,8 +155,9 @@ initializeDirectMap:
                 jae     .level1LoopOut
                 cmp     rbx, rsi
                 jae     .break
+                ; Direct map entries are present, writable and global.
                 mov     rax, rbx
-                or      rax, 0x3
+                or      rax, 0x103
                 mov     [r8 + r9 * 8], rax
                 mov     [directMapMaxMappedOffset], rbx
                 add     rbx, PAGE_SIZE
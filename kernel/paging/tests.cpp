@@ -4,6 +4,8 @@
 #include <interrupts/interrupts.hpp>
 #include <selftests/macros.hpp>
 #include <paging/addrspace.hpp>
+#include <smp/percpu.hpp>
+#include <cpu/cpu.hpp>
 
 namespace Paging {
 
@@ -181,6 +183,35 @@ SelfTests::TestResult unmapTest() {
     return SelfTests::TestResult::Success;
 }
 
+// Check that unmapping a page does not de-allocate a page table that is still
+// in use by other mappings.
+SelfTests::TestResult unmapPartialTableTest() {
+    // Map two pages sharing the same level 1 table. Unmapping the first page
+    // must keep the table around since the second page is still mapped.
+    VirAddr const vaddr(0xcafecafe000);
+    Res<FrameAlloc::Frame> const allocRes(FrameAlloc::alloc());
+    TEST_ASSERT(!!allocRes);
+    PhyAddr const paddr(allocRes->addr());
+    *paddr.toVir().ptr<u64>() = 0xdeadbeefcafebabe;
+
+    PageAttr const attrs(PageAttr::Writable);
+    TEST_ASSERT(!Paging::map(vaddr, paddr, attrs, 1));
+    TEST_ASSERT(!Paging::map(vaddr + PAGE_SIZE, paddr, attrs, 1));
+
+    Paging::unmap(vaddr, 1);
+    TEST_ASSERT(*(vaddr + PAGE_SIZE).ptr<u64>() == 0xdeadbeefcafebabe);
+
+    // Unmapping the second page de-allocates the tables. Mapping again must
+    // re-allocate them.
+    Paging::unmap(vaddr + PAGE_SIZE, 1);
+    TEST_ASSERT(!Paging::map(vaddr, paddr, attrs, 1));
+    TEST_ASSERT(*vaddr.ptr<u64>() == 0xdeadbeefcafebabe);
+    Paging::unmap(vaddr, 1);
+
+    FrameAlloc::free(*allocRes);
+    return SelfTests::TestResult::Success;
+}
+
 // Check that switch between address spaces work as expected.
 SelfTests::TestResult addrSpaceTest() {
     // This test performs the following steps:
@@ -256,12 +287,175 @@ SelfTests::TestResult addrSpaceTest() {
     return SelfTests::TestResult::Success;
 }
 
+// Check that AddrSpace::map, unmap and protect can modify an address space that
+// is not the current one.
+SelfTests::TestResult addrSpaceMapNonCurrentTest() {
+    Ptr<AddrSpace> const addrSpace(AddrSpace::New().value());
+    PhyAddr const oldPml4(Cpu::cr3() & ~(PAGE_SIZE - 1));
+    TEST_ASSERT(oldPml4 != addrSpace->pml4Address());
+
+    Frame const frame(FrameAlloc::alloc().value());
+    *frame.addr().toVir().ptr<u64>() = 0xdeadbeefcafebabe;
+    VirAddr const vaddr(0xcafe000);
+
+    // Map the frame without switching to the address space. The mapping must
+    // not be visible from the current address space.
+    TEST_ASSERT(!addrSpace->map(vaddr, frame.addr(), PageAttr::None, 1));
+    TEST_ASSERT((Cpu::cr3() & ~(PAGE_SIZE - 1)) == oldPml4.raw());
+
+    // Make the page writable, still without switching.
+    addrSpace->protect(vaddr, PageAttr::Writable, 1);
+
+    // Switch to the address space and check the mapping. The write would
+    // trigger a page fault if the protect() did not work.
+    AddrSpace::switchAddrSpace(addrSpace);
+    TEST_ASSERT(*vaddr.ptr<u64>() == 0xdeadbeefcafebabe);
+    *vaddr.ptr<u64>() = 0xbeef;
+    AddrSpace::switchAddrSpace(oldPml4);
+    TEST_ASSERT(*frame.addr().toVir().ptr<u64>() == 0xbeef);
+
+    // Unmap from the non-current address space. The page-tables allocated for
+    // this mapping are now empty and get de-allocated.
+    addrSpace->unmap(vaddr, 1);
+    FrameAlloc::free(frame);
+    return SelfTests::TestResult::Success;
+}
+
+// Check that destroying an AddrSpace frees its user page tables through the
+// per-cpu PageTableFrameCache. The first entry of the level 3 table mapping
+// vaddr also holds the used entries count of that table in its ignored bits,
+// which must not be mistaken for part of the next table's address.
+SelfTests::TestResult addrSpaceFreeTest() {
+    Ptr<AddrSpace> addrSpace(AddrSpace::New().value());
+    Frame const frame(FrameAlloc::alloc().value());
+    VirAddr const vaddr(0xcafe000);
+    TEST_ASSERT(!addrSpace->map(vaddr, frame.addr(), PageAttr::None, 1));
+
+    // Collect the addresses of the tables used to map vaddr.
+    u64 const addrMask(0x000ffffffffff000ULL);
+    PhyAddr tables[4];
+    tables[0] = addrSpace->pml4Address();
+    for (u64 i(1); i < 4; ++i) {
+        u64 const idx((vaddr.raw() >> (12 + (4 - i) * 9)) & 0x1ff);
+        u64 const entry(tables[i - 1].toVir().ptr<u64>()[idx]);
+        TEST_ASSERT(entry & 1);
+        tables[i] = PhyAddr(entry & addrMask);
+    }
+
+    // The cache is per-cpu, keep interrupts disabled while inspecting it.
+    bool const savedIrqFlag(Cpu::interruptsEnabled());
+    Cpu::disableInterrupts();
+    PageTableFrameCache& cache(Smp::PerCpu::data().pageTableFrameCache);
+    // Make room for the freed tables.
+    while (cache.size > PageTableFrameCache::Capacity - 4) {
+        FrameAlloc::free(Frame(cache.frames[--cache.size]));
+    }
+    u64 const sizeBefore(cache.size);
+    addrSpace = Ptr<AddrSpace>();
+    bool const allFreed(cache.size == sizeBefore + 4);
+    bool allFound(true);
+    for (PhyAddr const& table : tables) {
+        bool found(false);
+        for (u64 i(sizeBefore); i < cache.size; ++i) {
+            found = found || cache.frames[i] == table;
+        }
+        allFound = allFound && found;
+    }
+    Cpu::setInterruptFlag(savedIrqFlag);
+    TEST_ASSERT(allFreed);
+    TEST_ASSERT(allFound);
+    FrameAlloc::free(frame);
+    return SelfTests::TestResult::Success;
+}
+
+// Check that changing a global kernel mapping invalidates its stale TLB entry.
+SelfTests::TestResult globalMappingRemapTest() {
+    // Global pages must be enabled.
+    TEST_ASSERT(Cpu::cr4() & (1 << 7));
+
+    Frame const frameA(FrameAlloc::alloc().value());
+    Frame const frameB(FrameAlloc::alloc().value());
+    *frameA.addr().toVir().ptr<u64>() = 0xaaaa;
+    *frameB.addr().toVir().ptr<u64>() = 0xbbbb;
+
+    // Kernel address, outside of the direct map and the kernel image.
+    VirAddr const vaddr(0xffffc00000000000);
+    PageAttr const attrs(PageAttr::Writable | PageAttr::Global);
+    TEST_ASSERT(!Paging::map(vaddr, frameA.addr(), attrs, 1));
+    // Access the page to make sure its translation is cached in the TLB.
+    TEST_ASSERT(*vaddr.ptr<u64>() == 0xaaaa);
+
+    // Re-map the page to the other frame. A CR3 reload would not invalidate
+    // the global entry, map() must take care of it.
+    TEST_ASSERT(!Paging::map(vaddr, frameB.addr(), attrs, 1));
+    TEST_ASSERT(*vaddr.ptr<u64>() == 0xbbbb);
+
+    Paging::unmap(vaddr, 1);
+    FrameAlloc::free(frameA);
+    FrameAlloc::free(frameB);
+    return SelfTests::TestResult::Success;
+}
+
+// Check the content of the PAT, it must match the memory types of PageAttr.
+SelfTests::TestResult patTest() {
+    u64 const pat(Cpu::rdmsr(Cpu::Msr::IA32_PAT));
+    // Write-back, entry 0.
+    TEST_ASSERT(((pat >> (0 * 8)) & 0xff) == 0x6);
+    // Write-through, entry 1.
+    TEST_ASSERT(((pat >> (1 * 8)) & 0xff) == 0x4);
+    // Uncacheable-minus, entry 2.
+    TEST_ASSERT(((pat >> (2 * 8)) & 0xff) == 0x7);
+    // Uncacheable, entry 3.
+    TEST_ASSERT(((pat >> (3 * 8)) & 0xff) == 0x0);
+    // Write-combining, entry 4.
+    TEST_ASSERT(((pat >> (4 * 8)) & 0xff) == 0x1);
+    // Write-protected, entry 5.
+    TEST_ASSERT(((pat >> (5 * 8)) & 0xff) == 0x5);
+    return SelfTests::TestResult::Success;
+}
+
+// Check that translate() returns the physical address, page size and attributes
+// of a mapping and that protect() changes the attributes of the mapping.
+SelfTests::TestResult translateProtectTest() {
+    Frame const frame(FrameAlloc::alloc().value());
+    VirAddr const vaddr(0xcafe000);
+    TEST_ASSERT(Paging::translate(vaddr).error() == Error::AddrNotMapped);
+
+    PageAttr const attrs(PageAttr::Writable | PageAttr::NoExec);
+    TEST_ASSERT(!Paging::map(vaddr, frame.addr(), attrs, 1));
+    Res<Mapping> const mapping(Paging::translate(vaddr + 0x123));
+    TEST_ASSERT(!!mapping);
+    TEST_ASSERT(mapping->paddr == frame.addr() + 0x123);
+    TEST_ASSERT(mapping->pageSize == PAGE_SIZE);
+    TEST_ASSERT(mapping->attrs & PageAttr::Writable);
+    TEST_ASSERT(mapping->attrs & PageAttr::NoExec);
+
+    // Make the page read-only, the physical address must not change.
+    Paging::protect(vaddr, PageAttr::None, 1);
+    Res<Mapping> const protMapping(Paging::translate(vaddr));
+    TEST_ASSERT(!!protMapping);
+    TEST_ASSERT(protMapping->paddr == frame.addr());
+    TEST_ASSERT(!(protMapping->attrs & PageAttr::Writable));
+    TEST_ASSERT(!(protMapping->attrs & PageAttr::NoExec));
+
+    Paging::unmap(vaddr, 1);
+    TEST_ASSERT(!Paging::translate(vaddr));
+    FrameAlloc::free(frame);
+    return SelfTests::TestResult::Success;
+}
+
 // Run paging tests.
 void Test(SelfTests::TestRunner& runner) {
     RUN_TEST(runner, mapTest);
     RUN_TEST(runner, mapAttrsTest);
     RUN_TEST(runner, unmapTest);
+    RUN_TEST(runner, unmapPartialTableTest);
     RUN_TEST(runner, addrSpaceTest);
+    RUN_TEST(runner, addrSpaceMapNonCurrentTest);
+    RUN_TEST(runner, addrSpaceFreeTest);
+    RUN_TEST(runner, globalMappingRemapTest);
+    RUN_TEST(runner, patTest);
+    RUN_TEST(runner, translateProtectTest);
 }
 
 }
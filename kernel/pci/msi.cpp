@@ -0,0 +1,203 @@
+// Message Signaled Interrupts (MSI and MSI-X).
+#include <pci/pci.hpp>
+#include <util/assert.hpp>
+
+namespace Pci {
+
+// Offsets in the MSI capability.
+static constexpr u8 MSI_CONTROL = 0x2;
+static constexpr u8 MSI_ADDRESS_LOW = 0x4;
+static constexpr u8 MSI_ADDRESS_HIGH = 0x8;
+// The offsets of the data and mask depend on the address size.
+static constexpr u8 MSI_DATA_32 = 0x8;
+static constexpr u8 MSI_DATA_64 = 0xc;
+static constexpr u8 MSI_MASK_32 = 0xc;
+static constexpr u8 MSI_MASK_64 = 0x10;
+
+// Bits of the MSI message control register.
+static constexpr u16 MSI_CONTROL_ENABLE = 1 << 0;
+static constexpr u16 MSI_CONTROL_MULTIPLE_MESSAGE_ENABLE = 0x7 << 4;
+static constexpr u16 MSI_CONTROL_64BIT = 1 << 7;
+static constexpr u16 MSI_CONTROL_PER_VECTOR_MASKING = 1 << 8;
+
+// Offsets in the MSI-X capability.
+static constexpr u8 MSIX_CONTROL = 0x2;
+static constexpr u8 MSIX_TABLE = 0x4;
+
+// Bits of the MSI-X message control register.
+static constexpr u16 MSIX_CONTROL_TABLE_SIZE = 0x7ff;
+static constexpr u16 MSIX_CONTROL_FUNCTION_MASK = 1 << 14;
+static constexpr u16 MSIX_CONTROL_ENABLE = 1 << 15;
+
+// Layout of an entry in the MSI-X table.
+static constexpr u64 MSIX_ENTRY_SIZE = 16;
+static constexpr u64 MSIX_ENTRY_ADDRESS_LOW = 0x0;
+static constexpr u64 MSIX_ENTRY_ADDRESS_HIGH = 0x4;
+static constexpr u64 MSIX_ENTRY_DATA = 0x8;
+static constexpr u64 MSIX_ENTRY_VECTOR_CONTROL = 0xc;
+static constexpr u32 MSIX_ENTRY_MASKED = 1 << 0;
+
+// Compute the address of an MSI targeting a cpu.
+// @param cpu: The destination cpu.
+// @return: The message address.
+u64 msiAddress(Smp::Id const cpu) {
+    // Physical destination mode, no redirection hint. The APIC ID of a cpu is
+    // its Smp::Id.
+    return 0xfee00000 | (u64(cpu.raw()) << 12);
+}
+
+// Compute the data of an MSI raising a vector.
+// @param vector: The vector raised on the destination cpu.
+// @return: The message data.
+u16 msiData(Interrupts::Vector const vector) {
+    // Fixed delivery mode, edge triggered.
+    return vector.raw();
+}
+
+// Enable bus mastering, needed for the function to send MSIs, and disable INTx.
+// @param dev: The function.
+static void prepareForMsi(Device const& dev) {
+    u16 const command(read16(dev.addr, COMMAND));
+    write16(dev.addr, COMMAND,
+            command | COMMAND_BUS_MASTER | COMMAND_INTX_DISABLE);
+}
+
+// Configure and enable MSI on a function, using a single message.
+// @param dev: The function.
+// @param cpu: The cpu receiving the interrupts.
+// @param vector: The vector raised on `cpu`.
+// @return: An error if the function does not support MSI.
+Err enableMsi(Device const& dev,
+              Smp::Id const cpu,
+              Interrupts::Vector const vector) {
+    Res<u8> const capRes(findCapability(dev, CAPABILITY_MSI));
+    if (!capRes) {
+        return capRes.error();
+    }
+    u8 const cap(*capRes);
+    u16 control(read16(dev.addr, cap + MSI_CONTROL));
+    // The message must not be changed while MSI is enabled.
+    control &= ~(MSI_CONTROL_ENABLE | MSI_CONTROL_MULTIPLE_MESSAGE_ENABLE);
+    write16(dev.addr, cap + MSI_CONTROL, control);
+
+    u64 const address(msiAddress(cpu));
+    bool const is64Bit(control & MSI_CONTROL_64BIT);
+    write32(dev.addr, cap + MSI_ADDRESS_LOW, address & 0xffffffff);
+    if (is64Bit) {
+        write32(dev.addr, cap + MSI_ADDRESS_HIGH, address >> 32);
+    }
+    write16(dev.addr, cap + (is64Bit ? MSI_DATA_64 : MSI_DATA_32),
+            msiData(vector));
+    if (control & MSI_CONTROL_PER_VECTOR_MASKING) {
+        u8 const maskOffset(cap + (is64Bit ? MSI_MASK_64 : MSI_MASK_32));
+        write32(dev.addr, maskOffset, read32(dev.addr, maskOffset) & ~1U);
+    }
+
+    prepareForMsi(dev);
+    write16(dev.addr, cap + MSI_CONTROL, control | MSI_CONTROL_ENABLE);
+    return Ok;
+}
+
+// Disable MSI on a function.
+// @param dev: The function.
+void disableMsi(Device const& dev) {
+    Res<u8> const cap(findCapability(dev, CAPABILITY_MSI));
+    if (!cap) {
+        return;
+    }
+    u16 const control(read16(dev.addr, *cap + MSI_CONTROL));
+    write16(dev.addr, *cap + MSI_CONTROL, control & ~MSI_CONTROL_ENABLE);
+}
+
+// Get a pointer to a register of an entry in an MSI-X table.
+// @param table: The table.
+// @param index: The index of the entry.
+// @param reg: The offset of the register in the entry.
+// @return: Pointer to the register.
+static u32 volatile* msixEntryReg(MsixTable const& table,
+                                  u16 const index,
+                                  u64 const reg) {
+    ASSERT(index < table.size);
+    VirAddr const addr(table.table + index * MSIX_ENTRY_SIZE + reg);
+    return addr.ptr<u32 volatile>();
+}
+
+// Enable MSI-X on a function. All entries of the table are masked.
+// @param dev: The function.
+// @return: The MSI-X table of the function or an error if the function does
+// not support MSI-X.
+Res<MsixTable> enableMsix(Device const& dev) {
+    Res<u8> const capRes(findCapability(dev, CAPABILITY_MSIX));
+    if (!capRes) {
+        return capRes.error();
+    }
+    u8 const cap(*capRes);
+    u32 const tableReg(read32(dev.addr, cap + MSIX_TABLE));
+    u8 const bir(tableReg & 0x7);
+    Res<VirAddr> const barAddr(mapBar(dev, bir));
+    if (!barAddr) {
+        return barAddr.error();
+    }
+    u16 const control(read16(dev.addr, cap + MSIX_CONTROL));
+    MsixTable const table({
+        .dev = dev,
+        .capOffset = cap,
+        .table = *barAddr + (tableReg & ~0x7U),
+        .size = u16((control & MSIX_CONTROL_TABLE_SIZE) + 1),
+    });
+
+    // Enable MSI-X with the function masked while masking all the entries,
+    // the table is only accessible once MSI-X is enabled.
+    prepareForMsi(dev);
+    write16(dev.addr, cap + MSIX_CONTROL,
+            control | MSIX_CONTROL_ENABLE | MSIX_CONTROL_FUNCTION_MASK);
+    for (u16 i(0); i < table.size; ++i) {
+        setMsixEntryMask(table, i, true);
+    }
+    write16(dev.addr, cap + MSIX_CONTROL, control | MSIX_CONTROL_ENABLE);
+    return table;
+}
+
+// Configure and unmask an entry of an MSI-X table.
+// @param table: The table.
+// @param index: The index of the entry.
+// @param cpu: The cpu receiving the interrupts of this entry.
+// @param vector: The vector raised on `cpu`.
+void setMsixEntry(MsixTable const& table,
+                  u16 const index,
+                  Smp::Id const cpu,
+                  Interrupts::Vector const vector) {
+    // The message of an entry must not be changed while it is unmasked.
+    setMsixEntryMask(table, index, true);
+    u64 const address(msiAddress(cpu));
+    *msixEntryReg(table, index, MSIX_ENTRY_ADDRESS_LOW) = address & 0xffffffff;
+    *msixEntryReg(table, index, MSIX_ENTRY_ADDRESS_HIGH) = address >> 32;
+    *msixEntryReg(table, index, MSIX_ENTRY_DATA) = msiData(vector);
+    setMsixEntryMask(table, index, false);
+}
+
+// (Un-)Mask an entry of an MSI-X table.
+// @param table: The table.
+// @param index: The index of the entry.
+// @param isMasked: If true, mask the entry, otherwise unmask it.
+void setMsixEntryMask(MsixTable const& table,
+                      u16 const index,
+                      bool const isMasked) {
+    u32 volatile* const reg(
+        msixEntryReg(table, index, MSIX_ENTRY_VECTOR_CONTROL));
+    if (isMasked) {
+        *reg = *reg | MSIX_ENTRY_MASKED;
+    } else {
+        *reg = *reg & ~MSIX_ENTRY_MASKED;
+    }
+}
+
+// Disable MSI-X on a function.
+// @param table: The table returned by enableMsix().
+void disableMsix(MsixTable const& table) {
+    u8 const cap(table.capOffset);
+    u16 const control(read16(table.dev.addr, cap + MSIX_CONTROL));
+    write16(table.dev.addr, cap + MSIX_CONTROL,
+            control & ~MSIX_CONTROL_ENABLE);
+}
+}
@@ -0,0 +1,422 @@
+// PCI bus enumeration and configuration space access.
+#include <pci/pci.hpp>
+#include <acpi/acpi.hpp>
+#include <paging/paging.hpp>
+#include <concurrency/lock.hpp>
+#include <cpu/cpu.hpp>
+#include <logging/log.hpp>
+#include <util/assert.hpp>
+#include <util/panic.hpp>
+
+namespace Pci {
+
+// The I/O ports of the legacy configuration mechanism. The address of the
+// register is written to CONFIG_ADDRESS, the register is then accessed through
+// CONFIG_DATA.
+static constexpr Cpu::Port CONFIG_ADDRESS = 0xcf8;
+static constexpr Cpu::Port CONFIG_DATA = 0xcfc;
+
+// Serializes the accesses through the legacy I/O ports, which take two steps.
+static Concurrency::SpinLock PortIoLock;
+
+// An ECAM region and the buses of the region that are mapped in the direct
+// map. The configuration space of a bus is 1MiB, buses are therefore mapped
+// upon their first access instead of mapping the entire region.
+struct EcamRegion {
+    Acpi::Info::EcamDesc desc;
+    u64 volatile mappedBuses[256 / 64];
+};
+
+// The ECAM regions found in the MCFG.
+static Vector<EcamRegion> EcamRegions;
+
+// Serializes the mapping of the buses in the ECAM regions.
+static Concurrency::SpinLock EcamMapLock;
+
+// The functions found by Init().
+static Vector<Device> Devices;
+
+// Has Init() been called?
+static bool IsInitialized = false;
+
+// Find the ECAM region containing a function.
+// @param addr: The address of the function.
+// @return: The region or nullptr if the function is not in any ECAM region.
+static EcamRegion* ecamRegion(Address const& addr) {
+    for (EcamRegion& region : EcamRegions) {
+        if (region.desc.segment == addr.segment
+            && region.desc.startBus <= addr.bus
+            && addr.bus <= region.desc.endBus) {
+            return &region;
+        }
+    }
+    return nullptr;
+}
+
+// Get the virtual address of a register in the memory-mapped configuration
+// space, mapping the bus of the function if needed.
+// @param region: The ECAM region containing the function.
+// @param addr: The address of the function.
+// @param offset: The offset of the register.
+// @return: The virtual address of the register.
+static VirAddr ecamAddress(EcamRegion& region,
+                           Address const& addr,
+                           u16 const offset) {
+    u64 const busSize(1 << 20);
+    PhyAddr const busAddr(region.desc.address.raw() + addr.bus * busSize);
+    u64 const busBit(1ULL << (addr.bus % 64));
+    if (!(region.mappedBuses[addr.bus / 64] & busBit)) {
+        Concurrency::LockGuard guard(EcamMapLock);
+        if (!(region.mappedBuses[addr.bus / 64] & busBit)) {
+            Paging::PageAttr const attrs(Paging::PageAttr::Writable
+                                         | Paging::PageAttr::Uncacheable
+                                         | Paging::PageAttr::Global);
+            Err const err(Paging::map(busAddr.toVir(), busAddr, attrs,
+                                      busSize / PAGE_SIZE));
+            if (err) {
+                PANIC("Failed to map ECAM of bus {}: {}", addr.bus,
+                      err.error());
+            }
+            u64 volatile& mapped(region.mappedBuses[addr.bus / 64]);
+            mapped = mapped | busBit;
+        }
+    }
+    u64 const funcOffset((addr.device << 15) | (addr.function << 12));
+    return busAddr.toVir() + funcOffset + offset;
+}
+
+// Read a register in the configuration space of a function.
+// @param addr: The address of the function.
+// @param offset: The offset of the register.
+// @return: The value of the register.
+template<typename T>
+static T readConfig(Address const& addr, u16 const offset) {
+    ASSERT(addr.device < 32 && addr.function < 8);
+    ASSERT(!(offset % sizeof(T)));
+    EcamRegion* const region(ecamRegion(addr));
+    if (!!region) {
+        ASSERT(offset < 4096);
+        return *ecamAddress(*region, addr, offset).ptr<T volatile>();
+    }
+    ASSERT(!addr.segment);
+    ASSERT(offset < 256);
+    u32 const configAddr((1U << 31) | (addr.bus << 16) | (addr.device << 11)
+                         | (addr.function << 8) | (offset & 0xfc));
+    Concurrency::LockGuard guard(PortIoLock);
+    Cpu::outl(CONFIG_ADDRESS, configAddr);
+    Cpu::Port const port(CONFIG_DATA + (offset & 3));
+    if constexpr (sizeof(T) == 1) {
+        return Cpu::inb(port);
+    } else if constexpr (sizeof(T) == 2) {
+        return Cpu::inw(port);
+    } else {
+        return Cpu::inl(port);
+    }
+}
+
+// Write a register in the configuration space of a function.
+// @param addr: The address of the function.
+// @param offset: The offset of the register.
+// @param value: The value to write.
+template<typename T>
+static void writeConfig(Address const& addr, u16 const offset, T const value) {
+    ASSERT(addr.device < 32 && addr.function < 8);
+    ASSERT(!(offset % sizeof(T)));
+    EcamRegion* const region(ecamRegion(addr));
+    if (!!region) {
+        ASSERT(offset < 4096);
+        *ecamAddress(*region, addr, offset).ptr<T volatile>() = value;
+        return;
+    }
+    ASSERT(!addr.segment);
+    ASSERT(offset < 256);
+    u32 const configAddr((1U << 31) | (addr.bus << 16) | (addr.device << 11)
+                         | (addr.function << 8) | (offset & 0xfc));
+    Concurrency::LockGuard guard(PortIoLock);
+    Cpu::outl(CONFIG_ADDRESS, configAddr);
+    Cpu::Port const port(CONFIG_DATA + (offset & 3));
+    if constexpr (sizeof(T) == 1) {
+        Cpu::outb(port, value);
+    } else if constexpr (sizeof(T) == 2) {
+        Cpu::outw(port, value);
+    } else {
+        Cpu::outl(port, value);
+    }
+}
+
+// Read a register in the configuration space of a function.
+// @param addr: The address of the function.
+// @param offset: The offset of the register.
+// @return: The value of the register.
+u8 read8(Address const& addr, u16 const offset) {
+    return readConfig<u8>(addr, offset);
+}
+
+u16 read16(Address const& addr, u16 const offset) {
+    return readConfig<u16>(addr, offset);
+}
+
+u32 read32(Address const& addr, u16 const offset) {
+    return readConfig<u32>(addr, offset);
+}
+
+// Write a register in the configuration space of a function.
+// @param addr: The address of the function.
+// @param offset: The offset of the register.
+// @param value: The value to write.
+void write8(Address const& addr, u16 const offset, u8 const value) {
+    writeConfig<u8>(addr, offset, value);
+}
+
+void write16(Address const& addr, u16 const offset, u16 const value) {
+    writeConfig<u16>(addr, offset, value);
+}
+
+void write32(Address const& addr, u16 const offset, u32 const value) {
+    writeConfig<u32>(addr, offset, value);
+}
+
+// Check if the configuration space of a function is accessed through ECAM.
+// @param addr: The address of the function.
+// @return: true if ECAM is used, false if the legacy I/O ports are used.
+bool usesEcam(Address const& addr) {
+    return !!ecamRegion(addr);
+}
+
+static void scanBus(u16 const segment, u8 const bus);
+
+// Add a function to the list of devices. If the function is a PCI-to-PCI
+// bridge, the bus behind it is scanned as well.
+// @param addr: The address of the function.
+static void scanFunction(Address const& addr) {
+    Device const dev({
+        .addr = addr,
+        .vendorId = read16(addr, VENDOR_ID),
+        .deviceId = read16(addr, DEVICE_ID),
+        .classCode = read8(addr, CLASS_CODE),
+        .subclass = read8(addr, SUBCLASS),
+        .progIf = read8(addr, PROG_IF),
+        .headerType = u8(read8(addr, HEADER_TYPE) & 0x7f),
+    });
+    Log::info("  {}:{}:{}.{}: vendor = {x} device = {x} class = {x}:{x}:{x}",
+              addr.segment, addr.bus, addr.device, addr.function,
+              dev.vendorId, dev.deviceId, dev.classCode, dev.subclass,
+              dev.progIf);
+    Devices.pushBack(dev);
+    if (dev.headerType == 1 && dev.classCode == 0x06 && dev.subclass == 0x04) {
+        u8 const secondaryBus(read8(addr, SECONDARY_BUS));
+        // An unconfigured bridge has a secondary bus of 0, buses are always
+        // numbered in increasing order away from the root.
+        if (secondaryBus > addr.bus) {
+            scanBus(addr.segment, secondaryBus);
+        }
+    }
+}
+
+// Scan all the functions of a device.
+// @param segment: The segment of the device.
+// @param bus: The bus of the device.
+// @param device: The device number.
+static void scanDevice(u16 const segment, u8 const bus, u8 const device) {
+    Address addr({
+        .segment = segment,
+        .bus = bus,
+        .device = device,
+        .function = 0,
+    });
+    if (read16(addr, VENDOR_ID) == 0xffff) {
+        return;
+    }
+    scanFunction(addr);
+    if (!(read8(addr, HEADER_TYPE) & 0x80)) {
+        // Not a multi-function device.
+        return;
+    }
+    for (addr.function = 1; addr.function < 8; ++addr.function) {
+        if (read16(addr, VENDOR_ID) != 0xffff) {
+            scanFunction(addr);
+        }
+    }
+}
+
+// Scan all the devices of a bus.
+// @param segment: The segment of the bus.
+// @param bus: The bus number.
+static void scanBus(u16 const segment, u8 const bus) {
+    for (u8 device(0); device < 32; ++device) {
+        scanDevice(segment, bus, device);
+    }
+}
+
+// Scan the buses of a segment starting from the host bridge(s) of its first
+// bus.
+// @param segment: The segment.
+// @param startBus: The first bus of the segment.
+// @param endBus: The last bus of the segment, buses after it are not decoded.
+static void scanSegment(u16 const segment,
+                        u8 const startBus,
+                        u8 const endBus) {
+    Address const hostBridge({
+        .segment = segment,
+        .bus = startBus,
+        .device = 0,
+        .function = 0,
+    });
+    if (!(read8(hostBridge, HEADER_TYPE) & 0x80)) {
+        scanBus(segment, startBus);
+        return;
+    }
+    // Multiple host bridges, function i of the host bridge is responsible for
+    // bus startBus + i.
+    for (u8 function(0); function < 8 && startBus + function <= endBus;
+         ++function) {
+        Address const addr({
+            .segment = segment,
+            .bus = startBus,
+            .device = 0,
+            .function = function,
+        });
+        if (read16(addr, VENDOR_ID) != 0xffff) {
+            scanBus(segment, startBus + function);
+        }
+    }
+}
+
+// Enumerate the PCI buses.
+void Init() {
+    for (Acpi::Info::EcamDesc const& desc : Acpi::info().ecamDesc) {
+        EcamRegion const region({
+            .desc = desc,
+            .mappedBuses = {0},
+        });
+        EcamRegions.pushBack(region);
+    }
+    if (EcamRegions.empty()) {
+        Log::info("No MCFG, using I/O ports to access PCI configuration space");
+        Log::info("PCI functions:");
+        scanSegment(0, 0, 255);
+    } else {
+        Log::info("PCI functions:");
+        for (EcamRegion const& region : EcamRegions) {
+            scanSegment(region.desc.segment,
+                        region.desc.startBus,
+                        region.desc.endBus);
+        }
+    }
+    IsInitialized = true;
+}
+
+// Get the functions found by Init().
+// @return: The functions in the system, in the order they were enumerated.
+Vector<Device> const& devices() {
+    ASSERT(IsInitialized);
+    return Devices;
+}
+
+// Read and size a Base Address Register of a function.
+// @param dev: The function.
+// @param index: The index of the BAR, between 0 and 5.
+// @return: The BAR, or an error if the BAR does not exist or is not
+// implemented.
+Res<Bar> readBar(Device const& dev, u8 const index) {
+    u8 const numBars(dev.headerType == 0 ? 6 : (dev.headerType == 1 ? 2 : 0));
+    if (index >= numBars) {
+        return Error::InvalidPciBar;
+    }
+    Address const& addr(dev.addr);
+    u16 const offset(BAR0 + index * 4);
+    u32 const low(read32(addr, offset));
+    bool const isIo(low & 1);
+    bool const is64Bit(!isIo && ((low >> 1) & 0x3) == 0x2);
+    if (is64Bit && index + 1 >= numBars) {
+        return Error::InvalidPciBar;
+    }
+
+    // Size the BAR by writing all ones and reading back the address mask. The
+    // function must not decode accesses while the BAR contains garbage.
+    u16 const command(read16(addr, COMMAND));
+    write16(addr, COMMAND,
+            command & ~(COMMAND_IO_SPACE | COMMAND_MEMORY_SPACE));
+    write32(addr, offset, ~0U);
+    u32 const lowMask(read32(addr, offset));
+    write32(addr, offset, low);
+    u32 high(0);
+    u32 highMask(~0U);
+    if (is64Bit) {
+        high = read32(addr, offset + 4);
+        write32(addr, offset + 4, ~0U);
+        highMask = read32(addr, offset + 4);
+        write32(addr, offset + 4, high);
+    }
+    write16(addr, COMMAND, command);
+
+    u64 base;
+    u64 mask;
+    if (isIo) {
+        base = low & ~0x3U;
+        // The upper 16 bits of I/O BARs may be hardwired to 0.
+        mask = u64(highMask) << 32 | (lowMask & ~0x3U) | 0xffff0000;
+    } else {
+        base = u64(high) << 32 | (low & ~0xfU);
+        mask = u64(highMask) << 32 | (lowMask & ~0xfU);
+    }
+    u64 const size(~mask + 1);
+    if (!size || !(mask & ~0xfULL)) {
+        // Not implemented.
+        return Error::InvalidPciBar;
+    }
+    return Bar {
+        .type = isIo ? Bar::Type::Io : Bar::Type::Memory,
+        .base = base,
+        .size = size,
+        .isPrefetchable = !isIo && !!(low & (1 << 3)),
+        .is64Bit = is64Bit,
+    };
+}
+
+// Map the address range of a memory BAR in the direct map, uncacheable.
+// @param dev: The function.
+// @param index: The index of the BAR.
+// @return: The virtual address of the start of the range, or an error if the
+// BAR does not exist or is not a memory BAR.
+Res<VirAddr> mapBar(Device const& dev, u8 const index) {
+    Res<Bar> const bar(readBar(dev, index));
+    if (!bar) {
+        return bar.error();
+    } else if (bar->type != Bar::Type::Memory) {
+        return Error::InvalidPciBar;
+    }
+    // BARs smaller than a page are not necessarily page aligned.
+    PhyAddr const start(bar->base & ~(PAGE_SIZE - 1));
+    u64 const end(bar->base + bar->size);
+    u64 const numPages((end - start.raw() + PAGE_SIZE - 1) / PAGE_SIZE);
+    Paging::PageAttr const attrs(Paging::PageAttr::Writable
+                                 | Paging::PageAttr::Uncacheable
+                                 | Paging::PageAttr::Global);
+    Err const err(Paging::map(start.toVir(), start, attrs, numPages));
+    if (err) {
+        return err.error();
+    }
+    return PhyAddr(bar->base).toVir();
+}
+
+// Find a capability in the capability list of a function.
+// @param dev: The function.
+// @param id: The ID of the capability.
+// @return: The offset of the capability in the configuration space, or an
+// error if the function does not implement it.
+Res<u8> findCapability(Device const& dev, u8 const id) {
+    if (!(read16(dev.addr, STATUS) & STATUS_CAPABILITIES_LIST)) {
+        return Error::PciCapabilityNotFound;
+    }
+    u8 offset(read8(dev.addr, CAPABILITIES_POINTER) & ~0x3);
+    // Bound the walk in case of a malformed, circular, list.
+    for (u64 i(0); !!offset && i < 48; ++i) {
+        if (read8(dev.addr, offset) == id) {
+            return offset;
+        }
+        offset = read8(dev.addr, offset + 1) & ~0x3;
+    }
+    return Error::PciCapabilityNotFound;
+}
+}
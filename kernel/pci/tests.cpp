@@ -0,0 +1,217 @@
+// PCI tests.
+#include <pci/pci.hpp>
+#include <paging/paging.hpp>
+#include <smp/percpu.hpp>
+#include <selftests/macros.hpp>
+
+namespace Pci {
+
+// Check that the enumeration found the host bridge and only valid functions.
+SelfTests::TestResult pciEnumerationTest() {
+    Vector<Device> const& devs(devices());
+    TEST_ASSERT(!devs.empty());
+    // The host bridge is always the first function of the first bus.
+    Address const hostBridge({.segment = 0, .bus = 0, .device = 0,
+                              .function = 0});
+    TEST_ASSERT(devs[0].addr == hostBridge);
+    TEST_ASSERT(devs[0].classCode == 0x06 && devs[0].subclass == 0x00);
+    for (Device const& dev : devs) {
+        TEST_ASSERT(dev.vendorId != 0xffff);
+        TEST_ASSERT(read16(dev.addr, VENDOR_ID) == dev.vendorId);
+        // 16-bit and 32-bit accesses agree.
+        u32 const ids(read32(dev.addr, VENDOR_ID));
+        TEST_ASSERT((ids & 0xffff) == dev.vendorId);
+        TEST_ASSERT((ids >> 16) == dev.deviceId);
+    }
+    return SelfTests::TestResult::Success;
+}
+
+// Check that sizing the BARs gives naturally aligned power-of-two ranges, does
+// not modify the BARs, and that memory BARs can be mapped.
+SelfTests::TestResult pciBarTest() {
+    u64 numMemoryBars(0);
+    for (Device const& dev : devices()) {
+        for (u8 i(0); i < 6; ++i) {
+            u16 const offset(BAR0 + i * 4);
+            u32 const before(read32(dev.addr, offset));
+            Res<Bar> const bar(readBar(dev, i));
+            if (!bar) {
+                TEST_ASSERT(bar.error() == Error::InvalidPciBar);
+                continue;
+            }
+            TEST_ASSERT(read32(dev.addr, offset) == before);
+            TEST_ASSERT(!(bar->size & (bar->size - 1)));
+            TEST_ASSERT(!(bar->base & (bar->size - 1)));
+            if (bar->type == Bar::Type::Memory && !!bar->base) {
+                numMemoryBars++;
+                Res<VirAddr> const vaddr(mapBar(dev, i));
+                TEST_ASSERT(!!vaddr);
+                Res<Paging::Mapping> const mapping(Paging::translate(*vaddr));
+                TEST_ASSERT(!!mapping);
+                TEST_ASSERT(mapping->paddr == PhyAddr(bar->base));
+            }
+            if (bar->is64Bit) {
+                // The upper half is not a BAR on its own.
+                i++;
+            }
+        }
+    }
+    // Qemu always provides at least a VGA or network device with a memory BAR.
+    TEST_ASSERT(!!numMemoryBars);
+    return SelfTests::TestResult::Success;
+}
+
+// Check the encoding of MSI messages.
+SelfTests::TestResult msiMessageTest() {
+    TEST_ASSERT(msiAddress(Smp::Id(0)) == 0xfee00000);
+    TEST_ASSERT(msiAddress(Smp::Id(3)) == 0xfee03000);
+    TEST_ASSERT(msiAddress(Smp::Id(255)) == 0xfeeff000);
+    TEST_ASSERT(msiData(Interrupts::Vector(0x42)) == 0x42);
+    return SelfTests::TestResult::Success;
+}
+
+// Registers of the e1000e NIC of Qemu's q35 machine, used to raise interrupts:
+// writing a cause to the Interrupt Cause Set register raises an interrupt if
+// the cause is enabled in the Interrupt Mask Set register.
+static constexpr u64 E1000E_ICR = 0xc0;
+static constexpr u64 E1000E_ICS = 0xc8;
+static constexpr u64 E1000E_IMS = 0xd0;
+static constexpr u64 E1000E_IMC = 0xd8;
+// Interrupt Vector Allocation register, maps the causes to MSI-X entries.
+static constexpr u64 E1000E_IVAR = 0xe4;
+// The cause of the first RX queue, and its field in the IVAR register: the
+// index of the MSI-X entry in bits 0-2, bit 3 is the valid bit.
+static constexpr u32 E1000E_ICR_RXQ0 = 1 << 20;
+static constexpr u32 E1000E_IVAR_RXQ0_VALID = 1 << 3;
+
+// Find the e1000e NIC.
+// @return: The function of the NIC, nullptr if there is none.
+static Device const* findE1000e() {
+    for (Device const& dev : devices()) {
+        if (dev.vendorId == 0x8086 && dev.deviceId == 0x10d3) {
+            return &dev;
+        }
+    }
+    return nullptr;
+}
+
+// Handler counting the interrupts raised by the e1000e and recording the cpu
+// that received the last one.
+static u64 volatile numInterrupts;
+static u64 volatile receivingCpu;
+static void countingHandler(Interrupts::Vector const,
+                            Interrupts::Frame const&) {
+    receivingCpu = Smp::id().raw();
+    numInterrupts = numInterrupts + 1;
+}
+
+// Check that MSIs are delivered to the requested cpu. This uses the e1000e NIC
+// of Qemu's q35 machine, the test is skipped if there is no such NIC.
+SelfTests::TestResult msiDeliveryTest() {
+    Device const* const nic(findE1000e());
+    if (!nic) {
+        Log::warn("No e1000e NIC found, skipping test");
+        return SelfTests::TestResult::Skip;
+    }
+    Res<VirAddr> const regs(mapBar(*nic, 0));
+    TEST_ASSERT(!!regs);
+    auto const reg([&](u64 const offset) {
+        return (*regs + offset).ptr<u32 volatile>();
+    });
+
+    Res<Interrupts::Vector> const vector(Interrupts::allocateVector());
+    TEST_ASSERT(!!vector);
+    Interrupts::registerHandler(*vector, countingHandler);
+    numInterrupts = 0;
+
+    u64 expected(0);
+    for (Smp::Id cpu(0); cpu < Smp::ncpus(); ++cpu) {
+        if (!Smp::PerCpu::data(cpu).isOnline) {
+            continue;
+        }
+        TEST_ASSERT(!enableMsi(*nic, cpu, *vector));
+        *reg(E1000E_IMS) = 1;
+        *reg(E1000E_ICS) = 1;
+        expected++;
+        TEST_WAIT_FOR(numInterrupts == expected, 1000);
+        TEST_ASSERT(receivingCpu == cpu.raw());
+        // Clear and disable the cause.
+        *reg(E1000E_IMC) = ~0U;
+        *reg(E1000E_ICR) = ~0U;
+        disableMsi(*nic);
+    }
+
+    Interrupts::deregisterHandler(*vector);
+    Interrupts::freeVector(*vector);
+    return SelfTests::TestResult::Success;
+}
+
+// Check that MSI-X entries are delivered to the requested cpu, and that masked
+// entries are not. This uses the MSI-X table of the e1000e NIC of Qemu's q35
+// machine, the test is skipped if there is no such NIC.
+SelfTests::TestResult msixDeliveryTest() {
+    Device const* const nic(findE1000e());
+    if (!nic) {
+        Log::warn("No e1000e NIC found, skipping test");
+        return SelfTests::TestResult::Skip;
+    }
+    Res<VirAddr> const regs(mapBar(*nic, 0));
+    TEST_ASSERT(!!regs);
+    auto const reg([&](u64 const offset) {
+        return (*regs + offset).ptr<u32 volatile>();
+    });
+
+    Res<MsixTable> const table(enableMsix(*nic));
+    TEST_ASSERT(!!table);
+    TEST_ASSERT(!!table->size);
+    Res<Interrupts::Vector> const vector(Interrupts::allocateVector());
+    TEST_ASSERT(!!vector);
+    Interrupts::registerHandler(*vector, countingHandler);
+    numInterrupts = 0;
+    // Route the RX queue 0 cause to entry 0 of the table.
+    *reg(E1000E_IVAR) = E1000E_IVAR_RXQ0_VALID | 0;
+
+    u64 expected(0);
+    for (Smp::Id cpu(0); cpu < Smp::ncpus(); ++cpu) {
+        if (!Smp::PerCpu::data(cpu).isOnline) {
+            continue;
+        }
+        setMsixEntry(*table, 0, cpu, *vector);
+        *reg(E1000E_IMS) = E1000E_ICR_RXQ0;
+        *reg(E1000E_ICS) = E1000E_ICR_RXQ0;
+        expected++;
+        TEST_WAIT_FOR(numInterrupts == expected, 1000);
+        TEST_ASSERT(receivingCpu == cpu.raw());
+        // Clear and disable the cause.
+        *reg(E1000E_IMC) = ~0U;
+        *reg(E1000E_ICR) = ~0U;
+        setMsixEntryMask(*table, 0, true);
+    }
+
+    // A masked entry does not raise the interrupt.
+    *reg(E1000E_IMS) = E1000E_ICR_RXQ0;
+    *reg(E1000E_ICS) = E1000E_ICR_RXQ0;
+    for (u64 i(0); i < 1000000; ++i) {
+        asm("pause");
+    }
+    bool const maskedEntryRaised(numInterrupts != expected);
+    *reg(E1000E_IMC) = ~0U;
+    *reg(E1000E_ICR) = ~0U;
+
+    *reg(E1000E_IVAR) = 0;
+    disableMsix(*table);
+    Interrupts::deregisterHandler(*vector);
+    Interrupts::freeVector(*vector);
+    TEST_ASSERT(!maskedEntryRaised);
+    return SelfTests::TestResult::Success;
+}
+
+// Run the PCI tests.
+void Test(SelfTests::TestRunner& runner) {
+    RUN_TEST(runner, pciEnumerationTest);
+    RUN_TEST(runner, pciBarTest);
+    RUN_TEST(runner, msiMessageTest);
+    RUN_TEST(runner, msiDeliveryTest);
+    RUN_TEST(runner, msixDeliveryTest);
+}
+}
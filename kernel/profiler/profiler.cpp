@@ -0,0 +1,366 @@
+// Sampling profiler.
+#include <profiler/profiler.hpp>
+#include <interrupts/interrupts.hpp>
+#include <interrupts/lapic.hpp>
+#include <interrupts/cpulocal.hpp>
+#include <smp/percpu.hpp>
+#include <smp/remotecall.hpp>
+#include <datastruct/map.hpp>
+#include <datastruct/vector.hpp>
+#include <cpu/cpu.hpp>
+#include <logging/log.hpp>
+#include <util/assert.hpp>
+#include <util/panic.hpp>
+#include <util/ptr.hpp>
+
+namespace Profiler {
+
+// The profiling state and sample buffer of a cpu. Samples are only ever added
+// by the sampling interrupt of the cpu owning the buffer, hence no lock is
+// needed: the RIP is written before the count is incremented so that other
+// cpus only ever read complete samples.
+struct CpuState {
+    // The sampled RIPs, only the first `count` entries are valid.
+    u64 volatile rips[BUFFER_SIZE];
+    u64 volatile count = 0;
+    // Number of samples dropped because the buffer was full.
+    u64 volatile dropped = 0;
+    // Set while profiling is running on this cpu.
+    bool volatile isRunning = false;
+    // The source of the sampling interrupts, only valid if isRunning.
+    Source source = Source::LapicTimer;
+    // The period between two samples, only valid if isRunning.
+    u64 period = 0;
+};
+
+// The state of each cpu, indexed by Smp::Id.
+static Vector<Ptr<CpuState>> CpuStates;
+
+// The vector used by the LAPIC timer source.
+static Interrupts::Vector TimerVector = Interrupts::Vector(0);
+
+// The handler of the NMI vector before Init(). NMIs that are not caused by a
+// perf counter overflow are forwarded to it.
+static Interrupts::InterruptHandler PrevNmiHandler = nullptr;
+
+static bool IsInitialized = false;
+
+// Event select for unhalted core cycles.
+static constexpr u64 EVENT_UNHALTED_CORE_CYCLES = 0x3c;
+// Bits of IA32_PERFEVTSELx.
+static constexpr u64 PERFEVTSEL_USR = 1 << 16;
+static constexpr u64 PERFEVTSEL_OS = 1 << 17;
+static constexpr u64 PERFEVTSEL_INT = 1 << 20;
+static constexpr u64 PERFEVTSEL_EN = 1 << 22;
+// Overflow and enable bit of PMC0 in the IA32_PERF_GLOBAL_* MSRs.
+static constexpr u64 PERF_GLOBAL_PMC0 = 1 << 0;
+
+// Get the state of the current cpu. Called from the sampling interrupts, hence
+// the id of the cpu is read from its CpuLocal instead of using Smp::id(),
+// whose CPUID causes a VM exit on every sample under a hypervisor.
+// @return: The CpuState of the current cpu.
+static CpuState& currState() {
+    return *CpuStates[Interrupts::cpuLocal().id.raw()];
+}
+
+// Add a sample to the buffer of the current cpu.
+// @param rip: The sampled RIP.
+static void recordSample(u64 const rip) {
+    CpuState& state(currState());
+    u64 const count(state.count);
+    if (count < BUFFER_SIZE) {
+        state.rips[count] = rip;
+        state.count = count + 1;
+    } else {
+        state.dropped = state.dropped + 1;
+    }
+}
+
+// Check if the current cpu exposes an architectural PMU that can be used for
+// sampling.
+// @return: true if the perf counter source is available, false otherwise.
+bool hasPerfCounter() {
+    if (Cpu::cpuid(0x0).eax < 0xa) {
+        return false;
+    }
+    Cpu::CpuidResult const pmu(Cpu::cpuid(0xa));
+    u8 const version(pmu.eax & 0xff);
+    u8 const numCounters((pmu.eax >> 8) & 0xff);
+    u8 const ebxLength((pmu.eax >> 24) & 0xff);
+    // Version 2 is needed for the global status and control MSRs used to
+    // identify the source of an NMI. Bit 0 of EBX is set if the unhalted core
+    // cycles event is _not_ available.
+    return version >= 2 && !!numCounters && !!ebxLength && !(pmu.ebx & 1);
+}
+
+// Arm IA32_PMC0 so that it overflows after `period` cycles.
+// @param period: The number of cycles until the overflow.
+static void armPerfCounter(u64 const period) {
+    // Writes to IA32_PMCx only set the lower 32 bits and sign-extend them.
+    Cpu::wrmsr(Cpu::Msr::IA32_PMC0, -period);
+}
+
+// Interrupt handler for the NMIs raised by the overflow of IA32_PMC0.
+// @param vector: The vector of the interrupt, always 2.
+// @param frame: The interrupt frame, contains the sampled RIP.
+static void perfCounterNmiHandler(Interrupts::Vector const vector,
+                                  Interrupts::Frame const& frame) {
+    CpuState& state(currState());
+    bool const isOverflow(state.isRunning
+        && state.source == Source::PerfCounter
+        && (Cpu::rdmsr(Cpu::Msr::IA32_PERF_GLOBAL_STATUS) & PERF_GLOBAL_PMC0));
+    if (!isOverflow) {
+        PrevNmiHandler(vector, frame);
+        return;
+    }
+    recordSample(frame.rip);
+    armPerfCounter(state.period);
+    Cpu::wrmsr(Cpu::Msr::IA32_PERF_GLOBAL_OVF_CTRL, PERF_GLOBAL_PMC0);
+    // The LAPIC sets the mask bit of the LVT when delivering the interrupt.
+    Interrupts::lapic().setPerformanceCounterLvt({
+        .messageType = Interrupts::Lapic::Lvt::MessageType::Nmi,
+        .mask = false,
+    });
+}
+
+// Interrupt handler for the LAPIC timer source.
+// @param vector: Unused.
+// @param frame: The interrupt frame, contains the sampled RIP.
+static void timerHandler(Interrupts::Vector const,
+                         Interrupts::Frame const& frame) {
+    recordSample(frame.rip);
+}
+
+// Allocate the per-cpu sample buffers and install the sampling interrupt
+// handlers. Must be called after Smp::PerCpu::Init().
+void Init() {
+    ASSERT(!IsInitialized);
+    for (u64 i(0); i < Smp::ncpus(); ++i) {
+        CpuStates.pushBack(Ptr<CpuState>::New());
+    }
+    // Use the highest priority class so that the timer source can also sample
+    // the handlers of other interrupts.
+    Res<Interrupts::Vector> const vector(
+        Interrupts::allocateVector(Interrupts::PriorityClass(15)));
+    if (!vector) {
+        PANIC("Cannot allocate a vector for the profiler: {}", vector.error());
+    }
+    TimerVector = *vector;
+    Interrupts::registerHandler(TimerVector, timerHandler);
+    Interrupts::Vector const nmi(2);
+    PrevNmiHandler = Interrupts::registeredHandler(nmi);
+    Interrupts::registerHandler(nmi, perfCounterNmiHandler);
+    IsInitialized = true;
+    InitCurrCpu();
+}
+
+// Start profiling the current cpu if the kernel was built with PROFILE_PERIOD.
+// Called by Init() for the BSP and by each AP once online.
+void InitCurrCpu() {
+#ifdef PROFILE_PERIOD
+    // The LAPIC timer is needed by the rest of the kernel, only the perf
+    // counter can profile the kernel as a whole.
+    if (!hasPerfCounter()) {
+        Log::warn("No perf counter on cpu {}, not profiling it", Smp::id());
+        return;
+    }
+    startCurrCpu(PROFILE_PERIOD);
+#endif
+}
+
+// Check if the kernel was built with PROFILE_PERIOD, in which case all cpus
+// are profiled from boot until shutdown.
+// @return: true if profiling from boot, false otherwise.
+bool isBootProfiling() {
+#ifdef PROFILE_PERIOD
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Start profiling on the current cpu. The samples recorded so far on this cpu
+// are kept. While the LAPIC timer is the source, the LAPIC timer of this cpu
+// cannot be used for anything else, including LapicTimer::delay().
+// @param period: The number of cycles, or LAPIC timer ticks if the perf counter
+// is not available, between two samples. Must be non-zero and below 2^31.
+// @return: The source used for the sampling interrupts.
+Source startCurrCpu(u64 const period) {
+    ASSERT(IsInitialized);
+    ASSERT(!!period && period < (1ULL << 31));
+    stopCurrCpu();
+    CpuState& state(currState());
+    state.period = period;
+    Interrupts::Lapic& lapic(Interrupts::lapic());
+    if (hasPerfCounter()) {
+        state.source = Source::PerfCounter;
+        state.isRunning = true;
+        Cpu::wrmsr(Cpu::Msr::IA32_PERFEVTSEL0, 0);
+        armPerfCounter(period);
+        Cpu::wrmsr(Cpu::Msr::IA32_PERF_GLOBAL_OVF_CTRL, PERF_GLOBAL_PMC0);
+        lapic.setPerformanceCounterLvt({
+            .messageType = Interrupts::Lapic::Lvt::MessageType::Nmi,
+            .mask = false,
+        });
+        Cpu::wrmsr(Cpu::Msr::IA32_PERFEVTSEL0,
+                   EVENT_UNHALTED_CORE_CYCLES | PERFEVTSEL_USR | PERFEVTSEL_OS
+                   | PERFEVTSEL_INT | PERFEVTSEL_EN);
+        Cpu::wrmsr(Cpu::Msr::IA32_PERF_GLOBAL_CTRL,
+                   Cpu::rdmsr(Cpu::Msr::IA32_PERF_GLOBAL_CTRL)
+                   | PERF_GLOBAL_PMC0);
+    } else {
+        state.source = Source::LapicTimer;
+        state.isRunning = true;
+        lapic.setTimerDivideConfiguration(
+            Interrupts::Lapic::TimerDivideConfiguration::DivideBy1);
+        lapic.setTimerLvt({
+            .vector = TimerVector,
+            .mask = false,
+            .timerMode = Interrupts::Lapic::Lvt::TimerMode::Periodic,
+        });
+        lapic.setTimerInitialCount(period);
+    }
+    return state.source;
+}
+
+// Stop profiling on the current cpu. No-op if profiling is not running.
+void stopCurrCpu() {
+    ASSERT(IsInitialized);
+    CpuState& state(currState());
+    if (!state.isRunning) {
+        return;
+    }
+    Interrupts::Lapic& lapic(Interrupts::lapic());
+    if (state.source == Source::PerfCounter) {
+        Cpu::wrmsr(Cpu::Msr::IA32_PERFEVTSEL0, 0);
+        Cpu::wrmsr(Cpu::Msr::IA32_PERF_GLOBAL_CTRL,
+                   Cpu::rdmsr(Cpu::Msr::IA32_PERF_GLOBAL_CTRL)
+                   & ~PERF_GLOBAL_PMC0);
+        lapic.setPerformanceCounterLvt({.mask = true});
+        Cpu::wrmsr(Cpu::Msr::IA32_PERF_GLOBAL_OVF_CTRL, PERF_GLOBAL_PMC0);
+    } else {
+        lapic.setTimerInitialCount(0);
+        lapic.setTimerLvt({.vector = TimerVector, .mask = true});
+    }
+    state.isRunning = false;
+}
+
+// Run a function on all online cpus and wait for it to complete everywhere.
+// @param func: The function to run.
+// @param arg: The argument passed to `func`.
+static void runOnAllCpus(void (*func)(u64), u64 const arg) {
+    Smp::Id const self(Smp::id());
+    Vector<Ptr<Smp::RemoteCall::CallResult<void>>> calls;
+    for (Smp::Id cpu(0); cpu < Smp::ncpus(); ++cpu) {
+        if (cpu != self && Smp::PerCpu::data(cpu).isOnline) {
+            calls.pushBack(Smp::RemoteCall::invokeOn(cpu, func, arg));
+        }
+    }
+    func(arg);
+    for (Ptr<Smp::RemoteCall::CallResult<void>> const& call : calls) {
+        call->wait();
+    }
+}
+
+// Start profiling on all online cpus, see startCurrCpu().
+// @param period: The period between two samples on each cpu.
+void start(u64 const period) {
+    runOnAllCpus([](u64 const p) { startCurrCpu(p); }, period);
+}
+
+// Stop profiling on all online cpus.
+void stop() {
+    runOnAllCpus([](u64) { stopCurrCpu(); }, 0);
+}
+
+// Get the number of samples recorded on a cpu.
+// @param cpu: The cpu.
+// @return: The number of samples in the buffer of `cpu`.
+u64 numSamples(Smp::Id const cpu) {
+    ASSERT(IsInitialized);
+    return CpuStates[cpu.raw()]->count;
+}
+
+// Get the number of samples that were dropped on a cpu because its buffer was
+// full.
+// @param cpu: The cpu.
+// @return: The number of dropped samples.
+u64 numDropped(Smp::Id const cpu) {
+    ASSERT(IsInitialized);
+    return CpuStates[cpu.raw()]->dropped;
+}
+
+// Get the number of samples recorded on all cpus with a given RIP.
+// @param rip: The RIP to count.
+// @return: The number of samples of `rip` in all buffers.
+u64 numSamplesAt(u64 const rip) {
+    ASSERT(IsInitialized);
+    u64 res(0);
+    for (Ptr<CpuState> const& state : CpuStates) {
+        u64 const count(state->count);
+        for (u64 i(0); i < count; ++i) {
+            res += state->rips[i] == rip;
+        }
+    }
+    return res;
+}
+
+// Discard all the samples recorded so far. Profiling must be stopped on all
+// cpus.
+void reset() {
+    ASSERT(IsInitialized);
+    for (Ptr<CpuState> const& state : CpuStates) {
+        ASSERT(!state->isRunning);
+        state->count = 0;
+        state->dropped = 0;
+    }
+}
+
+// Log the histogram of the samples recorded on all cpus, most sampled RIPs
+// first. No-op if no sample was recorded.
+// @param maxEntries: The maximum number of RIPs to log.
+void dump(u64 const maxEntries) {
+    if (!IsInitialized) {
+        return;
+    }
+    Map<u64, u64> histogram;
+    // The distinct RIPs in the histogram, Map cannot be iterated.
+    Vector<u64> rips;
+    u64 total(0);
+    u64 dropped(0);
+    for (Ptr<CpuState> const& state : CpuStates) {
+        u64 const count(state->count);
+        for (u64 i(0); i < count; ++i) {
+            u64 const rip(state->rips[i]);
+            if (!histogram.contains(rip)) {
+                rips.pushBack(rip);
+            }
+            histogram[rip]++;
+        }
+        total += count;
+        dropped += state->dropped;
+    }
+    if (!total) {
+        return;
+    }
+    Log::info("Profile: {} samples, {} dropped, {} distinct RIPs", total,
+              dropped, rips.size());
+    // Selection of the most sampled RIPs, the number of entries logged is
+    // small compared to the number of distinct RIPs.
+    Vector<bool> isLogged(rips.size(), false);
+    for (u64 n(0); n < maxEntries && n < rips.size(); ++n) {
+        u64 best(0);
+        u64 bestCount(0);
+        for (u64 i(0); i < rips.size(); ++i) {
+            u64 const count(histogram[rips[i]]);
+            if (!isLogged[i] && count > bestCount) {
+                best = i;
+                bestCount = count;
+            }
+        }
+        isLogged[best] = true;
+        Log::info("  {x}: {} samples ({}%)", rips[best], bestCount,
+                  bestCount * 100 / total);
+    }
+}
+}
@@ -0,0 +1,99 @@
+// Profiler tests.
+#include <profiler/profiler.hpp>
+#include <smp/percpu.hpp>
+#include <smp/remotecall.hpp>
+#include <timers/tsc.hpp>
+#include <selftests/macros.hpp>
+
+namespace Profiler {
+
+// Sampling period used by the tests. With the LAPIC timer source this is a few
+// hundred microseconds under Qemu.
+static constexpr u64 TEST_PERIOD = 200000;
+
+// Get the duration of a number of sampling periods, which are in TSC cycles.
+// @param numPeriods: The number of periods.
+// @return: The duration of numPeriods * TEST_PERIOD cycles.
+static Timer::Duration periods(u64 const numPeriods) {
+    u64 const nanos(Timer::Tsc::cyclesToNanos(numPeriods * TEST_PERIOD));
+    return Timer::Duration::MicroSecs(nanos / 1000);
+}
+
+// Skip the current test if the kernel is profiled from boot, the tests would
+// discard the boot profile.
+#define TEST_REQUIRES_NO_BOOT_PROFILING()                                      \
+    do {                                                                       \
+        if (isBootProfiling()) {                                               \
+            Log::warn("Profiling from boot, skipping test");                   \
+            return SelfTests::TestResult::Skip;                                \
+        }                                                                      \
+    } while (0)
+
+// Check that profiling a single cpu only records samples on that cpu, and only
+// while profiling is running.
+SelfTests::TestResult profilerSingleCpuTest() {
+    TEST_REQUIRES_MULTICORE();
+    TEST_REQUIRES_NO_BOOT_PROFILING();
+    Smp::Id target(0);
+    for (Smp::Id cpu(0); cpu < Smp::ncpus(); ++cpu) {
+        if (cpu != Smp::id() && Smp::PerCpu::data(cpu).isOnline) {
+            target = cpu;
+        }
+    }
+    TEST_ASSERT(target != Smp::id());
+    reset();
+    Ptr<Smp::RemoteCall::CallResult<void>> const call(
+        Smp::RemoteCall::invokeOn(target, []() {
+            startCurrCpu(TEST_PERIOD);
+            Timer::Tsc::delay(periods(1000));
+            stopCurrCpu();
+        }));
+    call->wait();
+
+    u64 const count(numSamples(target));
+    TEST_ASSERT(!!count);
+    TEST_ASSERT(!numDropped(target));
+    for (Smp::Id cpu(0); cpu < Smp::ncpus(); ++cpu) {
+        if (cpu != target) {
+            TEST_ASSERT(!numSamples(cpu));
+        }
+    }
+    Timer::Tsc::delay(periods(100));
+    TEST_ASSERT(numSamples(target) == count);
+    reset();
+    return SelfTests::TestResult::Success;
+}
+
+// Check that start() and stop() profile the current cpu along with the other
+// cpus and stop recording samples once stopped.
+SelfTests::TestResult profilerAllCpusTest() {
+    TEST_REQUIRES_NO_BOOT_PROFILING();
+    reset();
+    start(TEST_PERIOD);
+    Timer::Tsc::delay(periods(1000));
+    stop();
+
+    Smp::Id const self(Smp::id());
+    u64 const count(numSamples(self));
+    TEST_ASSERT(!!count);
+    Timer::Tsc::delay(periods(100));
+    TEST_ASSERT(numSamples(self) == count);
+    u64 total(0);
+    for (Smp::Id cpu(0); cpu < Smp::ncpus(); ++cpu) {
+        total += numSamples(cpu);
+    }
+    TEST_ASSERT(total >= count);
+    // Samples are the RIPs of interrupted kernel code.
+    TEST_ASSERT(!numSamplesAt(0));
+    dump(5);
+    reset();
+    TEST_ASSERT(!numSamples(self));
+    return SelfTests::TestResult::Success;
+}
+
+// Run the profiler tests.
+void Test(SelfTests::TestRunner& runner) {
+    RUN_TEST(runner, profilerSingleCpuTest);
+    RUN_TEST(runner, profilerAllCpusTest);
+}
+}
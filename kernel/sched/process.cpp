@@ -20,9 +20,11 @@ static void handleRetFromProc() {
 // Create a process that executes a function or lambda.
 // @param func: The function to be executed. This must be a function taking no
 // argument. If this function ever returns, a PANIC is raised.
+// @param kernelStackPages: The size of the process' kernel stack in number of
+// pages.
 // @return: A pointer to the Proc instance or an error, if any.
-Res<Ptr<Proc>> Proc::New(void (*func)(void)) {
-    Res<Ptr<Proc>> const procAlloc(Proc::New());
+Res<Ptr<Proc>> Proc::New(void (*func)(void), u64 const kernelStackPages) {
+    Res<Ptr<Proc>> const procAlloc(Proc::New(kernelStackPages));
     if (!procAlloc) {
         return procAlloc.error();
     }
@@ -58,6 +60,12 @@ Proc::Id Proc::id() const {
     return m_id;
 }
 
+// Get the high-water mark of the kernel stack of this process.
+// @return: The number of bytes used on the kernel stack.
+u64 Proc::kernelStackHighWaterMark() const {
+    return m_kernelStack->highWaterMark();
+}
+
 // Get the current state of the process.
 Proc::State Proc::state() const {
     return m_state;
@@ -90,9 +98,12 @@ void Proc::setState(Proc::State const& newState) {
 }
 
 // Create a process.
+// @param kernelStackPages: The size of the process' kernel stack in number of
+// pages.
 // @return: A pointer to the Proc instance or an error, if any.
-Res<Ptr<Proc>> Proc::New() {
-    Res<Ptr<Memory::Stack>> const stackAllocRes(Memory::Stack::New());
+Res<Ptr<Proc>> Proc::New(u64 const kernelStackPages) {
+    Res<Ptr<Memory::Stack>> const stackAllocRes(
+        Memory::Stack::New(kernelStackPages));
     if (!stackAllocRes) {
         return stackAllocRes.error();
     }
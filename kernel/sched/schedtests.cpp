@@ -122,6 +122,9 @@ SelfTests::TestResult procCreationAndJumpTest() {
     // Proc is static so that destCpu can access it further below.
     static Ptr<Proc> proc;
     proc = Proc::New(procFunc).value();
+    // Only the initial stack frames have been written to the kernel stack so
+    // far.
+    TEST_ASSERT(proc->kernelStackHighWaterMark() == 8 * sizeof(u64));
 
     // The CPU that will run the process.
     Smp::Id const destCpu((Smp::id().raw() + 1) % Smp::ncpus());
@@ -146,6 +149,9 @@ SelfTests::TestResult procCreationAndJumpTest() {
     Ptr<Memory::Stack> const procStack(proc->m_kernelStack);
     TEST_ASSERT(procStack->lowAddress() <= procFuncRsp
                 && procFuncRsp < procStack->highAddress().raw());
+    // The high-water mark accounts for at least the stack used by procFunc.
+    u64 const usedStack(procStack->highAddress().raw() - procFuncRsp);
+    TEST_ASSERT(proc->kernelStackHighWaterMark() >= usedStack);
     // Check that the address space changed when switching to the process.
     TEST_ASSERT(procFuncPml4 == proc->m_addrSpace->pml4Address().raw());
     // As a sanity check, we also check that the stack pointer is not contained
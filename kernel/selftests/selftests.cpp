@@ -26,6 +26,8 @@ void TestRunner::_runTest(char const * const testName,
         m_numTestsSkipped++;
         Log::warn("  [SKIP] {}", testName);
     }
+    // Do not keep the result in the log buffers, the next test could hang.
+    Log::flush();
 }
 
 // Print a summary of the passed and failed tests.
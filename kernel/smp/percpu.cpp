@@ -22,6 +22,15 @@ void Init() {
         perCpuDataVec.pushBack(Data());
     }
     IsInitialized = true;
+    // Init() is called by the BSP, which is obviously online. APs mark
+    // themselves online during their startup.
+    data().isOnline = true;
+}
+
+// Check if Init() has been called.
+// @return: true if the per-cpu data is available, false otherwise.
+bool isInitialized() {
+    return IsInitialized;
 }
 
 // Get a reference to the per-cpu data of the current cpu.
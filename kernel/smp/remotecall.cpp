@@ -5,10 +5,10 @@
 namespace Smp::RemoteCall {
 
 // Interrupt handler for a RemoteCall interrupt. Processes all CallDesc
-// currently enqueued in the remoteCallQueue of this cpu.
+// currently enqueued in the remoteCallQueue of this cpu. Registered as a fast
+// handler since remote calls are latency-sensitive and do not need the frame.
 static void handleRemoteCallInterrupt(
-    __attribute__((unused)) Interrupts::Vector const vec,
-    __attribute__((unused)) Interrupts::Frame const& frame) {
+    __attribute__((unused)) Interrupts::Vector const vec) {
     Smp::PerCpu::Data& data(Smp::PerCpu::data());
 
     // In order to guarantee that remote functions are executed in the same
@@ -40,8 +40,8 @@ static bool IsInitialized = false;
 
 // Initialize the RemoteCall subsystem.
 void Init() {
-    Interrupts::registerHandler(Interrupts::VectorMap::RemoteCallVector,
-                                handleRemoteCallInterrupt);
+    Interrupts::registerFastHandler(Interrupts::VectorMap::RemoteCallVector,
+                                    handleRemoteCallInterrupt);
     IsInitialized = true;
 }
 
@@ -69,7 +69,7 @@ SelfTests::TestResult remoteCallWaitTest() {
         }
     }));
     TEST_ASSERT(!call->isDone());
-    Timer::LapicTimer::delay(Timer::Duration::MilliSecs(500));
+    Timer::Tsc::delay(Timer::Duration::MilliSecs(500));
     TEST_ASSERT(!call->isDone());
     flag++;
     call->wait();
@@ -3,7 +3,8 @@
 #include <acpi/acpi.hpp>
 #include <interrupts/interrupts.hpp>
 #include <interrupts/lapic.hpp>
-#include <timers/lapictimer.hpp>
+#include <interrupts/softirq.hpp>
+#include <timers/tsc.hpp>
 #include <memory/segmentation.hpp>
 #include <util/assert.hpp>
 #include <memory/stack.hpp>
@@ -12,6 +13,7 @@
 #include <paging/paging.hpp>
 #include <smp/percpu.hpp>
 #include <paging/addrspace.hpp>
+#include <profiler/profiler.hpp>
 
 namespace Smp {
 
@@ -60,7 +62,7 @@ static void sendInitIpi(Id const id) {
 
         // The Multiprocessor Specification indicates that under normal
         // operation the IPI should be delivered in less than 20us.
-        Timer::LapicTimer::delay(Timer::Duration::MicroSecs(20));
+        Timer::Tsc::delay(Timer::Duration::MicroSecs(20));
 
         // Check if the IPI was successfully delivered, this is indicated by a
         // reset of the deliveryStatus in the ICR.
@@ -97,7 +99,7 @@ static void sendStartupIpi(Id const id, Interrupts::Vector const vector) {
 
         // The Multiprocessor Specification indicates that under normal
         // operation the IPI should be delivered in less than 20us.
-        Timer::LapicTimer::delay(Timer::Duration::MicroSecs(20));
+        Timer::Tsc::delay(Timer::Duration::MicroSecs(20));
 
         // Check if the IPI was successfully delivered, this is indicated by a
         // reset of the deliveryStatus in the ICR.
@@ -215,7 +217,7 @@ void wakeApplicationProcessor(Id const id, PhyAddr const bootStrapRoutine) {
     sendInitIpi(id);
 
     // Wait 10 milliseconds.
-    Timer::LapicTimer::delay(Timer::Duration::MilliSecs(10));
+    Timer::Tsc::delay(Timer::Duration::MilliSecs(10));
 
     // Send the Startup IPI.
     sendStartupIpi(id, sipiVector);
@@ -343,6 +345,9 @@ void startupApplicationProcessor(Id const id) {
         Log::info("CPU {} online", Smp::id());
         while (true) {
             asm("sti");
+            // Complete any deferred work left over by the interrupt handlers
+            // before going idle.
+            Interrupts::Softirq::runPending();
             asm("hlt");
         }
     });
@@ -361,7 +366,13 @@ void startupApplicationProcessor(Id const id) {
 extern "C" void finalizeApplicationProcessorStartup(
     ApBootInfo const * const info) {
 
-    // Switch to the final GDT that will be used until reset.
+    // Point the GS base to this cpu's interrupt state. This must be done before
+    // running any code that might use it, e.g. logging, and before any
+    // interrupt is raised on this cpu.
+    Interrupts::InitCurrCpuLocal();
+
+    // Switch to the final GDT that will be used until reset. The GS base is
+    // preserved.
     Memory::Segmentation::InitCurrCpu();
 
     // Load the kernel-wide IDT.
@@ -373,8 +384,14 @@ extern "C" void finalizeApplicationProcessorStartup(
     // Switch to the boot address space.
     Paging::AddrSpace::switchAddrSpace(Paging::bootAddrSpace());
 
+    // Switch to this cpu's own GDT and TSS, giving the exceptions using the
+    // Interrupt Stack Table a known-good stack.
+    Memory::Segmentation::InitCurrCpuTss();
+
     // Configure this cpu's LAPIC.
     Interrupts::lapic();
+    Smp::PerCpu::data().isOnline = true;
+    Profiler::InitCurrCpu();
 
     // Allocate a stack for this cpu. We MUST do this in its own scope in order
     // to avoid keeping Ptr<Memory::Stack> around when calling switchToStack
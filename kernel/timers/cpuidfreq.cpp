@@ -0,0 +1,93 @@
+// Timer frequencies reported by CPUID.
+#include <timers/cpuidfreq.hpp>
+#include <cpu/cpu.hpp>
+
+namespace Timer::CpuidFreq {
+
+// The leaf reporting the timer frequencies on hypervisors implementing it. EAX
+// is the frequency of the TSC and EBX the frequency of the LAPIC timer, both in
+// kHz.
+static constexpr u32 HYPERVISOR_FREQ_LEAF = 0x40000010;
+
+// Check if running under a hypervisor.
+// @return: true if CPUID.1:ECX[31] is set.
+static bool isHypervisor() {
+    return !!(Cpu::cpuid(0x1).ecx & (1U << 31));
+}
+
+// Get the frequencies reported by the hypervisor leaf.
+// @return: The result of CPUID.0x40000010, or all zeros if not running under a
+// hypervisor implementing this leaf.
+static Cpu::CpuidResult hypervisorLeaf() {
+    Cpu::CpuidResult const none({.eax = 0, .ebx = 0, .ecx = 0, .edx = 0});
+    // A hypervisor reports its max leaf in CPUID.0x40000000:EAX.
+    if (!isHypervisor()) {
+        return none;
+    }
+    if (Cpu::cpuid(0x40000000).eax < HYPERVISOR_FREQ_LEAF) {
+        return none;
+    }
+    return Cpu::cpuid(HYPERVISOR_FREQ_LEAF);
+}
+
+// Frequencies derived from leaves 0x15 and 0x16, in Hz, 0 if unknown.
+struct CrystalFreqs {
+    u64 tsc;
+    u64 crystal;
+};
+
+// Get the frequency of the core crystal clock and of the TSC from leaf 0x15.
+// If the leaf reports the ratio between the two but not the frequency of the
+// crystal, the frequency of the TSC is the base frequency of the core reported
+// in leaf 0x16.
+// @return: The CrystalFreqs.
+static CrystalFreqs crystalLeaves() {
+    CrystalFreqs freqs({.tsc = 0, .crystal = 0});
+    u32 const maxLeaf(Cpu::cpuid(0x0).eax);
+    if (maxLeaf < 0x15) {
+        return freqs;
+    }
+    Cpu::CpuidResult const res(Cpu::cpuid(0x15));
+    u64 const denominator(res.eax);
+    u64 const numerator(res.ebx);
+    if (!denominator || !numerator) {
+        return freqs;
+    }
+    if (!!res.ecx) {
+        freqs.crystal = res.ecx;
+        freqs.tsc = freqs.crystal * numerator / denominator;
+    } else if (maxLeaf >= 0x16) {
+        // The base frequency is in MHz.
+        freqs.tsc = u64(Cpu::cpuid(0x16).eax & 0xffff) * 1000000;
+        freqs.crystal = freqs.tsc * denominator / numerator;
+    }
+    return freqs;
+}
+
+// Get the frequency of the TSC as reported by CPUID.
+// @return: The frequency in Hz, or 0 if CPUID does not report it.
+u64 tscFrequency() {
+    // Hypervisors pass leaves 0x15 and 0x16 through from the host, which do
+    // not necessarily describe the TSC of the guest, e.g. under TSC scaling.
+    // Only trust the hypervisor leaf in a guest.
+    if (isHypervisor()) {
+        return u64(hypervisorLeaf().eax) * 1000;
+    }
+    return crystalLeaves().tsc;
+}
+
+// Get the frequency of the LAPIC timer, with a divisor of 1, as reported by
+// CPUID.
+// @return: The frequency in Hz, or 0 if CPUID does not report it.
+u64 lapicTimerFrequency() {
+    // The emulated LAPIC timer of a hypervisor does not run at the crystal
+    // frequency of the host, e.g. KVM exposes leaf 0x15 but its LAPIC timer
+    // runs at 1GHz. Only trust the hypervisor leaf in a guest.
+    if (isHypervisor()) {
+        return u64(hypervisorLeaf().ebx) * 1000;
+    }
+    // On cpus enumerating leaf 0x15 the LAPIC timer is driven by the core
+    // crystal clock.
+    return crystalLeaves().crystal;
+}
+}
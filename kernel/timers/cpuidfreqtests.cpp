@@ -0,0 +1,48 @@
+// Tests cross-checking the frequencies reported by CPUID with the measured
+// frequencies.
+#include <timers/cpuidfreq.hpp>
+#include <timers/lapictimer.hpp>
+#include <timers/tsc.hpp>
+#include <selftests/macros.hpp>
+
+namespace Timer::CpuidFreq {
+
+// Check that a frequency reported by CPUID is within 1% of the measured
+// frequency.
+// @param name: The name of the timer, for logging.
+// @param reported: The frequency reported by CPUID, 0 if not reported.
+// @param measure: Function measuring the frequency.
+// @return: The result of the test.
+static SelfTests::TestResult crossCheck(char const * const name,
+                                        u64 const reported,
+                                        Freq (*measure)()) {
+    if (!reported) {
+        Log::warn("CPUID does not report the {} frequency, skipping test",
+                  name);
+        return SelfTests::TestResult::Skip;
+    }
+    u64 const measured(measure().raw());
+    Log::info("{} frequency: CPUID = {} Hz, measured = {} Hz", name, reported,
+              measured);
+    TEST_ASSERT(absdiff(reported, measured) <= reported / 100);
+    return SelfTests::TestResult::Success;
+}
+
+// Check the frequency of the TSC reported by CPUID.
+SelfTests::TestResult cpuidTscFrequencyTest() {
+    return crossCheck("TSC", tscFrequency(), Tsc::measureFrequency);
+}
+
+// Check the frequency of the LAPIC timer reported by CPUID.
+SelfTests::TestResult cpuidLapicTimerFrequencyTest() {
+    return crossCheck("LAPIC timer", lapicTimerFrequency(),
+                      LapicTimer::measureFrequency);
+}
+
+// Run the tests comparing the frequencies reported by CPUID with the measured
+// frequencies.
+void Test(SelfTests::TestRunner& runner) {
+    RUN_TEST(runner, cpuidTscFrequencyTest);
+    RUN_TEST(runner, cpuidLapicTimerFrequencyTest);
+}
+}
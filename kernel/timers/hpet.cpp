@@ -0,0 +1,166 @@
+// High Precision Event Timer (HPET).
+#include <timers/hpet.hpp>
+#include <acpi/acpi.hpp>
+#include <paging/paging.hpp>
+#include <logging/log.hpp>
+#include <util/assert.hpp>
+#include <util/panic.hpp>
+
+namespace Timer::Hpet {
+
+// Offsets of the registers used by this driver.
+static constexpr u64 GENERAL_CAPABILITIES = 0x0;
+static constexpr u64 GENERAL_CONFIGURATION = 0x10;
+static constexpr u64 MAIN_COUNTER = 0xf0;
+
+// Bits of the General Capabilities and ID register.
+static constexpr u64 COUNT_SIZE_CAP = 1ULL << 13;
+// Bits of the General Configuration register.
+static constexpr u64 ENABLE_CNF = 1ULL << 0;
+
+// The maximum period of the main counter allowed by the specification, in
+// femtoseconds, e.g. 100ns.
+static constexpr u64 MAX_PERIOD = 0x05f5e100;
+
+// Pointer to the registers of the HPET, in the direct map.
+static u64 volatile* Regs = nullptr;
+
+// The frequency of the main counter.
+static Freq CounterFreq = Freq(1);
+static bool CounterIs64Bit = false;
+
+static bool IsInitialized = false;
+
+// Get a register of the HPET.
+// @param offset: The offset of the register.
+// @return: Reference to the register.
+static u64 volatile& reg(u64 const offset) {
+    return Regs[offset / sizeof(u64)];
+}
+
+// Map the registers of the HPET and start its main counter. Must be called
+// after Acpi::Init(). Does nothing if ACPI does not report an HPET.
+void Init() {
+    ASSERT(!IsInitialized);
+    Acpi::Info const& acpiInfo(Acpi::info());
+    if (!acpiInfo.hasHpet) {
+        Log::info("No HPET found");
+        return;
+    }
+    PhyAddr const base(acpiInfo.hpetDesc.address);
+    VirAddr const vaddr(base.toVir());
+    Paging::PageAttr const attrs(Paging::PageAttr::Writable
+                                 | Paging::PageAttr::Uncacheable
+                                 | Paging::PageAttr::Global);
+    Err const err(Paging::map(vaddr, base, attrs, 1));
+    if (err) {
+        PANIC("Failed to map HPET @{}: {}", base, err.error());
+    }
+    Regs = vaddr.ptr<u64 volatile>();
+
+    u64 const caps(reg(GENERAL_CAPABILITIES));
+    u64 const period(caps >> 32);
+    if (!period || MAX_PERIOD < period) {
+        Log::warn("HPET reports an invalid period of {} fs, ignoring it",
+                  period);
+        return;
+    }
+    CounterFreq = Freq(1000000000000000ULL / period);
+    CounterIs64Bit = !!(caps & COUNT_SIZE_CAP);
+    // The counter might already be running if the firmware used the HPET, in
+    // which case it is not reset.
+    u64 const config(reg(GENERAL_CONFIGURATION));
+    if (!(config & ENABLE_CNF)) {
+        reg(GENERAL_CONFIGURATION) = config | ENABLE_CNF;
+    }
+    Log::info("HPET @{}: frequency = {} Hz, {}-bit counter", base,
+              CounterFreq, CounterIs64Bit ? 64 : 32);
+    IsInitialized = true;
+}
+
+// Check if the HPET can be used.
+// @return: true if Init() found and enabled an HPET, false otherwise.
+bool isAvailable() {
+    return IsInitialized;
+}
+
+// Check if the main counter is 64 bits wide. A 32-bit counter wraps around
+// after a few minutes and is therefore only usable for short measurements.
+// @return: true if the main counter is 64-bit, false otherwise.
+bool is64Bit() {
+    ASSERT(IsInitialized);
+    return CounterIs64Bit;
+}
+
+// Get the frequency of the main counter, as reported by the HPET.
+// @return: The frequency in Hz.
+Freq frequency() {
+    ASSERT(IsInitialized);
+    return CounterFreq;
+}
+
+// Read the main counter. Must only be called if isAvailable().
+// @return: The current value of the main counter.
+u64 counter() {
+    return reg(MAIN_COUNTER);
+}
+
+// Compute the number of ticks of the main counter between two reads, taking
+// the wrap-around of 32-bit counters into account.
+// @param start: The first read.
+// @param end: The second read.
+// @return: The number of ticks elapsed between the two reads.
+static u64 elapsed(u64 const start, u64 const end) {
+    return CounterIs64Bit ? end - start : u32(end - start);
+}
+
+// A read of the main counter and the corresponding value of another counter.
+struct BracketedRead {
+    u64 hpet;
+    u64 other;
+};
+
+// Read the main counter between two reads of another counter. The read is
+// attempted a few times and the one with the narrowest bracket is kept, its
+// midpoint is used as the value of the other counter.
+// @param readCounter: Function reading the other counter.
+// @return: The BracketedRead.
+static BracketedRead bracketedRead(u64 (*readCounter)()) {
+    u64 const numTries(4);
+    BracketedRead best({.hpet = 0, .other = 0});
+    u64 bestWidth(~0ULL);
+    for (u64 i(0); i < numTries; ++i) {
+        u64 const before(readCounter());
+        u64 const hpet(counter());
+        u64 const after(readCounter());
+        if (after - before < bestWidth) {
+            bestWidth = after - before;
+            best = {.hpet = hpet, .other = before + bestWidth / 2};
+        }
+    }
+    return best;
+}
+
+// Measure the frequency of another counter against the main counter. Each end
+// of the measurement interval is bracketed by two reads of the measured counter
+// so that the latency of the MMIO reads does not skew the result.
+// @param readCounter: Function reading the measured counter, which must be
+// increasing and must not wrap around during the measurement.
+// @param nanos: The duration of the measurement in nanoseconds.
+// @return: The frequency of the measured counter in Hz.
+Freq measureFrequency(u64 (*readCounter)(), u64 const nanos) {
+    ASSERT(IsInitialized);
+    u64 const freq(CounterFreq.raw());
+    u64 const numTicks(max(nanos * freq / 1000000000, u64(1)));
+    BracketedRead const start(bracketedRead(readCounter));
+    while (elapsed(start.hpet, counter()) < numTicks) {
+        asm("pause");
+    }
+    BracketedRead const end(bracketedRead(readCounter));
+    u64 const hpetDelta(elapsed(start.hpet, end.hpet));
+    u64 const otherDelta(end.other - start.other);
+    // otherDelta * freq / hpetDelta, split to avoid overflows.
+    return Freq((otherDelta / hpetDelta) * freq
+                + ((otherDelta % hpetDelta) * freq) / hpetDelta);
+}
+}
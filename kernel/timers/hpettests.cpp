@@ -0,0 +1,53 @@
+// Tests for the HPET.
+#include <timers/hpet.hpp>
+#include <timers/tsc.hpp>
+#include <cpu/cpu.hpp>
+#include <selftests/macros.hpp>
+
+namespace Timer::Hpet {
+
+// Skip the current test if there is no HPET.
+#define TEST_REQUIRES_HPET()                                                   \
+    do {                                                                       \
+        if (!isAvailable()) {                                                  \
+            Log::warn("No HPET, skipping test");                               \
+            return SelfTests::TestResult::Skip;                                \
+        }                                                                      \
+    } while (0)
+
+// Check that the main counter runs at the frequency reported by the HPET,
+// using the TSC as reference.
+SelfTests::TestResult hpetCounterTest() {
+    TEST_REQUIRES_HPET();
+    u64 const durationNanos(10000000);
+    u64 const startTsc(Cpu::rdtsc());
+    u64 const start(counter());
+    u64 const endTsc(startTsc + Tsc::nanosToCycles(durationNanos));
+    while (Cpu::rdtsc() < endTsc) {
+        asm("pause");
+    }
+    u64 const end(counter());
+    u64 const elapsed(is64Bit() ? end - start : u32(end - start));
+    u64 const expected(durationNanos * frequency().raw() / 1000000000);
+    TEST_ASSERT(absdiff(elapsed, expected) <= expected / 20);
+    return SelfTests::TestResult::Success;
+}
+
+// Check measureFrequency() against the frequency of the TSC computed by
+// Tsc::Init().
+SelfTests::TestResult hpetMeasureFrequencyTest() {
+    TEST_REQUIRES_HPET();
+    u64 const durationNanos(1000000);
+    u64 const measured(measureFrequency(Cpu::rdtsc, durationNanos).raw());
+    u64 const expected(Tsc::frequency().raw());
+    Log::info("TSC frequency measured against the HPET: {} Hz", measured);
+    TEST_ASSERT(absdiff(measured, expected) <= expected / 100);
+    return SelfTests::TestResult::Success;
+}
+
+// Run the HPET tests.
+void Test(SelfTests::TestRunner& runner) {
+    RUN_TEST(runner, hpetCounterTest);
+    RUN_TEST(runner, hpetMeasureFrequencyTest);
+}
+}
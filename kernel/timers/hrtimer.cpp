@@ -0,0 +1,291 @@
+// High-resolution timers.
+#include <timers/hrtimer.hpp>
+#include <timers/tsc.hpp>
+#include <timers/lapictimer.hpp>
+#include <interrupts/interrupts.hpp>
+#include <interrupts/cpulocal.hpp>
+#include <concurrency/lock.hpp>
+#include <datastruct/vector.hpp>
+#include <cpu/cpu.hpp>
+#include <logging/log.hpp>
+#include <util/assert.hpp>
+#include <util/panic.hpp>
+#include <util/ptr.hpp>
+
+namespace Timer {
+
+// The vector raised by the LAPIC timers when the earliest timer expires.
+static Interrupts::Vector TimerVector = Interrupts::Vector(0);
+
+// If true the LAPIC timers are used in TSC-deadline mode, otherwise in one-shot
+// mode.
+static bool UseTscDeadline = false;
+
+static bool IsInitialized = false;
+
+// The pending timers of a cpu.
+struct HrTimerQueue {
+    // Protects the heap and m_heapIndex of the timers in it.
+    Concurrency::SpinLock lock;
+    // Min-heap of the pending timers, ordered by deadline.
+    Vector<HrTimer*> heap;
+    // The timer whose callback is currently running on this cpu, if any.
+    HrTimer* volatile running = nullptr;
+
+    // Swap two timers in the heap.
+    // @param i: The index of the first timer.
+    // @param j: The index of the second timer.
+    void swap(u64 const i, u64 const j) {
+        HrTimer* const tmp(heap[i]);
+        heap[i] = heap[j];
+        heap[j] = tmp;
+        heap[i]->m_heapIndex = i;
+        heap[j]->m_heapIndex = j;
+    }
+
+    // Move a timer up the heap until its parent has an earlier deadline.
+    // @param index: The index of the timer.
+    void siftUp(u64 index) {
+        while (!!index) {
+            u64 const parent((index - 1) / 2);
+            if (heap[parent]->m_deadline <= heap[index]->m_deadline) {
+                break;
+            }
+            swap(index, parent);
+            index = parent;
+        }
+    }
+
+    // Move a timer down the heap until its children have later deadlines.
+    // @param index: The index of the timer.
+    void siftDown(u64 index) {
+        while (true) {
+            u64 const left(2 * index + 1);
+            u64 const right(left + 1);
+            u64 earliest(index);
+            if (left < heap.size()
+                && heap[left]->m_deadline < heap[earliest]->m_deadline) {
+                earliest = left;
+            }
+            if (right < heap.size()
+                && heap[right]->m_deadline < heap[earliest]->m_deadline) {
+                earliest = right;
+            }
+            if (earliest == index) {
+                break;
+            }
+            swap(index, earliest);
+            index = earliest;
+        }
+    }
+
+    // Insert a timer in the heap. Must be called with the lock held.
+    // @param timer: The timer, must not be in any heap.
+    void insert(HrTimer* const timer) {
+        ASSERT(timer->m_heapIndex == HrTimer::NotQueued);
+        timer->m_heapIndex = heap.size();
+        heap.pushBack(timer);
+        siftUp(timer->m_heapIndex);
+    }
+
+    // Remove a timer from the heap. Must be called with the lock held.
+    // @param timer: The timer, must be in this heap.
+    void remove(HrTimer* const timer) {
+        u64 const index(timer->m_heapIndex);
+        ASSERT(index < heap.size() && heap[index] == timer);
+        u64 const last(heap.size() - 1);
+        if (index != last) {
+            swap(index, last);
+        }
+        heap.popBack();
+        timer->m_heapIndex = HrTimer::NotQueued;
+        if (index != last) {
+            // The timer moved into the hole can be earlier than the parent or
+            // later than the children of the hole.
+            siftUp(index);
+            siftDown(index);
+        }
+    }
+
+    // Arm the LAPIC timer of the current cpu for the earliest timer. Must be
+    // called with the lock held on the cpu owning this queue.
+    // @param switchMode: If true, first switch the LAPIC timer to the mode used
+    // by the hrtimers. Needed when the queue was empty as the LAPIC timer might
+    // have been used for something else in the meantime.
+    void program(bool const switchMode) {
+        if (heap.empty()) {
+            return;
+        }
+        u64 const deadline(heap[0]->m_deadline);
+        u64 const tsc(Cpu::rdtsc());
+        u64 const now(Tsc::monotonicNanos());
+        u64 const delta(deadline > now ? deadline - now : 0);
+        if (UseTscDeadline) {
+            if (switchMode) {
+                LapicTimer::initTscDeadline(TimerVector);
+            }
+            LapicTimer::setTscDeadline(tsc + Tsc::nanosToCycles(delta));
+        } else {
+            LapicTimer::armOneShot(TimerVector, delta);
+        }
+    }
+
+    // Interrupt handler of the LAPIC timer, runs the expired timers of the
+    // current cpu and re-arms the LAPIC timer for the next one. Uses the fast
+    // entry path.
+    static void handleInterrupt(Interrupts::Vector const);
+};
+
+// The queue of each cpu, indexed by Smp::Id.
+static Vector<Ptr<HrTimerQueue>> Queues;
+
+// Get the queue of a cpu.
+// @param cpu: The cpu.
+// @return: The HrTimerQueue of `cpu`.
+static HrTimerQueue& queue(Smp::Id const cpu) {
+    return *Queues[cpu.raw()];
+}
+
+// Interrupt handler of the LAPIC timer, runs the expired timers of the current
+// cpu and re-arms the LAPIC timer for the next one. Uses the fast entry path.
+void HrTimerQueue::handleInterrupt(Interrupts::Vector const) {
+    // Avoid Smp::id() which executes CPUID.
+    HrTimerQueue& q(queue(Interrupts::cpuLocal().id));
+    q.lock.lock();
+    // The interrupt may be early, e.g. the earliest timer was cancelled or the
+    // LAPIC timer was armed for less than the full duration, in which case no
+    // timer expired and the LAPIC timer is simply re-armed.
+    while (!q.heap.empty()
+           && q.heap[0]->m_deadline <= Tsc::monotonicNanos()) {
+        HrTimer* const timer(q.heap[0]);
+        q.remove(timer);
+        q.running = timer;
+        // The callback may restart the timer.
+        q.lock.unlock();
+        timer->m_callback(*timer);
+        q.lock.lock();
+        q.running = nullptr;
+    }
+    q.program(false);
+    q.lock.unlock();
+}
+
+// Initialize the per-cpu timer queues. Must be called after
+// Smp::PerCpu::Init() and Tsc::Init().
+void HrTimer::Init() {
+    ASSERT(!IsInitialized);
+    for (u64 i(0); i < Smp::ncpus(); ++i) {
+        Queues.pushBack(Ptr<HrTimerQueue>::New());
+    }
+    // Use a high priority so that the expiry of a timer is not delayed by the
+    // handlers of other interrupts.
+    Res<Interrupts::Vector> const vector(
+        Interrupts::allocateVector(Interrupts::PriorityClass(15)));
+    if (!vector) {
+        PANIC("Cannot allocate a vector for the hrtimers: {}", vector.error());
+    }
+    TimerVector = *vector;
+    Interrupts::registerFastHandler(TimerVector,
+                                    HrTimerQueue::handleInterrupt);
+    UseTscDeadline = LapicTimer::hasTscDeadline();
+    if (!UseTscDeadline) {
+        // The timers are armed with the queue locked and interrupts disabled,
+        // at which point the frequency of the LAPIC timer cannot be measured.
+        LapicTimer::InitFrequency();
+    }
+    Log::info("HrTimers use the LAPIC timer in {} mode",
+              UseTscDeadline ? "TSC-deadline" : "one-shot");
+    IsInitialized = true;
+}
+
+// Create a timer. The timer is not started.
+// @param callback: The function called when the timer expires.
+// @param arg: Opaque argument for the callback, see arg().
+HrTimer::HrTimer(Callback const callback, void* const arg) :
+    m_callback(callback), m_arg(arg), m_deadline(0), m_cpu(0),
+    m_heapIndex(NotQueued) {
+    ASSERT(!!m_callback);
+}
+
+// Destroy a timer, cancelling it if it is pending.
+HrTimer::~HrTimer() {
+    cancel();
+}
+
+// Start the timer on the current cpu. If the timer was already pending it is
+// re-armed with the new deadline, possibly moving it to the current cpu. A
+// timer must not be started or cancelled concurrently from multiple cpus.
+// @param deadline: The value of Tsc::monotonicNanos() at which the timer
+// expires. A deadline in the past expires immediately.
+void HrTimer::start(u64 const deadline) {
+    ASSERT(IsInitialized);
+    if (isPending()) {
+        HrTimerQueue& prev(queue(m_cpu));
+        Concurrency::LockGuard guard(prev.lock);
+        // The timer might have expired in the meantime.
+        if (m_heapIndex != NotQueued) {
+            prev.remove(this);
+        }
+    }
+    Smp::Id const cpu(Interrupts::cpuLocal().id);
+    HrTimerQueue& q(queue(cpu));
+    Concurrency::LockGuard guard(q.lock);
+    bool const wasEmpty(q.heap.empty());
+    m_deadline = deadline;
+    m_cpu = cpu;
+    q.insert(this);
+    if (!m_heapIndex) {
+        q.program(wasEmpty);
+    }
+}
+
+// Start the timer on the current cpu to expire after the given duration.
+// @param nanos: The number of nanoseconds until the timer expires.
+void HrTimer::startAfter(u64 const nanos) {
+    start(Tsc::monotonicNanos() + nanos);
+}
+
+// Cancel the timer. If the callback of the timer is running on another cpu this
+// waits for it to complete.
+// @return: true if the timer was pending, false otherwise.
+bool HrTimer::cancel() {
+    if (!IsInitialized) {
+        return false;
+    }
+    HrTimerQueue& q(queue(m_cpu));
+    bool wasPending(false);
+    {
+        Concurrency::LockGuard guard(q.lock);
+        if (m_heapIndex != NotQueued) {
+            // If this was the earliest timer the LAPIC timer fires early, the
+            // interrupt handler then re-arms it for the next timer.
+            q.remove(this);
+            wasPending = true;
+        }
+    }
+    if (m_cpu != Interrupts::cpuLocal().id) {
+        while (q.running == this) {
+            asm("pause");
+        }
+    }
+    return wasPending;
+}
+
+// Check if the timer is pending, i.e. started and not yet expired.
+// @return: true if pending, false otherwise.
+bool HrTimer::isPending() const {
+    return m_heapIndex != NotQueued;
+}
+
+// Get the deadline of the timer.
+// @return: The deadline given to the last call to start().
+u64 HrTimer::deadline() const {
+    return m_deadline;
+}
+
+// Get the argument given at construction.
+// @return: The opaque argument of the callback.
+void* HrTimer::arg() const {
+    return m_arg;
+}
+}
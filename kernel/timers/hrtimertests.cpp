@@ -0,0 +1,172 @@
+// Tests for the high-resolution timers.
+#include <timers/hrtimer.hpp>
+#include <timers/tsc.hpp>
+#include <smp/percpu.hpp>
+#include <smp/remotecall.hpp>
+#include <selftests/macros.hpp>
+
+namespace Timer {
+
+// Number of nanoseconds in a microsecond and a millisecond.
+static constexpr u64 US = 1000;
+static constexpr u64 MS = 1000 * US;
+
+// Number of callbacks run during the current test.
+static u64 volatile NumExpired;
+// The arg() of the timers in the order their callbacks were run.
+static u64 volatile ExpiredOrder[8];
+
+// Callback recording the order in which the timers expired. The arg of the
+// timer is its index.
+// @param timer: The expired timer.
+static void recordExpiry(HrTimer& timer) {
+    ExpiredOrder[NumExpired] = reinterpret_cast<u64>(timer.arg());
+    NumExpired = NumExpired + 1;
+}
+
+// Check that timers expire in the order of their deadlines, not in the order
+// they were started, and never before their deadline.
+SelfTests::TestResult hrTimerOrderTest() {
+    NumExpired = 0;
+    u64 const order[] = {4, 1, 3, 0, 2};
+    Vector<Ptr<HrTimer>> timers;
+    for (u64 i(0); i < 5; ++i) {
+        timers.pushBack(Ptr<HrTimer>::New(recordExpiry,
+                                          reinterpret_cast<void*>(i)));
+    }
+    u64 const start(Tsc::monotonicNanos());
+    for (u64 const i : order) {
+        timers[i]->start(start + (i + 1) * MS);
+    }
+    for (u64 i(0); i < 5; ++i) {
+        TEST_ASSERT(timers[i]->isPending());
+    }
+    TEST_ASSERT(SelfTests::waitFor([]() { return NumExpired == 5; }, 100));
+    TEST_ASSERT(Tsc::monotonicNanos() >= start + 5 * MS);
+    for (u64 i(0); i < 5; ++i) {
+        TEST_ASSERT(ExpiredOrder[i] == i);
+        TEST_ASSERT(!timers[i]->isPending());
+    }
+    return SelfTests::TestResult::Success;
+}
+
+// Check cancelling and re-arming timers.
+SelfTests::TestResult hrTimerCancelTest() {
+    NumExpired = 0;
+    HrTimer cancelled(recordExpiry, reinterpret_cast<void*>(0));
+    HrTimer rearmed(recordExpiry, reinterpret_cast<void*>(1));
+    TEST_ASSERT(!cancelled.cancel());
+
+    cancelled.startAfter(2 * MS);
+    rearmed.startAfter(50 * MS);
+    TEST_ASSERT(cancelled.cancel());
+    TEST_ASSERT(!cancelled.isPending());
+    // Re-arming replaces the previous deadline, the timer only expires once.
+    u64 const start(Tsc::monotonicNanos());
+    rearmed.startAfter(1 * MS);
+    TEST_ASSERT(SelfTests::waitFor([]() { return NumExpired == 1; }, 20));
+    TEST_ASSERT(Tsc::monotonicNanos() - start < 20 * MS);
+    TEST_ASSERT(ExpiredOrder[0] == 1);
+    TEST_ASSERT(!SelfTests::waitFor([]() { return NumExpired == 2; }, 5));
+    TEST_ASSERT(!rearmed.cancel());
+    return SelfTests::TestResult::Success;
+}
+
+// Check that a timer expires on the cpu it was started on.
+SelfTests::TestResult hrTimerRemoteCpuTest() {
+    TEST_REQUIRES_MULTICORE();
+    static u64 volatile expiredOn;
+    static u64 volatile numExpired;
+    numExpired = 0;
+    HrTimer timer([](HrTimer&) {
+        expiredOn = Smp::id().raw();
+        numExpired = numExpired + 1;
+    });
+    for (Smp::Id cpu(0); cpu < Smp::ncpus(); ++cpu) {
+        if (!Smp::PerCpu::data(cpu).isOnline) {
+            continue;
+        }
+        u64 const expected(numExpired + 1);
+        if (cpu == Smp::id()) {
+            timer.startAfter(1 * MS);
+        } else {
+            Smp::RemoteCall::invokeOn(cpu, [&]() {
+                timer.startAfter(1 * MS);
+            })->wait();
+        }
+        TEST_ASSERT(SelfTests::waitFor([&]() {
+            return numExpired == expected;
+        }, 20));
+        TEST_ASSERT(expiredOn == cpu.raw());
+    }
+    return SelfTests::TestResult::Success;
+}
+
+// State of the periodic timer in hrTimerJitterTest.
+static constexpr u64 JITTER_PERIOD = 100 * US;
+static constexpr u64 JITTER_NUM_PERIODS = 500;
+static u64 volatile JitterNumPeriods;
+// Sum and max of the lateness of the callbacks, in nanoseconds.
+static u64 volatile JitterTotalLateness;
+static u64 volatile JitterMaxLateness;
+// Number of callbacks that ran before their deadline.
+static u64 volatile JitterNumEarly;
+
+// Callback of the periodic timer of hrTimerJitterTest, measures the lateness
+// and re-arms the timer for the next period.
+// @param timer: The expired timer.
+static void jitterCallback(HrTimer& timer) {
+    u64 const now(Tsc::monotonicNanos());
+    if (now < timer.deadline()) {
+        JitterNumEarly = JitterNumEarly + 1;
+    } else {
+        u64 const lateness(now - timer.deadline());
+        JitterTotalLateness = JitterTotalLateness + lateness;
+        JitterMaxLateness = max(u64(JitterMaxLateness), lateness);
+    }
+    JitterNumPeriods = JitterNumPeriods + 1;
+    if (JitterNumPeriods < JITTER_NUM_PERIODS) {
+        // Re-arm relative to the deadline so that the lateness does not
+        // accumulate.
+        timer.start(timer.deadline() + JITTER_PERIOD);
+    }
+}
+
+// Check that timers expire within a few microseconds of their deadline.
+SelfTests::TestResult hrTimerJitterTest() {
+    JitterNumPeriods = 0;
+    JitterTotalLateness = 0;
+    JitterMaxLateness = 0;
+    JitterNumEarly = 0;
+    HrTimer timer(jitterCallback);
+    timer.startAfter(JITTER_PERIOD);
+    TEST_ASSERT(SelfTests::waitFor([]() {
+        return JitterNumPeriods == JITTER_NUM_PERIODS;
+    }, JITTER_NUM_PERIODS * JITTER_PERIOD / MS + 100));
+    u64 const avgLateness(JitterTotalLateness / JITTER_NUM_PERIODS);
+    Log::info("HrTimer lateness: avg = {} ns, max = {} ns", avgLateness,
+              u64(JitterMaxLateness));
+    TEST_ASSERT(!JitterNumEarly);
+    // Each expiry reads the monotonic clock at least twice, which is slow when
+    // it is derived from the HPET.
+    u64 const numReads(1000);
+    u64 const start(Tsc::monotonicNanos());
+    for (u64 i(0); i < numReads; ++i) {
+        Tsc::monotonicNanos();
+    }
+    u64 const readCost((Tsc::monotonicNanos() - start) / numReads);
+    TEST_ASSERT(avgLateness <= 10 * US + 2 * readCost);
+    // A single expiry can be delayed by a VM exit or by the host descheduling
+    // the vcpu, hence the much looser bound on the worst case.
+    TEST_ASSERT(JitterMaxLateness <= 1 * MS + 2 * readCost);
+    return SelfTests::TestResult::Success;
+}
+
+// Run the high-resolution timer tests.
+void HrTimerTest(SelfTests::TestRunner& runner) {
+    RUN_TEST(runner, hrTimerOrderTest);
+    RUN_TEST(runner, hrTimerCancelTest);
+    RUN_TEST(runner, hrTimerRemoteCpuTest);
+    RUN_TEST(runner, hrTimerJitterTest);
+}
+}
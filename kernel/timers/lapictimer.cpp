@@ -1,10 +1,14 @@
 // Functions to interact with and configure the LAPIC timer.
 #include <timers/lapictimer.hpp>
 #include <timers/pit.hpp>
+#include <timers/hpet.hpp>
+#include <timers/cpuidfreq.hpp>
 #include <interrupts/vectormap.hpp>
 #include <interrupts/lapic.hpp>
 #include <logging/log.hpp>
 #include <util/panic.hpp>
+#include <util/assert.hpp>
+#include <cpu/cpu.hpp>
 
 namespace Timer::LapicTimer {
 
@@ -16,9 +20,9 @@ static Freq LapicTimerBaseFreq = Freq(1);
 // The frequency at which the LAPIC timer is currently configured.
 static Freq LapicTimerCurrFreq = Freq(1);
 
-// Compute the frequency of the LAPIC timer.
+// Compute the frequency of the LAPIC timer using the PIT. This takes 100ms.
 // @return: The frequency of the LAPIC timer.
-static Freq getTimerFreq() {
+static Freq getTimerFreqFromPit() {
     // The LAPIC timer frequency is computed using the PIT as follows:
     //  1. Configure the PIT to a particular frequency.
     //  2. Setup the LAPIC timer so that it does not generate an interrupt and
@@ -110,6 +114,68 @@ static Freq getTimerFreq() {
     return lapicFreq;
 }
 
+// Compute the frequency of the LAPIC timer using the HPET. This takes less than
+// a millisecond.
+// @return: The frequency of the LAPIC timer.
+static Freq getTimerFreqFromHpet() {
+    // Let the timer count down from the max u32 in masked one-shot mode, the
+    // number of ticks elapsed since the start is then an increasing counter
+    // that can be measured against the HPET.
+    Interrupts::Lapic::Lvt const timerLvt({
+        .mask = true,
+        .timerMode = Interrupts::Lapic::Lvt::TimerMode::OneShot,
+    });
+    Interrupts::lapic().setTimerLvt(timerLvt);
+    Interrupts::lapic().setTimerDivideConfiguration(
+        Interrupts::Lapic::TimerDivideConfiguration::DivideBy1);
+    Interrupts::lapic().setTimerInitialCount(u32(~0ULL));
+    u64 const durationNanos(500000);
+    Timer::Freq const lapicFreq(Hpet::measureFrequency([]() {
+        return u64(u32(~0ULL) - Interrupts::lapic().timerCurrentCount());
+    }, durationNanos));
+    if (!Interrupts::lapic().timerCurrentCount()) {
+        PANIC("LAPIC timer counter expired while measuring its frequency");
+    }
+    stop();
+    Log::info("LAPIC timer frequency = {} Hz (HPET)", lapicFreq);
+    return lapicFreq;
+}
+
+// Measure the frequency of the LAPIC timer of the current cpu against the HPET
+// if available, otherwise against the PIT. The frequency used by this namespace
+// comes from CPUID when reported, in which case it is never measured. This
+// clobbers the configuration of the LAPIC timer.
+// @return: The measured frequency, with a divisor of 1.
+Freq measureFrequency() {
+    if (Hpet::isAvailable()) {
+        return getTimerFreqFromHpet();
+    } else {
+        return getTimerFreqFromPit();
+    }
+}
+
+// Compute the frequency of the LAPIC timer. The frequency reported by CPUID is
+// used if any, otherwise the frequency is measured.
+// @return: The frequency of the LAPIC timer.
+static Freq getTimerFreq() {
+    u64 const cpuidFreq(CpuidFreq::lapicTimerFrequency());
+    if (!!cpuidFreq) {
+        Log::info("LAPIC timer frequency from CPUID = {} Hz", cpuidFreq);
+        return Freq(cpuidFreq);
+    }
+    return measureFrequency();
+}
+
+// Compute the frequency of the LAPIC timer if it has not been computed yet. The
+// frequency may be measured against the PIT, whose interrupts must be able to
+// fire: this must not be called with interrupts disabled or while holding a
+// spinlock.
+void InitFrequency() {
+    if (LapicTimerBaseFreq == 1) {
+        LapicTimerBaseFreq = getTimerFreq();
+    }
+}
+
 // Initialize the LAPIC timer. The timer is configured to use the given
 // frequency and uses vector Interrupts::VectorMap::LapicTimerVector. The timer
 // is _not_ started by calling this function.
@@ -227,4 +293,74 @@ void delay(Duration const duration) {
         remainingTicks -= min(remainingTicks, elapsed);
     }
 }
+
+// Arm the LAPIC timer of the current cpu to fire a single interrupt after the
+// given duration. The duration is rounded to the resolution of the LAPIC timer
+// and clamped to the longest duration the timer can count, the caller is
+// expected to re-arm the timer if it fired too early. InitFrequency() must
+// have been called.
+// @param vector: The vector raised when the timer expires.
+// @param nanos: The duration in nanoseconds.
+void armOneShot(Interrupts::Vector const vector, u64 const nanos) {
+    // This is called with interrupts disabled, the frequency cannot be
+    // measured here.
+    ASSERT(LapicTimerBaseFreq != 1);
+    // Limit the duration to avoid overflows, this is fine since the caller must
+    // re-arm the timer if it fires too early anyway. The duration is split to
+    // avoid a 128-bit division.
+    u64 const clamped(min(nanos, u64(60) * 1000000000));
+    u64 const freq(LapicTimerBaseFreq.raw());
+    u64 const ticks((clamped / 1000000000) * freq
+                    + ((clamped % 1000000000) * freq) / 1000000000);
+    // An initial count of 0 stops the timer.
+    u32 const count(max(min(ticks, u64(u32(~0ULL))), u64(1)));
+    Interrupts::lapic().setTimerDivideConfiguration(
+        Interrupts::Lapic::TimerDivideConfiguration::DivideBy1);
+    Interrupts::Lapic::Lvt const lvt({
+        .vector = vector,
+        .mask = false,
+        .timerMode = Interrupts::Lapic::Lvt::TimerMode::OneShot,
+    });
+    Interrupts::lapic().setTimerLvt(lvt);
+    Interrupts::lapic().setTimerInitialCount(count);
+}
+
+// Check if the current cpu supports the TSC-deadline mode.
+// @return: true if CPUID advertises the TSC-deadline mode, false otherwise.
+bool hasTscDeadline() {
+    return !!(Cpu::cpuid(0x1).ecx & (1 << 24));
+}
+
+// Switch the LAPIC timer of the current cpu to TSC-deadline mode. No deadline
+// is armed after this call. Must only be called if hasTscDeadline().
+// @param vector: The vector raised when a deadline is reached.
+void initTscDeadline(Interrupts::Vector const vector) {
+    ASSERT(hasTscDeadline());
+    stop();
+    Interrupts::Lapic::Lvt const lvt({
+        .vector = vector,
+        .mask = false,
+        .timerMode = Interrupts::Lapic::Lvt::TimerMode::TscDeadline,
+    });
+    Interrupts::lapic().setTimerLvt(lvt);
+    // The write to the LVT is an MMIO write while IA32_TSC_DEADLINE is an MSR,
+    // a deadline written right after the mode switch could be ignored unless
+    // the two are ordered.
+    asm volatile("mfence" : : : "memory");
+    cancelTscDeadline();
+}
+
+// Arm the timer of the current cpu to fire at the given TSC value. Replaces
+// the previous deadline, if any. A deadline in the past fires immediately. The
+// timer must be in TSC-deadline mode, see initTscDeadline().
+// @param tscDeadline: The value of the TSC at which the interrupt fires.
+void setTscDeadline(u64 const tscDeadline) {
+    // Writing 0 disarms the timer, a deadline of 0 is in the past anyway.
+    Cpu::wrmsr(Cpu::Msr::IA32_TSC_DEADLINE, max(tscDeadline, u64(1)));
+}
+
+// Disarm the deadline of the current cpu, if any.
+void cancelTscDeadline() {
+    Cpu::wrmsr(Cpu::Msr::IA32_TSC_DEADLINE, 0);
+}
 }
@@ -1,6 +1,7 @@
 // Timer tests.
 #include <timers/pit.hpp>
 #include <timers/lapictimer.hpp>
+#include <timers/tsc.hpp>
 #include <interrupts/vectormap.hpp>
 #include <selftests/macros.hpp>
 
@@ -129,9 +130,50 @@ SelfTests::TestResult lapicBasicTest() {
     return SelfTests::TestResult::Success;
 }
 
+// Check that the TSC-deadline mode of the LAPIC timer fires once the deadline
+// is reached and that a cancelled deadline does not fire.
+SelfTests::TestResult lapicTscDeadlineTest() {
+    if (!LapicTimer::hasTscDeadline()) {
+        Log::warn("TSC-deadline mode is not supported, skipping test");
+        return SelfTests::TestResult::Skip;
+    }
+    Interrupts::Vector const vector(Interrupts::VectorMap::TestVector);
+    // The number of interrupts and the TSC when the last one was received.
+    static u64 volatile numTicks;
+    static u64 volatile lastTickTsc;
+    numTicks = 0;
+    auto const handler([](Interrupts::Vector const, Interrupts::Frame const&) {
+        lastTickTsc = Cpu::rdtsc();
+        numTicks = numTicks + 1;
+    });
+    TemporaryInterruptHandlerGuard guard(vector, handler);
+    LapicTimer::initTscDeadline(vector);
+    u64 const oneMs(Tsc::nanosToCycles(1000000));
+
+    // The interrupt is raised after the deadline, once.
+    for (u64 i(1); i <= 10; ++i) {
+        u64 const deadline(Cpu::rdtsc() + oneMs);
+        LapicTimer::setTscDeadline(deadline);
+        TEST_ASSERT(SelfTests::waitFor([&]() { return numTicks == i; }, 100));
+        TEST_ASSERT(deadline <= lastTickTsc);
+    }
+
+    // A deadline in the past fires immediately.
+    LapicTimer::setTscDeadline(Cpu::rdtsc() - oneMs);
+    TEST_ASSERT(SelfTests::waitFor([]() { return numTicks == 11; }, 1));
+
+    // A cancelled deadline does not fire.
+    LapicTimer::setTscDeadline(Cpu::rdtsc() + oneMs);
+    LapicTimer::cancelTscDeadline();
+    TEST_ASSERT(!SelfTests::waitFor([]() { return numTicks == 12; }, 5));
+    LapicTimer::stop();
+    return SelfTests::TestResult::Success;
+}
+
 // Run Timer tests.
 void Test(SelfTests::TestRunner& runner) {
     RUN_TEST(runner, pitBasicTest);
     RUN_TEST(runner, lapicBasicTest);
+    RUN_TEST(runner, lapicTscDeadlineTest);
 }
 }
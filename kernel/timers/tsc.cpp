@@ -0,0 +1,297 @@
+// Time-Stamp Counter (TSC) clocksource.
+#include <timers/tsc.hpp>
+#include <timers/pit.hpp>
+#include <timers/hpet.hpp>
+#include <timers/cpuidfreq.hpp>
+#include <interrupts/vectormap.hpp>
+#include <concurrency/lock.hpp>
+#include <concurrency/atomic.hpp>
+#include <smp/percpu.hpp>
+#include <smp/remotecall.hpp>
+#include <cpu/cpu.hpp>
+#include <logging/log.hpp>
+#include <util/assert.hpp>
+
+namespace Timer::Tsc {
+
+// The frequency of the TSC, computed by Init().
+static Freq TscFreq = Freq(1);
+
+// Parameters of the monotonic clock, derived from a counter:
+//  nanos = nanosBase + (((counter - counterBase) * mult) >> SHIFT)
+// The counter is the TSC, or the HPET if UseHpetClock.
+struct Clock {
+    u64 counterBase;
+    u64 nanosBase;
+    u64 mult;
+};
+static constexpr u64 SHIFT = 32;
+// Multiplier of the conversion from TSC cycles to nanoseconds:
+//  nanos = (cycles * TscMult) >> SHIFT
+static u64 TscMult = 0;
+// Parameters of the conversion from nanoseconds to TSC cycles:
+//  cycles = (nanos * InverseMult) >> INVERSE_SHIFT
+// The shift is smaller than SHIFT so that the multiplier fits in 64 bits for
+// any realistic TSC frequency.
+static constexpr u64 INVERSE_SHIFT = 24;
+static u64 InverseMult = 0;
+
+// The current clock parameters, protected by ClockLock.
+static Clock CurrClock;
+static Concurrency::SeqLock ClockLock;
+
+// If true the monotonic clock is derived from the HPET instead of the TSC. This
+// is the case when the TSC is not invariant and a 64-bit HPET is available.
+static bool UseHpetClock = false;
+
+static bool IsInitialized = false;
+
+// Read the TSC once all previous instructions completed. RDTSC is not
+// serializing and could otherwise be executed before a load that precedes it.
+// @return: The current value of the TSC.
+static u64 orderedRdtsc() {
+    asm volatile("lfence" : : : "memory");
+    return Cpu::rdtsc();
+}
+
+// Measure the frequency of the TSC against the PIT. This takes about 50
+// milliseconds.
+// @return: The frequency in Hz.
+static u64 frequencyFromPit() {
+    Interrupts::Vector const pitVector(Interrupts::VectorMap::PitVector);
+    u64 const pitFreq(1000);
+    u64 const numTicks(50);
+
+    static u64 volatile numPitTicks;
+    numPitTicks = 0;
+    auto const pitHandler([](Interrupts::Vector const,
+                             Interrupts::Frame const&) {
+        numPitTicks = numPitTicks + 1;
+    });
+    bool const savedIrqFlag(Cpu::interruptsEnabled());
+    Cpu::disableInterrupts();
+    Interrupts::registerHandler(pitVector, pitHandler);
+    Pit::mapToVector(pitVector);
+    Pit::setFrequency(Freq(pitFreq));
+    Cpu::enableInterrupts();
+
+    // Start measuring on a tick so that the measurement is not off by the
+    // fraction of the period before the first tick.
+    while (!numPitTicks) {
+        asm("pause");
+    }
+    u64 const start(Cpu::rdtsc());
+    u64 const startTick(numPitTicks);
+    while (numPitTicks - startTick < numTicks) {
+        asm("pause");
+    }
+    u64 const end(Cpu::rdtsc());
+
+    Cpu::disableInterrupts();
+    Pit::disable();
+    Interrupts::deregisterHandler(pitVector);
+    Cpu::setInterruptFlag(savedIrqFlag);
+    return (end - start) * pitFreq / numTicks;
+}
+
+// Measure the frequency of the TSC against the HPET. This takes half a
+// millisecond.
+// @return: The frequency in Hz.
+static u64 frequencyFromHpet() {
+    u64 const durationNanos(500000);
+    return Hpet::measureFrequency(orderedRdtsc, durationNanos).raw();
+}
+
+// Read the counter the monotonic clock is derived from.
+// @return: The current value of the counter.
+static u64 readClockCounter() {
+    return UseHpetClock ? Hpet::counter() : Cpu::rdtsc();
+}
+
+// Set the frequency used by the conversions and, if the clock is derived from
+// the TSC, by the clock. The clock is rebased so that it stays continuous.
+// @param freq: The new frequency of the TSC.
+static void setFrequency(Freq const freq) {
+    u64 const counterFreq(UseHpetClock ? Hpet::frequency().raw() : freq.raw());
+    u64 const counter(readClockCounter());
+    u64 const nanos(IsInitialized ? monotonicNanos() : 0);
+    ClockLock.writeBegin();
+    CurrClock.counterBase = counter;
+    CurrClock.nanosBase = nanos;
+    CurrClock.mult = (1000000000ULL << SHIFT) / counterFreq;
+    TscMult = (1000000000ULL << SHIFT) / freq.raw();
+    InverseMult = (freq.raw() << INVERSE_SHIFT) / 1000000000ULL;
+    TscFreq = freq;
+    ClockLock.writeEnd();
+}
+
+// Calibrate the TSC and start the monotonic clock at 0. Must be called after
+// the I/O APICs and the HPET have been initialized, the HPET or the PIT is used
+// for the calibration if CPUID does not report the frequency of the TSC.
+void Init() {
+    ASSERT(!IsInitialized);
+    if (!isInvariant()) {
+        if (Hpet::isAvailable() && Hpet::is64Bit()) {
+            Log::info("TSC is not invariant, using the HPET as clocksource");
+            UseHpetClock = true;
+        } else {
+            Log::warn("TSC is not invariant, the monotonic clock may drift");
+        }
+    }
+    u64 const cpuidFreq(CpuidFreq::tscFrequency());
+    if (!!cpuidFreq) {
+        Log::info("TSC frequency from CPUID: {} Hz", cpuidFreq);
+        setFrequency(Freq(cpuidFreq));
+    } else {
+        setFrequency(measureFrequency());
+    }
+    IsInitialized = true;
+}
+
+// Measure the frequency of the TSC against the HPET if available, otherwise
+// against the PIT. Init() only measures the frequency if CPUID does not report
+// it. Must be called after the I/O APICs and the HPET have been initialized.
+// @return: The measured frequency.
+Freq measureFrequency() {
+    if (Hpet::isAvailable()) {
+        u64 const freq(frequencyFromHpet());
+        Log::info("TSC frequency from HPET: {} Hz", freq);
+        return Freq(freq);
+    } else {
+        u64 const freq(frequencyFromPit());
+        Log::info("TSC frequency from PIT: {} Hz", freq);
+        return Freq(freq);
+    }
+}
+
+// Check if the TSC is invariant, that is it ticks at a constant rate in all
+// ACPI P-, C- and T-states.
+// @return: true if CPUID reports an invariant TSC, false otherwise.
+bool isInvariant() {
+    if (Cpu::cpuid(0x80000000).eax < 0x80000007) {
+        return false;
+    }
+    return !!(Cpu::cpuid(0x80000007).edx & (1 << 8));
+}
+
+// Get the frequency of the TSC computed by Init().
+// @return: The frequency in Hz.
+Freq frequency() {
+    ASSERT(IsInitialized);
+    return TscFreq;
+}
+
+// The last TSC value read by any of the cpus running checkWarps().
+static Atomic<u64> LastTsc;
+// Number of times a cpu in checkWarps() read a TSC value smaller than LastTsc.
+static Atomic<u64> NumWarps;
+// Number of cpus that entered checkWarps().
+static Atomic<u64> NumCpusInCheck;
+
+// Repeatedly compare the TSC of the current cpu with the last value read by
+// another cpu running this function concurrently.
+static void checkWarps() {
+    u64 const numIterations(200000);
+    NumCpusInCheck++;
+    while (NumCpusInCheck < 2) {
+        asm("pause");
+    }
+    for (u64 i(0); i < numIterations; ++i) {
+        u64 const prev(LastTsc.read());
+        u64 const now(orderedRdtsc());
+        // Only account the comparison if no other cpu updated LastTsc in the
+        // meantime, otherwise `prev` could have been read before a value
+        // larger than `now` was written.
+        if (LastTsc.compareAndExchange(prev, now) && now < prev) {
+            NumWarps++;
+        }
+    }
+}
+
+// Check that the TSCs of all online cpus are synchronized, that is a value read
+// on a cpu is never smaller than a value read earlier on another cpu. Logs a
+// warning if a cpu is not synchronized with the current cpu.
+// @return: true if all online cpus are synchronized with the current cpu.
+bool checkSynchronization() {
+    bool isSynchronized(true);
+    for (Smp::Id cpu(0); cpu < Smp::ncpus(); ++cpu) {
+        if (cpu == Smp::id() || !Smp::PerCpu::data(cpu).isOnline) {
+            continue;
+        }
+        LastTsc = 0;
+        NumWarps = 0;
+        NumCpusInCheck = 0;
+        Ptr<Smp::RemoteCall::CallResult<void>> const call(
+            Smp::RemoteCall::invokeOn(cpu, checkWarps));
+        checkWarps();
+        call->wait();
+        if (!!NumWarps) {
+            Log::warn("TSC of cpu {} is not synchronized: {} warps",
+                      cpu.raw(), NumWarps.read());
+            isSynchronized = false;
+        }
+    }
+    return isSynchronized;
+}
+
+// Get the current value of the monotonic clock. This is callable from any cpu
+// and any context, including interrupt handlers.
+// @return: The number of nanoseconds elapsed since Init().
+u64 monotonicNanos() {
+    Clock clock;
+    u64 seq;
+    do {
+        seq = ClockLock.readBegin();
+        clock = CurrClock;
+    } while (ClockLock.readRetry(seq));
+    u64 const counter(readClockCounter());
+    // A cpu with a TSC slightly behind the one that rebased the clock must not
+    // go back in time.
+    u64 const delta(counter > clock.counterBase ?
+                    counter - clock.counterBase : 0);
+    return clock.nanosBase + ((u128(delta) * clock.mult) >> SHIFT);
+}
+
+// Busy-wait for the given duration, counting TSC cycles. Unlike
+// LapicTimer::delay() this does not touch the LAPIC timer and can therefore be
+// called from any context, including interrupt handlers and while the LAPIC
+// timer is in use. The interrupt flag is untouched during the delay.
+// @param duration: The amount of time to busy-wait for.
+void delay(Duration const duration) {
+    ASSERT(IsInitialized);
+    u64 const start(Cpu::rdtsc());
+    u64 const cycles(nanosToCycles(duration.microSecs() * 1000));
+    // Comparing the elapsed cycles instead of an end value is correct even if
+    // the TSC wraps around.
+    while (Cpu::rdtsc() - start < cycles) {
+        asm("pause");
+    }
+}
+
+// Busy-wait until the monotonic clock reaches a deadline. Like delay(), this
+// can be called from any context.
+// @param deadline: The value of monotonicNanos() to wait for. A deadline in the
+// past returns immediately.
+void spinUntil(u64 const deadline) {
+    ASSERT(IsInitialized);
+    while (monotonicNanos() < deadline) {
+        asm("pause");
+    }
+}
+
+// Convert a number of TSC cycles to nanoseconds.
+// @param cycles: The number of cycles.
+// @return: The duration of `cycles` in nanoseconds.
+u64 cyclesToNanos(u64 const cycles) {
+    ASSERT(IsInitialized);
+    return (u128(cycles) * TscMult) >> SHIFT;
+}
+
+// Convert a number of nanoseconds to TSC cycles.
+// @param nanos: The number of nanoseconds.
+// @return: The number of cycles in `nanos`.
+u64 nanosToCycles(u64 const nanos) {
+    ASSERT(IsInitialized);
+    return (u128(nanos) * InverseMult) >> INVERSE_SHIFT;
+}
+}
@@ -0,0 +1,124 @@
+// Tests for the TSC clocksource.
+#include <timers/tsc.hpp>
+#include <timers/lapictimer.hpp>
+#include <interrupts/vectormap.hpp>
+#include <cpu/cpu.hpp>
+#include <smp/percpu.hpp>
+#include <smp/remotecall.hpp>
+#include <selftests/macros.hpp>
+
+namespace Timer::Tsc {
+
+// Check the conversions between cycles and nanoseconds.
+SelfTests::TestResult tscConversionTest() {
+    u64 const freq(frequency().raw());
+    u64 const oneSec(1000000000);
+    TEST_ASSERT(absdiff(cyclesToNanos(freq), oneSec) <= 1);
+    // The inverse multiplier has a lower precision.
+    TEST_ASSERT(absdiff(nanosToCycles(oneSec), freq) <= freq / 1000000);
+    TEST_ASSERT(!cyclesToNanos(0));
+    TEST_ASSERT(!nanosToCycles(0));
+    return SelfTests::TestResult::Success;
+}
+
+// Check that the monotonic clock agrees with the LAPIC timer, which was
+// calibrated independently.
+SelfTests::TestResult tscMonotonicClockRateTest() {
+    u64 const delayMs(50);
+    u64 const start(monotonicNanos());
+    LapicTimer::delay(Duration::MilliSecs(delayMs));
+    u64 const elapsed(monotonicNanos() - start);
+    u64 const expected(delayMs * 1000000);
+    TEST_ASSERT(absdiff(elapsed, expected) <= expected / 10);
+    return SelfTests::TestResult::Success;
+}
+
+// Check delay() and spinUntil() against the monotonic clock, and that delay()
+// can be used while the LAPIC timer is running.
+SelfTests::TestResult tscDelayTest() {
+    u64 const delayMs(10);
+    u64 const expected(delayMs * 1000000);
+    u64 start(monotonicNanos());
+    delay(Duration::MilliSecs(delayMs));
+    u64 elapsed(monotonicNanos() - start);
+    TEST_ASSERT(elapsed + expected / 100 >= expected);
+    TEST_ASSERT(elapsed <= expected + expected / 10);
+
+    start = monotonicNanos();
+    spinUntil(start + expected);
+    elapsed = monotonicNanos() - start;
+    TEST_ASSERT(elapsed >= expected);
+    TEST_ASSERT(elapsed <= expected + expected / 10);
+    // A deadline in the past returns immediately.
+    start = monotonicNanos();
+    spinUntil(0);
+    TEST_ASSERT(monotonicNanos() - start < expected);
+
+    // The LAPIC timer ticks must keep coming during a delay.
+    static u64 volatile numTicks;
+    numTicks = 0;
+    Interrupts::Vector const vector(Interrupts::VectorMap::LapicTimerVector);
+    TemporaryInterruptHandlerGuard guard(vector,
+        [](Interrupts::Vector const, Interrupts::Frame const&) {
+            numTicks = numTicks + 1;
+        });
+    LapicTimer::init(Freq(1000));
+    LapicTimer::start();
+    bool const savedIrqFlag(Cpu::interruptsEnabled());
+    Cpu::enableInterrupts();
+    delay(Duration::MilliSecs(delayMs));
+    Cpu::setInterruptFlag(savedIrqFlag);
+    LapicTimer::stop();
+    TEST_ASSERT(numTicks >= delayMs / 2);
+    return SelfTests::TestResult::Success;
+}
+
+// Check that the monotonic clock never goes backward, on a single cpu and
+// across cpus.
+SelfTests::TestResult tscMonotonicClockTest() {
+    u64 last(monotonicNanos());
+    for (u64 i(0); i < 100000; ++i) {
+        u64 const now(monotonicNanos());
+        TEST_ASSERT(last <= now);
+        last = now;
+    }
+    if (!isInvariant()) {
+        Log::warn("TSC is not invariant, skipping the cross-cpu check");
+        return SelfTests::TestResult::Success;
+    }
+    for (Smp::Id cpu(0); cpu < Smp::ncpus(); ++cpu) {
+        if (cpu == Smp::id() || !Smp::PerCpu::data(cpu).isOnline) {
+            continue;
+        }
+        u64 const before(monotonicNanos());
+        Ptr<Smp::RemoteCall::CallResult<u64>> const call(
+            Smp::RemoteCall::invokeOn(cpu, []() { return monotonicNanos(); }));
+        u64 const remote(call->returnValue());
+        TEST_ASSERT(before <= remote);
+        TEST_ASSERT(remote <= monotonicNanos());
+    }
+    return SelfTests::TestResult::Success;
+}
+
+// Check that the TSCs are synchronized across cpus. Only invariant TSCs are
+// expected to be synchronized.
+SelfTests::TestResult tscSynchronizationTest() {
+    TEST_REQUIRES_MULTICORE();
+    bool const isSynchronized(checkSynchronization());
+    if (!isInvariant()) {
+        Log::warn("TSC is not invariant, ignoring the synchronization result");
+        return SelfTests::TestResult::Success;
+    }
+    TEST_ASSERT(isSynchronized);
+    return SelfTests::TestResult::Success;
+}
+
+// Run the TSC tests.
+void Test(SelfTests::TestRunner& runner) {
+    RUN_TEST(runner, tscConversionTest);
+    RUN_TEST(runner, tscMonotonicClockRateTest);
+    RUN_TEST(runner, tscDelayTest);
+    RUN_TEST(runner, tscMonotonicClockTest);
+    RUN_TEST(runner, tscSynchronizationTest);
+}
+}
@@ -1,6 +1,8 @@
 // Util functions to manipulate C-strings.
 
 #include <util/cstring.hpp>
+#include <util/assert.hpp>
+#include <cpu/cpu.hpp>
 
 namespace Util {
 
@@ -26,25 +28,148 @@ bool streq(char const * const str1, char const * const str2) {
     return !*ptr1 && !*ptr2;
 }
 
+// Routines implemented in cstringAsm.asm.
+extern "C" void _memcpyRepMovsb(void * const dst,
+                                void const * const src,
+                                u64 const size);
+extern "C" void _memcpyRepMovsq(void * const dst,
+                                void const * const src,
+                                u64 const size);
+extern "C" void _memsetRepStosb(void * const ptr,
+                                u8 const value,
+                                u64 const size);
+extern "C" void _memsetRepStosq(void * const ptr,
+                                u8 const value,
+                                u64 const size);
+extern "C" void _memzeroNonTemporal(void * const ptr, u64 const size);
+
+// Below this size, REP MOVSB/STOSB have a high startup cost unless the cpu
+// supports Fast Short REP MOV (FSRM).
+static constexpr u64 SHORT_REP_THRESHOLD = 128;
+
+// The string operations supported by the cpu, as reported by CPUID.
+struct StringOpFeatures {
+    // Set once the features have been read from CPUID.
+    bool isInitialized;
+    // Enhanced REP MOVSB/STOSB.
+    bool erms;
+    // Fast Short REP MOV.
+    bool fsrm;
+};
+static StringOpFeatures Features = {};
+
+// Check if REP MOVSB/STOSB should be used for a given size on this cpu. The
+// features are lazily read from CPUID since the memory functions are used
+// before any initialization. Concurrent initialization is benign as all cpus
+// compute the same values.
+// @param size: The size of the operation in bytes.
+// @return: true if REP MOVSB/STOSB is faster than its 8-byte wide counterpart.
+static bool useRepByte(u64 const size) {
+    if (!Features.isInitialized) {
+        bool const hasLeaf7(Cpu::cpuid(0x0).eax >= 0x7);
+        Cpu::CpuidResult const leaf7(hasLeaf7 ? Cpu::cpuid(0x7, 0x0)
+                                              : Cpu::CpuidResult{});
+        Features.erms = leaf7.ebx & (1 << 9);
+        Features.fsrm = leaf7.edx & (1 << 4);
+        Features.isInitialized = true;
+    }
+    return Features.fsrm || (Features.erms && size >= SHORT_REP_THRESHOLD);
+}
+
+// Set all the bytes of a memory buffer to the same value.
+// @param ptr: Memory buffer to set.
+// @param value: The value to write in each byte of the buffer.
+// @param size: Size of the buffer in bytes.
+void memset(void * const ptr, u8 const value, u64 const size) {
+    if (useRepByte(size)) {
+        _memsetRepStosb(ptr, value, size);
+    } else {
+        _memsetRepStosq(ptr, value, size);
+    }
+}
+
 // Zero a memory buffer.
 // @param ptr: Memory buffer to zero.
 // @param size: Size of the buffer in bytes.
 void memzero(void * const ptr, u64 const size) {
-    u8 * const wPtr(reinterpret_cast<u8*>(ptr));
-    for (u64 i(0); i < size; ++i) {
-        wPtr[i] = 0;
+    memset(ptr, 0, size);
+}
+
+// Zero a memory buffer using non-temporal stores, e.g. without polluting the
+// caches.
+// @param ptr: Memory buffer to zero, must be 8-byte aligned.
+// @param size: Size of the buffer in bytes, must be a multiple of 64.
+void memzeroNonTemporal(void * const ptr, u64 const size) {
+    ASSERT(!(reinterpret_cast<u64>(ptr) % 8));
+    ASSERT(!(size % 64));
+    _memzeroNonTemporal(ptr, size);
+}
+
+// Copy a memory buffer into another. The buffers must not overlap.
+// @param dest: The destination buffer.
+// @param src: The source buffer.
+// @param size: The number of bytes to copy.
+void memcpy(void * const dst, void const * const src, u64 const size) {
+    if (useRepByte(size)) {
+        _memcpyRepMovsb(dst, src, size);
+    } else {
+        _memcpyRepMovsq(dst, src, size);
     }
 }
 
-// Copy a memory buffer into another
+// Copy a memory buffer into another. The buffers may overlap.
 // @param dest: The destination buffer.
 // @param src: The source buffer.
 // @param size: The number of bytes to copy.
-void memcpy(void * const _dst, void const * const _src, u64 const size) {
-    u8 * dst(reinterpret_cast<u8*>(_dst));
-    u8 const * src(reinterpret_cast<u8 const*>(_src));
-    for (u64 i(0); i < size; ++i, ++dst, ++src) {
-        *dst = *src;
+void memmove(void * const _dst, void const * const _src, u64 const size) {
+    u64 const dstAddr(reinterpret_cast<u64>(_dst));
+    u64 const srcAddr(reinterpret_cast<u64>(_src));
+    if (dstAddr - srcAddr >= size) {
+        // Either dst is before src, in which case a forward copy never reads a
+        // byte after overwriting it, or the buffers do not overlap. In both
+        // cases memcpy, which copies forward, is correct.
+        memcpy(_dst, _src, size);
+        return;
+    }
+    // dst overlaps the end of src, copy backward, 8 bytes at a time then the
+    // remaining bytes. Backward string operations do not benefit from fast
+    // strings, hence the plain loops.
+    u8 * const dst(reinterpret_cast<u8*>(_dst));
+    u8 const * const src(reinterpret_cast<u8 const*>(_src));
+    u64 remaining(size);
+    while (remaining >= sizeof(u64)) {
+        remaining -= sizeof(u64);
+        *reinterpret_cast<u64*>(dst + remaining) =
+            *reinterpret_cast<u64 const*>(src + remaining);
+    }
+    while (!!remaining) {
+        remaining--;
+        dst[remaining] = src[remaining];
+    }
+}
+
+// Compare two memory buffers.
+// @param ptr1: The first buffer.
+// @param ptr2: The second buffer.
+// @param size: The number of bytes to compare.
+// @return: 0 if both buffers have the same content, otherwise the difference
+// between the first differing bytes of ptr1 and ptr2, interpreted as u8.
+i32 memcmp(void const * const ptr1, void const * const ptr2, u64 const size) {
+    u8 const * const buf1(reinterpret_cast<u8 const*>(ptr1));
+    u8 const * const buf2(reinterpret_cast<u8 const*>(ptr2));
+    // Skip the identical prefix 8 bytes at a time, then find the first
+    // differing byte.
+    u64 i(0);
+    while (i + sizeof(u64) <= size
+           && *reinterpret_cast<u64 const*>(buf1 + i)
+              == *reinterpret_cast<u64 const*>(buf2 + i)) {
+        i += sizeof(u64);
+    }
+    for (; i < size; ++i) {
+        if (buf1[i] != buf2[i]) {
+            return i32(buf1[i]) - i32(buf2[i]);
+        }
     }
+    return 0;
 }
 }
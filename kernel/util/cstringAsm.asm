@@ -0,0 +1,126 @@
+; Memory manipulation routines using string instructions. Those are called by
+; the functions in cstring.cpp which select the best routine for the current
+; cpu.
+BITS    64
+SECTION .text
+
+; Copy a memory buffer using REP MOVSB. This is the fastest way to copy memory
+; on cpus supporting Enhanced REP MOVSB (ERMS).
+; @param dst: The destination buffer.
+; @param src: The source buffer.
+; @param size: The number of bytes to copy.
+; extern "C" void _memcpyRepMovsb(void * const dst,
+;                                 void const * const src,
+;                                 u64 const size);
+GLOBAL  _memcpyRepMovsb:function
+_memcpyRepMovsb:
+    push    rbp
+    mov     rbp, rsp
+
+    mov     rcx, rdx
+    rep movsb
+
+    leave
+    ret
+
+; Copy a memory buffer 8 bytes at a time using REP MOVSQ, the remaining bytes
+; are copied using REP MOVSB.
+; @param dst: The destination buffer.
+; @param src: The source buffer.
+; @param size: The number of bytes to copy.
+; extern "C" void _memcpyRepMovsq(void * const dst,
+;                                 void const * const src,
+;                                 u64 const size);
+GLOBAL  _memcpyRepMovsq:function
+_memcpyRepMovsq:
+    push    rbp
+    mov     rbp, rsp
+
+    mov     rcx, rdx
+    shr     rcx, 3
+    rep movsq
+    mov     rcx, rdx
+    and     rcx, 7
+    rep movsb
+
+    leave
+    ret
+
+; Set all the bytes of a memory buffer to the same value using REP STOSB.
+; @param ptr: The buffer.
+; @param value: The value to write in each byte of the buffer.
+; @param size: The size of the buffer in bytes.
+; extern "C" void _memsetRepStosb(void * const ptr,
+;                                 u8 const value,
+;                                 u64 const size);
+GLOBAL  _memsetRepStosb:function
+_memsetRepStosb:
+    push    rbp
+    mov     rbp, rsp
+
+    movzx   eax, sil
+    mov     rcx, rdx
+    rep stosb
+
+    leave
+    ret
+
+; Set all the bytes of a memory buffer to the same value 8 bytes at a time using
+; REP STOSQ, the remaining bytes are set using REP STOSB.
+; @param ptr: The buffer.
+; @param value: The value to write in each byte of the buffer.
+; @param size: The size of the buffer in bytes.
+; extern "C" void _memsetRepStosq(void * const ptr,
+;                                 u8 const value,
+;                                 u64 const size);
+GLOBAL  _memsetRepStosq:function
+_memsetRepStosq:
+    push    rbp
+    mov     rbp, rsp
+
+    ; Broadcast the value to all the bytes of RAX.
+    movzx   eax, sil
+    mov     r8, 0x0101010101010101
+    imul    rax, r8
+    mov     rcx, rdx
+    shr     rcx, 3
+    rep stosq
+    mov     rcx, rdx
+    and     rcx, 7
+    rep stosb
+
+    leave
+    ret
+
+; Zero a memory buffer using non-temporal stores, e.g. bypassing the caches.
+; @param ptr: The buffer, must be 8-byte aligned.
+; @param size: The size of the buffer in bytes, must be a multiple of 64.
+; extern "C" void _memzeroNonTemporal(void * const ptr, u64 const size);
+GLOBAL  _memzeroNonTemporal:function
+_memzeroNonTemporal:
+    push    rbp
+    mov     rbp, rsp
+
+    xor     eax, eax
+    ; RCX = Number of 64-byte blocks.
+    mov     rcx, rsi
+    shr     rcx, 6
+    jz      .done
+.loop:
+    movnti  [rdi], rax
+    movnti  [rdi + 0x08], rax
+    movnti  [rdi + 0x10], rax
+    movnti  [rdi + 0x18], rax
+    movnti  [rdi + 0x20], rax
+    movnti  [rdi + 0x28], rax
+    movnti  [rdi + 0x30], rax
+    movnti  [rdi + 0x38], rax
+    add     rdi, 0x40
+    dec     rcx
+    jnz     .loop
+    ; Non-temporal stores are weakly ordered, make them visible before any
+    ; subsequent store, e.g. before the buffer is handed to another cpu.
+    sfence
+.done:
+    leave
+    ret
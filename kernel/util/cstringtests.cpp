@@ -0,0 +1,272 @@
+// Tests and benchmarks for the memory functions.
+#include <util/cstring.hpp>
+#include <memory/virtalloc.hpp>
+#include <logging/log.hpp>
+#include <selftests/macros.hpp>
+#include <cpu/cpu.hpp>
+
+namespace Util {
+
+// Routines implemented in cstringAsm.asm. The tests call them directly to test
+// all of them, regardless of which one memcpy() and memset() would select on
+// this cpu.
+extern "C" void _memcpyRepMovsb(void * const dst,
+                                void const * const src,
+                                u64 const size);
+extern "C" void _memcpyRepMovsq(void * const dst,
+                                void const * const src,
+                                u64 const size);
+extern "C" void _memsetRepStosb(void * const ptr,
+                                u8 const value,
+                                u64 const size);
+extern "C" void _memsetRepStosq(void * const ptr,
+                                u8 const value,
+                                u64 const size);
+
+// Size of the buffers used by the tests.
+static constexpr u64 BUF_SIZE = 512;
+
+// Fill a buffer with a pattern that depends on the index of each byte and a
+// seed.
+// @param buf: The buffer to fill.
+// @param size: The size of the buffer.
+// @param seed: The seed of the pattern.
+static void fillPattern(u8 * const buf, u64 const size, u8 const seed) {
+    for (u64 i(0); i < size; ++i) {
+        buf[i] = u8(i * 7 + seed);
+    }
+}
+
+// Type of the routines copying memory.
+using CopyFunc = void (*)(void * const, void const * const, u64 const);
+
+// Check that a copy routine copies exactly the requested bytes for various
+// sizes and alignments of the buffers.
+// @param copy: The routine to test.
+// @return: true if the routine is correct, false otherwise.
+static bool checkCopy(CopyFunc const copy) {
+    static u8 src[BUF_SIZE];
+    static u8 dst[BUF_SIZE];
+    for (u64 size(0); size < 200; ++size) {
+        for (u64 srcOff(0); srcOff < 8; ++srcOff) {
+            for (u64 dstOff(0); dstOff < 8; ++dstOff) {
+                fillPattern(src, BUF_SIZE, 1);
+                fillPattern(dst, BUF_SIZE, 2);
+                copy(dst + dstOff, src + srcOff, size);
+                for (u64 i(0); i < BUF_SIZE; ++i) {
+                    bool const inRange(dstOff <= i && i < dstOff + size);
+                    u8 const exp(inRange ? src[i - dstOff + srcOff]
+                                         : u8(i * 7 + 2));
+                    if (dst[i] != exp) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Type of the routines setting memory.
+using SetFunc = void (*)(void * const, u8 const, u64 const);
+
+// Check that a set routine sets exactly the requested bytes for various sizes
+// and alignments of the buffer.
+// @param set: The routine to test.
+// @return: true if the routine is correct, false otherwise.
+static bool checkSet(SetFunc const set) {
+    static u8 buf[BUF_SIZE];
+    for (u64 size(0); size < 200; ++size) {
+        for (u64 off(0); off < 8; ++off) {
+            fillPattern(buf, BUF_SIZE, 3);
+            set(buf + off, 0xab, size);
+            for (u64 i(0); i < BUF_SIZE; ++i) {
+                bool const inRange(off <= i && i < off + size);
+                if (buf[i] != (inRange ? 0xab : u8(i * 7 + 3))) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Check memcpy() and all its underlying routines.
+SelfTests::TestResult memcpyTest() {
+    TEST_ASSERT(checkCopy(_memcpyRepMovsb));
+    TEST_ASSERT(checkCopy(_memcpyRepMovsq));
+    TEST_ASSERT(checkCopy(memcpy));
+    return SelfTests::TestResult::Success;
+}
+
+// Check memset(), memzero() and all their underlying routines.
+SelfTests::TestResult memsetTest() {
+    TEST_ASSERT(checkSet(_memsetRepStosb));
+    TEST_ASSERT(checkSet(_memsetRepStosq));
+    TEST_ASSERT(checkSet(memset));
+
+    static u8 buf[BUF_SIZE];
+    fillPattern(buf, BUF_SIZE, 4);
+    memzero(buf + 3, 100);
+    for (u64 i(0); i < BUF_SIZE; ++i) {
+        bool const inRange(3 <= i && i < 103);
+        TEST_ASSERT(buf[i] == (inRange ? 0 : u8(i * 7 + 4)));
+    }
+
+    // Non-temporal zeroing only supports aligned buffers.
+    static u64 words[BUF_SIZE / sizeof(u64)];
+    fillPattern(reinterpret_cast<u8*>(words), BUF_SIZE, 5);
+    memzeroNonTemporal(words + 1, 256);
+    u8 const * const bytes(reinterpret_cast<u8 const*>(words));
+    for (u64 i(0); i < BUF_SIZE; ++i) {
+        bool const inRange(8 <= i && i < 8 + 256);
+        TEST_ASSERT(bytes[i] == (inRange ? 0 : u8(i * 7 + 5)));
+    }
+    return SelfTests::TestResult::Success;
+}
+
+// Check memmove() with overlapping buffers in both directions.
+SelfTests::TestResult memmoveTest() {
+    static u8 buf[BUF_SIZE];
+    static u8 ref[BUF_SIZE];
+    for (u64 size(0); size < 100; ++size) {
+        for (u64 srcOff(0); srcOff < 16; ++srcOff) {
+            for (u64 dstOff(0); dstOff < 16; ++dstOff) {
+                fillPattern(buf, BUF_SIZE, 6);
+                fillPattern(ref, BUF_SIZE, 6);
+                memmove(buf + dstOff, buf + srcOff, size);
+                for (u64 i(0); i < BUF_SIZE; ++i) {
+                    bool const inRange(dstOff <= i && i < dstOff + size);
+                    u8 const exp(inRange ? ref[i - dstOff + srcOff] : ref[i]);
+                    TEST_ASSERT(buf[i] == exp);
+                }
+            }
+        }
+    }
+    return SelfTests::TestResult::Success;
+}
+
+// Check memcmp() for equal buffers and for differences at every position.
+SelfTests::TestResult memcmpTest() {
+    static u8 buf1[BUF_SIZE];
+    static u8 buf2[BUF_SIZE];
+    fillPattern(buf1, BUF_SIZE, 7);
+    fillPattern(buf2, BUF_SIZE, 7);
+    TEST_ASSERT(!memcmp(buf1, buf2, 0));
+    TEST_ASSERT(!memcmp(buf1, buf2, BUF_SIZE));
+    TEST_ASSERT(!memcmp(buf1 + 3, buf2 + 3, BUF_SIZE - 3));
+    for (u64 i(0); i < 100; ++i) {
+        u8 const orig(buf2[i]);
+        buf2[i] = orig + 1;
+        // The difference is only visible if i is in the compared range.
+        TEST_ASSERT(!memcmp(buf1, buf2, i));
+        TEST_ASSERT(memcmp(buf1, buf2, 100) < 0);
+        TEST_ASSERT(memcmp(buf2, buf1, 100) > 0);
+        TEST_ASSERT(memcmp(buf1, buf2, 100) == i32(orig) - i32(u8(orig + 1)));
+        buf2[i] = orig;
+    }
+    return SelfTests::TestResult::Success;
+}
+
+// Reference implementation of memcpy copying one byte at a time, the benchmark
+// reports the other routines against it.
+// @param dst: The destination buffer.
+// @param src: The source buffer.
+// @param size: The number of bytes to copy.
+static void byteLoopCopy(void * const dst,
+                         void const * const src,
+                         u64 const size) {
+    u8 * d(reinterpret_cast<u8*>(dst));
+    u8 const * s(reinterpret_cast<u8 const*>(src));
+    for (u64 i(0); i < size; ++i) {
+        *(d++) = *(s++);
+    }
+}
+
+// Zero a buffer, non-temporal zeroing with the CopyFunc signature so that the
+// benchmark can use it. The source is ignored.
+static void zeroNonTemporal(void * const dst,
+                            void const * const,
+                            u64 const size) {
+    memzeroNonTemporal(dst, size);
+}
+
+// Zero a buffer with memzero(), with the CopyFunc signature so that the
+// benchmark can use it. The source is ignored.
+static void zero(void * const dst, void const * const, u64 const size) {
+    memzero(dst, size);
+}
+
+// Measure the throughput of a routine for a given size of operation and log the
+// result in cycles per byte.
+// @param name: The name of the routine, for logging.
+// @param func: The routine to benchmark.
+// @param dst: The destination buffer, at least `size` bytes.
+// @param src: The source buffer, at least `size` bytes.
+// @param size: The size of each operation.
+static void benchmark(char const * const name,
+                      CopyFunc const func,
+                      void * const dst,
+                      void const * const src,
+                      u64 const size) {
+    // Process the same amount of bytes for all sizes.
+    u64 const totalBytes(256 * 1024);
+    u64 const iterations(totalBytes / size);
+    // Warm up the caches and TLB.
+    func(dst, src, size);
+    u64 const start(Cpu::rdtsc());
+    for (u64 i(0); i < iterations; ++i) {
+        func(dst, src, size);
+    }
+    u64 const cycles(Cpu::rdtsc() - start);
+    // Cycles per byte, in hundredths.
+    u64 const cpb(cycles * 100 / (iterations * size));
+    Log::info("  {} size = {}: {}.{}{} cycles/byte", name, size, cpb / 100,
+              (cpb / 10) % 10, cpb % 10);
+}
+
+// Benchmark the memory routines for various sizes and report their throughput
+// in cycles per byte. This never fails, the results are only logged.
+SelfTests::TestResult memBenchmark() {
+    Cpu::CpuidResult const leaf7(Cpu::cpuid(0x7, 0x0));
+    Log::info("  ERMS = {}, FSRM = {}", !!(leaf7.ebx & (1 << 9)),
+              !!(leaf7.edx & (1 << 4)));
+
+    u64 const maxSize(64 * 1024);
+    u64 const numPages(maxSize / PAGE_SIZE);
+    Paging::PageAttr const attrs(Paging::PageAttr::Writable);
+    Res<VirAddr> const dstAlloc(VirtAlloc::alloc(numPages, attrs));
+    Res<VirAddr> const srcAlloc(VirtAlloc::alloc(numPages, attrs));
+    TEST_ASSERT(!!dstAlloc && !!srcAlloc);
+    void * const dst(dstAlloc->ptr<void>());
+    void * const src(srcAlloc->ptr<void>());
+    // Map all the pages before measuring.
+    memset(dst, 0xff, maxSize);
+    memset(src, 0xaa, maxSize);
+
+    u64 const sizes[] = {16, 64, 256, 1024, 4096, maxSize};
+    for (u64 const size : sizes) {
+        benchmark("byte loop  ", byteLoopCopy, dst, src, size);
+        benchmark("rep movsq  ", _memcpyRepMovsq, dst, src, size);
+        benchmark("rep movsb  ", _memcpyRepMovsb, dst, src, size);
+        benchmark("memcpy     ", memcpy, dst, src, size);
+        benchmark("memzero    ", zero, dst, src, size);
+        if (!(size % 64)) {
+            benchmark("memzero nt ", zeroNonTemporal, dst, src, size);
+        }
+    }
+
+    VirtAlloc::free(*dstAlloc);
+    VirtAlloc::free(*srcAlloc);
+    return SelfTests::TestResult::Success;
+}
+
+// Run the tests and benchmarks of the memory functions.
+void Test(SelfTests::TestRunner& runner) {
+    RUN_TEST(runner, memcpyTest);
+    RUN_TEST(runner, memsetTest);
+    RUN_TEST(runner, memmoveTest);
+    RUN_TEST(runner, memcmpTest);
+    RUN_TEST(runner, memBenchmark);
+}
+}